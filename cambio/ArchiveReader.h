@@ -0,0 +1,111 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef ArchiveReader_H
+#define ArchiveReader_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace FileLoader
+{
+  class MappedFile;
+}
+
+/** Lists, and reads into memory, the files in a tar or zip archive, so they
+ can be parsed without first being extracted to disk.
+
+ Zip archives may use Zip64, and entries may be stored or deflated.  Tar
+ archives may be ustar, pax, or GNU format, and may themselves be gzip, zstd,
+ or xz compressed (in which case the whole archive is decompressed into
+ memory when opened).
+
+ Entries with absolute paths, or ".." path components, are ignored, so output
+ paths mirroring entry names always stay inside the output directory.
+
+ Reading entries is thread safe.
+ */
+class ArchiveReader
+{
+public:
+  struct Entry
+  {
+    /** Path inside the archive, using '/' separators. */
+    std::string name;
+
+    /** Uncompressed size. */
+    uint64_t size;
+
+    /** For tar, where the data starts; for zip, where the local header starts. */
+    uint64_t offset;
+
+    /** For zip: the compressed size, compression method, and CRC-32. */
+    uint64_t compressed_size;
+    uint16_t method;
+    uint32_t crc;
+  };//struct Entry
+
+  /** Returns if the file looks like a tar or zip archive, from its first few
+   hundred bytes; compressed tar files are recognized by having a ".tar.gz",
+   ".tgz", ".tar.zst", or ".tar.xz" extension.
+   */
+  static bool is_archive( const std::string &filename );
+
+  /** Opens the archive, and reads its list of files.
+
+   Throws std::exception if the file can't be read, or isn't a valid archive.
+   */
+  explicit ArchiveReader( const std::string &filename );
+  ~ArchiveReader();
+
+  const std::string &filename() const;
+
+  /** The regular files in the archive (directories etc. are not included). */
+  const std::vector<Entry> &entries() const;
+
+  /** Reads (and decompresses) the entry, replacing `contents`.
+
+   Returns false if the entry is corrupt (including a CRC mismatch), or uses
+   an unsupported compression method or encryption.
+   */
+  bool read( const size_t index, std::string &contents ) const;
+
+private:
+  ArchiveReader( const ArchiveReader & ) = delete;
+  ArchiveReader &operator=( const ArchiveReader & ) = delete;
+
+  void read_zip_directory();
+  void read_tar_headers();
+
+  const std::string m_filename;
+  std::unique_ptr<FileLoader::MappedFile> m_mapped;
+
+  /** The decompressed archive, for compressed tar files. */
+  std::string m_decompressed;
+
+  const char *m_data;
+  size_t m_size;
+  bool m_is_zip;
+
+  std::vector<Entry> m_entries;
+};//class ArchiveReader
+
+#endif //ArchiveReader_H
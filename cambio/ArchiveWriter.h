@@ -0,0 +1,140 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef ArchiveWriter_H
+#define ArchiveWriter_H
+
+#include <set>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+
+class OutputFile;
+
+/** Writes many output files into a single tar or zip archive, as one
+ sequential write, rather than creating each file on disk.
+
+ Files are stored uncompressed.  Tar archives use the POSIX (pax) format for
+ names longer than ustar allows, and zip archives switch to Zip64 as needed, so
+ there are no practical limits on the number or size of files.
+
+ The archive itself is written through an OutputFile, so only appears at its
+ final location once close() succeeds.
+
+ All functions are thread safe.
+ */
+class ArchiveWriter
+{
+public:
+  enum class Format
+  {
+    Tar,
+    Zip
+  };//enum class Format
+
+  /** Returns the format implied by the extension of `filename` (".tar" or
+   ".zip", case insensitive), or throws std::exception if neither.
+   */
+  static Format format_from_filename( const std::string &filename );
+
+  /** Opens the archive for writing.
+
+   @param filename The archive to create.
+   @param root_dir File names passed to add_file(...) are stored relative to
+          this directory; files outside of it are stored with just their file
+          name.
+   @param sync_to_disk Passed through to OutputFile.
+
+   Throws std::exception if the archive can not be opened.
+   */
+  ArchiveWriter( const std::string &filename, const Format format,
+                 const std::string &root_dir, const bool sync_to_disk );
+
+  /** Writes the archive to an already open stream, for archives that are
+   themselves an output file (e.g., NumPy .npz files); entry names are just
+   the file names passed to add_file(...).  close() flushes, but does not
+   close, the stream.
+   */
+  ArchiveWriter( std::ostream &output, const Format format );
+
+  /** If close() wasn't called, the partial archive is discarded. */
+  ~ArchiveWriter();
+
+  /** Returns the name `filename` will be stored as in the archive. */
+  std::string entry_name( const std::string &filename ) const;
+
+  /** Returns if a file with the same entry name as `filename` has already
+   been added.
+   */
+  bool contains( const std::string &filename ) const;
+
+  /** Adds a file to the archive.
+
+   Returns false if the write failed, or the archive was already closed.
+   */
+  bool add_file( const std::string &filename, const std::string &contents );
+
+  /** Writes the trailing records (e.g., zip central directory), and moves the
+   archive to its final location.  Returns if the whole archive was written
+   successfully.
+   */
+  bool close();
+
+  const std::string &filename() const;
+
+protected:
+  /** Sets the DOS format time and date stored in zip entries, from m_unix_time. */
+  void init_dos_time();
+
+  void write_tar_entry( const std::string &name, const std::string &contents );
+  void write_zip_entry( const std::string &name, const std::string &contents );
+  void write_zip_central_directory();
+
+  struct ZipEntry
+  {
+    std::string name;
+    uint32_t crc;
+    uint64_t size;
+    uint64_t offset;
+  };//struct ZipEntry
+
+  const std::string m_filename;
+  const Format m_format;
+  const std::string m_root_dir;
+
+  mutable std::mutex m_mutex;
+
+  /** The file being written, unless writing to a stream owned by the caller. */
+  std::unique_ptr<OutputFile> m_file;
+  std::ostream *m_output;
+  uint64_t m_bytes_written;
+  uint32_t m_dos_time;
+  uint32_t m_dos_date;
+  int64_t m_unix_time;
+  bool m_closed;
+  bool m_close_success;
+
+  std::set<std::string> m_entry_names;
+  std::vector<ZipEntry> m_zip_entries;
+};//class ArchiveWriter
+
+#endif //ArchiveWriter_H
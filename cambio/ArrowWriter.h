@@ -0,0 +1,121 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef ArrowWriter_H
+#define ArrowWriter_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+
+namespace SpecUtils
+{
+  class Measurement;
+}
+
+/** Writes measurements as an Apache Arrow IPC file (also known as Feather
+ version 2), with one row per measurement, so they can be loaded directly
+ into dataframes (e.g., `pyarrow.ipc.open_file(...)`, `pandas.read_feather(...)`,
+ or `polars.read_ipc(...)`) without any parsing.
+
+ The columns are:
+   detector_name (utf8), detector_number (int32), sample_number (int32),
+   title (utf8), start_time (timestamp[us], null if not known),
+   live_time (float32), real_time (float32), source_type (utf8),
+   occupied (bool, null if unknown), latitude and longitude (float64, null
+   without GPS), gamma_count_sum (float64), neutron_count_sum (float64, null
+   if the record did not contain neutron data), energy_calibration_type
+   (utf8, null without a valid calibration), energy_calibration_coefficients
+   (list<float32>), and channel_counts (list<float32>, null if the record has
+   no gamma data).
+
+ Rows are buffered and written out as record batches of up to
+ `rows_per_batch` measurements (or fewer, if the batch holds a lot of channel
+ data), so memory use stays bounded no matter how many measurements are
+ written.  The Arrow metadata is written by hand, so there is no dependency on
+ the Arrow libraries.
+
+ Example:
+   ArrowWriter arrow( output );
+   for( const auto &meas : info.measurements() )
+     arrow.add( *meas );
+   const bool wrote = arrow.finish();
+ */
+class ArrowWriter
+{
+public:
+  /** Writes the file header and schema to `output`. */
+  explicit ArrowWriter( std::ostream &output, const size_t rows_per_batch = 1024 );
+
+  /** Calls finish(), if it hasn't already been called. */
+  ~ArrowWriter();
+
+  /** Adds a row for the measurement, writing out a record batch if the
+   current one is full.
+   */
+  void add( const SpecUtils::Measurement &meas );
+
+  /** Writes any buffered rows, and the file footer; returns if the stream is
+   good.  No more rows may be added afterwards.
+   */
+  bool finish();
+
+private:
+  ArrowWriter( const ArrowWriter & ) = delete;
+  ArrowWriter &operator=( const ArrowWriter & ) = delete;
+
+  struct Column;
+
+  /** Location of a record batch in the file, for the footer. */
+  struct Block
+  {
+    uint64_t offset;
+    uint32_t metadata_length;
+    uint64_t body_length;
+  };//struct Block
+
+  /** Writes the buffered rows as a record batch, and clears them. */
+  void write_batch();
+
+  /** Writes the message metadata, with its length prefix and padding, then
+   returns the number of bytes written.
+   */
+  uint32_t write_message_metadata( const std::string &metadata );
+
+  /** Writes `length` bytes, followed by zeros up to a multiple of 8 bytes. */
+  void write_padded( const char *data, const size_t length );
+
+  std::ostream &m_output;
+  const size_t m_rows_per_batch;
+
+  /** Number of bytes written to the stream so far. */
+  uint64_t m_position;
+
+  /** Number of rows, and number of list values, in the current batch. */
+  size_t m_batch_rows;
+  size_t m_batch_values;
+
+  std::vector<std::unique_ptr<Column>> m_columns;
+  std::vector<Block> m_blocks;
+  bool m_finished;
+};//class ArrowWriter
+
+#endif //ArrowWriter_H
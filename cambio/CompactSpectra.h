@@ -0,0 +1,148 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef CompactSpectra_H
+#define CompactSpectra_H
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#include "SpecUtils/SpecFile.h"
+
+namespace SpecUtils{ class EnergyCalibration; }
+
+
+/** Channel counts stored as runs of non-zero channels.
+
+ Short gaps of zeros (two channels or fewer) are kept inside a run, since
+ starting a new run costs more than storing a couple of zeros.  For the 0.1 s,
+ 8k-16k channel records of portal passthrough files, which are typically more
+ than 95% zeros, this uses roughly a tenth of the memory of a dense array.
+ */
+class SparseChannelCounts
+{
+public:
+  SparseChannelCounts();
+  explicit SparseChannelCounts( const std::vector<float> &counts );
+
+  size_t num_channels() const;
+
+  /** Approximate number of heap bytes used. */
+  size_t memory_size() const;
+
+  /** Adds the counts to `sum`, which must have num_channels() entries. */
+  void add_to( std::vector<double> &sum ) const;
+
+  /** Adds the counts, binned according to `from_energies`, to `sum`, which is
+   binned according to `to_energies`, a run at a time using
+   SpectrumSum::rebin_add(...), so the counts are never expanded.
+   */
+  void rebin_add_to( const std::vector<float> &from_energies,
+                     const std::vector<float> &to_energies,
+                     std::vector<double> &sum ) const;
+
+  std::shared_ptr<std::vector<float>> to_dense() const;
+
+protected:
+  uint32_t m_num_channels;
+
+  /** The first channel of each run. */
+  std::vector<uint32_t> m_run_start;
+
+  /** Index into m_values of the first value of each run, with an extra entry
+   at the end equal to m_values.size(), so run `i` has
+   `m_value_start[i+1] - m_value_start[i]` channels.
+   */
+  std::vector<uint32_t> m_value_start;
+
+  std::vector<float> m_values;
+};//class SparseChannelCounts
+
+
+/** Holds a spectrum file with the gamma counts of each record kept as
+ SparseChannelCounts.
+
+ The SpecFile returned by meta() has all of its records, but with their gamma
+ counts replaced by an all-zero array (shared between all records with the
+ same number of channels), so that it can be inspected, and combined with
+ other files, without paying for the dense channel data.
+
+ The dense counts are only ever held for one file at a time: they are
+ released from the parsed file as it is compacted, and the encoded counts are
+ released as records are taken back out with take(...) or take_expanded().
+ */
+class CompactSpecFile
+{
+public:
+  /** If `compact` is true, the gamma counts of the records of `info` are
+   encoded, and replaced in `info` by zeros, so the dense counts are freed once
+   the file is compacted; `info` should not be used afterwards, other than to
+   be destroyed.
+
+   If `compact` is false, the file is just held as-is (sharing the channel
+   data of `info`), and expand(...) will return copies of the original records.
+   */
+  CompactSpecFile( SpecUtils::SpecFile &info, const bool compact );
+
+  bool compacted() const;
+
+  /** The file; if compacted, records have zeroed gamma counts. */
+  const SpecUtils::SpecFile &meta() const;
+
+  /** The records of meta(), cached so they can be indexed cheaply. */
+  const std::vector<std::shared_ptr<const SpecUtils::Measurement>> &measurements() const;
+
+  /** Returns a copy of the index'th record of measurements(), with its
+   original gamma counts.
+   */
+  std::shared_ptr<SpecUtils::Measurement> expand( const size_t index ) const;
+
+  /** Returns a copy of the file with all of the original gamma counts. */
+  SpecUtils::SpecFile expanded() const;
+
+  /** The same as expand(...), but releases the encoded counts of the record,
+   so it can only be called once for each index.
+   */
+  std::shared_ptr<SpecUtils::Measurement> take( const size_t index );
+
+  /** The same as expanded(), but releases the encoded counts of all records. */
+  SpecUtils::SpecFile take_expanded();
+
+  /** Adds the gamma counts of the index'th record of measurements() to `sum`,
+   rebinning to `cal` as needed, without expanding the record.  Records without
+   a valid energy calibration are skipped.
+
+   This gives the bit-for-bit same result as SpectrumSum::deterministic_sum(...)
+   does for the original record, so can be used as the `add_record` of
+   SpectrumSum::pairwise_sum(...).
+   */
+  void add_gamma_counts( const size_t index, const SpecUtils::EnergyCalibration &cal,
+                         std::vector<double> &sum ) const;
+
+protected:
+  bool m_compacted;
+  SpecUtils::SpecFile m_meta;
+  std::vector<std::shared_ptr<const SpecUtils::Measurement>> m_measurements;
+
+  /** Indexed the same as m_measurements; empty if not compacted. */
+  std::vector<SparseChannelCounts> m_counts;
+};//class CompactSpecFile
+
+#endif //CompactSpectra_H
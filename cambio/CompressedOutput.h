@@ -0,0 +1,150 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef CompressedOutput_H
+#define CompressedOutput_H
+
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <streambuf>
+#include <condition_variable>
+
+namespace CompressedOutput
+{
+  enum class Compression
+  {
+    None,
+    Gzip,
+    Zstd
+  };//enum class Compression
+
+  /** Returns the compression for "gzip" (or "gz"), "zstd" (or "zst"), or
+   "none"/"" (case insensitive).
+
+   Throws std::exception if the string isn't recognized, or the compression
+   isn't available in this build.
+   */
+  Compression compression_from_string( const std::string &name );
+
+  /** Returns if `type` can be used; zstd is only available if Cambio was built
+   with CAMBIO_ENABLE_ZSTD.
+   */
+  bool is_available( const Compression type );
+
+  /** The extension to append to file names, e.g. ".gz"; empty for None. */
+  const char *file_extension( const Compression type );
+
+  /** Compresses `data` in one go; returns an empty string on error. */
+  std::string compress( const std::string &data, const Compression type,
+                        const size_t num_threads = 1 );
+
+
+  /** A stream buffer that compresses everything written to it, and writes the
+   compressed data to another stream buffer.
+
+   Data is split into fixed size blocks, which are compressed independently,
+   so multiple blocks can be compressed at once by a small pool of threads
+   while the caller keeps encoding the next block.  Compressed blocks are
+   written to the destination, in order, by the thread writing to this
+   buffer, so the destination does not need to be thread safe.
+
+   Gzip output is a single standard gzip member (each block is a raw deflate
+   stream ended with a sync-flush, and the CRCs are combined), and zstd output
+   is a sequence of frames, one per block, so both can be read by the standard
+   tools.  Compressing blocks independently costs a little compression ratio.
+
+   The threads are only started once there is more than one block of data, so
+   small outputs are compressed on the calling thread.
+   */
+  class CompressingStreamBuf : public std::streambuf
+  {
+  public:
+    /**
+     @param dest Where the compressed data is written; must outlive this object.
+     @param num_threads The maximum number of threads to compress with; 0 uses
+            one per CPU core, and 1 compresses on the calling thread.
+     @param block_size The amount of uncompressed data in each block.
+     */
+    CompressingStreamBuf( std::streambuf *dest, const Compression type,
+                          const size_t num_threads = 0,
+                          const size_t block_size = 1024*1024 );
+
+    /** Stops the worker threads; if finish() wasn't called, the output will
+     be incomplete.
+     */
+    ~CompressingStreamBuf();
+
+    /** Compresses any remaining data, waits for all blocks to be written, and
+     writes the trailing data (e.g., gzip CRC).  Returns if everything was
+     successfully compressed and written.  Nothing may be written after this.
+     */
+    bool finish();
+
+  protected:
+    virtual int_type overflow( int_type ch ) override;
+
+  private:
+    CompressingStreamBuf( const CompressingStreamBuf & ) = delete;
+    CompressingStreamBuf &operator=( const CompressingStreamBuf & ) = delete;
+
+    struct Block
+    {
+      std::string input;
+      std::string output;
+      uint32_t crc;
+      bool last;
+      bool done;
+      bool ok;
+    };//struct Block
+
+    void submit_block( const bool last );
+    void write_completed_blocks();
+    void write_to_dest( const std::string &data );
+    void start_workers();
+    void worker_loop();
+    void compress_block( Block &block ) const;
+
+    std::streambuf * const m_dest;
+    const Compression m_type;
+    const size_t m_num_threads;
+    const size_t m_block_size;
+
+    std::vector<char> m_block;
+    bool m_wrote_header;
+    bool m_finished;
+    bool m_failed;
+    uint32_t m_crc;
+    uint64_t m_total_in;
+
+    std::mutex m_mutex;
+    std::condition_variable m_job_available;
+    std::condition_variable m_block_done;
+    std::deque<std::shared_ptr<Block>> m_pending;  //In output order
+    std::deque<std::shared_ptr<Block>> m_jobs;     //Not yet picked up by a worker
+    bool m_stopping;
+    std::vector<std::thread> m_workers;
+  };//class CompressingStreamBuf
+}//namespace CompressedOutput
+
+#endif //CompressedOutput_H
@@ -0,0 +1,201 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef FileLoader_H
+#define FileLoader_H
+
+#include <string>
+#include <functional>
+
+#include "SpecUtils/SpecFile.h"
+
+namespace FileLoader
+{
+  /** A read-only memory mapping of an entire file.
+
+   Pages are only read from disk as they are touched, and are shared with the
+   page cache (and so with any other process converting the same file).  The
+   data can not be written to, so it can not be handed to a parser that
+   modifies its input (e.g., the N42 parser).  Touching a page past the end of
+   a file that was truncated after being mapped raises SIGBUS, so mappings
+   should be kept only as long as they are needed: load_file(...) keeps an
+   input file mapped just while parsing it, and longer-lived readers (like the
+   GUI load preview) should read the file instead.
+
+   Throws std::exception if the file can not be opened or mapped.
+   */
+  class MappedFile
+  {
+  public:
+    explicit MappedFile( const std::string &filename );
+    ~MappedFile();
+
+    const char *data() const;
+    size_t size() const;
+
+  private:
+    MappedFile( const MappedFile & ) = delete;
+    MappedFile &operator=( const MappedFile & ) = delete;
+
+    const char *m_data;
+    size_t m_size;
+
+#if( defined(_WIN32) )
+    void *m_file;
+    void *m_mapping;
+#endif
+  };//class MappedFile
+
+
+  /** Guesses the format of a spectrum file from its first few kilobytes, by
+   looking for: the N42 XML root element, the PCF "DHS" header, the CHN -1
+   leading word, the ORTEC binary SPC record header, the Canberra CNF block
+   IDs, or the IAEA SPE "$SPEC_ID:" style keywords.
+
+   @param data The start of the file.
+   @param nbytes The number of bytes available at `data`.
+   @param file_size The total size of the file.
+
+   Returns SpecUtils::ParserType::Auto if the format isn't recognized.
+   */
+  SpecUtils::ParserType sniff_parser_type( const char *data, const size_t nbytes,
+                                           const size_t file_size );
+
+  /** Returns a short name for the parser type, for diagnostic messages. */
+  const char *parser_type_name( const SpecUtils::ParserType type );
+
+
+  /** Compression formats load_file(...) will transparently decompress. */
+  enum class Compression
+  {
+    None,
+    Gzip,
+    Zstd,
+    Xz
+  };//enum class Compression
+
+  /** Identifies gzip, zstd, or xz compressed data by its magic bytes. */
+  Compression sniff_compression( const char *data, const size_t nbytes );
+
+  /** Returns a short name for the compression, for diagnostic messages. */
+  const char *compression_name( const Compression type );
+
+  /** Decompresses all of `data`, appending the result to `output`.
+
+   Gzip files made of multiple members (e.g., from pigz, or bgzip) are
+   decompressed using up to `num_threads` threads (0 for one per CPU core).
+
+   Returns false if the data is corrupt or truncated, or decompressing the
+   format isn't supported by this build (zstd and xz are optional).
+   */
+  bool decompress( const char *data, const size_t nbytes, const Compression type,
+                   std::string &output, const size_t num_threads = 0 );
+
+  /** Returns `filename` without a trailing ".gz", ".zst", or ".xz" extension. */
+  std::string uncompressed_name( const std::string &filename );
+
+
+  /** Diagnostic information about a call to load_file(...). */
+  struct LoadTiming
+  {
+    /** The format found by sniff_parser_type(...). */
+    SpecUtils::ParserType sniffed_type;
+
+    /** If the sniffed format failed to parse (or wasn't recognized), and
+     SpecUtils::ParserType::Auto had to be used.
+     */
+    bool used_auto;
+
+    /** If the file was compressed; it is decompressed as it is parsed. */
+    Compression compression;
+
+    double sniff_seconds;
+
+    /** Time spent in the decoder, which is not included in parse_seconds. */
+    double decompress_seconds;
+    double parse_seconds;
+
+    /** Why the file could not be loaded (e.g., "unrecognized format inside
+     compressed file"), or empty if it was loaded.
+     */
+    std::string error;
+
+    LoadTiming();
+  };//struct LoadTiming
+
+
+  /** Parses a spectrum file that has already been read into memory (e.g., it
+   came from an archive), by sniffing the format and calling the matching
+   parser.  gzip, zstd, or xz compressed data is decompressed as it is parsed.
+   If the format isn't recognized, or fails to parse, each of the parsers that
+   can read from memory (N42, PCF, SPC, CHN, SPE, CNF, TKA, Exploranium, SPM
+   daily files, and CSV/text) is tried in turn; other formats SpecUtils
+   supports can only be loaded from a file with load_file(...).  Nothing is
+   written to disk.
+
+   `filename` is used to set SpecFile::filename().
+   */
+  bool load_from_memory( SpecUtils::SpecFile &info, const char *data, const size_t nbytes,
+                         const std::string &filename, LoadTiming *timing = nullptr );
+
+
+  /** Loads a spectrum file, the same as
+   `info.load_file( filename, SpecUtils::ParserType::Auto, hint )`, but:
+   - the format is first sniffed from the start of the file, and the matching
+     parser used directly, rather than trying every parser in turn; if that
+     parser fails, ParserType::Auto is used.
+   - formats whose parsers only read their input (PCF, SPC, CHN, SPE, and
+     CNF) are parsed straight from a read-only MappedFile, rather than the
+     file being copied into memory first; N42 files, whose parser modifies its
+     input, still go through SpecFile::load_file(...).
+   - gzip, zstd, or xz compressed files (identified by their magic bytes, not
+     extension) are decompressed as they are parsed, the same as by
+     load_from_memory(...), with the SpecFile::filename() set to the name
+     without the compression extension.
+
+   Returns if the file was successfully parsed.
+   */
+  bool load_file( SpecUtils::SpecFile &info, const std::string &filename,
+                  const std::string &hint = "", LoadTiming *timing = nullptr );
+
+
+  /** Parses an uncompressed N42-2012 file a few megabytes of <RadMeasurement>
+   elements at a time, so a preview of a large file can be shown while
+   load_file(...) is still parsing it.  Other formats (including N42-2006),
+   and compressed files, can not be split up this way, so have no preview.
+
+   The file is read a block at a time with ordinary reads (it is not mapped),
+   and each byte is looked at once, so this can run alongside load_file(...)
+   for as long as it takes, without re-reading the start of the file.
+
+   Each piece is parsed as its own SpecFile, along with everything in the file
+   before the first <RadMeasurement> (instrument and detector information,
+   energy calibrations, etc), and passed to `callback`, along with the
+   fraction of the file read so far.  Any other elements that come after the
+   first <RadMeasurement> (e.g., analysis results) are not included, and
+   sample numbers are only meaningful within each piece.
+
+   Reading stops early if `callback` returns false.  Returns false if the file
+   isn't an uncompressed N42-2012 file, or none of it could be parsed.
+   */
+  bool preview_n42_2012( const std::string &filename,
+              const std::function<bool(const SpecUtils::SpecFile &piece,double fraction)> &callback );
+}//namespace FileLoader
+
+#endif //FileLoader_H
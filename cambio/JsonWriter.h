@@ -0,0 +1,149 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef JsonWriter_H
+#define JsonWriter_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+
+namespace SpecUtils
+{
+  class SpecFile;
+  class Measurement;
+}
+
+/** Writes JSON to a stream, a value at a time, so arbitrarily large documents
+ can be written without building them in memory first.
+
+ Output is accumulated in an internal buffer, and written to the stream in
+ large blocks, avoiding the per-value overhead of iostream formatting.
+ Commas and colons are inserted automatically; callers are responsible for
+ balancing begin_object()/end_object() and begin_array()/end_array(), and
+ calling key(...) before each value in an object.
+
+ Floating point values are written with the fewest digits that read back as
+ the same value, and integer valued floats (e.g., most channel counts) are
+ written as integers.  NaN and infinite values are written as null, as JSON
+ has no representation for them.
+
+ Example:
+   JsonWriter json( output );
+   json.begin_object();
+   json.key( "LiveTime" );
+   json.number( 299.5f );
+   json.key( "Counts" );
+   json.number_array( counts.data(), counts.size() );
+   json.end_object();
+   json.flush();
+ */
+class JsonWriter
+{
+public:
+  explicit JsonWriter( std::ostream &output, const size_t buffer_size = 64*1024 );
+
+  /** Flushes any buffered output. */
+  ~JsonWriter();
+
+  void begin_object();
+  void end_object();
+  void begin_array();
+  void end_array();
+
+  /** Writes the name of the next member of the current object. */
+  void key( const char *name );
+  void key( const std::string &name );
+
+  void string_value( const char *value );
+  void string_value( const std::string &value );
+  void number( const float value );
+  void number( const double value );
+  void integer( const int64_t value );
+  void boolean( const bool value );
+  void null();
+
+  /** Writes an array of numbers; much faster than calling number(...) for each. */
+  void number_array( const float *values, const size_t num_values );
+  void number_array( const std::vector<float> &values );
+
+  /** Writes the buffered output to the stream; returns if the stream is good. */
+  bool flush();
+
+  /** Appends `input` to `output`, escaped for use inside a JSON string (the
+   surrounding quotes are not added).  Characters that could end a HTML
+   <script> element are also escaped, so output may be embedded in a page.
+   */
+  static void escape( const char *input, const size_t length, std::string &output );
+
+  /** Writes the shortest decimal representation of `value` that reads back
+   as the same float into `buffer` (which must hold at least 32 characters),
+   and returns the number of characters written.
+   */
+  static size_t format_number( const float value, char *buffer );
+  static size_t format_number( const double value, char *buffer );
+
+private:
+  JsonWriter( const JsonWriter & ) = delete;
+  JsonWriter &operator=( const JsonWriter & ) = delete;
+
+  /** Writes a comma if this isn't the first value in the current array or
+   object, and flushes the buffer if it is full.
+   */
+  void before_value();
+
+  std::ostream &m_output;
+  const size_t m_buffer_size;
+  std::string m_buffer;
+
+  /** For each open array or object, if a value has been written to it yet. */
+  std::vector<bool> m_has_value;
+
+  /** If key(...) was just written, so the next value needs no comma. */
+  bool m_after_key;
+};//class JsonWriter
+
+
+/** Functions to write spectrum files to JSON, including file and record level
+ information (times, GPS, source type, analysis results, etc).
+ */
+namespace SpectrumJson
+{
+  /** Writes `info` as a JSON object, with the file level information as
+   members of a "File" object, and the measurements (in the order given) as
+   elements of a "Measurements" array.
+   */
+  void write_file( JsonWriter &json, const SpecUtils::SpecFile &info,
+                   const std::vector<std::shared_ptr<const SpecUtils::Measurement>> &measurements );
+
+  /** Writes the file level information of `info` as a JSON object. */
+  void write_file_meta_info( JsonWriter &json, const SpecUtils::SpecFile &info );
+
+  /** Writes a measurement as a JSON object.
+
+   The "title", "liveTime", "realTime", "neutrons", "x" (lower channel
+   energies), and "y" (channel counts) members match the spectrum objects
+   used by SpectrumChartD3, so measurements can be charted directly.
+   */
+  void write_measurement( JsonWriter &json, const SpecUtils::Measurement &meas );
+}//namespace SpectrumJson
+
+#endif //JsonWriter_H
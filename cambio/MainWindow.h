@@ -22,11 +22,14 @@
 #define MainWindow_H
 
 #include <set>
+#include <atomic>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <QUrl>
 #include <QList>
+#include <QString>
 #include <QRunnable>
 #include <QMainWindow>
 
@@ -37,6 +40,7 @@ class QDropEvent;
 class QCloseEvent;
 class QGridLayout;
 class QToolButton;
+class QProgressDialog;
 
 class TimeView;
 class SaveWidget;
@@ -44,9 +48,53 @@ class SpectrumView;
 class BusyIndicator;
 namespace SpecUtils{ class SpecFile; }
 namespace SpecUtils{ class Measurement; }
+namespace TimeSeries{ struct SampleTable; }
 class FileDetailWidget;
 
 
+//FileLoadRunnable parses a spectrum file (or loads it from the cache of large
+//  files) on a QThreadPool thread, so the GUI stays responsive while opening
+//  large files.  The result is delivered to the GUI thread through the
+//  `loaded(...)` signal, which should be connected with Qt::QueuedConnection.
+//  The parse itself can not be interrupted, so cancelling just means the
+//  result is not used, and the file is not cached.
+//  While large, uncompressed, N42-2012 files are being parsed, the start of
+//  the file is also read a piece at a time on another thread, and a preview
+//  (the gross-count time series, and summed spectrum, of the records read so
+//  far) emitted through `previewUpdated(...)` every quarter second or so,
+//  until the parse finishes.  Other formats, and compressed files, have no
+//  preview.
+class FileLoadRunnable : public QObject, public QRunnable
+{
+  Q_OBJECT
+  
+public:
+  //If `cache_filename` is non-empty, the file will be loaded from that cache
+  //  if it is valid, or else the cache written after parsing.  If
+  //  `remove_file` is true, the file is deleted after it is read (e.g., it was
+  //  a temporary file).
+  FileLoadRunnable( const QString &filename, const std::string &cache_filename,
+                    const bool remove_file, const int load_id,
+                    std::shared_ptr<std::atomic<bool>> cancelled );
+  virtual ~FileLoadRunnable();
+  virtual void run();
+  
+signals:
+  void progress( const QString &message );
+  void loaded( std::shared_ptr<SpecUtils::SpecFile> info, bool success, int load_id );
+  void previewUpdated( std::shared_ptr<SpecUtils::Measurement> grosscounts,
+                       std::shared_ptr<SpecUtils::Measurement> summed,
+                       double fraction, int load_id );
+  
+protected:
+  const QString m_filename;
+  const std::string m_cache_filename;
+  const bool m_remove_file;
+  const int m_load_id;
+  std::shared_ptr<std::atomic<bool>> m_cancelled;
+};//class FileLoadRunnable
+
+
 class MainWindow : public QMainWindow
 {
   Q_OBJECT
@@ -59,12 +107,22 @@ public:
 public:
   bool eventFilter( QObject *object, QEvent *event );
 
-  void handleSingleFileDrop( const QUrl &url );
+  //handleSingleFileDrop(...): starts loading the file in the background,
+  //  showing a progress dialog the user can cancel the load from; any load
+  //  already in progress is cancelled.  If `remove_file_when_done` is true,
+  //  the file is deleted once it has been read.
+  void handleSingleFileDrop( const QUrl &url, const bool remove_file_when_done = false );
   void handleMultipleFileDrop( const QList<QUrl> &urlist );
   
 public slots:
   void setMeasurment( std::shared_ptr<SpecUtils::SpecFile> measurment );
   
+  void fileLoadFinished( std::shared_ptr<SpecUtils::SpecFile> info, bool success, int load_id );
+  void fileLoadPreview( std::shared_ptr<SpecUtils::Measurement> grosscounts,
+                        std::shared_ptr<SpecUtils::Measurement> summed,
+                        double fraction, int load_id );
+  void cancelFileLoad();
+  
   void recievedDropEvent( QDropEvent *event );
   
   void spectrumMouseLeft();
@@ -114,8 +172,11 @@ protected:
   
   //calculateTimeSeriesData(...): calculates the time series histogram for
   //  passthrough/search-mode data.  The passed in Measurement shared ptr will
-  //  be reset to point at a new histogram
-  void calculateTimeSeriesData( std::shared_ptr<SpecUtils::Measurement> &hist ) const;
+  //  be reset to point at a new histogram.  The per-detector sums of each
+  //  sample are cached in m_timeSeriesTable, so changing the displayed
+  //  detectors doesnt require going through all the records again; any edit
+  //  to the records must reset it (see refreshDisplays()).
+  void calculateTimeSeriesData( std::shared_ptr<SpecUtils::Measurement> &hist );
   
   //updateForSampleNumChange(): sets stuff for m_currentSampleNum
   void updateForSampleNumChange();
@@ -149,6 +210,17 @@ protected:
   std::set<int> m_displayedSampleNumbers;
   std::vector<bool> m_detectorsDisplayed;
   std::shared_ptr<SpecUtils::SpecFile> m_measurment;
+  
+  //Must be reset whenever m_measurment, or its records, are changed.
+  std::shared_ptr<const TimeSeries::SampleTable> m_timeSeriesTable;
+  
+  //The file currently being loaded in the background, if any; results of
+  //  loads with an id other than m_loadId are ignored.
+  int m_loadId;
+  QString m_loadFilename;
+  QProgressDialog *m_loadProgress;
+  bool m_loadPreviewShown;
+  std::shared_ptr<std::atomic<bool>> m_loadCancelled;
 };//class MainWindow
 
 #endif //MainWindow
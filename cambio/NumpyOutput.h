@@ -0,0 +1,85 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef NumpyOutput_H
+#define NumpyOutput_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <ostream>
+
+namespace SpecUtils
+{
+  class Measurement;
+}
+
+/** Functions to write spectra as NumPy arrays: a .npy file holding an N x C
+ float32 matrix of channel counts (one row per measurement), that can be
+ memory-mapped with `numpy.load(filename, mmap_mode='r')`, and a .npz file
+ holding the per-measurement information as parallel arrays.
+
+ All measurements must have the same number of channels; if they don't, they
+ can be put on a common binning with the --linearize-* options.
+ */
+namespace NumpyOutput
+{
+  /** Returns the measurements with gamma channel data, which are the rows
+   written by write_counts(...) and write_metadata(...); neutron-only
+   measurements are left out.
+   */
+  std::vector<std::shared_ptr<const SpecUtils::Measurement>> gamma_measurements(
+                  const std::vector<std::shared_ptr<const SpecUtils::Measurement>> &measurements );
+
+  /** Returns the number of channels every measurement has, or throws
+   std::exception (with a message for the user) if they don't all have the
+   same number.
+   */
+  size_t common_num_channels( const std::vector<std::shared_ptr<const SpecUtils::Measurement>> &measurements );
+
+  /** Returns the header for a .npy file holding a C-ordered array of the
+   given NumPy type (e.g., "<f4") and shape.  The header length is a multiple
+   of 64 bytes, so the data that follows is aligned for memory-mapping.
+   */
+  std::string npy_header( const std::string &dtype, const std::vector<size_t> &shape );
+
+  /** Writes the channel counts of the measurements as a .npy file holding an
+   N x C float32 matrix.
+
+   Throws std::exception if the measurements have differing numbers of
+   channels.  Returns if the stream is good.
+   */
+  bool write_counts( std::ostream &output,
+                     const std::vector<std::shared_ptr<const SpecUtils::Measurement>> &measurements );
+
+  /** Writes an (uncompressed) .npz file with an array for each of: live_time,
+   real_time (float32), sample_number, detector_number (int32), detector_name,
+   title, source_type (unicode strings), start_time (datetime64[us], NaT if
+   unknown), gamma_count_sum, neutron_count_sum, latitude, longitude (float64,
+   NaN if not known), and channel_energies (float32 lower channel energies;
+   a single row of C values if all measurements share a binning, otherwise
+   N x C, with NaN for measurements without a valid energy calibration).
+
+   Returns if the stream is good.
+   */
+  bool write_metadata( std::ostream &output,
+                       const std::vector<std::shared_ptr<const SpecUtils::Measurement>> &measurements );
+}//namespace NumpyOutput
+
+#endif //NumpyOutput_H
@@ -0,0 +1,113 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef OutputFile_H
+#define OutputFile_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <ostream>
+#include <fstream>
+
+#include "cambio/CompressedOutput.h"
+
+class ArchiveWriter;
+
+/** An output stream that writes to a temporary file next to the destination,
+ through a large (1 MB) buffer, and then atomically renames the temporary file
+ to the destination when commit() is called.
+
+ Readers of the destination path will either see the previous file (or no
+ file), or the complete new file - never a partially written one.  If the
+ OutputFile is destroyed without commit() succeeding, the temporary file is
+ removed and the destination is left untouched.
+
+ If an ArchiveWriter is given, the output is instead collected in memory, and
+ added to the archive by commit().
+
+ If compress(...) is called, the data is compressed as it is written; the
+ caller is responsible for choosing a file name with the appropriate extension.
+
+ Example use:
+ \code
+ OutputFile output( "/some/path/file.n42" );
+ if( !output.is_open() )
+   return false;
+ const bool wrote = info.write_2012_N42( output );
+ return wrote && output.commit();
+ \endcode
+ */
+class OutputFile : public std::ostream
+{
+public:
+  /** Opens the temporary file for `filename`.
+
+   @param sync_to_disk If true, commit() will make sure the data is on disk
+          (i.e., fsync) before renaming the file to its final destination.
+   @param archive If non-null, the file is written into this archive instead
+          of to disk.
+   */
+  explicit OutputFile( const std::string &filename, const bool sync_to_disk = false,
+                       ArchiveWriter *archive = nullptr );
+
+  /** Removes the temporary file, if commit() hasn't succeeded. */
+  ~OutputFile();
+
+  /** Returns if the temporary file was successfully opened. */
+  bool is_open() const;
+
+  /** Compresses everything subsequently written to this stream, using up to
+   `num_threads` threads (0 for one per CPU core); must be called before
+   anything is written.  Compression::None does nothing.
+   */
+  void compress( const CompressedOutput::Compression type, const size_t num_threads = 0 );
+
+  /** Flushes and closes the temporary file, optionally syncs it to disk, and
+   then renames it to the destination, replacing any existing file.
+
+   Returns false, and removes the temporary file, if any of the writes
+   failed, or the file couldn't be renamed.  Calling commit() more than once
+   just returns the previous result.
+   */
+  bool commit();
+
+  /** The final destination of the file. */
+  const std::string &filename() const;
+
+private:
+  OutputFile( const OutputFile & ) = delete;
+  OutputFile &operator=( const OutputFile & ) = delete;
+
+  void discard();
+
+  std::string m_filename;
+  std::string m_temp_filename;
+  std::vector<char> m_buffer;
+  std::filebuf m_filebuf;
+  ArchiveWriter *m_archive;
+  std::stringbuf m_archive_buf;
+  std::unique_ptr<CompressedOutput::CompressingStreamBuf> m_compressor;
+  bool m_sync_to_disk;
+  bool m_committed;
+  bool m_commit_success;
+};//class OutputFile
+
+#endif //OutputFile_H
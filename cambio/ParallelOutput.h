@@ -0,0 +1,165 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef ParallelOutput_H
+#define ParallelOutput_H
+
+#include <set>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+class ArchiveWriter;
+
+namespace ParallelOutput
+{
+  /** Returns `num_threads`, or the number of CPU cores if `num_threads` is 0. */
+  size_t resolve_num_threads( const size_t num_threads );
+
+
+  /** Calls `fcn( index, thread_index )` for each index in [0, num_items),
+   using up to `num_threads` threads (the calling thread included), where
+   `thread_index` is in [0, num_threads) and identifies which thread is making
+   the call, so callers can keep per-thread state.
+
+   Indexes are handed out in increasing order, but may complete in any order.
+   If `fcn` throws, the remaining indexes are skipped, and the first exception
+   is re-thrown (as a std::runtime_error) once all threads are done.
+   */
+  void parallel_for( const size_t num_items, const size_t num_threads,
+                     const std::function<void(size_t,size_t)> &fcn );
+
+
+  /** Writes files from a small pool of background threads, so encoding the
+   next file doesn't have to wait on the disk (or network share).
+
+   Each file is written through an OutputFile, so appears atomically.  Calls
+   to submit(...) block while more than `max_queued_bytes` of data are waiting
+   to be written, to bound memory use.
+   */
+  class AsyncFileWriter
+  {
+  public:
+    /**
+     @param num_items The number of files that will be submitted; each is
+            identified by an index in [0, num_items).
+     @param num_writers The number of writer threads; must be at least 1.
+     @param sync_to_disk Passed through to OutputFile.
+     @param archive If non-null, files are added to this archive, rather than
+            written to disk.
+     */
+    AsyncFileWriter( const size_t num_items, const size_t num_writers,
+                     const bool sync_to_disk, ArchiveWriter *archive = nullptr,
+                     const size_t max_queued_bytes = 64*1024*1024 );
+
+    /** Calls finish(), if it hasn't been already. */
+    ~AsyncFileWriter();
+
+    /** Queues `contents` to be written to `filename`. Thread safe. */
+    void submit( const size_t index, const std::string &filename, std::string &&contents );
+
+    /** Waits for all queued files to be written, and stops the writer threads.
+
+     Returns, for each index, if the file was successfully written; indexes
+     never submitted are false.
+     */
+    const std::vector<bool> &finish();
+
+  private:
+    AsyncFileWriter( const AsyncFileWriter & ) = delete;
+    AsyncFileWriter &operator=( const AsyncFileWriter & ) = delete;
+
+    struct Job
+    {
+      size_t index;
+      std::string filename;
+      std::string contents;
+    };//struct Job
+
+    void writer_loop();
+
+    const bool m_sync_to_disk;
+    ArchiveWriter * const m_archive;
+    const size_t m_max_queued_bytes;
+
+    std::mutex m_mutex;
+    std::condition_variable m_job_available;
+    std::condition_variable m_space_available;
+    std::deque<Job> m_queue;
+    size_t m_queued_bytes;
+    bool m_finishing;
+
+    std::vector<bool> m_results;
+    std::vector<std::thread> m_writers;
+  };//class AsyncFileWriter
+
+
+  /** The names of the files in `directory`, from one directory listing, so
+   existence checks for many output files don't each need a stat() call.
+
+   On Windows and macOS, whose file systems are usually case insensitive,
+   names are compared case insensitively.
+   */
+  class DirectoryListing
+  {
+  public:
+    explicit DirectoryListing( const std::string &directory );
+
+    /** Returns if a file with the same file name (directory ignored) as
+     `filename` was in the directory.
+     */
+    bool contains( const std::string &filename ) const;
+
+  private:
+    std::set<std::string> m_names;
+  };//class DirectoryListing
+
+
+  /** Creates directories, including any missing parents (like "mkdir -p"),
+   remembering which directories are known to exist so each is only checked
+   for, or created, once per run, no matter how many output files go into it.
+
+   Thread safe; a directory created by another thread or process in the
+   meantime is not an error.
+   */
+  class DirectoryCache
+  {
+  public:
+    DirectoryCache();
+
+    /** Makes sure `directory`, and all of its parents, exist.
+
+     Returns false if a directory could not be created.
+     */
+    bool create_directories( const std::string &directory );
+
+  private:
+    DirectoryCache( const DirectoryCache & ) = delete;
+    DirectoryCache &operator=( const DirectoryCache & ) = delete;
+
+    std::mutex m_mutex;
+    std::set<std::string> m_existing;
+  };//class DirectoryCache
+}//namespace ParallelOutput
+
+#endif //ParallelOutput_H
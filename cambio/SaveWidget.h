@@ -29,6 +29,7 @@
 
 
 class QLabel;
+class QCheckBox;
 class QDialog;
 class QGroupBox;
 class QLineEdit;
@@ -70,6 +71,7 @@ protected:
   QGridLayout *m_layout;
   QLineEdit *m_saveDirectory;
   QLineEdit *m_saveName;
+  QCheckBox *m_compressOutput;
   QListWidget *m_saveAsType;
   QLabel *m_formatDescription;
   QLabel *m_noOptionsText;
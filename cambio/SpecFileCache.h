@@ -0,0 +1,106 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef SpecFileCache_H
+#define SpecFileCache_H
+
+#include <memory>
+#include <string>
+#include <cstdint>
+
+namespace SpecUtils
+{
+  class SpecFile;
+}
+
+/** A binary cache of a parsed spectrum file, so large files (e.g., portal
+ N42 files of hundreds of megabytes) can be re-opened without parsing them
+ again.
+
+ The cache holds the channel counts of every record as flat float arrays,
+ aligned for memory-mapping, along with the rest of the file (calibrations,
+ times, remarks, etc) as 2012 N42 XML without the channel data, which is
+ small and quick to parse.  Since N42-2012 is the only format SpecUtils reads
+ back everything it writes, only N42-2012 source files are cached; other
+ formats would lose information going through it.
+
+ When loading, the cache is memory-mapped, and only used if the source file
+ has the same size, modification time (to the nanosecond, where the file
+ system keeps it), file ID (inode), and hash of its first and last megabyte,
+ as when the cache was written.
+
+ Cache files are versioned; caches from other versions of Cambio, or from a
+ machine with a different byte order, are ignored.
+ */
+namespace SpecFileCache
+{
+  /** Source files smaller than this parse quickly enough not to be cached. */
+  const uint64_t ns_min_source_size = 8*1024*1024;
+
+  /** The default limit on the total size of the cache files in a directory;
+   see prune_cache_dir(...).
+   */
+  const uint64_t ns_max_cache_dir_size = uint64_t(2)*1024*1024*1024;
+
+  /** Returns the name of the cache file for `source_filename`, inside
+   `cache_dir`; the name is derived from a hash of the source path.
+   */
+  std::string cache_filename( const std::string &cache_dir, const std::string &source_filename );
+
+  /** What the cache is written from: the metadata of a file, and its
+   channel count arrays, which are shared with the file, not copied.
+   */
+  struct CacheContents;
+
+  /** Returns what is needed to write the cache for `info`; this is quick, so
+   can be done before `info` is handed off to be modified (which never
+   changes the shared channel count arrays), and the cache written afterwards.
+
+   Returns nullptr if `info` can't be cached (e.g., two records have the same
+   sample number and detector name).
+   */
+  std::shared_ptr<const CacheContents> prepare_cache( const SpecUtils::SpecFile &info );
+
+  /** Writes the cache for a file parsed from `source_filename`.
+
+   Returns false, without writing anything, if the source file isn't an
+   uncompressed N42-2012 file.  The cache is written to a temporary file and
+   then renamed, so a partially written cache is never seen.
+   */
+  bool write_cache( const CacheContents &contents, const std::string &source_filename,
+                    const std::string &cache_filename );
+
+  /** Loads `info` from the cache, if it exists, and is valid for the current
+   contents of `source_filename`.  Using a cache marks it as recently used,
+   for prune_cache_dir(...).
+
+   Returns false (leaving `info` reset) if the cache is missing, stale, or
+   corrupt, in which case the source file should be parsed as usual.
+   */
+  bool load_cache( SpecUtils::SpecFile &info, const std::string &source_filename,
+                   const std::string &cache_filename );
+
+  /** Removes the least recently used cache files in `cache_dir`, until the
+   total size of the cache files there is at most `max_total_size`.
+   */
+  void prune_cache_dir( const std::string &cache_dir,
+                        const uint64_t max_total_size = ns_max_cache_dir_size );
+}//namespace SpecFileCache
+
+#endif //SpecFileCache_H
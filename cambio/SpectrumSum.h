@@ -0,0 +1,101 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef SpectrumSum_H
+#define SpectrumSum_H
+
+#include <set>
+#include <memory>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace SpecUtils{ class SpecFile; }
+namespace SpecUtils{ class Measurement; }
+namespace SpecUtils{ class EnergyCalibration; }
+
+namespace SpectrumSum
+{
+  /** Sums the measurements of `info` with the given sample numbers and detector
+   names, similar to SpecUtils::SpecFile::sum_measurements(...), but so that the
+   result is bit-for-bit identical from run to run, no matter how many threads
+   are used.
+
+   Records are visited in the order of SpecFile::measurements(), put into the
+   binning of the result with rebin_add(...) if needed, and summed with
+   pairwise_sum(...).
+
+   @param energy_cal The energy calibration of the result; if nullptr,
+          SpecFile::suggested_sum_energy_calibration(...) is used.
+   @param num_threads Maximum number of threads to use; 0 means one per core.
+
+   As with sum_measurements(...), the result is a new Measurement with only the
+   summed quantities, the earliest start time, and (if they are the same for
+   every record) the sample number, detector name, and source type set; the
+   title, remarks, position, etc of the records are not carried over.
+
+   Returns nullptr if no measurements match the sample numbers and detectors.
+   Throws std::exception if there are matching records, but no gamma spectra
+   with a valid energy calibration to sum.
+   */
+  std::shared_ptr<SpecUtils::Measurement>
+    deterministic_sum( const SpecUtils::SpecFile &info,
+                       const std::set<int> &sample_numbers,
+                       const std::vector<std::string> &detector_names,
+                       std::shared_ptr<const SpecUtils::EnergyCalibration> energy_cal,
+                       size_t num_threads );
+
+
+  /** The summation deterministic_sum(...) uses, for callers that keep channel
+   counts some other way (e.g., CompactSpecFile).
+
+   `add_record(index,leaf)` must add the counts of record `index` (from 0 to
+   `num_records`) to `leaf`, which has `num_channels` zeros when passed in.
+   The leaves are accumulated in double precision using a fixed-shape pairwise
+   (cascade) sum over fixed size blocks of records; the blocks may be summed on
+   separate threads, but the shape of the summation tree only depends on the
+   number of records.  The inner loops are simple element-wise adds over
+   channel arrays so the compiler can vectorize them.
+
+   `add_record` may be called from multiple threads at once.  Exceptions it
+   throws are rethrown as a std::runtime_error.
+   */
+  std::vector<double> pairwise_sum( const size_t num_records, const size_t num_channels,
+                       const std::function<void(size_t,std::vector<double> &)> &add_record,
+                       size_t num_threads );
+
+
+  /** Adds `num_values` channel counts, that start at channel `first_channel`
+   of a spectrum with lower channel energies `from_energies`, to `sum`, which
+   has lower channel energies `to_energies`.
+
+   The counts of each channel are split between the bins of `sum` it overlaps,
+   in proportion to the overlap; counts outside the range of `sum` are
+   dropped.  If either set of energies does not have the upper edge of its last
+   channel, it is taken to be as wide as the channel before it.  Channels with
+   zero counts are skipped, so adding a spectrum a run of non-zero channels at
+   a time gives the bit-for-bit same result as adding it all at once.
+   */
+  void rebin_add( const float *counts, const size_t first_channel, const size_t num_values,
+                  const std::vector<float> &from_energies,
+                  const std::vector<float> &to_energies,
+                  std::vector<double> &sum );
+}//namespace SpectrumSum
+
+#endif //SpectrumSum_H
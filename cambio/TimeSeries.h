@@ -0,0 +1,130 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef TimeSeries_H
+#define TimeSeries_H
+
+#include <memory>
+#include <vector>
+#include <ostream>
+
+namespace SpecUtils{ class SpecFile; }
+namespace SpecUtils{ class Measurement; }
+
+/** Functions to compute the gross-count time series of passthrough (search
+ mode) data, as displayed by the GUI time chart, or written by the command
+ line "TimeSeries" format.
+ */
+namespace TimeSeries
+{
+  /** The sums, over the records of each sample and detector, of a file.
+
+   From this the time series for any combination of detectors can be made
+   (using combine(...)) without looking at the records again.
+   */
+  struct SampleTable
+  {
+    /** The sample numbers of the file, in increasing order. */
+    std::vector<int> sample_numbers;
+
+    /** The detector numbers, in the same order as SpecFile::detector_numbers()
+     (and so SpecFile::detector_names()).
+     */
+    std::vector<int> detector_numbers;
+
+    /** The number of records (of all detectors) in each sample. */
+    std::vector<size_t> num_records;
+
+    /** Sums for each sample and detector; element `sample_index*ndet + det_index`. */
+    std::vector<double> gamma_counts;
+    std::vector<double> neutron_counts;
+    std::vector<double> live_times;
+
+    /** The summed real time of only non-background records. */
+    std::vector<double> real_times;
+  };//struct SampleTable
+
+
+  /** The gross-count time series for a combination of detectors. */
+  struct Series
+  {
+    std::vector<int> sample_numbers;
+
+    /** The start time of each sample, in seconds, from the start of the first
+     sample, with an extra entry at the end for when the last sample ends.
+     The duration of each sample is the summed real time of its non-background
+     records, divided by the number of records in the sample.
+     */
+    std::vector<double> start_times;
+
+    /** The summed live time of each sample, divided by the number of records
+     in the sample.
+     */
+    std::vector<double> live_times;
+
+    std::vector<double> gamma_counts;
+    std::vector<double> neutron_counts;
+
+    /** Returns the gamma counts divided by the live time of the sample; or
+     just the gamma counts, if the live time isn't known.
+     */
+    double gamma_rate( const size_t index ) const;
+
+    /** Appends `other` to the end of this series; its start times are offset
+     to start when this series ends.
+     */
+    void append( const Series &other );
+  };//struct Series
+
+
+  /** Sums the records of `info` by sample and detector.
+
+   Records are grouped by sample in a single pass, and then samples are summed
+   on up to `num_threads` threads (0 for one per CPU core).
+   */
+  SampleTable tabulate( const SpecUtils::SpecFile &info, const size_t num_threads );
+
+
+  /** Returns the time series, using the detectors for which `use_detector` is
+   true; it must be the same size as SampleTable::detector_numbers, or
+   std::exception is thrown.
+
+   Every sample is included, even if it has no records from the selected
+   detectors.
+   */
+  Series combine( const SampleTable &table, const std::vector<bool> &use_detector );
+
+
+  /** Returns the time series as a histogram, in the form TimeView displays:
+   the lower channel energies are the sample start times, the gamma counts are
+   Series::gamma_rate(...), and the neutron counts are the neutron counts.
+   */
+  std::shared_ptr<SpecUtils::Measurement> to_histogram( const Series &series );
+
+
+  /** Writes the series as CSV, with a row for each sample, with columns:
+   sample number, start time, real time, live time (both in seconds), gamma
+   counts, gamma rate (see Series::gamma_rate), and neutron counts.
+
+   Returns if the stream is good.
+   */
+  bool write_csv( std::ostream &output, const Series &series );
+}//namespace TimeSeries
+
+#endif //TimeSeries_H
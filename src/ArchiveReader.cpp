@@ -0,0 +1,538 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <climits>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "SpecUtils/StringAlgo.h"
+
+#include "cambio/FileLoader.h"
+#include "cambio/ArchiveReader.h"
+
+using namespace std;
+
+namespace
+{
+  uint16_t read_uint16( const char *data )
+  {
+    const unsigned char *p = reinterpret_cast<const unsigned char *>( data );
+    return static_cast<uint16_t>( p[0] | (p[1] << 8) );
+  }
+
+
+  uint32_t read_uint32( const char *data )
+  {
+    const unsigned char *p = reinterpret_cast<const unsigned char *>( data );
+    return static_cast<uint32_t>( p[0] ) | (static_cast<uint32_t>( p[1] ) << 8)
+           | (static_cast<uint32_t>( p[2] ) << 16) | (static_cast<uint32_t>( p[3] ) << 24);
+  }
+
+
+  uint64_t read_uint64( const char *data )
+  {
+    return static_cast<uint64_t>( read_uint32( data ) )
+           | (static_cast<uint64_t>( read_uint32( data + 4 ) ) << 32);
+  }
+
+
+  bool is_tar_header( const char *data, const size_t nbytes )
+  {
+    //Both POSIX ("ustar\0") and GNU ("ustar ") tar have this magic.
+    return (nbytes >= 512) && !memcmp( data + 257, "ustar", 5 );
+  }
+
+
+  bool is_zip_header( const char *data, const size_t nbytes )
+  {
+    return (nbytes >= 4) && ((read_uint32( data ) == 0x04034b50)    //Local file header
+                             || (read_uint32( data ) == 0x06054b50)); //Empty archive
+  }
+
+
+  bool has_compressed_tar_extension( const string &filename )
+  {
+    const char * const exts[] = { ".tar.gz", ".tgz", ".tar.zst", ".tar.xz", ".txz" };
+    for( const char *ext : exts )
+    {
+      const size_t len = strlen( ext );
+      if( (filename.size() > len)
+          && SpecUtils::iequals_ascii( filename.substr( filename.size() - len ), ext ) )
+        return true;
+    }
+
+    return false;
+  }//has_compressed_tar_extension(...)
+
+
+  /** Returns the null-terminated (or field length) string in a tar header field. */
+  string tar_field( const char *data, const size_t len )
+  {
+    const char *end = static_cast<const char *>( memchr( data, '\0', len ) );
+    return string( data, end ? end : (data + len) );
+  }
+
+
+  /** Tar numbers are octal text, or for large values, base-256 with the high
+   bit of the first byte set.
+   */
+  uint64_t tar_number( const char *data, const size_t len )
+  {
+    const unsigned char *p = reinterpret_cast<const unsigned char *>( data );
+    uint64_t value = 0;
+
+    if( p[0] & 0x80 )
+    {
+      value = (p[0] & 0x7F);
+      for( size_t i = 1; i < len; ++i )
+        value = (value << 8) | p[i];
+      return value;
+    }
+
+    for( size_t i = 0; i < len; ++i )
+    {
+      if( (p[i] >= '0') && (p[i] <= '7') )
+        value = (value << 3) | (p[i] - '0');
+      else if( value || ((p[i] != ' ') && (p[i] != '\0')) )
+        break;
+    }
+
+    return value;
+  }//tar_number(...)
+
+
+  /** Normalizes an entry name to use '/' separators with no leading "./" or
+   "/"; returns an empty string for names that would escape the output
+   directory (i.e., have ".." components).
+   */
+  string sanitize_entry_name( string name )
+  {
+    std::replace( begin(name), end(name), '\\', '/' );
+
+    while( !name.empty() && (name[0] == '/') )
+      name = name.substr( 1 );
+    while( (name.size() > 2) && !name.compare( 0, 2, "./" ) )
+      name = name.substr( 2 );
+
+    if( (name == "..") || !name.compare( 0, 3, "../" )
+        || (name.find( "/../" ) != string::npos)
+        || ((name.size() >= 3) && !name.compare( name.size() - 3, 3, "/.." ))
+        || ((name.size() >= 2) && (name[1] == ':')) )  //Windows drive letter
+      return "";
+
+    return name;
+  }//sanitize_entry_name(...)
+
+
+  /** Parses a pax extended header, setting `path` and `size` if present. */
+  void parse_pax_header( const char *data, const size_t len, string &path, uint64_t &size,
+                         bool &has_size )
+  {
+    size_t pos = 0;
+    while( pos < len )
+    {
+      //Each record is "<length> <key>=<value>\n", where length includes itself.
+      size_t reclen = 0, i = pos;
+      while( (i < len) && (data[i] >= '0') && (data[i] <= '9') )
+        reclen = 10*reclen + (data[i++] - '0');
+
+      if( !reclen || ((pos + reclen) > len) || (i >= len) || (data[i] != ' ') )
+        break;
+
+      const string record( data + i + 1, data + pos + reclen - 1 );
+      const size_t eq = record.find( '=' );
+      if( eq != string::npos )
+      {
+        const string key = record.substr( 0, eq );
+        const string value = record.substr( eq + 1 );
+        if( key == "path" )
+        {
+          path = value;
+        }else if( key == "size" )
+        {
+          size = strtoull( value.c_str(), nullptr, 10 );
+          has_size = true;
+        }
+      }//if( eq != string::npos )
+
+      pos += reclen;
+    }//while( pos < len )
+  }//parse_pax_header(...)
+}//namespace
+
+
+bool ArchiveReader::is_archive( const std::string &filename )
+{
+#ifdef _WIN32
+  ifstream input( SpecUtils::convert_from_utf8_to_utf16(filename).c_str(), ios::in | ios::binary );
+#else
+  ifstream input( filename.c_str(), ios::in | ios::binary );
+#endif
+
+  if( !input )
+    return false;
+
+  char header[512];
+  input.read( header, sizeof(header) );
+  const size_t nread = static_cast<size_t>( input.gcount() );
+
+  if( is_zip_header( header, nread ) || is_tar_header( header, nread ) )
+    return true;
+
+  return has_compressed_tar_extension( filename )
+         && (FileLoader::sniff_compression( header, nread ) != FileLoader::Compression::None);
+}//is_archive(...)
+
+
+ArchiveReader::ArchiveReader( const std::string &filename )
+  : m_filename( filename ),
+    m_mapped(),
+    m_decompressed(),
+    m_data( nullptr ),
+    m_size( 0 ),
+    m_is_zip( false ),
+    m_entries()
+{
+  m_mapped.reset( new FileLoader::MappedFile( filename ) );
+  m_data = m_mapped->data();
+  m_size = m_mapped->size();
+
+  const FileLoader::Compression compression = FileLoader::sniff_compression( m_data, m_size );
+  if( compression != FileLoader::Compression::None )
+  {
+    if( !FileLoader::decompress( m_data, m_size, compression, m_decompressed ) )
+      throw runtime_error( "Unable to decompress '" + filename + "'" );
+
+    m_mapped.reset();
+    m_data = m_decompressed.data();
+    m_size = m_decompressed.size();
+  }//if( a compressed tar file )
+
+  if( is_zip_header( m_data, m_size ) )
+  {
+    m_is_zip = true;
+    read_zip_directory();
+  }else if( is_tar_header( m_data, m_size ) )
+  {
+    read_tar_headers();
+  }else
+  {
+    throw runtime_error( "'" + filename + "' is not a tar or zip archive" );
+  }
+}//ArchiveReader constructor
+
+
+ArchiveReader::~ArchiveReader()
+{
+}
+
+
+const std::string &ArchiveReader::filename() const
+{
+  return m_filename;
+}
+
+
+const std::vector<ArchiveReader::Entry> &ArchiveReader::entries() const
+{
+  return m_entries;
+}
+
+
+void ArchiveReader::read_zip_directory()
+{
+  //The end of central directory record is at the very end, unless there is a
+  //  (up to 64 kB) archive comment.
+  if( m_size < 22 )
+    throw runtime_error( "'" + m_filename + "' is too small to be a zip file" );
+
+  size_t eocd = string::npos;
+  const size_t min_pos = (m_size > (22 + 65535)) ? (m_size - 22 - 65535) : 0;
+  for( size_t pos = m_size - 22; ; --pos )
+  {
+    if( read_uint32( m_data + pos ) == 0x06054b50 )
+    {
+      eocd = pos;
+      break;
+    }
+
+    if( pos == min_pos )
+      break;
+  }//for( search backwards for the end of central directory )
+
+  if( eocd == string::npos )
+    throw runtime_error( "'" + m_filename + "' is missing the zip central directory" );
+
+  uint64_t num_entries = read_uint16( m_data + eocd + 10 );
+  uint64_t dir_size = read_uint32( m_data + eocd + 12 );
+  uint64_t dir_offset = read_uint32( m_data + eocd + 16 );
+
+  //Zip64 end of central directory locator, just before the normal record.
+  if( (eocd >= 20) && (read_uint32( m_data + eocd - 20 ) == 0x07064b50) )
+  {
+    const uint64_t zip64_eocd = read_uint64( m_data + eocd - 20 + 8 );
+    if( (m_size >= 56) && (zip64_eocd <= (m_size - 56))
+        && (read_uint32( m_data + zip64_eocd ) == 0x06064b50) )
+    {
+      num_entries = read_uint64( m_data + zip64_eocd + 32 );
+      dir_size = read_uint64( m_data + zip64_eocd + 40 );
+      dir_offset = read_uint64( m_data + zip64_eocd + 48 );
+    }
+  }//if( there is a Zip64 locator )
+
+  //Written as a subtraction so corrupt offsets/sizes can't wrap around.
+  if( (dir_offset > m_size) || (dir_size > (m_size - dir_offset)) )
+    throw runtime_error( "'" + m_filename + "' has an invalid zip central directory" );
+
+  size_t pos = static_cast<size_t>( dir_offset );
+  const size_t dir_end = static_cast<size_t>( dir_offset + dir_size );
+
+  for( uint64_t i = 0; i < num_entries; ++i )
+  {
+    if( ((pos + 46) > dir_end) || (read_uint32( m_data + pos ) != 0x02014b50) )
+      throw runtime_error( "'" + m_filename + "' has a corrupt zip central directory" );
+
+    const uint16_t flags = read_uint16( m_data + pos + 8 );
+    Entry entry;
+    entry.method = read_uint16( m_data + pos + 10 );
+    entry.crc = read_uint32( m_data + pos + 16 );
+    entry.compressed_size = read_uint32( m_data + pos + 20 );
+    entry.size = read_uint32( m_data + pos + 24 );
+    const uint16_t name_len = read_uint16( m_data + pos + 28 );
+    const uint16_t extra_len = read_uint16( m_data + pos + 30 );
+    const uint16_t comment_len = read_uint16( m_data + pos + 32 );
+    entry.offset = read_uint32( m_data + pos + 42 );
+
+    const size_t name_start = pos + 46;
+    const size_t extra_start = name_start + name_len;
+    const size_t next = extra_start + extra_len + comment_len;
+    if( next > dir_end )
+      throw runtime_error( "'" + m_filename + "' has a corrupt zip central directory" );
+
+    //The Zip64 extra field holds, in order, whichever of the sizes and offset
+    //  didn't fit in 32 bits.
+    for( size_t extra = extra_start; (extra + 4) <= (extra_start + extra_len); )
+    {
+      const uint16_t id = read_uint16( m_data + extra );
+      const uint16_t len = read_uint16( m_data + extra + 2 );
+      size_t field = extra + 4;
+      const size_t field_end = std::min( field + len, extra_start + extra_len );
+
+      if( id == 0x0001 )
+      {
+        if( (entry.size == 0xFFFFFFFF) && ((field + 8) <= field_end) )
+        {
+          entry.size = read_uint64( m_data + field );
+          field += 8;
+        }
+        if( (entry.compressed_size == 0xFFFFFFFF) && ((field + 8) <= field_end) )
+        {
+          entry.compressed_size = read_uint64( m_data + field );
+          field += 8;
+        }
+        if( (entry.offset == 0xFFFFFFFF) && ((field + 8) <= field_end) )
+          entry.offset = read_uint64( m_data + field );
+      }//if( id == 0x0001 )
+
+      extra += 4 + len;
+    }//for( loop over extra fields )
+
+    entry.name = sanitize_entry_name( string( m_data + name_start, m_data + extra_start ) );
+
+    //Skip directories, and encrypted entries (flag bit 0)
+    if( !entry.name.empty() && (entry.name.back() != '/') && !(flags & 0x1) )
+      m_entries.push_back( entry );
+
+    pos = next;
+  }//for( uint64_t i = 0; i < num_entries; ++i )
+}//read_zip_directory()
+
+
+void ArchiveReader::read_tar_headers()
+{
+  string next_name;          //From a pax or GNU long name header
+  uint64_t next_size = 0;    //From a pax header
+  bool has_next_size = false;
+
+  size_t pos = 0;
+  while( (pos + 512) <= m_size )
+  {
+    const char * const header = m_data + pos;
+
+    //The archive ends with two zero blocks; we'll stop at the first.
+    if( std::all_of( header, header + 512, []( const char c ){ return c == '\0'; } ) )
+      break;
+
+    if( !is_tar_header( header, 512 ) )
+      throw runtime_error( "'" + m_filename + "' has a corrupt tar header" );
+
+    const char type = header[156];
+    uint64_t size = tar_number( header + 124, 12 );
+    if( has_next_size && (type != 'x') && (type != 'L') )
+      size = next_size;
+
+    const size_t data_start = pos + 512;
+    if( size > (m_size - data_start) )
+      throw runtime_error( "'" + m_filename + "' is truncated" );
+
+    if( type == 'x' )
+    {
+      parse_pax_header( m_data + data_start, static_cast<size_t>(size), next_name,
+                        next_size, has_next_size );
+    }else if( type == 'L' )
+    {
+      next_name = tar_field( m_data + data_start, static_cast<size_t>(size) );
+    }else if( (type == '0') || (type == '\0') || (type == '7') )
+    {
+      string name = next_name;
+      if( name.empty() )
+      {
+        name = tar_field( header, 100 );
+        const string prefix = tar_field( header + 345, 155 );
+        if( !prefix.empty() )
+          name = prefix + "/" + name;
+      }//if( name.empty() )
+
+      Entry entry;
+      entry.name = sanitize_entry_name( name );
+      entry.size = size;
+      entry.offset = data_start;
+      entry.compressed_size = size;
+      entry.method = 0;
+      entry.crc = 0;
+
+      if( !entry.name.empty() && (entry.name.back() != '/') )
+        m_entries.push_back( entry );
+    }//if( pax header ) / else if( GNU long name ) / else if( regular file )
+
+    //Pax and long name headers apply to just the next entry ('g' global pax
+    //  headers are ignored).
+    if( (type != 'x') && (type != 'L') )
+    {
+      next_name.clear();
+      has_next_size = false;
+      next_size = 0;
+    }
+
+    pos = data_start + static_cast<size_t>( ((size + 511) / 512) * 512 );
+  }//while( (pos + 512) <= m_size )
+}//read_tar_headers()
+
+
+bool ArchiveReader::read( const size_t index, std::string &contents ) const
+{
+  contents.clear();
+
+  if( index >= m_entries.size() )
+    return false;
+
+  const Entry &entry = m_entries[index];
+
+  if( !m_is_zip )
+  {
+    contents.assign( m_data + entry.offset, static_cast<size_t>(entry.size) );
+    return true;
+  }
+
+  //The local header may have a different length extra field than the
+  //  central directory entry, so we have to look at it to find the data.
+  const size_t header = static_cast<size_t>( entry.offset );
+  if( (entry.offset > m_size) || ((m_size - header) < 30) || (read_uint32( m_data + header ) != 0x04034b50) )
+    return false;
+
+  const size_t data_start = header + 30 + read_uint16( m_data + header + 26 )
+                            + read_uint16( m_data + header + 28 );
+  if( (data_start > m_size) || (entry.compressed_size > (m_size - data_start)) )
+    return false;
+
+  const char * const data = m_data + data_start;
+
+  if( entry.method == 0 )
+  {
+    if( entry.compressed_size != entry.size )
+      return false;
+    contents.assign( data, static_cast<size_t>(entry.size) );
+  }else if( entry.method == 8 )
+  {
+    z_stream strm;
+    memset( &strm, 0, sizeof(strm) );
+    if( inflateInit2( &strm, -15 ) != Z_OK )  //Raw deflate data
+      return false;
+
+    contents.resize( static_cast<size_t>(entry.size) );
+
+    const uInt max_chunk = 1024u*1024u*1024u;
+    size_t in_pos = 0, out_pos = 0;
+    int rc = Z_OK;
+    while( rc == Z_OK )
+    {
+      const size_t in_left = static_cast<size_t>(entry.compressed_size) - in_pos;
+      const size_t out_left = contents.size() - out_pos;
+      strm.next_in = reinterpret_cast<Bytef *>( const_cast<char *>( data + in_pos ) );
+      strm.avail_in = static_cast<uInt>( std::min( in_left, size_t(max_chunk) ) );
+      strm.next_out = reinterpret_cast<Bytef *>( contents.empty() ? nullptr : &contents[out_pos] );
+      strm.avail_out = static_cast<uInt>( std::min( out_left, size_t(max_chunk) ) );
+
+      const uInt avail_in = strm.avail_in, avail_out = strm.avail_out;
+      rc = inflate( &strm, Z_NO_FLUSH );
+      in_pos += (avail_in - strm.avail_in);
+      out_pos += (avail_out - strm.avail_out);
+
+      //No room left, or no data left, but the stream isn't finished.
+      if( (rc == Z_OK) && (avail_in == strm.avail_in) && (avail_out == strm.avail_out) )
+        rc = Z_DATA_ERROR;
+    }//while( rc == Z_OK )
+
+    inflateEnd( &strm );
+
+    if( (rc != Z_STREAM_END) || (out_pos != contents.size()) )
+    {
+      contents.clear();
+      return false;
+    }
+  }else
+  {
+    //Other methods (bzip2, lzma, etc.) are rarely used, and not supported.
+    return false;
+  }//if( stored ) / else if( deflated ) / else
+
+  //crc32() takes a uInt length, so entries of 4 GB or more are done in pieces.
+  uLong crc = crc32( 0L, Z_NULL, 0 );
+  for( size_t crc_pos = 0; crc_pos < contents.size(); )
+  {
+    const size_t len = std::min( contents.size() - crc_pos, size_t(UINT_MAX) );
+    crc = crc32( crc, reinterpret_cast<const Bytef *>( contents.data() + crc_pos ),
+                 static_cast<uInt>( len ) );
+    crc_pos += len;
+  }
+
+  if( static_cast<uint32_t>(crc) != entry.crc )
+  {
+    contents.clear();
+    return false;
+  }
+
+  return true;
+}//read(...)
@@ -0,0 +1,521 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+#include "SpecUtils/StringAlgo.h"
+#include "SpecUtils/Filesystem.h"
+
+#include "cambio/OutputFile.h"
+#include "cambio/ArchiveWriter.h"
+
+using namespace std;
+
+namespace
+{
+  const uint32_t ns_zip_max_32 = 0xFFFFFFFFu;
+  const uint16_t ns_zip_max_16 = 0xFFFFu;
+
+
+  uint32_t crc32( const char *data, const size_t size )
+  {
+    static uint32_t s_table[256];
+    static std::once_flag s_table_init;
+    std::call_once( s_table_init, [](){
+      for( uint32_t i = 0; i < 256; ++i )
+      {
+        uint32_t c = i;
+        for( int k = 0; k < 8; ++k )
+          c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+        s_table[i] = c;
+      }
+    } );
+
+    uint32_t crc = 0xFFFFFFFFu;
+    const unsigned char *p = reinterpret_cast<const unsigned char *>( data );
+    for( size_t i = 0; i < size; ++i )
+      crc = s_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+
+    return crc ^ 0xFFFFFFFFu;
+  }//crc32(...)
+
+
+  void put_u16( string &out, const uint16_t val )
+  {
+    out += static_cast<char>( val & 0xFF );
+    out += static_cast<char>( (val >> 8) & 0xFF );
+  }
+
+
+  void put_u32( string &out, const uint32_t val )
+  {
+    put_u16( out, static_cast<uint16_t>(val & 0xFFFF) );
+    put_u16( out, static_cast<uint16_t>(val >> 16) );
+  }
+
+
+  void put_u64( string &out, const uint64_t val )
+  {
+    put_u32( out, static_cast<uint32_t>(val & 0xFFFFFFFFu) );
+    put_u32( out, static_cast<uint32_t>(val >> 32) );
+  }
+
+
+  /** Writes `val` as a zero padded, null terminated, octal number filling
+   `len` bytes; if it doesn't fit, uses the GNU/star base-256 extension.
+   */
+  void put_tar_number( char *field, const size_t len, uint64_t val )
+  {
+    const uint64_t max_octal = (len - 1) >= 21 ? ~uint64_t(0) : ((uint64_t(1) << (3*(len - 1))) - 1);
+
+    if( val <= max_octal )
+    {
+      field[len-1] = '\0';
+      for( size_t i = len - 1; i > 0; --i )
+      {
+        field[i-1] = static_cast<char>( '0' + (val & 7) );
+        val >>= 3;
+      }
+    }else
+    {
+      memset( field, 0, len );
+      field[0] = static_cast<char>( 0x80 );
+      for( size_t i = len; i > 1; --i )
+      {
+        field[i-1] = static_cast<char>( val & 0xFF );
+        val >>= 8;
+      }
+    }
+  }//put_tar_number(...)
+
+
+  /** Returns a 512 byte ustar header. */
+  string tar_header( const string &name, const string &prefix, const uint64_t size,
+                     const int64_t mtime, const char typeflag )
+  {
+    char header[512];
+    memset( header, 0, sizeof(header) );
+
+    memcpy( header, name.data(), std::min( name.size(), size_t(100) ) );
+    memcpy( header + 100, "0000644", 8 );               //mode
+    memcpy( header + 108, "0000000", 8 );               //uid
+    memcpy( header + 116, "0000000", 8 );               //gid
+    put_tar_number( header + 124, 12, size );
+    put_tar_number( header + 136, 12, static_cast<uint64_t>(std::max( mtime, int64_t(0) )) );
+    memset( header + 148, ' ', 8 );                     //checksum, computed below
+    header[156] = typeflag;
+    memcpy( header + 257, "ustar", 6 );                 //magic, with null
+    memcpy( header + 263, "00", 2 );                    //version
+    memcpy( header + 345, prefix.data(), std::min( prefix.size(), size_t(155) ) );
+
+    unsigned int checksum = 0;
+    for( size_t i = 0; i < sizeof(header); ++i )
+      checksum += static_cast<unsigned char>( header[i] );
+    snprintf( header + 148, 8, "%06o", checksum );
+    header[155] = ' ';
+
+    return string( header, header + sizeof(header) );
+  }//tar_header(...)
+
+
+  string tar_padding( const uint64_t size )
+  {
+    const size_t remainder = static_cast<size_t>( size % 512 );
+    return string( remainder ? (512 - remainder) : 0, '\0' );
+  }
+
+
+  /** Splits `name` into the ustar name and prefix fields; returns false if it
+   can't be split to fit.
+   */
+  bool split_ustar_name( const string &name, string &prefix, string &leaf )
+  {
+    if( name.size() <= 100 )
+    {
+      prefix.clear();
+      leaf = name;
+      return true;
+    }
+
+    for( size_t pos = name.find('/'); pos != string::npos; pos = name.find('/', pos + 1) )
+    {
+      if( (pos <= 155) && ((name.size() - pos - 1) <= 100) && (pos + 1) < name.size() )
+      {
+        prefix = name.substr( 0, pos );
+        leaf = name.substr( pos + 1 );
+        return true;
+      }
+    }
+
+    return false;
+  }//split_ustar_name(...)
+
+
+  /** Returns a pax extended header record "<len> path=<name>\n", where <len>
+   is the length of the whole record, including itself.
+   */
+  string pax_path_record( const string &name )
+  {
+    const string body = " path=" + name + "\n";
+    size_t len = body.size() + 1;
+    while( (std::to_string(len).size() + body.size()) != len )
+      len = std::to_string(len).size() + body.size();
+    return std::to_string(len) + body;
+  }//pax_path_record(...)
+}//namespace
+
+
+ArchiveWriter::Format ArchiveWriter::format_from_filename( const std::string &filename )
+{
+  string ext = SpecUtils::file_extension( filename );
+  SpecUtils::to_lower_ascii( ext );
+
+  if( ext == ".tar" )
+    return Format::Tar;
+  if( ext == ".zip" )
+    return Format::Zip;
+
+  throw runtime_error( "Archive file name must end in '.tar' or '.zip'" );
+}//format_from_filename(...)
+
+
+ArchiveWriter::ArchiveWriter( const std::string &filename, const Format format,
+                              const std::string &root_dir, const bool sync_to_disk )
+  : m_filename( filename ),
+    m_format( format ),
+    m_root_dir( root_dir ),
+    m_file( new OutputFile( filename, sync_to_disk ) ),
+    m_output( m_file.get() ),
+    m_bytes_written( 0 ),
+    m_dos_time( 0 ),
+    m_dos_date( 0 ),
+    m_unix_time( static_cast<int64_t>( time(nullptr) ) ),
+    m_closed( false ),
+    m_close_success( false )
+{
+  if( !m_file->is_open() )
+    throw runtime_error( "Unable to open archive '" + filename + "' for writing" );
+  
+  init_dos_time();
+}//ArchiveWriter constructor
+
+
+ArchiveWriter::ArchiveWriter( std::ostream &output, const Format format )
+  : m_filename(),
+    m_format( format ),
+    m_root_dir(),
+    m_file(),
+    m_output( &output ),
+    m_bytes_written( 0 ),
+    m_dos_time( 0 ),
+    m_dos_date( 0 ),
+    m_unix_time( static_cast<int64_t>( time(nullptr) ) ),
+    m_closed( false ),
+    m_close_success( false )
+{
+  init_dos_time();
+}//ArchiveWriter( std::ostream &output, const Format format )
+
+
+void ArchiveWriter::init_dos_time()
+{
+  const time_t now = static_cast<time_t>( m_unix_time );
+  struct tm local;
+#if( defined(_WIN32) )
+  localtime_s( &local, &now );
+#else
+  localtime_r( &now, &local );
+#endif
+  m_dos_time = static_cast<uint32_t>( (local.tm_hour << 11) | (local.tm_min << 5) | (local.tm_sec / 2) );
+  m_dos_date = static_cast<uint32_t>( ((std::max(local.tm_year - 80, 0)) << 9)
+                                      | ((local.tm_mon + 1) << 5) | local.tm_mday );
+}//init_dos_time()
+
+
+ArchiveWriter::~ArchiveWriter()
+{
+  //m_file discards the temporary file if it wasn't committed.
+}
+
+
+const std::string &ArchiveWriter::filename() const
+{
+  return m_filename;
+}
+
+
+std::string ArchiveWriter::entry_name( const std::string &filename ) const
+{
+  string name;
+  if( !m_root_dir.empty() )
+    name = SpecUtils::fs_relative( m_root_dir, filename );
+
+  if( name.empty() || SpecUtils::starts_with( name, ".." ) || SpecUtils::is_absolute_path( name ) )
+    name = SpecUtils::filename( filename );
+
+  std::replace( begin(name), end(name), '\\', '/' );
+  while( SpecUtils::starts_with( name, "./" ) )
+    name = name.substr( 2 );
+
+  return name;
+}//entry_name(...)
+
+
+bool ArchiveWriter::contains( const std::string &filename ) const
+{
+  const string name = entry_name( filename );
+
+  std::lock_guard<std::mutex> lock( m_mutex );
+  return m_entry_names.count( name ) > 0;
+}//contains(...)
+
+
+bool ArchiveWriter::add_file( const std::string &filename, const std::string &contents )
+{
+  const string name = entry_name( filename );
+
+  std::lock_guard<std::mutex> lock( m_mutex );
+
+  if( m_closed || !m_output->good() )
+    return false;
+
+  m_entry_names.insert( name );
+
+  switch( m_format )
+  {
+    case Format::Tar:
+      write_tar_entry( name, contents );
+      break;
+
+    case Format::Zip:
+      write_zip_entry( name, contents );
+      break;
+  }//switch( m_format )
+
+  return m_output->good();
+}//add_file(...)
+
+
+void ArchiveWriter::write_tar_entry( const std::string &name, const std::string &contents )
+{
+  string header, prefix, leaf;
+
+  if( !split_ustar_name( name, prefix, leaf ) )
+  {
+    //Name too long for ustar; put the full name in a pax extended header.
+    const string record = pax_path_record( name );
+    header = tar_header( "PaxHeader", "", record.size(), m_unix_time, 'x' );
+    header += record;
+    header += tar_padding( record.size() );
+    prefix.clear();
+    leaf = name.substr( name.size() - std::min( name.size(), size_t(100) ) );
+  }//if( name doesnt fit in ustar header )
+
+  header += tar_header( leaf, prefix, contents.size(), m_unix_time, '0' );
+
+  m_output->write( header.data(), static_cast<std::streamsize>(header.size()) );
+  m_output->write( contents.data(), static_cast<std::streamsize>(contents.size()) );
+
+  const string padding = tar_padding( contents.size() );
+  m_output->write( padding.data(), static_cast<std::streamsize>(padding.size()) );
+
+  m_bytes_written += header.size() + contents.size() + padding.size();
+}//write_tar_entry(...)
+
+
+void ArchiveWriter::write_zip_entry( const std::string &name, const std::string &contents )
+{
+  ZipEntry entry;
+  entry.name = name;
+  entry.crc = crc32( contents.data(), contents.size() );
+  entry.size = contents.size();
+  entry.offset = m_bytes_written;
+
+  const bool zip64 = (entry.size >= ns_zip_max_32);
+
+  string header;
+  put_u32( header, 0x04034b50 );                       //local file header signature
+  put_u16( header, zip64 ? 45 : 20 );                  //version needed to extract
+  put_u16( header, 0x0800 );                           //flags: UTF-8 names
+  put_u16( header, 0 );                                //compression: stored
+  put_u16( header, static_cast<uint16_t>(m_dos_time) );
+  put_u16( header, static_cast<uint16_t>(m_dos_date) );
+  put_u32( header, entry.crc );
+  put_u32( header, zip64 ? ns_zip_max_32 : static_cast<uint32_t>(entry.size) ); //compressed size
+  put_u32( header, zip64 ? ns_zip_max_32 : static_cast<uint32_t>(entry.size) ); //uncompressed size
+  put_u16( header, static_cast<uint16_t>(name.size()) );
+  put_u16( header, zip64 ? 20 : 0 );                   //extra field length
+  header += name;
+
+  if( zip64 )
+  {
+    put_u16( header, 0x0001 );                         //Zip64 extended information
+    put_u16( header, 16 );
+    put_u64( header, entry.size );
+    put_u64( header, entry.size );
+  }
+
+  m_output->write( header.data(), static_cast<std::streamsize>(header.size()) );
+  m_output->write( contents.data(), static_cast<std::streamsize>(contents.size()) );
+  m_bytes_written += header.size() + contents.size();
+
+  m_zip_entries.push_back( std::move(entry) );
+}//write_zip_entry(...)
+
+
+void ArchiveWriter::write_zip_central_directory()
+{
+  const uint64_t cd_offset = m_bytes_written;
+
+  string cd;
+  for( const ZipEntry &entry : m_zip_entries )
+  {
+    const bool big_size = (entry.size >= ns_zip_max_32);
+    const bool big_offset = (entry.offset >= ns_zip_max_32);
+
+    string extra;
+    if( big_size || big_offset )
+    {
+      put_u16( extra, 0x0001 );
+      put_u16( extra, static_cast<uint16_t>( (big_size ? 16 : 0) + (big_offset ? 8 : 0) ) );
+      if( big_size )
+      {
+        put_u64( extra, entry.size );
+        put_u64( extra, entry.size );
+      }
+      if( big_offset )
+        put_u64( extra, entry.offset );
+    }//if( need zip64 extra field )
+
+    put_u32( cd, 0x02014b50 );                         //central file header signature
+    put_u16( cd, (3 << 8) | 45 );                      //version made by: unix, 4.5
+    put_u16( cd, extra.empty() ? 20 : 45 );            //version needed to extract
+    put_u16( cd, 0x0800 );                             //flags: UTF-8 names
+    put_u16( cd, 0 );                                  //compression: stored
+    put_u16( cd, static_cast<uint16_t>(m_dos_time) );
+    put_u16( cd, static_cast<uint16_t>(m_dos_date) );
+    put_u32( cd, entry.crc );
+    put_u32( cd, big_size ? ns_zip_max_32 : static_cast<uint32_t>(entry.size) );
+    put_u32( cd, big_size ? ns_zip_max_32 : static_cast<uint32_t>(entry.size) );
+    put_u16( cd, static_cast<uint16_t>(entry.name.size()) );
+    put_u16( cd, static_cast<uint16_t>(extra.size()) );
+    put_u16( cd, 0 );                                  //comment length
+    put_u16( cd, 0 );                                  //disk number start
+    put_u16( cd, 0 );                                  //internal attributes
+    put_u32( cd, 0100644u << 16 );                     //external attributes: regular file, rw-r--r--
+    put_u32( cd, big_offset ? ns_zip_max_32 : static_cast<uint32_t>(entry.offset) );
+    cd += entry.name;
+    cd += extra;
+
+    //Dont let the central directory get too large in memory
+    if( cd.size() > 1024*1024 )
+    {
+      m_output->write( cd.data(), static_cast<std::streamsize>(cd.size()) );
+      m_bytes_written += cd.size();
+      cd.clear();
+    }
+  }//for( const ZipEntry &entry : m_zip_entries )
+
+  m_output->write( cd.data(), static_cast<std::streamsize>(cd.size()) );
+  m_bytes_written += cd.size();
+
+  const uint64_t cd_size = m_bytes_written - cd_offset;
+  const uint64_t num_entries = m_zip_entries.size();
+  const bool zip64 = (num_entries >= ns_zip_max_16) || (cd_size >= ns_zip_max_32)
+                     || (cd_offset >= ns_zip_max_32);
+
+  string trailer;
+  if( zip64 )
+  {
+    const uint64_t eocd64_offset = m_bytes_written;
+
+    put_u32( trailer, 0x06064b50 );                    //zip64 end of central dir signature
+    put_u64( trailer, 44 );                            //size of remaining record
+    put_u16( trailer, (3 << 8) | 45 );
+    put_u16( trailer, 45 );
+    put_u32( trailer, 0 );                             //this disk
+    put_u32( trailer, 0 );                             //disk with central directory
+    put_u64( trailer, num_entries );
+    put_u64( trailer, num_entries );
+    put_u64( trailer, cd_size );
+    put_u64( trailer, cd_offset );
+
+    put_u32( trailer, 0x07064b50 );                    //zip64 end of central dir locator
+    put_u32( trailer, 0 );
+    put_u64( trailer, eocd64_offset );
+    put_u32( trailer, 1 );                             //total number of disks
+  }//if( zip64 )
+
+  put_u32( trailer, 0x06054b50 );                      //end of central dir signature
+  put_u16( trailer, 0 );
+  put_u16( trailer, 0 );
+  put_u16( trailer, zip64 ? ns_zip_max_16 : static_cast<uint16_t>(num_entries) );
+  put_u16( trailer, zip64 ? ns_zip_max_16 : static_cast<uint16_t>(num_entries) );
+  put_u32( trailer, zip64 ? ns_zip_max_32 : static_cast<uint32_t>(cd_size) );
+  put_u32( trailer, zip64 ? ns_zip_max_32 : static_cast<uint32_t>(cd_offset) );
+  put_u16( trailer, 0 );                               //comment length
+
+  m_output->write( trailer.data(), static_cast<std::streamsize>(trailer.size()) );
+  m_bytes_written += trailer.size();
+}//write_zip_central_directory()
+
+
+bool ArchiveWriter::close()
+{
+  std::lock_guard<std::mutex> lock( m_mutex );
+
+  if( m_closed )
+    return m_close_success;
+
+  m_closed = true;
+
+  switch( m_format )
+  {
+    case Format::Tar:
+    {
+      const string end_blocks( 1024, '\0' );
+      m_output->write( end_blocks.data(), static_cast<std::streamsize>(end_blocks.size()) );
+      m_bytes_written += end_blocks.size();
+      break;
+    }//case Format::Tar:
+
+    case Format::Zip:
+      write_zip_central_directory();
+      break;
+  }//switch( m_format )
+
+  if( m_file )
+  {
+    m_close_success = m_file->commit();
+  }else
+  {
+    m_output->flush();
+    m_close_success = m_output->good();
+  }
+
+  return m_close_success;
+}//close()
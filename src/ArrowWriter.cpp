@@ -0,0 +1,784 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cassert>
+#include <cstring>
+#include <ostream>
+#include <utility>
+#include <algorithm>
+
+#include "SpecUtils/SpecFile.h"
+#include "SpecUtils/DateTime.h"
+#include "SpecUtils/EnergyCalibration.h"
+
+#include "cambio/ArrowWriter.h"
+
+using namespace std;
+
+namespace
+{
+  //The Arrow file format is "ARROW1", padded to 8 bytes, then the stream
+  //  format (a schema message, then record batch messages, then an
+  //  end-of-stream marker), then a footer listing where the record batches
+  //  are, the footer length, and "ARROW1" again.
+  //  See https://arrow.apache.org/docs/format/Columnar.html
+  const char ns_arrow_magic[] = "ARROW1";
+
+  //Values from the Arrow flatbuffer schemas (Schema.fbs and Message.fbs)
+  const int16_t ns_metadata_version_v5 = 4;
+
+  const uint8_t ns_header_schema = 1;
+  const uint8_t ns_header_record_batch = 3;
+
+  const uint8_t ns_type_int = 2;
+  const uint8_t ns_type_floating_point = 3;
+  const uint8_t ns_type_utf8 = 5;
+  const uint8_t ns_type_bool = 6;
+  const uint8_t ns_type_timestamp = 10;
+  const uint8_t ns_type_list = 12;
+
+  const int16_t ns_precision_single = 1;
+  const int16_t ns_precision_double = 2;
+  const int16_t ns_time_unit_microsecond = 2;
+
+  //Record batches are written once they hold this many list values, even if
+  //  they have fewer than `rows_per_batch` rows, to bound memory use for
+  //  files with many channels (and keep list offsets well within int32).
+  const size_t ns_max_batch_values = 4*1024*1024;
+
+
+  enum class ColumnType
+  {
+    Utf8, Int32, Float32, Float64, Timestamp, Bool, FloatList
+  };
+
+
+  enum ColumnIndex
+  {
+    DetectorName, DetectorNumber, SampleNumber, Title, StartTime,
+    LiveTime, RealTime, SourceType, Occupied, Latitude, Longitude,
+    GammaCountSum, NeutronCountSum, EnergyCalType, EnergyCalCoefficients,
+    ChannelCounts, NumColumns
+  };
+
+
+  struct ColumnDefinition
+  {
+    const char *name;
+    ColumnType type;
+    bool nullable;
+  };
+
+  //Indexed by ColumnIndex
+  const ColumnDefinition ns_columns[NumColumns] = {
+    { "detector_name",                   ColumnType::Utf8,      false },
+    { "detector_number",                 ColumnType::Int32,     false },
+    { "sample_number",                   ColumnType::Int32,     false },
+    { "title",                           ColumnType::Utf8,      false },
+    { "start_time",                      ColumnType::Timestamp, true  },
+    { "live_time",                       ColumnType::Float32,   false },
+    { "real_time",                       ColumnType::Float32,   false },
+    { "source_type",                     ColumnType::Utf8,      false },
+    { "occupied",                        ColumnType::Bool,      true  },
+    { "latitude",                        ColumnType::Float64,   true  },
+    { "longitude",                       ColumnType::Float64,   true  },
+    { "gamma_count_sum",                 ColumnType::Float64,   false },
+    { "neutron_count_sum",               ColumnType::Float64,   true  },
+    { "energy_calibration_type",         ColumnType::Utf8,      true  },
+    { "energy_calibration_coefficients", ColumnType::FloatList, true  },
+    { "channel_counts",                  ColumnType::FloatList, true  }
+  };
+
+
+  const char *source_type_str( const SpecUtils::SourceType type )
+  {
+    switch( type )
+    {
+      case SpecUtils::SourceType::IntrinsicActivity: return "IntrinsicActivity";
+      case SpecUtils::SourceType::Calibration:       return "Calibration";
+      case SpecUtils::SourceType::Background:        return "Background";
+      case SpecUtils::SourceType::Foreground:        return "Foreground";
+      case SpecUtils::SourceType::Unknown:           return "Unknown";
+    }//switch( type )
+
+    return "Unknown";
+  }//source_type_str(...)
+
+
+  const char *energy_cal_type_str( const SpecUtils::EnergyCalType type )
+  {
+    switch( type )
+    {
+      case SpecUtils::EnergyCalType::Polynomial:        return "Polynomial";
+      case SpecUtils::EnergyCalType::FullRangeFraction: return "FullRangeFraction";
+      case SpecUtils::EnergyCalType::LowerChannelEdge:  return "LowerChannelEdge";
+      case SpecUtils::EnergyCalType::UnspecifiedUsingDefaultPolynomial:
+        return "UnspecifiedUsingDefaultPolynomial";
+      case SpecUtils::EnergyCalType::InvalidEquationType: return "Invalid";
+    }//switch( type )
+
+    return "Invalid";
+  }//energy_cal_type_str(...)
+
+
+  bool is_little_endian()
+  {
+    const uint16_t value = 1;
+    uint8_t first_byte;
+    memcpy( &first_byte, &value, 1 );
+    return (first_byte == 1);
+  }
+
+
+  /** Writes `value` as little-endian bytes. */
+  template<class T>
+  void write_little_endian( T value, char *output )
+  {
+    static_assert( std::is_integral<T>::value, "Only integers supported" );
+    typename std::make_unsigned<T>::type bits = static_cast<typename std::make_unsigned<T>::type>( value );
+    for( size_t i = 0; i < sizeof(T); ++i )
+    {
+      output[i] = static_cast<char>( bits & 0xFF );
+      bits = static_cast<typename std::make_unsigned<T>::type>( bits >> 4 >> 4 );
+    }
+  }//write_little_endian(...)
+
+
+  size_t padded_length( const size_t length )
+  {
+    return (length + 7) & ~size_t(7);
+  }
+
+
+  void append_bit( string &bitmap, const size_t index, const bool value )
+  {
+    if( (index % 8) == 0 )
+      bitmap.push_back( '\0' );
+    if( value )
+      bitmap.back() = static_cast<char>( bitmap.back() | (1 << (index % 8)) );
+  }//append_bit(...)
+
+
+  /** A minimal FlatBuffers builder, with only what is needed to write Arrow
+   metadata.
+
+   Like the FlatBuffers library, the buffer is built back to front: objects
+   must be created before the objects that refer to them, and are identified
+   by their offset from the end of the buffer.  Only one table may be under
+   construction at a time.
+   */
+  class FlatBufferBuilder
+  {
+  public:
+    FlatBufferBuilder()
+      : m_min_align( 1 ), m_table_start( 0 )
+    {
+    }
+
+    uint32_t create_string( const string &value )
+    {
+      align( value.size() + 1, 4 );
+      m_buffer.insert( 0, 1, '\0' );
+      m_buffer.insert( 0, value );
+      prepend_scalar( static_cast<uint32_t>(value.size()) );
+      return offset();
+    }//create_string(...)
+
+    /** Creates a vector of scalars or structs, already in little-endian format. */
+    uint32_t create_vector( const string &elements, const size_t num_elements,
+                            const size_t element_alignment )
+    {
+      align( elements.size(), std::max( element_alignment, size_t(4) ) );
+      m_buffer.insert( 0, elements );
+      prepend_scalar( static_cast<uint32_t>(num_elements) );
+      return offset();
+    }//create_vector(...)
+
+    /** Creates a vector of tables or strings. */
+    uint32_t create_offset_vector( const vector<uint32_t> &objects )
+    {
+      align( 4*objects.size(), 4 );
+      for( size_t i = objects.size(); i > 0; --i )
+        prepend_scalar( static_cast<uint32_t>(offset() + 4 - objects[i-1]) );
+      prepend_scalar( static_cast<uint32_t>(objects.size()) );
+      return offset();
+    }//create_offset_vector(...)
+
+    void start_table()
+    {
+      assert( m_fields.empty() );
+      m_fields.clear();
+      m_table_start = offset();
+    }
+
+    template<class T>
+    void add_scalar( const uint16_t field, const T value )
+    {
+      prepend_scalar( value );
+      m_fields.push_back( make_pair( field, offset() ) );
+    }
+
+    void add_bool( const uint16_t field, const bool value )
+    {
+      add_scalar( field, static_cast<uint8_t>(value ? 1 : 0) );
+    }
+
+    void add_offset( const uint16_t field, const uint32_t object )
+    {
+      align( 4, 4 );
+      prepend_scalar( static_cast<uint32_t>(offset() + 4 - object) );
+      m_fields.push_back( make_pair( field, offset() ) );
+    }
+
+    uint32_t end_table()
+    {
+      prepend_scalar( int32_t(0) );  //Placeholder for the offset to the vtable
+      const uint32_t table = offset();
+
+      uint16_t num_fields = 0;
+      for( const pair<uint16_t,uint32_t> &field : m_fields )
+        num_fields = std::max( num_fields, static_cast<uint16_t>(field.first + 1) );
+
+      vector<uint16_t> vtable( 2 + num_fields, 0 );
+      vtable[0] = static_cast<uint16_t>( 2*vtable.size() );
+      vtable[1] = static_cast<uint16_t>( table - m_table_start );
+      for( const pair<uint16_t,uint32_t> &field : m_fields )
+        vtable[2 + field.first] = static_cast<uint16_t>( table - field.second );
+
+      string vtable_bytes( 2*vtable.size(), '\0' );
+      for( size_t i = 0; i < vtable.size(); ++i )
+        write_little_endian( vtable[i], &vtable_bytes[2*i] );
+      m_buffer.insert( 0, vtable_bytes );
+
+      //The vtable is immediately before the table, so the (signed) offset to
+      //  it is positive.
+      write_little_endian( static_cast<int32_t>(offset() - table),
+                           &m_buffer[m_buffer.size() - table] );
+
+      m_fields.clear();
+      return table;
+    }//end_table()
+
+    /** Writes the offset to the root table, and returns the finished buffer. */
+    string finish( const uint32_t root )
+    {
+      align( 4, m_min_align );
+      prepend_scalar( static_cast<uint32_t>(offset() + 4 - root) );
+      return m_buffer;
+    }
+
+  private:
+    uint32_t offset() const
+    {
+      return static_cast<uint32_t>( m_buffer.size() );
+    }
+
+    /** Adds padding so that after prepending `length` bytes, the buffer end
+     will be aligned to `alignment`.
+     */
+    void align( const size_t length, const size_t alignment )
+    {
+      m_min_align = std::max( m_min_align, alignment );
+      const size_t remainder = (m_buffer.size() + length) % alignment;
+      if( remainder )
+        m_buffer.insert( 0, alignment - remainder, '\0' );
+    }
+
+    template<class T>
+    void prepend_scalar( const T value )
+    {
+      char bytes[sizeof(T)];
+      write_little_endian( value, bytes );
+      align( sizeof(T), sizeof(T) );
+      m_buffer.insert( 0, bytes, sizeof(T) );
+    }
+
+    string m_buffer;
+    size_t m_min_align;
+    uint32_t m_table_start;
+    vector<pair<uint16_t,uint32_t>> m_fields;
+  };//class FlatBufferBuilder
+
+
+  uint32_t create_field( FlatBufferBuilder &fbb, const char *name,
+                         const ColumnType type, const bool nullable )
+  {
+    uint32_t children = 0;
+    if( type == ColumnType::FloatList )
+    {
+      const uint32_t item = create_field( fbb, "item", ColumnType::Float32, false );
+      children = fbb.create_offset_vector( vector<uint32_t>(1, item) );
+    }else
+    {
+      children = fbb.create_offset_vector( vector<uint32_t>() );
+    }
+
+    uint8_t type_type = 0;
+    fbb.start_table();
+    switch( type )
+    {
+      case ColumnType::Utf8:
+        type_type = ns_type_utf8;
+        break;
+
+      case ColumnType::Int32:
+        type_type = ns_type_int;
+        fbb.add_scalar( 0, int32_t(32) );  //bitWidth
+        fbb.add_bool( 1, true );           //is_signed
+        break;
+
+      case ColumnType::Float32:
+        type_type = ns_type_floating_point;
+        fbb.add_scalar( 0, ns_precision_single );
+        break;
+
+      case ColumnType::Float64:
+        type_type = ns_type_floating_point;
+        fbb.add_scalar( 0, ns_precision_double );
+        break;
+
+      case ColumnType::Timestamp:
+        //SpecUtils times do not have a time zone, so none is given
+        type_type = ns_type_timestamp;
+        fbb.add_scalar( 0, ns_time_unit_microsecond );
+        break;
+
+      case ColumnType::Bool:
+        type_type = ns_type_bool;
+        break;
+
+      case ColumnType::FloatList:
+        type_type = ns_type_list;
+        break;
+    }//switch( type )
+    const uint32_t type_table = fbb.end_table();
+
+    const uint32_t field_name = fbb.create_string( name );
+
+    fbb.start_table();
+    fbb.add_offset( 0, field_name );
+    fbb.add_bool( 1, nullable );
+    fbb.add_scalar( 2, type_type );
+    fbb.add_offset( 3, type_table );
+    fbb.add_offset( 5, children );
+    return fbb.end_table();
+  }//create_field(...)
+
+
+  uint32_t create_schema( FlatBufferBuilder &fbb )
+  {
+    vector<uint32_t> fields;
+    for( const ColumnDefinition &column : ns_columns )
+      fields.push_back( create_field( fbb, column.name, column.type, column.nullable ) );
+    const uint32_t field_vector = fbb.create_offset_vector( fields );
+
+    fbb.start_table();
+    fbb.add_scalar( 0, static_cast<int16_t>(is_little_endian() ? 0 : 1) );  //endianness
+    fbb.add_offset( 1, field_vector );
+    return fbb.end_table();
+  }//create_schema(...)
+
+
+  string create_message( FlatBufferBuilder &fbb, const uint8_t header_type,
+                         const uint32_t header, const uint64_t body_length )
+  {
+    fbb.start_table();
+    fbb.add_scalar( 3, static_cast<int64_t>(body_length) );
+    fbb.add_offset( 2, header );
+    fbb.add_scalar( 0, ns_metadata_version_v5 );
+    fbb.add_scalar( 1, header_type );
+    return fbb.finish( fbb.end_table() );
+  }//create_message(...)
+}//namespace
+
+
+struct ArrowWriter::Column
+{
+  explicit Column( const ColumnDefinition &definition )
+    : type( definition.type ), length( 0 ), null_count( 0 )
+  {
+    clear();
+  }
+
+  void clear()
+  {
+    length = null_count = 0;
+    validity.clear();
+    values.clear();
+    offsets.clear();
+    if( (type == ColumnType::Utf8) || (type == ColumnType::FloatList) )
+      offsets.push_back( 0 );
+  }
+
+  /** Marks the next row as valid, or null; all `append_*` functions call this. */
+  void append_validity( const bool valid )
+  {
+    append_bit( validity, length, valid );
+    null_count += !valid;
+    ++length;
+  }
+
+  void append_null()
+  {
+    switch( type )
+    {
+      case ColumnType::Utf8:
+      case ColumnType::FloatList:
+        offsets.push_back( offsets.back() );
+        break;
+      case ColumnType::Bool:
+        append_bit( values, length, false );
+        break;
+      case ColumnType::Int32:
+      case ColumnType::Float32:
+        values.append( 4, '\0' );
+        break;
+      case ColumnType::Float64:
+      case ColumnType::Timestamp:
+        values.append( 8, '\0' );
+        break;
+    }//switch( type )
+
+    append_validity( false );
+  }//append_null()
+
+  template<class T>
+  void append_value( const T value )
+  {
+    values.append( reinterpret_cast<const char *>(&value), sizeof(T) );
+    append_validity( true );
+  }
+
+  void append_bool( const bool value )
+  {
+    append_bit( values, length, value );
+    append_validity( true );
+  }
+
+  void append_string( const string &value )
+  {
+    values += value;
+    offsets.push_back( static_cast<int32_t>(values.size()) );
+    append_validity( true );
+  }
+
+  void append_floats( const float *data, const size_t num_values )
+  {
+    if( num_values )
+      values.append( reinterpret_cast<const char *>(data), 4*num_values );
+    offsets.push_back( static_cast<int32_t>(values.size() / 4) );
+    append_validity( true );
+  }
+
+  const ColumnType type;
+  size_t length, null_count;
+
+  /** Bitmap with a bit set for each non-null row. */
+  string validity;
+
+  /** The fixed width values, bitmap of bools, UTF-8 bytes, or list floats. */
+  string values;
+
+  /** For strings and lists, where each row starts in `values` (in bytes for
+   strings, and elements for lists), with a final entry for the end.
+   */
+  vector<int32_t> offsets;
+};//struct ArrowWriter::Column
+
+
+ArrowWriter::ArrowWriter( std::ostream &output, const size_t rows_per_batch )
+  : m_output( output ),
+    m_rows_per_batch( std::max( rows_per_batch, size_t(1) ) ),
+    m_position( 0 ),
+    m_batch_rows( 0 ),
+    m_batch_values( 0 ),
+    m_finished( false )
+{
+  for( const ColumnDefinition &column : ns_columns )
+    m_columns.emplace_back( new Column( column ) );
+
+  write_padded( ns_arrow_magic, 6 );
+
+  FlatBufferBuilder fbb;
+  const uint32_t schema = create_schema( fbb );
+  write_message_metadata( create_message( fbb, ns_header_schema, schema, 0 ) );
+}//ArrowWriter constructor
+
+
+ArrowWriter::~ArrowWriter()
+{
+  try
+  {
+    if( !m_finished )
+      finish();
+  }catch( std::exception & )
+  {
+  }
+}//~ArrowWriter()
+
+
+void ArrowWriter::add( const SpecUtils::Measurement &meas )
+{
+  assert( !m_finished );
+
+  m_columns[DetectorName]->append_string( meas.detector_name() );
+  m_columns[DetectorNumber]->append_value( static_cast<int32_t>(meas.detector_number()) );
+  m_columns[SampleNumber]->append_value( static_cast<int32_t>(meas.sample_number()) );
+  m_columns[Title]->append_string( meas.title() );
+
+  const SpecUtils::time_point_t &start_time = meas.start_time();
+  if( SpecUtils::is_special( start_time ) )
+  {
+    m_columns[StartTime]->append_null();
+  }else
+  {
+    const auto since_epoch = chrono::duration_cast<chrono::microseconds>( start_time.time_since_epoch() );
+    m_columns[StartTime]->append_value( static_cast<int64_t>(since_epoch.count()) );
+  }
+
+  m_columns[LiveTime]->append_value( meas.live_time() );
+  m_columns[RealTime]->append_value( meas.real_time() );
+  m_columns[SourceType]->append_string( source_type_str( meas.source_type() ) );
+
+  switch( meas.occupied() )
+  {
+    case SpecUtils::OccupancyStatus::NotOccupied:
+      m_columns[Occupied]->append_bool( false );
+      break;
+    case SpecUtils::OccupancyStatus::Occupied:
+      m_columns[Occupied]->append_bool( true );
+      break;
+    case SpecUtils::OccupancyStatus::Unknown:
+      m_columns[Occupied]->append_null();
+      break;
+  }//switch( meas.occupied() )
+
+  if( meas.has_gps_info() )
+  {
+    m_columns[Latitude]->append_value( meas.latitude() );
+    m_columns[Longitude]->append_value( meas.longitude() );
+  }else
+  {
+    m_columns[Latitude]->append_null();
+    m_columns[Longitude]->append_null();
+  }
+
+  m_columns[GammaCountSum]->append_value( meas.gamma_count_sum() );
+
+  if( meas.contained_neutron() )
+    m_columns[NeutronCountSum]->append_value( meas.neutron_counts_sum() );
+  else
+    m_columns[NeutronCountSum]->append_null();
+
+  const shared_ptr<const SpecUtils::EnergyCalibration> &cal = meas.energy_calibration();
+  if( cal && cal->valid() )
+  {
+    const vector<float> &coefficients = cal->coefficients();
+    m_columns[EnergyCalType]->append_string( energy_cal_type_str( cal->type() ) );
+    m_columns[EnergyCalCoefficients]->append_floats( coefficients.data(), coefficients.size() );
+    m_batch_values += coefficients.size();
+  }else
+  {
+    m_columns[EnergyCalType]->append_null();
+    m_columns[EnergyCalCoefficients]->append_null();
+  }
+
+  const shared_ptr<const vector<float>> &counts = meas.gamma_counts();
+  if( counts )
+  {
+    m_columns[ChannelCounts]->append_floats( counts->data(), counts->size() );
+    m_batch_values += counts->size();
+  }else
+  {
+    m_columns[ChannelCounts]->append_null();
+  }
+
+  ++m_batch_rows;
+  if( (m_batch_rows >= m_rows_per_batch) || (m_batch_values >= ns_max_batch_values) )
+    write_batch();
+}//void add( const SpecUtils::Measurement &meas )
+
+
+bool ArrowWriter::finish()
+{
+  if( m_finished )
+    return m_output.good();
+  m_finished = true;
+
+  if( m_batch_rows )
+    write_batch();
+
+  //End-of-stream marker
+  char eos[8];
+  write_little_endian( uint32_t(0xFFFFFFFF), eos );
+  write_little_endian( uint32_t(0), eos + 4 );
+  write_padded( eos, 8 );
+
+  FlatBufferBuilder fbb;
+  string blocks;
+  for( const Block &block : m_blocks )
+  {
+    char bytes[24] = { 0 };
+    write_little_endian( static_cast<int64_t>(block.offset), bytes );
+    write_little_endian( static_cast<int32_t>(block.metadata_length), bytes + 8 );
+    write_little_endian( static_cast<int64_t>(block.body_length), bytes + 16 );
+    blocks.append( bytes, 24 );
+  }
+  const uint32_t record_batches = fbb.create_vector( blocks, m_blocks.size(), 8 );
+  const uint32_t dictionaries = fbb.create_vector( string(), 0, 8 );
+  const uint32_t schema = create_schema( fbb );
+
+  fbb.start_table();
+  fbb.add_offset( 1, schema );
+  fbb.add_offset( 2, dictionaries );
+  fbb.add_offset( 3, record_batches );
+  fbb.add_scalar( 0, ns_metadata_version_v5 );
+  const string footer = fbb.finish( fbb.end_table() );
+
+  char length[4];
+  write_little_endian( static_cast<int32_t>(footer.size()), length );
+
+  m_output.write( footer.data(), footer.size() );
+  m_output.write( length, 4 );
+  m_output.write( ns_arrow_magic, 6 );
+  m_position += footer.size() + 4 + 6;
+
+  m_output.flush();
+  return m_output.good();
+}//bool finish()
+
+
+void ArrowWriter::write_batch()
+{
+  //The body is each columns buffers, in schema order, each padded to a
+  //  multiple of 8 bytes; a column without nulls gets an empty validity buffer.
+  vector<pair<const char *,size_t>> body;
+  string nodes;
+
+  auto add_node = [&nodes]( const size_t length, const size_t null_count ){
+    char bytes[16];
+    write_little_endian( static_cast<int64_t>(length), bytes );
+    write_little_endian( static_cast<int64_t>(null_count), bytes + 8 );
+    nodes.append( bytes, 16 );
+  };
+
+  for( const unique_ptr<Column> &column_ptr : m_columns )
+  {
+    const Column &column = *column_ptr;
+    assert( column.length == m_batch_rows );
+
+    add_node( column.length, column.null_count );
+    body.push_back( make_pair( column.validity.data(),
+                               column.null_count ? column.validity.size() : size_t(0) ) );
+
+    switch( column.type )
+    {
+      case ColumnType::Utf8:
+        body.push_back( make_pair( reinterpret_cast<const char *>(column.offsets.data()),
+                                   4*column.offsets.size() ) );
+        body.push_back( make_pair( column.values.data(), column.values.size() ) );
+        break;
+
+      case ColumnType::FloatList:
+        body.push_back( make_pair( reinterpret_cast<const char *>(column.offsets.data()),
+                                   4*column.offsets.size() ) );
+        add_node( column.values.size() / 4, 0 );
+        body.push_back( make_pair( column.values.data(), size_t(0) ) );
+        body.push_back( make_pair( column.values.data(), column.values.size() ) );
+        break;
+
+      case ColumnType::Int32:
+      case ColumnType::Float32:
+      case ColumnType::Float64:
+      case ColumnType::Timestamp:
+      case ColumnType::Bool:
+        body.push_back( make_pair( column.values.data(), column.values.size() ) );
+        break;
+    }//switch( column.type )
+  }//for( loop over columns )
+
+  string buffers;
+  uint64_t body_length = 0;
+  for( const pair<const char *,size_t> &buffer : body )
+  {
+    char bytes[16];
+    write_little_endian( static_cast<int64_t>(body_length), bytes );
+    write_little_endian( static_cast<int64_t>(buffer.second), bytes + 8 );
+    buffers.append( bytes, 16 );
+    body_length += padded_length( buffer.second );
+  }
+
+  FlatBufferBuilder fbb;
+  const uint32_t buffer_vector = fbb.create_vector( buffers, body.size(), 8 );
+  const uint32_t node_vector = fbb.create_vector( nodes, nodes.size() / 16, 8 );
+
+  fbb.start_table();
+  fbb.add_scalar( 0, static_cast<int64_t>(m_batch_rows) );
+  fbb.add_offset( 1, node_vector );
+  fbb.add_offset( 2, buffer_vector );
+  const uint32_t record_batch = fbb.end_table();
+
+  Block block;
+  block.offset = m_position;
+  block.metadata_length = write_message_metadata(
+                  create_message( fbb, ns_header_record_batch, record_batch, body_length ) );
+  block.body_length = body_length;
+  m_blocks.push_back( block );
+
+  for( const pair<const char *,size_t> &buffer : body )
+    write_padded( buffer.first, buffer.second );
+
+  for( const unique_ptr<Column> &column : m_columns )
+    column->clear();
+  m_batch_rows = m_batch_values = 0;
+}//void write_batch()
+
+
+uint32_t ArrowWriter::write_message_metadata( const std::string &metadata )
+{
+  //A continuation marker and the metadata length, then the metadata padded so
+  //  the message body starts on an 8 byte boundary.
+  const size_t length = padded_length( metadata.size() );
+
+  char prefix[8];
+  write_little_endian( uint32_t(0xFFFFFFFF), prefix );
+  write_little_endian( static_cast<int32_t>(length), prefix + 4 );
+
+  m_output.write( prefix, 8 );
+  m_position += 8;
+  write_padded( metadata.data(), metadata.size() );
+
+  return static_cast<uint32_t>( 8 + length );
+}//write_message_metadata(...)
+
+
+void ArrowWriter::write_padded( const char *data, const size_t length )
+{
+  static const char zeros[8] = { 0 };
+
+  if( length )
+    m_output.write( data, length );
+  const size_t padding = padded_length( length ) - length;
+  if( padding )
+    m_output.write( zeros, padding );
+  m_position += length + padding;
+}//write_padded(...)
@@ -47,6 +47,8 @@
 
 #include "SpecUtils/SpecFile.h"
 #include "SpecUtils/Filesystem.h"
+#include "cambio/FileLoader.h"
+#include "cambio/OutputFile.h"
 #include "cambio/BatchConvertDialog.h"
 #include "SpecUtils/D3SpectrumExport.h"
 
@@ -459,7 +461,9 @@ void BatchConvertDialog::convert()
   for( i = 0; i < selectedfiles.size(); ++i )
   {
     const QString &path = selectedfiles[i];
-    QFileInfo input( path );
+    //For compressed inputs (e.g., "file.n42.gz"), name the output from "file.n42"
+    const std::string uncompressed_path = FileLoader::uncompressed_name( path.toUtf8().data() );
+    QFileInfo input( QString::fromUtf8( uncompressed_path.c_str() ) );
     QFileInfo outputInfo(savetodir, input.fileName());
     QString out = outputInfo.absoluteFilePath();
     
@@ -475,7 +479,7 @@ void BatchConvertDialog::convert()
     outputInfo = QFileInfo( out );
 
     SpecUtils::SpecFile meas;
-    const bool opened = meas.load_file( path.toUtf8().data(), SpecUtils::ParserType::Auto );
+    const bool opened = FileLoader::load_file( meas, path.toUtf8().data() );
     
     if( !opened )
     {
@@ -517,14 +521,9 @@ void BatchConvertDialog::convert()
     
     const std::string outname = out.toUtf8().data();
     
-    auto open_output_file = [&failed, &out]( const std::string &name ) -> std::unique_ptr<std::ofstream>{
-      std::unique_ptr<std::ofstream> output;
+    auto open_output_file = [&failed, &out]( const std::string &name ) -> std::unique_ptr<OutputFile>{
+      std::unique_ptr<OutputFile> output( new OutputFile( name ) );
 
-#ifdef _WIN32
-      output.reset( new std::ofstream( convert_from_utf8_to_utf16(name).c_str(), std::ios::binary | std::ios::out ) );
-#else
-      output.reset( new std::ofstream( name.c_str(), std::ios::binary | std::ios::out ) );
-#endif
       if( !output->is_open() )
       {
         failed.push_back( "Couldnt open '" + out + "' for writing" );
@@ -542,7 +541,7 @@ void BatchConvertDialog::convert()
       {
         auto output = open_output_file( outname );
         if( output )
-          ok = meas.write_txt( *output );
+          ok = meas.write_txt( *output ) && output->commit();
 
         if( !ok )
           failed.push_back( "Possibly failed writing '" + out + "'" );
@@ -556,7 +555,7 @@ void BatchConvertDialog::convert()
       {
         auto output = open_output_file( outname );
         if( output )
-          ok = meas.write_csv( *output );
+          ok = meas.write_csv( *output ) && output->commit();
 
         if( !ok )
           failed.push_back( "Possibly failed writing '" + out + "'" );
@@ -570,7 +569,7 @@ void BatchConvertDialog::convert()
       {
         auto output = open_output_file( outname );
         if( output )
-          ok = meas.write_pcf( *output );
+          ok = meas.write_pcf( *output ) && output->commit();
 
         if( !ok )
           failed.push_back( "Possibly failed writing '" + out + "'" );
@@ -584,7 +583,7 @@ void BatchConvertDialog::convert()
       {
         auto output = open_output_file( outname );
         if( output )
-          ok = meas.write_2006_N42( *output );
+          ok = meas.write_2006_N42( *output ) && output->commit();
 
         if( !ok )
           failed.push_back( "Possibly failed writing '" + out + "'" );
@@ -598,7 +597,7 @@ void BatchConvertDialog::convert()
       {
         auto output = open_output_file( outname );
         if( output )
-          ok = meas.write_2012_N42( *output );
+          ok = meas.write_2012_N42( *output ) && output->commit();
 
         if( !ok )
           failed.push_back( "Possibly failed writing '" + out + "'" );
@@ -612,7 +611,7 @@ void BatchConvertDialog::convert()
       {
         auto output = open_output_file( outname );
         if( output )
-          ok = meas.write_binary_exploranium_gr130v0( *output );
+          ok = meas.write_binary_exploranium_gr130v0( *output ) && output->commit();
 
         if( !ok )
           failed.push_back( "Possibly failed writing '" + out + "'" );
@@ -626,7 +625,7 @@ void BatchConvertDialog::convert()
       {
         auto output = open_output_file( outname );
         if( output )
-          ok = meas.write_binary_exploranium_gr135v2( *output );
+          ok = meas.write_binary_exploranium_gr135v2( *output ) && output->commit();
 
         if( !ok )
           failed.push_back( "Possibly failed writing '" + out + "'" );
@@ -716,6 +715,7 @@ void BatchConvertDialog::convert()
               else
                 assert( 0 );
             
+              wrote = (wrote && output->commit());
               
               if( !wrote )
                 failed.push_back( "Possibly failed writing '" + outname + "'" );
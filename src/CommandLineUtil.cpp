@@ -17,12 +17,18 @@
  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <map>
 #include <set>
 #include <deque>
+#include <mutex>
+#include <chrono>
+#include <memory>
 #include <cctype>
+#include <cstdio>
 #include <string>
 #include <deque>
 #include <fstream>
+#include <unordered_map>
 #include <iostream>
 
 #include <boost/program_options.hpp>
@@ -36,6 +42,18 @@
 #endif
 #include "SpecUtils/EnergyCalibration.h"
 
+#include "cambio/FileLoader.h"
+#include "cambio/JsonWriter.h"
+#include "cambio/ArrowWriter.h"
+#include "cambio/NumpyOutput.h"
+#include "cambio/TimeSeries.h"
+#include "cambio/OutputFile.h"
+#include "cambio/ArchiveReader.h"
+#include "cambio/ArchiveWriter.h"
+#include "cambio/CompressedOutput.h"
+#include "cambio/ParallelOutput.h"
+#include "cambio/SpectrumSum.h"
+#include "cambio/CompactSpectra.h"
 #include "cambio/CommandLineUtil.h"
 
 
@@ -58,12 +76,6 @@ using SpecUtils::convert_from_utf8_to_utf16;
 #if( SpecUtils_ENABLE_D3_CHART )
 #include "SpecUtils/D3SpectrumExport.h"
 
-/** If you want to also save meta-info to JSON output (serial number, like GPS,
-    analysis results, etc), then set WRITE_JSON_META_INFO to 1.
-    Not tested, and only file-level (not record-leve) info currently written out.
- */
-#define WRITE_JSON_META_INFO 0
-
 namespace {
 #if( !SpecUtils_D3_SUPPORT_FILE_STATIC )
   string file_to_string( const char *filename )
@@ -83,7 +95,44 @@ namespace {
 #endif
   
 
-  bool html_page_header( std::ostream &ostr, const std::string &title )
+  /** The JavaScript and CSS files that pages reference, when writing with
+   "--html-assets shared"; the contents of each are from html_shared_asset(...).
+   */
+  const char * const ns_html_shared_asset_names[] = {
+    "cambio_d3.js", "cambio_SpectrumChartD3.js", "cambio_SpectrumChartSetup.js",
+    "cambio_SpectrumChartD3.css"
+  };
+  
+  
+  /** Returns the contents of ns_html_shared_asset_names[index].
+   
+   Only available when the D3 assets are compiled in; "--html-assets shared"
+   is rejected otherwise.
+   */
+  string html_shared_asset( const size_t index )
+  {
+#if( SpecUtils_D3_SUPPORT_FILE_STATIC )
+    switch( index )
+    {
+      case 0: return D3SpectrumExport::d3_js();
+      case 1: return D3SpectrumExport::spectrum_chart_d3_js();
+      case 2: return D3SpectrumExport::spectrum_chart_setup_js();
+      case 3: return D3SpectrumExport::spectrum_char_d3_css();
+    }//switch( index )
+#endif
+    
+    throw std::logic_error( "html_shared_asset: invalid index" );
+  }//html_shared_asset(...)
+  
+  
+  /** Writes the start of a HTML page, through the end of the <head> element.
+   
+   If `shared_assets` is true, the page references the ns_html_shared_asset_names
+   files (which must be written to the same directory), rather than including
+   their contents.
+   */
+  bool html_page_header( std::ostream &ostr, const std::string &title,
+                         const bool shared_assets = false )
   {
     const char *endline = "\r\n";
     
@@ -91,6 +140,21 @@ namespace {
     ostr << "<head>" << endline;
     ostr << "<title>" << title << "</title>" << endline;
     
+    if( shared_assets )
+    {
+      for( const char *name : ns_html_shared_asset_names )
+      {
+        if( SpecUtils::iends_with( name, ".css" ) )
+          ostr << "<link rel=\"stylesheet\" href=\"" << name << "\">" << endline;
+        else
+          ostr << "<script src=\"" << name << "\"></script>" << endline;
+      }
+      
+      ostr << "</head>" << endline;
+      
+      return ostr.good();
+    }//if( shared_assets )
+    
 #if( SpecUtils_D3_SUPPORT_FILE_STATIC )
     ostr << "<script>" << D3SpectrumExport::d3_js() << "</script>" << endline;
     ostr << "<script>" << D3SpectrumExport::spectrum_chart_d3_js() << "</script>" << endline;
@@ -108,119 +172,233 @@ namespace {
     return ostr.good();
   }//html_page_header
   
-#if( WRITE_JSON_META_INFO )
-  /** Output meta-information at the file level */
-  void add_file_meta_info_to_json( std::ostream &output, const SpecUtils::SpecFile &info )
+  
+  /** Escapes `input` for use inside a double-quoted JSON or JavaScript string. */
+  string json_escape( const string &input )
   {
-    auto jsonEscape = []( string input ) -> string {
-      SpecUtils::ireplace_all( input, "\"", "\\\"" );  //ToDo: Properly escape JSON strings!
-      return input;
-    };
-    
-    output << "{ IsMetaInformation: true";
-    if( !info.manufacturer().empty() )
-      output << ", Manufacturer: \"" << jsonEscape( info.manufacturer() ) << "\"";
-    if( !info.instrument_model().empty() )
-      output << ", Model: \"" << jsonEscape( info.instrument_model() ) << "\"";
-    output << ", DetectorType: \"" << jsonEscape( detectorTypeToString( info.detector_type() ) ) << "\"";
-    if( !info.instrument_type().empty() )
-      output << ", InstrumentType: \"" << jsonEscape( info.instrument_type() ) << "\"";
-    if( !info.instrument_id().empty() )
-      output << ", SerialNumber: \"" << jsonEscape( info.instrument_id() ) << "\"";
-    output << ", FileUuid: \"" << jsonEscape( info.uuid() ) << "\"";
-    
-    const vector<string> &fileRemarks = info.remarks();
-    if( fileRemarks.size() )
-    {
-      output << ", Remarks: [";
-      for( size_t remarknum = 0; remarknum < fileRemarks.size(); ++remarknum )
-        output << (remarknum ? "," : "") << "\"" << jsonEscape( fileRemarks[remarknum] ) << "\"";
-      output << "]";
-    }
-    
-    if( !info.measurement_operator().empty() )
-      output << ", Operator: \"" << jsonEscape( info.measurement_operator() ) << "\"";
+    string output;
+    JsonWriter::escape( input.data(), input.size(), output );
+    return output;
+  }//json_escape(...)
+  
+  
+  /** The number of records in each data file of the "lazy" HTML output. */
+  const size_t ns_lazy_html_chunk_size = 64;
+  
+  
+  /** Returns the file name, within the data directory, of a "lazy" HTML chunk. */
+  string lazy_html_chunk_name( const size_t chunk_index )
+  {
+    char buffer[32];
+    snprintf( buffer, sizeof(buffer), "chunk_%05u.js", static_cast<unsigned int>(chunk_index) );
+    return buffer;
+  }//lazy_html_chunk_name(...)
+  
+  
+  /** Returns the name of the directory, next to the page, that the records of
+   a "lazy" HTML page are written into.
+   */
+  string lazy_html_data_dir_name( const string &uncompressed_saveto )
+  {
+    string stem = SpecUtils::filename( uncompressed_saveto );
+    const string::size_type dotpos = stem.find_last_of( '.' );
+    if( dotpos != string::npos )
+      stem = stem.substr( 0, dotpos );
+    return stem + "_data";
+  }//lazy_html_data_dir_name(...)
+  
+  
+  /** Returns the name of the .npz file, with the information about each row,
+   written next to a .npy output file.
+   */
+  string npy_meta_filename( const string &uncompressed_saveto, const string &compressed_ext )
+  {
+    const size_t len = uncompressed_saveto.size();
+    const bool has_ext = (len > 4) && SpecUtils::iequals_ascii( uncompressed_saveto.substr(len - 4), ".npy" );
+    return uncompressed_saveto.substr( 0, has_ext ? (len - 4) : len ) + ".npz" + compressed_ext;
+  }//npy_meta_filename(...)
+  
+  
+  /** Returns the contents of a data file for the "lazy" HTML output; this is
+   JavaScript (not JSON) so the page can load it with a <script> element, which,
+   unlike fetch(), also works when the page is opened from the local disk.
+   */
+  string lazy_html_chunk( const vector<shared_ptr<const SpecUtils::Measurement>> &measurements,
+                          const size_t chunk_index )
+  {
+    std::ostringstream output;
+    output << "cambioViewer.addChunk(" << chunk_index << ",[\n";
     
-    output << ", NumberMeasurements: " << info.num_measurements();
+    const size_t begin_index = chunk_index * ns_lazy_html_chunk_size;
+    const size_t end_index = std::min( begin_index + ns_lazy_html_chunk_size, measurements.size() );
     
-    if( info.has_gps_info() )
+    for( size_t i = begin_index; i < end_index; ++i )
     {
-      //info.position_time()
-      output << ", MeanLatitude: " << info.mean_latitude();
-      output << ", MeanLongitude: " << info.mean_longitude();
-    }
-    //info.inspection()
-    //info.measurement_location_name()
-    //info.lane_number()
-    //const std::vector<std::string> &SpecUtils::SpecFile::detector_names() const
-    output << ", TotalLiveTime: " << info.gamma_live_time();
-    output << ", TotalRealTime: " << info.gamma_real_time();
-    output << ", TotalSumGammas: " << info.gamma_count_sum();
-    //output << ", TotalSumNeutrons: " << info.neutron_counts_sum();
-    
-    std::shared_ptr<const DetectorAnalysis> ana = info.detectors_analysis();
-    if( ana )
-    {
-      output << ", Analysis: {";
-      
-      output << " AlgorithmName:'" << jsonEscape( ana->algorithm_name_ ) << "'";
-      output << " AlgorithmCreator:'" << jsonEscape( ana->algorithm_creator_ ) << "'";
-      output << " AlgorithmDescription:'" << jsonEscape( ana->algorithm_description_ ) << "'";
-      output << " AlgorithmResultDescription:'" << jsonEscape( ana->algorithm_result_description_ ) << "'";
-      if( !ana->algorithm_component_versions_.empty() )
-      {
-        output << ", ComponentVersions: [";
-        for( size_t i = 0; i < ana->algorithm_component_versions_.size(); ++i )
-          output << (i?",":"") << "{component:'" << jsonEscape( ana->algorithm_component_versions_[i].first ) << "', "
-                 << "version:'" << jsonEscape( ana->algorithm_component_versions_[i].second ) << "'}";
-        output << "]";
-      }
+      const SpecUtils::Measurement &m = *measurements[i];
       
-      if( !ana->remarks_.empty() )
+      string title = m.title();
+      if( title.empty() )
       {
-        output << ", Remarks: [";
-        for( size_t i = 0; i < ana->remarks_.size(); ++i )
-          output << (i?",":"") << "'" << jsonEscape( ana->remarks_[i] ) << "'";
-        output << "]";
+        if( m.detector_name() != "" )
+          title = "Det " + m.detector_name() + " ";
+        title += "Sample " + to_string(m.sample_number());
       }
       
-      if( !ana->results_.empty() )
-      {
-        output << ", Results: [";
-        for( size_t i = 0; i < ana->results_.size(); ++i )
-        {
-          const auto &result = ana->results_[i];
-          output << (i?",":"") << "{";
-          output << "Nuclide:'" << jsonEscape( result.nuclide_ ) << "'";
-          if( !result.remark_.empty() )
-            output << ", Remark:'" << jsonEscape( result.remark_ ) << "'";
-          if( result.activity_ > 0.0f )
-            output << ", Activity:" << result.activity_ << ""; //in units of becquerel (eg: 1.0 == 1 bq)
-          //float ;
-          if( !result.nuclide_type_.empty() )
-            output << ", NuclideType:'" << jsonEscape( result.nuclide_type_ ) << "'";
-          if( !result.id_confidence_.empty() )
-            output << ", Confidence:'" << jsonEscape( result.id_confidence_ ) << "'";
-          //float distance_;            //in units of mm (eg: 1.0 == 1 mm )
-          if( result.dose_rate_ > 0.0f )
-            output << ", DoseRate:" << result.dose_rate_ << ""; //in units of micro-sievert per hour
-          //float real_time_;           //in units of seconds (eg: 1.0 = 1 s)
-          //std::string detector_;
-          output << "}";
-        }
-        output << "]";
-      }//if( !ana->results_.empty() )
-    }//if( ana )
-
-    output << "},\n\t";
-  }//void add_file_meta_info_to_json( std::ostream &ostr, const SpecUtils::SpecFile &info )
-#endif
+      D3SpectrumExport::D3SpectrumOptions specopts;
+      specopts.line_color = "black";
+      specopts.display_scale_factor = 1.0;
+      
+      output << (i == begin_index ? "" : ",\n")
+             << "{\"title\":\"" << json_escape(title) << "\",\"data\":{\"updateXAxis\":true,"
+                "\"updateYAxis\":true,\"spectra\":[";
+      D3SpectrumExport::write_spectrum_data_js( output, m, specopts, 0, -1 );
+      output << "]}}";
+    }//for( loop over measurements in this chunk )
+    
+    output << "\n]);\n";
+    
+    return output.str();
+  }//lazy_html_chunk(...)
+  
+  
+  /** Writes the "lazy" HTML page: a single chart, and controls to step through
+   the records, whose data is loaded from `data_dir` a chunk at a time, as
+   needed; so the page opens just as quickly for files with tens of thousands
+   of records as for files with one.
+   */
+  bool write_lazy_html_page( std::ostream &output, const D3SpectrumExport::D3SpectrumChartOptions &fileopts,
+                             const string &data_dir, const size_t num_records,
+                             const bool shared_assets )
+  {
+    const char *endline = "\r\n";
+    const string div_id = "chart";
+    
+    html_page_header( output, fileopts.m_title, shared_assets );
+    
+    output << "<body>" << endline;
+    output << "<div id=\"" << div_id << "\" class=\"chart\" oncontextmenu=\"return false;\";></div>" << endline;
+    output << "<div style=\"margin: 5px 20px;\">" << endline
+           << "<button id=\"cambio-prev\">&lt;</button>" << endline
+           << "<input id=\"cambio-slider\" type=\"range\" min=\"1\" max=\"" << num_records
+           << "\" value=\"1\" style=\"width: 40%; vertical-align: middle;\" />" << endline
+           << "<input id=\"cambio-record\" type=\"number\" min=\"1\" max=\"" << num_records
+           << "\" value=\"1\" style=\"width: 7em;\" /> of " << num_records << endline
+           << "<button id=\"cambio-next\">&gt;</button>" << endline
+           << "<span id=\"cambio-title\" style=\"margin-left: 1em;\"></span>" << endline
+           << "</div>" << endline;
+    
+    output << "<script>" << endline;
+    D3SpectrumExport::write_js_for_chart( output, div_id, fileopts.m_dataTitle,
+                                          fileopts.m_xAxisTitle, fileopts.m_yAxisTitle );
+    output <<
+      "const resizeChart_" << div_id << " = function(){\n"
+      "  let height = window.innerHeight;\n"
+      "  let width = window.innerWidth; \n"
+      "  let el = spec_chart_" << div_id << ".chart;\n"
+      "  el.style.width = (width - 40) + \"px\";\n"
+      "  el.style.height = Math.max(250, Math.min(0.4*width,height-175)) + \"px\";\n"
+      "  el.style.marginLeft = \"20px\";\n"
+      "  el.style.marginRight = \"20px\";\n"
+      "  spec_chart_" << div_id << ".handleResize();\n"
+      "};\n"
+      "resizeChart_" << div_id << "();\n"
+      "window.addEventListener('resize', resizeChart_" << div_id << ");\n";
+    D3SpectrumExport::write_set_options_for_chart( output, div_id, fileopts );
+    
+    output <<
+      "const cambioViewer = (function(){\n"
+      "  const numRecords = " << num_records << ", chunkSize = " << ns_lazy_html_chunk_size << ";\n"
+      "  const dataDir = \"" << json_escape(data_dir) << "\";\n"
+      "  const maxChunks = 16;\n"  //Number of chunks to keep in memory
+      "  let chunks = {}, requested = {}, current = 0;\n"
+      "  const el = function(id){ return document.getElementById(id); };\n"
+      "  const load = function(c){\n"
+      "    if( c < 0 || c*chunkSize >= numRecords || chunks[c] || requested[c] ) return;\n"
+      "    requested[c] = true;\n"
+      "    const s = document.createElement('script');\n"
+      "    s.src = dataDir + '/chunk_' + String(c).padStart(5,'0') + '.js';\n"
+      "    s.onerror = function(){ delete requested[c]; el('cambio-title').textContent = 'Failed to load ' + s.src; };\n"
+      "    s.onload = function(){ s.remove(); };\n"
+      "    document.head.appendChild(s);\n"
+      "  };\n"
+      "  const display = function(){\n"
+      "    const c = Math.floor(current/chunkSize);\n"
+      "    if( !chunks[c] ){ el('cambio-title').textContent = 'Loading...'; load(c); return; }\n"
+      "    const rec = chunks[c][current % chunkSize];\n"
+      "    el('cambio-title').textContent = rec.title;\n"
+      "    spec_chart_" << div_id << ".setData( rec.data );\n"
+      "    load(c+1);\n"  //Prefetch, so stepping through records stays smooth
+      "    load(c-1);\n"
+      "  };\n"
+      "  const show = function(index){\n"
+      "    index = Math.max(0, Math.min(numRecords-1, index));\n"
+      "    if( isNaN(index) ) return;\n"
+      "    current = index;\n"
+      "    el('cambio-slider').value = index + 1;\n"
+      "    el('cambio-record').value = index + 1;\n"
+      "    display();\n"
+      "  };\n"
+      "  const addChunk = function(c, records){\n"
+      "    chunks[c] = records;\n"
+      "    delete requested[c];\n"
+      "    const loaded = Object.keys(chunks).map(Number);\n"
+      "    const cur = Math.floor(current/chunkSize);\n"
+      "    if( loaded.length > maxChunks )\n"
+      "      loaded.sort(function(a,b){ return Math.abs(b-cur) - Math.abs(a-cur); })\n"
+      "            .slice(0, loaded.length - maxChunks).forEach(function(k){ delete chunks[k]; });\n"
+      "    if( c === cur ) display();\n"
+      "  };\n"
+      "  el('cambio-prev').addEventListener('click', function(){ show(current-1); });\n"
+      "  el('cambio-next').addEventListener('click', function(){ show(current+1); });\n"
+      "  el('cambio-slider').addEventListener('input', function(e){ show(parseInt(e.target.value)-1); });\n"
+      "  el('cambio-record').addEventListener('change', function(e){ show(parseInt(e.target.value)-1); });\n"
+      "  document.addEventListener('keydown', function(e){\n"
+      "    if( e.target.tagName === 'INPUT' ) return;\n"
+      "    if( e.key === 'ArrowLeft' ) show(current-1);\n"
+      "    else if( e.key === 'ArrowRight' ) show(current+1);\n"
+      "  });\n"
+      "  return { addChunk: addChunk, show: show };\n"
+      "})();\n"
+      "cambioViewer.show(0);\n";
+    output << "</script>" << endline;
+    
+    output << "</body>" << endline;
+    output << "</html>" << endline;
+    
+    return output.good();
+  }//write_lazy_html_page(...)
+  
 }
 #endif
 
 namespace
 {
   
+  /** Returns if `format` can only hold a single spectrum, in which case input
+   files with multiple records get written to a separate output file per record
+   (unless the records are being summed).
+   */
+  bool is_single_spectrum_format( const SpecUtils::SaveSpectrumAsType format )
+  {
+    switch( format )
+    {
+      case SpecUtils::SaveSpectrumAsType::Chn:
+      case SpecUtils::SaveSpectrumAsType::SpcBinaryInt:
+      case SpecUtils::SaveSpectrumAsType::SpcBinaryFloat:
+      case SpecUtils::SaveSpectrumAsType::SpcAscii:
+      case SpecUtils::SaveSpectrumAsType::SpeIaea:
+      case SpecUtils::SaveSpectrumAsType::Cnf:
+      case SpecUtils::SaveSpectrumAsType::Tka:
+        return true;
+        
+      default:
+        break;
+    }//switch( format )
+    
+    return false;
+  }//is_single_spectrum_format(...)
+  
+  
   /** Checks if the starting 3 or 4 letters are consistent with N42 naming scheme
      Doesnt check letters after this incase we have already prepended the name
      with the N42 check, or energy cal info got appended to name.
@@ -485,6 +663,217 @@ namespace
       }
     }//if( print_debug )
   }//void normalize_det_name_to_n42( SpecUtils::SpecFile &info )
+  
+  
+  /** Picks which energy calibration variant of a file to keep (e.g., "LinEnCal" out of
+   "CmpEnCal" and "LinEnCal", or "9MeV" out of "2.5MeV" and "9MeV"), when there is more than one
+   and the user didn't ask for all of them.
+   
+   Returns an empty string if no preference could be determined.
+   */
+  string preferred_energy_cal_variant( const set<string> &cals )
+  {
+    //Calibrations I've seen:
+    //"CmpEnCal", and "LinEnCal"
+    //"2.5MeV" vs "9MeV"
+    //{"EnergyCalibration", "LowEnergyCalibration", vs "FullEnergyCalibration"}
+    
+    string prefered_variant;
+    for( const auto str : cals )
+    {
+      if( SpecUtils::icontains( str, "Lin") )
+        prefered_variant = str;
+      //else if( SpecUtils::iequals_ascii( str, "EnergyCalibration") )
+      //  prefered_variant = str;
+    }//for( const auto &str : cals )
+    
+    if( prefered_variant.empty() )
+    {
+      auto getMev = []( string str ) -> double {
+        SpecUtils::to_lower_ascii(str);
+        size_t pos = str.find("mev");
+        if( pos == string::npos )
+          return -999.9;
+        str = str.substr(0,pos);
+        SpecUtils::trim( str );
+        for( size_t index = str.size(); index > 0; --index )
+        {
+          const char c = str[index-1];
+          if( !isdigit(c) && c != '.' && c!=',' )
+          {
+            str = str.substr(index);
+            break;
+          }
+        }
+        
+        double val;
+        if( stringstream(str) >> val )
+          return val;
+        
+        return -999.9;
+      };
+      
+      double maxenergy = -999.9;
+      for( const auto str : cals )
+      {
+        const double energy = getMev(str);
+        if( (energy > 0.0) && (energy > maxenergy) )
+        {
+          maxenergy = energy;
+          prefered_variant = str;
+        }
+      }//for( const auto str : cals )
+    }//if( prefered_variant.empty() )
+    
+    return prefered_variant;
+  }//string preferred_energy_cal_variant( const set<string> &cals )
+  
+  
+  /** The energy calibration of a detector, to be written to a CALp file. */
+  struct DetectorCalibration
+  {
+    string detector;
+    int sample;
+    SpecUtils::time_point_t start_time;
+    shared_ptr<const SpecUtils::EnergyCalibration> cal;
+  };//struct DetectorCalibration
+  
+  
+  /** Returns the energy calibration of each gamma detector, from the lowest sample number the
+   detector has a valid calibration for.  Results are ordered by that sample number, and then
+   by the detector order of the file.
+   
+   Makes a single pass over the measurements, rather than looking up every sample number and
+   detector combination.
+   */
+  vector<DetectorCalibration> calibration_per_detector( const SpecUtils::SpecFile &info )
+  {
+    const vector<string> &all_detectors = info.detector_names();
+    
+    map<string,DetectorCalibration> det_cals;
+    for( const shared_ptr<const SpecUtils::Measurement> &m : info.measurements() )
+    {
+      const shared_ptr<const SpecUtils::EnergyCalibration> cal = m ? m->energy_calibration() : nullptr;
+      if( !cal || !cal->valid() || (cal->num_channels() < 3) )
+        continue;
+      
+      const auto pos = det_cals.find( m->detector_name() );
+      if( (pos != end(det_cals)) && (pos->second.sample <= m->sample_number()) )
+        continue;
+      
+      det_cals[m->detector_name()]
+                   = DetectorCalibration{ m->detector_name(), m->sample_number(), m->start_time(), cal };
+    }//for( loop over measurements )
+    
+    vector<DetectorCalibration> answer;
+    for( const string &det : all_detectors )
+    {
+      const auto pos = det_cals.find( det );
+      if( pos != end(det_cals) )
+        answer.push_back( pos->second );
+    }
+    
+    std::stable_sort( begin(answer), end(answer),
+                      []( const DetectorCalibration &lhs, const DetectorCalibration &rhs ) -> bool {
+      return lhs.sample < rhs.sample;
+    } );
+    
+    return answer;
+  }//vector<DetectorCalibration> calibration_per_detector( const SpecUtils::SpecFile &info )
+  
+  
+  /** De-duplicates energy calibrations that have the same type, number of channels,
+   coefficients, and deviation pairs; calibrations are looked up by a hash of these, so
+   de-duplicating calibrations from many files stays cheap.
+   
+   Not thread safe.
+   */
+  class CalibrationSet
+  {
+  public:
+    /** Returns the first calibration added that is identical to `cal`, or adds `cal` and
+     returns it, if there wasn't one.
+     */
+    shared_ptr<const SpecUtils::EnergyCalibration> canonical(
+                                      const shared_ptr<const SpecUtils::EnergyCalibration> &cal )
+    {
+      assert( cal );
+      
+      const uint64_t key = hash( *cal );
+      const auto range = m_cals.equal_range( key );
+      for( auto iter = range.first; iter != range.second; ++iter )
+      {
+        if( (iter->second == cal) || identical( *iter->second, *cal ) )
+          return iter->second;
+      }
+      
+      m_cals.insert( make_pair(key, cal) );
+      
+      return cal;
+    }//canonical(...)
+    
+    /** The number of distinct calibrations seen. */
+    size_t size() const
+    {
+      return m_cals.size();
+    }
+    
+  private:
+    static bool identical( const SpecUtils::EnergyCalibration &lhs,
+                           const SpecUtils::EnergyCalibration &rhs )
+    {
+      if( (lhs.type() != rhs.type())
+         || (lhs.num_channels() != rhs.num_channels())
+         || (lhs.coefficients() != rhs.coefficients())
+         || (lhs.deviation_pairs() != rhs.deviation_pairs()) )
+        return false;
+      
+      if( lhs.type() != SpecUtils::EnergyCalType::LowerChannelEdge )
+        return true;
+      
+      const shared_ptr<const vector<float>> &lhs_energies = lhs.channel_energies();
+      const shared_ptr<const vector<float>> &rhs_energies = rhs.channel_energies();
+      if( !lhs_energies || !rhs_energies )
+        return (lhs_energies == rhs_energies);
+      
+      return (*lhs_energies == *rhs_energies);
+    }//identical(...)
+    
+    
+    static uint64_t hash( const SpecUtils::EnergyCalibration &cal )
+    {
+      // 64-bit FNV-1a
+      uint64_t value = 14695981039346656037ull;
+      auto add_bytes = [&value]( const void *data, const size_t nbytes ){
+        const unsigned char *bytes = static_cast<const unsigned char *>( data );
+        for( size_t i = 0; i < nbytes; ++i )
+          value = (value ^ bytes[i]) * 1099511628211ull;
+      };
+      
+      const int type = static_cast<int>( cal.type() );
+      const uint64_t nchannel = cal.num_channels();
+      add_bytes( &type, sizeof(type) );
+      add_bytes( &nchannel, sizeof(nchannel) );
+      
+      const vector<float> &coefs = cal.coefficients();
+      if( !coefs.empty() )
+        add_bytes( coefs.data(), coefs.size()*sizeof(float) );
+      
+      for( const pair<float,float> &dev_pair : cal.deviation_pairs() )
+      {
+        add_bytes( &dev_pair.first, sizeof(float) );
+        add_bytes( &dev_pair.second, sizeof(float) );
+      }
+      
+      const shared_ptr<const vector<float>> &energies = cal.channel_energies();
+      if( (cal.type() == SpecUtils::EnergyCalType::LowerChannelEdge) && energies && !energies->empty() )
+        add_bytes( energies->data(), energies->size()*sizeof(float) );
+      
+      return value;
+    }//hash(...)
+    
+    std::unordered_multimap<uint64_t,shared_ptr<const SpecUtils::EnergyCalibration>> m_cals;
+  };//class CalibrationSet
 
 
 #if defined(__APPLE__) || defined(unix) || defined(__unix) || defined(__unix__)
@@ -552,16 +941,19 @@ int run_command_util( const int argc, char *argv[] )
   bool background_only, foreground_only, calibration_only, intrinsic_only;
   bool sum_det_per_sample, sum_samples_per_det;
   bool no_derived, only_derived;
+  bool deterministic_sum, compact_channels, print_load_timing, sync_output;
+  unsigned int num_jobs;
   //bool spectra_of_likely_interest_only;
   vector<string> detector_renaimings, detectors_to_include, detectors_to_exclude;
   
 #if( SpecUtils_ENABLE_D3_CHART )
   string html_to_include = "all";
+  string html_assets = "inline";
 #endif
   unsigned int rebin_factor;
   
   bool recursive = false;
-  string inputdir, outputname, outputformatstr, calp_file;
+  string inputdir, outputname, outputformatstr, calp_file, calp_batch, output_archive_name, compress_name;
   vector<string> inputfiles;
   float linearize_lower_energy, linearize_upper_energy;
   
@@ -575,6 +967,7 @@ int run_command_util( const int argc, char *argv[] )
 #if( SpecUtils_ENABLE_URI_SPECTRA )
   size_t num_uris = 1;
   vector<string> uri_options;
+  bool uri_per_measurement = false;
 #endif
   
   unsigned term_width = terminal_width();
@@ -586,7 +979,9 @@ int run_command_util( const int argc, char *argv[] )
     ("about,a",  "produce the about message")
     ("version,v",  "print version information and exit")
     ("input,i", po::value< vector<string> >(&inputfiles),
-              "input spectrum file(s)")
+              "input spectrum file(s); tar or zip archives (including .tar.gz,"
+              " .tgz, .tar.zst, and .tar.xz) are expanded, and each file in them"
+              " converted.")
     ("output,o", po::value<string>(&outputname),
               "Output file or directory; if multiple input files are specified,"
               " this must be a valid existing directory.")
@@ -600,7 +995,12 @@ int run_command_util( const int argc, char *argv[] )
               " N42 (defaults to 2012 variant), 2012N42, 2006N42,"
               " CHN (binary integer variant), SPC (defaults to int variant),"
               " INTSPC, FLTSPC, SPE (IAEA format), asciispc (ASCII version of"
-              " SPC), TKA, gr130 (256 channel binary format), CNF, or CALp (energy calibration only),"
+              " SPC), TKA, gr130 (256 channel binary format), CNF, CALp (energy calibration only),"
+              " Arrow (Apache Arrow IPC/Feather file, with a row per measurement, for dataframes),"
+              " or NPY (NumPy matrix of channel counts, with measurement information in a .npz file"
+              " next to it; use the linearize options if measurements have differing binnings),"
+              " TimeSeries (CSV of the gross gamma and neutron counts of each sample, for"
+              " passthrough or search-mode data)"
 #if( SpecUtils_ENABLE_D3_CHART )
               ", html (webpage plot), json (chart data in json format, equiv to '--format=html --html-output=json')"
 #endif
@@ -631,7 +1031,9 @@ int run_command_util( const int argc, char *argv[] )
      "Must also specify 'output' option to point to an existing directory, as"
      " well as the 'format' option.\n"
      "May not be used with 'input' option.\n"
-     "By default not recursive, see 'recursive' option."
+     "By default not recursive, see 'recursive' option.\n"
+     "May also be a tar or zip archive, in which case the output directory"
+     " structure will mirror that inside the archive."
     )
     ("recursive", po::value<bool>(&recursive)->default_value(false)->implicit_value(true),
      "When 'inputdir' is used, specifying this to be true will result in files"
@@ -664,6 +1066,17 @@ int run_command_util( const int argc, char *argv[] )
      "Apply the energy calibration from the specified CALp file.\n\t"
      "The CALp file is applied after renaming or filtering detectors, but before summing."
     )
+    ("CALp-batch", po::value<string>(&calp_batch),
+     "Only applies when the output format is CALp.\n\t"
+     "Extracts the energy calibrations of any number of input files,\n\t"
+     "in parallel (see --jobs), and writes either a CALp file for\n\t"
+     "each input file ('--CALp-batch=file'), or a CALp file for each\n\t"
+     "instrument serial number ('--CALp-batch=serial'), named by the\n\t"
+     "serial number.  If a detectors calibration changes between\n\t"
+     "the files of an instrument, the most recent one is written.\n\t"
+     "Detector filtering and renaming options are applied, but options\n\t"
+     "that change the spectra are not."
+    )
     ("set-serial-number", po::value<string>(&newserialnum),
      "Used to change the detector serial number written to the output file."
     )
@@ -791,6 +1204,37 @@ int run_command_util( const int argc, char *argv[] )
    "For each detector, sum all sample numbers together.\n\t"
    "i.e. Output one spectrum for each detector, no matter how many sample is in input."
   )
+  ("deterministic", po::value<bool>(&deterministic_sum)->default_value(false)->implicit_value(true),
+   "Sum spectra using a fixed-shape pairwise summation in double precision, so that"
+   " output files are bit-for-bit identical between runs, no matter the value of the"
+   " 'jobs' option.\n\t"
+   "Applies to all summing of spectra (e.g., 'sum-all-spectra', 'combine-multi',"
+   " 'sum-det-per-sample', 'sum-samples-per-det')."
+  )
+  ("jobs,j", po::value<unsigned int>(&num_jobs)->default_value(0),
+   "The maximum number of worker threads to use; a value of 0 (the default) will use"
+   " one thread per CPU core.\n\t"
+   "Used when summing spectra with the 'deterministic' option, and when writing each record"
+   " to its own file (e.g., CHN, SPC, SPE, CNF, or TKA output without 'combine-multi')."
+  )
+  ("sync-output", po::value<bool>(&sync_output)->default_value(false)->implicit_value(true),
+   "Makes sure each output file is written to disk before it is moved into its final location.\n\t"
+   "Output files are always written to a temporary file in the output directory, and then"
+   " renamed, so other programs never see partially written files.")
+  ("output-archive", po::value<string>(&output_archive_name)->default_value(""),
+   "Writes all output files into a single tar or zip archive (determined by the extension,"
+   " '.tar' or '.zip'), instead of creating each file on disk.\n\t"
+   "Files in the archive are named relative to the output directory, which must still be"
+   " specified (e.g., '-o .'), and are stored uncompressed.\n\t"
+   "Useful when writing each record to its own file, or converting a large directory tree.")
+  ("compress", po::value<string>(&compress_name)->default_value(""),
+   "Compresses each output file as it is written; either 'gzip', or 'zstd' (if this build"
+   " supports it).  The '.gz' or '.zst' extension is added to output file names.\n\t"
+   "Compression is done in blocks, on multiple threads (see the 'jobs' option), while the"
+   " file is being encoded.  Especially useful for N42 and CSV outputs.")
+  ("print-load-timing", po::value<bool>(&print_load_timing)->default_value(false)->implicit_value(true),
+   "Prints, for each input file, the format detected from the start of the file, and the"
+   " time spent detecting the format and parsing the file.")
   ("combine-input-files", po::value<bool>(&combine_all_files)->default_value(false)->implicit_value(true),
    "Combines all input files, and writes a single output file."
    "  An output file name must be specified.")
@@ -799,16 +1243,35 @@ int run_command_util( const int argc, char *argv[] )
    "Only possible value: 'time'.  Others may be added in future.\n\t"  //TODO: add 'count-rate-increasing', 'count-rate-decreasing'
    "By default, if not specified, records in the combined output file will be ordered\n\t"
    "according to the order of input files.")
+  ("compact-channels", po::value<bool>(&compact_channels)->default_value(false)->implicit_value(true),
+   "Can only be specified with the 'combine-input-files' option.\n\t"
+   "Holds the channel counts of input files in a run-length encoded form until the\n\t"
+   "output is written, greatly reducing memory use for files with many mostly-empty\n\t"
+   "spectra, such as portal passthrough files.  When 'sum-all-spectra' is also\n\t"
+   "specified, spectra are summed directly from the encoded form.")
 #if( SpecUtils_ENABLE_D3_CHART )
     ("html-output", po::value<string>(&html_to_include)->default_value("all"),
      "Only applies when saving to the HTML format.  The components to include"
      " in the output file.  Options are \n\t"
        "'all': includes everything making a self contained html file \n\t"
        "'json': only the data compnents of the spectra\n\t"
+       "'json-meta': the spectra, and file and record information (times,\n\t"
+       "GPS, source type, analysis results, etc), as a JSON object\n\t"
        "'css': the default styling of the charts\n\t"
        "'js': the SpectrumChartD3 library\n\t"
        "'d3': the D3 javascript library\n\t"
-       "'controls': the html and js for display options"
+       "'controls': the html and js for display options\n\t"
+       "'lazy': a page with a single chart, and controls to step through the\n\t"
+       "records, whose data is written to a '<name>_data' directory next to\n\t"
+       "the page and loaded as needed; use for files with many records"
+    )
+    ("html-assets", po::value<string>(&html_assets)->default_value("inline"),
+     "Only applies when saving complete HTML files.  Options are\n\t"
+       "'inline': each HTML file includes the D3, chart JavaScript, and CSS\n\t"
+       "'shared': the JavaScript and CSS are written once to each output\n\t"
+       "directory, and referenced by each HTML file, greatly reducing output\n\t"
+       "size when converting many files (requires the D3 assets to be\n\t"
+       "compiled in)."
     )
 #endif
 #if( SpecUtils_ENABLE_URI_SPECTRA )
@@ -827,6 +1290,18 @@ int run_command_util( const int argc, char *argv[] )
        "a value of 1 (default) must be used.  If a single spectrum\n\t"
        "a value from 1 to 9 can be used."
   )
+  ("uri-per-measurement", po::value<bool>(&uri_per_measurement)->default_value(false)->implicit_value(true),
+   "Only applies when saving to the URI format.\n\t"
+       "Encode each measurement of the input file separately (each\n\t"
+       "into --num-uri URIs), using multiple threads (see --jobs).\n\t"
+       "The URIs are written one per line to the output file (with a\n\t"
+       "blank line after each measurement's URIs if --num-uri is more\n\t"
+       "than 1, and an empty line for a measurement that could not be\n\t"
+       "encoded), or if --output-archive is specified, to a file per\n\t"
+       "measurement in the archive.  Neutron-only records are combined\n\t"
+       "with a gamma record of the same sample.  Useful for generating\n\t"
+       "QR codes for every sample of a long measurement."
+  )
 #endif
   ;
   
@@ -1013,7 +1488,11 @@ int run_command_util( const int argc, char *argv[] )
   str_to_save_type["uri"]        = SpecUtils::SaveSpectrumAsType::Uri;
 #endif
 
+  //Formats SpecUtils doesnt write use NumTypes, and are told apart by `outputformatstr`
   str_to_save_type["calp"]       = SpecUtils::SaveSpectrumAsType::NumTypes;
+  str_to_save_type["arrow"]      = SpecUtils::SaveSpectrumAsType::NumTypes;
+  str_to_save_type["npy"]        = SpecUtils::SaveSpectrumAsType::NumTypes;
+  str_to_save_type["timeseries"] = SpecUtils::SaveSpectrumAsType::NumTypes;
   
   //spec_exts: extensions of files that we can read.
   const string spec_exts[] = { "txt", "csv", "pcf", "xml", "n42", "chn",
@@ -1040,7 +1519,10 @@ int run_command_util( const int argc, char *argv[] )
       return 14;
     }
     
-    if( !SpecUtils::is_directory(inputdir) )
+    const bool inputdir_is_archive = (SpecUtils::is_file(inputdir)
+                                      && ArchiveReader::is_archive(inputdir));
+    
+    if( !inputdir_is_archive && !SpecUtils::is_directory(inputdir) )
     {
       cerr << "Input directory '" << inputdir << "' is not a valid directory"
            << endl;
@@ -1062,7 +1544,9 @@ int run_command_util( const int argc, char *argv[] )
       return 21;
     }
     
-    if( recursive )
+    if( inputdir_is_archive )
+      inputfiles.push_back( inputdir );  //Expanded below
+    else if( recursive )
       inputfiles = SpecUtils::recursive_ls(inputdir);
     else
       inputfiles = SpecUtils::ls_files_in_directory(inputdir);
@@ -1114,6 +1598,55 @@ int run_command_util( const int argc, char *argv[] )
   }//if( outputname.empty() )
   
   
+  //Replace any tar or zip archives in the inputs with the files inside them;
+  //  these are named like "bundle.zip/path/in/archive.n42", and read straight
+  //  from the archive, without being extracted to disk.
+  struct ArchiveInput
+  {
+    shared_ptr<ArchiveReader> reader;
+    size_t index;
+  };//struct ArchiveInput
+  
+  map<string,ArchiveInput> archive_inputs;
+  
+  {//begin codeblock to expand archives
+    vector<string> expanded_inputs;
+    for( const string &filename : inputfiles )
+    {
+      if( !SpecUtils::is_file(filename) || !ArchiveReader::is_archive(filename) )
+      {
+        expanded_inputs.push_back( filename );
+        continue;
+      }
+      
+      shared_ptr<ArchiveReader> reader;
+      try
+      {
+        reader = make_shared<ArchiveReader>( filename );
+      }catch( std::exception &e )
+      {
+        cerr << "Error reading archive '" << filename << "': " << e.what() << endl;
+        return 44;
+      }
+      
+      for( size_t index = 0; index < reader->entries().size(); ++index )
+      {
+        const string name = filename + "/" + reader->entries()[index].name;
+        archive_inputs[name] = ArchiveInput{ reader, index };
+        expanded_inputs.push_back( name );
+      }
+    }//for( const string &filename : inputfiles )
+    
+    if( !archive_inputs.empty() && expanded_inputs.empty() )
+    {
+      cerr << "No files found in the input archive(s)." << endl;
+      return 44;
+    }
+    
+    inputfiles.swap( expanded_inputs );
+  }//end codeblock to expand archives
+  
+  
   if( (inputfiles.size() > 1) && !SpecUtils::is_directory(outputname) && !combine_all_files )
   {
     cerr << "You must specify an output directory when there are mutliple input"
@@ -1124,7 +1657,7 @@ int run_command_util( const int argc, char *argv[] )
   }//if( mutliple input files, and not a output directory )
   
   
-  if( !force_writing && SpecUtils::is_file(outputname) )
+  if( !force_writing && output_archive_name.empty() && SpecUtils::is_file(outputname) )
   {
     cerr << "Output file ('" << outputname << "') already exists; you can force"
          << " overwriting it by using the --force option." << endl;
@@ -1252,7 +1785,7 @@ int run_command_util( const int argc, char *argv[] )
   //Make sure all the input files exist
   for( size_t i = 0; i < inputfiles.size(); ++i )
   {
-    if( !SpecUtils::is_file(inputfiles[i]) )
+    if( !archive_inputs.count(inputfiles[i]) && !SpecUtils::is_file(inputfiles[i]) )
     {
       cerr << "Input file '" << inputfiles[i] << "' doesnt exist, or cant be"
            << " accessed." << endl;
@@ -1282,7 +1815,50 @@ int run_command_util( const int argc, char *argv[] )
   }
   
   
-  assert( (outputformatstr == "calp") == (format == SpecUtils::SaveSpectrumAsType::NumTypes) );
+  CompressedOutput::Compression output_compression = CompressedOutput::Compression::None;
+  try
+  {
+    output_compression = CompressedOutput::compression_from_string( compress_name );
+  }catch( std::exception &e )
+  {
+    cerr << e.what() << endl;
+    return 43;
+  }//try / catch
+  
+  
+  std::shared_ptr<ArchiveWriter> output_archive;
+  if( !output_archive_name.empty() )
+  {
+    if( !force_writing && SpecUtils::is_file(output_archive_name) )
+    {
+      cerr << "Output archive ('" << output_archive_name << "') already exists; you can force"
+           << " overwriting it by using the --force option." << endl;
+      return 5;
+    }
+    
+    try
+    {
+      const ArchiveWriter::Format archive_format
+                                  = ArchiveWriter::format_from_filename( output_archive_name );
+      output_archive = std::make_shared<ArchiveWriter>( output_archive_name, archive_format,
+                                                        outdir, sync_output );
+    }catch( std::exception &e )
+    {
+      cerr << "Unable to create output archive: " << e.what() << endl;
+      return 42;
+    }//try / catch
+  }//if( !output_archive_name.empty() )
+  
+  // When writing to an archive, whether an output file "exists" means if it is already in the
+  //  archive; we will never look at, or change, files on disk.
+  auto output_exists = [output_archive]( const string &path ) -> bool {
+    return output_archive ? output_archive->contains( path ) : SpecUtils::is_file( path );
+  };
+  
+  
+  assert( ((outputformatstr == "calp") || (outputformatstr == "arrow") || (outputformatstr == "npy")
+           || (outputformatstr == "timeseries"))
+          == (format == SpecUtils::SaveSpectrumAsType::NumTypes) );
   if( outputformatstr == "calp" )
   {
     // If we are making a CALp file, we can only have one input file, and we can not specify
@@ -1294,20 +1870,42 @@ int run_command_util( const int argc, char *argv[] )
       return 37;
     }
     
-    if( inputfiles.size() != 1 )
+    if( (inputfiles.size() != 1) && calp_batch.empty() )
     {
       // We could relax this and let users make multiple CALp files at once, but I think
-      //  the chance of confusion is too great, so we'll keep this option restricted.
-      cerr << "When creating a CALp file, you can only specify a single input file." << endl;
+      //  the chance of confusion is too great, so we'll keep this option restricted, unless
+      //  the user explicitly asks for batch mode.
+      cerr << "When creating a CALp file, you can only specify a single input file,"
+              " unless the '--CALp-batch' option is used." << endl;
       return 38;
     }
     
+    SpecUtils::to_lower_ascii( calp_batch );
+    if( !calp_batch.empty() && (calp_batch != "file") && (calp_batch != "serial") )
+    {
+      cerr << "The '--CALp-batch' option must be either 'file' or 'serial'." << endl;
+      return 47;
+    }
+    
+    if( !calp_batch.empty()
+       && (normalize_det_names || (rebin_factor > 1)
+           || cl_vm.count("linearize-lower-energy") || cl_vm.count("linearize-upper-energy")) )
+    {
+      cerr << "The '--CALp-batch' option can not be used with options that change the energy"
+              " calibration or detector names of spectra, other than '--rename-det'." << endl;
+      return 48;
+    }
+    
     if( combine_all_files )
     {
       cerr << "The '--combine-input-files' option can not be used when creating CALp file." << endl;
       return 39;
     }
-  }//if( outputformatstr == "calp" )
+  }else if( !calp_batch.empty() )
+  {
+    cerr << "The '--CALp-batch' option can only be used when creating CALp files." << endl;
+    return 47;
+  }//if( outputformatstr == "calp" ) / else
   
   
   if( !calp_file.empty() && !SpecUtils::is_file(calp_file) )
@@ -1350,8 +1948,14 @@ int run_command_util( const int argc, char *argv[] )
   
   if( format == SpecUtils::SaveSpectrumAsType::NumTypes )
   {
-    assert( outputformatstr == "calp" );
-    ending = "CALp";
+    assert( (outputformatstr == "calp") || (outputformatstr == "arrow") || (outputformatstr == "npy")
+            || (outputformatstr == "timeseries") );
+    if( outputformatstr == "calp" )
+      ending = "CALp";
+    else if( outputformatstr == "timeseries" )
+      ending = "csv";
+    else
+      ending = outputformatstr;
   }//if( format == SpecUtils::SaveSpectrumAsType::NumTypes )
   
   
@@ -1362,24 +1966,47 @@ int run_command_util( const int argc, char *argv[] )
     SpecUtils::to_lower_ascii( html_to_include );
     SpecUtils::trim( html_to_include );
     
-    if( outputformatstr == "json" )
+    if( (outputformatstr == "json") && (html_to_include != "json-meta") )
       html_to_include = "json";
     
     
     if( (html_to_include != "all")
        && (html_to_include != "json")
+       && (html_to_include != "json-meta")
        && (html_to_include != "css")
        && (html_to_include != "js")
        && (html_to_include != "d3")
-       && (html_to_include != "controls") )
+       && (html_to_include != "controls")
+       && (html_to_include != "lazy") )
     {
       cerr << "The 'html-output' option must specify exactly one of the"
-      " following: all, json, css, js, d3, controls."
+      " following: all, json, json-meta, css, js, d3, controls, lazy."
       "  You specified '" << html_to_include << "'" << endl;
       
       return 10;
     }
     
+    SpecUtils::to_lower_ascii( html_assets );
+    SpecUtils::trim( html_assets );
+    
+    if( (html_assets != "inline") && (html_assets != "shared") )
+    {
+      cerr << "The 'html-assets' option must be either 'inline' or 'shared'."
+      "  You specified '" << html_assets << "'" << endl;
+      
+      return 45;
+    }
+    
+#if( !SpecUtils_D3_SUPPORT_FILE_STATIC )
+    if( html_assets == "shared" )
+    {
+      cerr << "The 'html-assets shared' option requires the D3 chart JavaScript and CSS"
+      " to be compiled into the executable (SpecUtils_D3_SUPPORT_FILE_STATIC)." << endl;
+      
+      return 50;
+    }
+#endif
+    
     if( html_to_include == "controls" )
     {
       // When (if) we implement this look below for "control", and fix that up
@@ -1387,9 +2014,9 @@ int run_command_util( const int argc, char *argv[] )
       return 12;
     }
     
-    if( html_to_include == "all" )
+    if( (html_to_include == "all") || (html_to_include == "lazy") )
       ending = "html";
-    else if( html_to_include == "json" )
+    else if( (html_to_include == "json") || (html_to_include == "json-meta") )
       ending = "json";
     else if( html_to_include == "css" )
       ending = "css";
@@ -1449,6 +2076,12 @@ int run_command_util( const int argc, char *argv[] )
       cerr << "You can not specify the 'num-uri' option unless output format is URI." << endl;
       return 18;
     }
+    
+    if( uri_per_measurement )
+    {
+      cerr << "You can not specify the 'uri-per-measurement' option unless output format is URI." << endl;
+      return 46;
+    }
   }else
   {
     for( const string &opt : uri_options )
@@ -1527,6 +2160,14 @@ int run_command_util( const int argc, char *argv[] )
       
       return 26;
     }
+    
+    if( compact_channels )
+    {
+      cerr << "The 'compact-channels' option can only be specified along with the "
+      << "'combine-input-files' option." << endl;
+      
+      return 41;
+    }
   }//if( combine_all_files ) / else
   
   if( sum_det_per_sample && sum_samples_per_det )
@@ -1538,17 +2179,45 @@ int run_command_util( const int argc, char *argv[] )
   
  
   
+  // All summing of spectra goes through this lambda, so the 'deterministic' option is honored
+  //  everywhere; like SpecFile::sum_measurements(...), the binning of the result is chosen
+  //  automatically.
+  auto sum_measurements = [deterministic_sum, num_jobs]( const SpecUtils::SpecFile &info,
+                                                         const set<int> &samples,
+                                                         const vector<string> &dets )
+    -> shared_ptr<SpecUtils::Measurement> {
+    if( deterministic_sum )
+      return SpectrumSum::deterministic_sum( info, samples, dets, nullptr, num_jobs );
+    return info.sum_measurements( samples, dets, nullptr );
+  };//sum_measurements lambda
+  
+  
+#if( SpecUtils_ENABLE_D3_CHART )
+  // With "--html-assets shared", the directories we have written the JavaScript and CSS to;
+  //  files may be written from multiple threads, so access is guarded by the mutex.
+  const bool html_shared_assets = (html_assets == "shared");
+  auto html_asset_dirs = make_shared<set<string>>();
+  auto html_asset_dirs_mutex = make_shared<std::mutex>();
+#endif
+  
+  // Arrow, NumPy, time series, and CALp output all use SaveSpectrumAsType::NumTypes
+  const bool write_arrow = (outputformatstr == "arrow");
+  const bool write_npy = (outputformatstr == "npy");
+  const bool write_time_series = (outputformatstr == "timeseries");
+  
   // We'll define a lambda to actually write the output file
   auto write_output_file = [
     //First we'll capture variables we wont change, by value
     force_writing, summ_meas_for_single_out,
+    sum_measurements, sync_output, num_jobs, write_arrow, write_npy, write_time_series,
+    output_archive, output_exists, output_compression,
     sum_det_per_sample, 
     sum_samples_per_det
 #if( SpecUtils_ENABLE_D3_CHART )
-    , html_to_include
+    , html_to_include, html_shared_assets, html_asset_dirs, html_asset_dirs_mutex
 #endif
 #if( SpecUtils_ENABLE_URI_SPECTRA )
-    , num_uris, uri_encode_options
+    , num_uris, uri_encode_options, uri_per_measurement
 #endif
 #if( SpecUtils_INJA_TEMPLATES )
      , template_file, strip_template_blocks
@@ -1558,9 +2227,12 @@ int run_command_util( const int argc, char *argv[] )
 #endif
   ]( SpecUtils::SpecFile &info,
     const SpecUtils::SaveSpectrumAsType format,
-    const string &saveto, const string &inname ) 
+    const string &uncompressed_saveto, const string &inname ) 
   -> pair<bool /*wrote all output files*/,bool /*a output file already existed, and `force_writing` was false*/ > {
     
+    const char * const compressed_ext = CompressedOutput::file_extension( output_compression );
+    const string saveto = uncompressed_saveto + compressed_ext;
+    
     bool file_existed = false;
     bool opened_all_output_files = true, encoded_all_files = true;
     
@@ -1584,7 +2256,7 @@ int run_command_util( const int argc, char *argv[] )
           // TODO: summing will fail if we dont have any Measurements with gamma spectra that have valid energy calibrations (e.g., all Measurements are neutrons) - we should handle this case
           try
           {
-            shared_ptr<SpecUtils::Measurement> m = info.sum_measurements( {sample}, orig_dets, 0 );
+            shared_ptr<SpecUtils::Measurement> m = sum_measurements( info, {sample}, orig_dets );
             
             set<string> titles;
             bool all_background = true;
@@ -1660,7 +2332,7 @@ int run_command_util( const int argc, char *argv[] )
           // TODO: summing will fail if we dont have any Measurements with gamma spectra that have valid energy calibrations (e.g., this is a neutron detector) - we should handle this case
           try
           {
-            shared_ptr<SpecUtils::Measurement> m = info.sum_measurements( orig_samples, {det}, 0 );
+            shared_ptr<SpecUtils::Measurement> m = sum_measurements( info, orig_samples, {det} );
             m->set_detector_name( det );
             m->set_sample_number( 1 );
             keepers.push_back( m );
@@ -1680,14 +2352,7 @@ int run_command_util( const int argc, char *argv[] )
       info.cleanup_after_load( SpecUtils::SpecFile::CleanupAfterLoadFlags::DontChangeOrReorderSamples );
     }//if( sum_samples_per_det )
     
-    if( format == SpecUtils::SaveSpectrumAsType::Chn
-       || format == SpecUtils::SaveSpectrumAsType::SpcBinaryInt
-       || format == SpecUtils::SaveSpectrumAsType::SpcBinaryFloat
-       || format == SpecUtils::SaveSpectrumAsType::SpcAscii
-       || format == SpecUtils::SaveSpectrumAsType::SpeIaea
-       || format == SpecUtils::SaveSpectrumAsType::Cnf
-       || format == SpecUtils::SaveSpectrumAsType::Tka
-       )
+    if( is_single_spectrum_format(format) )
     {
       const vector< std::shared_ptr<const SpecUtils::Measurement> > meass = info.measurements();
       const std::set<int> samplenums = info.sample_numbers();
@@ -1695,7 +2360,7 @@ int run_command_util( const int argc, char *argv[] )
       
       if( meass.size()<2 || summ_meas_for_single_out )
       {
-        if( !force_writing && SpecUtils::is_file(saveto) )
+        if( !force_writing && output_exists(saveto) )
         {
           cerr << "Output file '" << saveto << "' existed, and --force not"
           << " specified, not saving file" << endl;
@@ -1703,11 +2368,8 @@ int run_command_util( const int argc, char *argv[] )
           return make_pair(false, file_existed);
         }//if( !force_writing && SpecUtils::is_file(savename) )
         
-#ifdef _WIN32
-        ofstream output( convert_from_utf8_to_utf16(saveto).c_str(), ios_base::binary | ios_base::out );
-#else
-        ofstream output( saveto.c_str(), ios_base::binary | ios_base::out );
-#endif
+        OutputFile output( saveto, sync_output, output_archive.get() );
+        output.compress( output_compression, num_jobs );
         
         if( !output.is_open() )
         {
@@ -1740,6 +2402,8 @@ int run_command_util( const int argc, char *argv[] )
           assert( 0 );
         }
         
+        wrote = (wrote && output.commit());
+        
         if( !wrote )
         {
           encoded_all_files = false;
@@ -1750,8 +2414,28 @@ int run_command_util( const int argc, char *argv[] )
         }
       }else  //if( sum all measurements )
       {
-        int nwroteone = 0;
+        // We'll first figure out the name of every output file, then check which already exist
+        //  using a single directory listing, then encode the records in parallel into memory,
+        //  and hand the results off to a few threads to write to disk.
+        struct RecordOutput
+        {
+          int sample;
+          int detnum;
+          string outname;
+        };//struct RecordOutput
+        
+        string extention;
+        string basename = uncompressed_saveto;
+        
+        const string::size_type pos = uncompressed_saveto.find_last_of( '.' );
+        if( pos != string::npos )
+        {
+          extention = uncompressed_saveto.substr( pos );
+          basename = uncompressed_saveto.substr( 0, pos );
+        }//if( pos >= 0 )
+        extention += compressed_ext;
         
+        vector<RecordOutput> record_outputs;
         for( set<int>::const_iterator i = samplenums.begin(); i != samplenums.end(); ++i )
         {
           const int sample = *i;
@@ -1759,11 +2443,6 @@ int run_command_util( const int argc, char *argv[] )
           {
             const int detnum = *j;
             
-            std::set<int> detnumset, samplenumset;
-            detnumset.insert( detnum );
-            samplenumset.insert( sample );
-            
-            
             const auto m = info.measurement( sample, detnum );
             if( !m )
             {
@@ -1772,88 +2451,356 @@ int run_command_util( const int argc, char *argv[] )
               continue;
             }
             
-            string extention;
-            string outname = saveto;
-            
-            const string::size_type pos = saveto.find_last_of( '.' );
-            if( pos != string::npos )
-            {
-              extention = saveto.substr( pos );
-              outname = saveto.substr( 0, pos );
-            }//if( pos >= 0 )
-            
-            {
-              outname += "_";
-              
-              char buffer[32];
-              snprintf( buffer, sizeof(buffer), "%d", nwroteone );
-              size_t nchar = strlen(buffer);
-              while( nchar++ < 4 )  //VS2012 doesnt support %4d format flag
-                outname += "0";
-              outname += buffer;
-            }
-            
-            if( extention.size() > 0 )
-              outname = outname + extention;
-            
-            if( !force_writing && SpecUtils::is_file(outname) )
-            {
-              cerr << "Output file '" << outname << "' existed, and --force not"
-              << " specified, not saving file" << endl;
-              file_existed = true;
-              continue;
-            }//if( !force_writing && SpecUtils::is_file(savename) )
+            string outname = basename + "_";
             
-#ifdef _WIN32
-            ofstream output( convert_from_utf8_to_utf16(outname).c_str(), ios_base::binary | ios_base::out );
-#else
-            ofstream output( outname.c_str(), ios_base::binary | ios_base::out );
-#endif
+            char buffer[32];
+            snprintf( buffer, sizeof(buffer), "%d", static_cast<int>(record_outputs.size()) );
+            size_t nchar = strlen(buffer);
+            while( nchar++ < 4 )  //VS2012 doesnt support %4d format flag
+              outname += "0";
+            outname += buffer;
+            outname += extention;
             
-            if( !output.is_open() )
-            {
-              cerr << "Failed to open output file " << outname << endl;
-              opened_all_output_files = false;
-              continue;
-            }else
-            {
-              bool wrote;
-              if( format == SpecUtils::SaveSpectrumAsType::Chn )
-                wrote = info.write_integer_chn( output, samplenumset, detnumset );
-              else if( format == SpecUtils::SaveSpectrumAsType::SpcBinaryInt )
-                wrote = info.write_binary_spc( output, SpecUtils::SpecFile::IntegerSpcType, samplenumset, detnumset );
-              else if( format == SpecUtils::SaveSpectrumAsType::SpcBinaryFloat )
-                wrote = info.write_binary_spc( output, SpecUtils::SpecFile::FloatSpcType, samplenumset, detnumset );
-              else if( format == SpecUtils::SaveSpectrumAsType::SpcAscii )
-                wrote = info.write_ascii_spc( output, samplenumset, detnumset );
-              else if( format == SpecUtils::SaveSpectrumAsType::SpeIaea )
-                wrote = info.write_iaea_spe( output, samplenumset, detnumset );
-              else if( format == SpecUtils::SaveSpectrumAsType::Cnf )
-                wrote = info.write_cnf( output, samplenumset, detnumset );
-              else if( format == SpecUtils::SaveSpectrumAsType::Tka )
-                wrote = info.write_tka( output, samplenumset, detnumset );
-              else
-                assert( 0 );
-              
-              
-              if( !wrote )
-              {
-                encoded_all_files = false;
-                cerr << "Possibly failed writing of '" + outname + "'" << endl;
-              }else
-              {
-                cout << "Saved '" << outname << "'" << endl;
-              }
-              
-              nwroteone += wrote;
-            }
+            record_outputs.push_back( RecordOutput{ sample, detnum, outname } );
           }//foreach( const int detnum, detnums )
         }//foreach( const int sample, samplenums )
+        
+        vector<size_t> to_write;
+        unique_ptr<ParallelOutput::DirectoryListing> existing_files;
+        if( !output_archive )
+          existing_files.reset( new ParallelOutput::DirectoryListing( SpecUtils::parent_path(saveto) ) );
+        
+        for( size_t i = 0; i < record_outputs.size(); ++i )
+        {
+          const RecordOutput &record = record_outputs[i];
+          const bool exists = existing_files ? existing_files->contains( record.outname )
+                                             : output_archive->contains( record.outname );
+          if( !force_writing && exists )
+          {
+            cerr << "Output file '" << record.outname << "' existed, and --force not"
+            << " specified, not saving file" << endl;
+            file_existed = true;
+            continue;
+          }//if( !force_writing && file exists )
+          
+          to_write.push_back( i );
+        }//for( size_t i = 0; i < record_outputs.size(); ++i )
+        
+        const size_t num_encoders = ParallelOutput::resolve_num_threads( num_jobs );
+        const size_t num_writers = std::min( num_encoders, size_t(4) );
+        
+        // SpecFile serializes its write functions with an internal mutex, so we will give each
+        //  encoding thread its own copy of `info`; this is fairly cheap as the channel data of
+        //  the measurements is shared between copies.
+        vector<unique_ptr<SpecUtils::SpecFile>> thread_infos( num_encoders );
+        vector<char> encoded( to_write.size(), 0 );
+        
+        ParallelOutput::AsyncFileWriter writer( to_write.size(), num_writers, sync_output,
+                                                output_archive.get() );
+        
+        try
+        {
+          ParallelOutput::parallel_for( to_write.size(), num_encoders,
+                                        [&]( const size_t index, const size_t thread_index ){
+            unique_ptr<SpecUtils::SpecFile> &thread_info = thread_infos[thread_index];
+            if( !thread_info )
+              thread_info.reset( new SpecUtils::SpecFile( info ) );
+            
+            const RecordOutput &record = record_outputs[to_write[index]];
+            const std::set<int> detnumset{ record.detnum }, samplenumset{ record.sample };
+            
+            std::ostringstream output;
+            
+            bool wrote = false;
+            if( format == SpecUtils::SaveSpectrumAsType::Chn )
+              wrote = thread_info->write_integer_chn( output, samplenumset, detnumset );
+            else if( format == SpecUtils::SaveSpectrumAsType::SpcBinaryInt )
+              wrote = thread_info->write_binary_spc( output, SpecUtils::SpecFile::IntegerSpcType, samplenumset, detnumset );
+            else if( format == SpecUtils::SaveSpectrumAsType::SpcBinaryFloat )
+              wrote = thread_info->write_binary_spc( output, SpecUtils::SpecFile::FloatSpcType, samplenumset, detnumset );
+            else if( format == SpecUtils::SaveSpectrumAsType::SpcAscii )
+              wrote = thread_info->write_ascii_spc( output, samplenumset, detnumset );
+            else if( format == SpecUtils::SaveSpectrumAsType::SpeIaea )
+              wrote = thread_info->write_iaea_spe( output, samplenumset, detnumset );
+            else if( format == SpecUtils::SaveSpectrumAsType::Cnf )
+              wrote = thread_info->write_cnf( output, samplenumset, detnumset );
+            else if( format == SpecUtils::SaveSpectrumAsType::Tka )
+              wrote = thread_info->write_tka( output, samplenumset, detnumset );
+            else
+              assert( 0 );
+            
+            // Each record is small, and records are already encoded in parallel, so we will
+            //  compress each one on this thread.
+            string contents = output.str();
+            if( wrote && (output_compression != CompressedOutput::Compression::None) )
+            {
+              contents = CompressedOutput::compress( contents, output_compression, 1 );
+              wrote = !contents.empty();
+            }
+            
+            if( wrote )
+            {
+              encoded[index] = 1;
+              writer.submit( index, record.outname, std::move(contents) );
+            }
+          } );
+        }catch( std::exception &e )
+        {
+          encoded_all_files = false;
+          cerr << "Error writing individual records of '" << inname << "': " << e.what() << endl;
+        }//try / catch
+        
+        const vector<bool> &written = writer.finish();
+        
+        for( size_t index = 0; index < to_write.size(); ++index )
+        {
+          const string &outname = record_outputs[to_write[index]].outname;
+          
+          if( !encoded[index] || !written[index] )
+          {
+            encoded_all_files = false;
+            cerr << "Possibly failed writing of '" + outname + "'" << endl;
+          }else
+          {
+            cout << "Saved '" << outname << "'" << endl;
+          }
+        }//for( loop over records we tried to write )
       }//if( we should sum all of then and then save ) / else
+#if( SpecUtils_ENABLE_URI_SPECTRA )
+    }else if( uri_per_measurement )
+    {
+      // Each measurement gets its own set of URIs; deflating and base-45/64 encoding them is
+      //  what takes the time, so we will encode the measurements in parallel, and then either
+      //  write them out one per line to a single file, or (if writing to an archive) hand them
+      //  off to a few threads to write as a file per measurement.
+      assert( format == SpecUtils::SaveSpectrumAsType::Uri );
+      
+      if( (num_uris == 0) || (num_uris > 9) )
+      {
+        cerr << "You must specify between 1 and 9 URIs per measurement." << endl;
+        encoded_all_files = false;
+        return make_pair(false, file_existed);
+      }
+      
+      // Neutron-only records can not be put into a URI by themselves, so their counts are added
+      //  to the first gamma record of the same sample, as they would be if the whole sample was
+      //  encoded together.
+      vector<shared_ptr<const SpecUtils::Measurement>> meass;
+      map<int,vector<shared_ptr<const SpecUtils::Measurement>>> sample_neutron_records;
+      for( const auto &m : info.measurements() )
+      {
+        if( m && (m->num_gamma_channels() > 0) )
+          meass.push_back( m );
+        else if( m && m->contained_neutron() )
+          sample_neutron_records[m->sample_number()].push_back( m );
+      }
+      
+      set<int> samples_with_neutrons_added;
+      for( shared_ptr<const SpecUtils::Measurement> &m : meass )
+      {
+        const auto neutron_pos = sample_neutron_records.find( m->sample_number() );
+        if( (neutron_pos == end(sample_neutron_records))
+            || !samples_with_neutrons_added.insert( m->sample_number() ).second )
+          continue;
+        
+        vector<float> neutron_counts = m->neutron_counts();
+        float neutron_live_time = m->contained_neutron() ? m->neutron_live_time() : 0.0f;
+        for( const shared_ptr<const SpecUtils::Measurement> &neutron_meas : neutron_pos->second )
+        {
+          const vector<float> &counts = neutron_meas->neutron_counts();
+          neutron_counts.insert( end(neutron_counts), begin(counts), end(counts) );
+          if( neutron_live_time <= 0.0f )
+            neutron_live_time = neutron_meas->neutron_live_time();
+        }
+        
+        auto combined = make_shared<SpecUtils::Measurement>( *m );
+        combined->set_neutron_counts( neutron_counts, neutron_live_time );
+        m = combined;
+      }//for( loop over gamma records )
+      
+      if( meass.empty() )
+      {
+        cerr << "'" << inname << "' did not contain any gamma spectra to write as URIs." << endl;
+        encoded_all_files = false;
+        return make_pair(false, file_existed);
+      }
+      
+      const bool to_archive = !!output_archive;
+      
+      string extention;
+      string basename = uncompressed_saveto;
+      const string::size_type pos = uncompressed_saveto.find_last_of( '.' );
+      if( pos != string::npos )
+      {
+        extention = uncompressed_saveto.substr( pos );
+        basename = uncompressed_saveto.substr( 0, pos );
+      }//if( pos != string::npos )
+      extention += compressed_ext;
+      
+      vector<string> outnames;
+      vector<size_t> to_write;
+      for( size_t i = 0; i < meass.size(); ++i )
+      {
+        if( !to_archive )
+        {
+          to_write.push_back( i );
+          continue;
+        }
+        
+        char buffer[32];
+        snprintf( buffer, sizeof(buffer), "_%04d", static_cast<int>(i) );
+        outnames.push_back( basename + buffer + extention );
+        
+        if( !force_writing && output_archive->contains( outnames.back() ) )
+        {
+          cerr << "Output file '" << outnames.back() << "' existed, and --force not"
+          << " specified, not saving file" << endl;
+          file_existed = true;
+          continue;
+        }//if( !force_writing && file exists )
+        
+        to_write.push_back( i );
+      }//for( size_t i = 0; i < meass.size(); ++i )
+      
+      if( !to_archive && !force_writing && output_exists(saveto) )
+      {
+        cerr << "Output file '" << saveto << "' existed, and --force not"
+        << " specified, not saving file" << endl;
+        file_existed = true;
+        return make_pair(false, file_existed);
+      }//if( !force_writing && SpecUtils::is_file(savename) )
+      
+      const size_t num_encoders = ParallelOutput::resolve_num_threads( num_jobs );
+      const size_t num_writers = std::min( num_encoders, size_t(4) );
+      const string model = info.instrument_model();
+      
+      // When writing to a single file, we keep the encoded URIs of each measurement until all
+      //  are done, so they can be written in order; they are only a few kilobytes each.
+      vector<string> records( to_archive ? size_t(0) : to_write.size() );
+      vector<string> errors( to_write.size() );
+      vector<char> encoded( to_write.size(), 0 );
+      
+      unique_ptr<ParallelOutput::AsyncFileWriter> writer;
+      if( to_archive )
+        writer.reset( new ParallelOutput::AsyncFileWriter( to_write.size(), num_writers,
+                                                           sync_output, output_archive.get() ) );
+      
+      ParallelOutput::parallel_for( to_write.size(), num_encoders,
+                                    [&]( const size_t index, const size_t /*thread_index*/ ){
+        try
+        {
+          const vector<shared_ptr<const SpecUtils::Measurement>> spec{ meass[to_write[index]] };
+          const vector<SpecUtils::UrlSpectrum> url_spectra = SpecUtils::to_url_spectra( spec, model );
+          const vector<string> uris = SpecUtils::url_encode_spectra( url_spectra,
+                                                                     uri_encode_options, num_uris );
+          if( uris.empty() )
+            throw runtime_error( "no URIs were created" );
+          
+          string contents;
+          for( const string &uri : uris )
+          {
+            contents += uri;
+            contents += '\n';
+          }
+          
+          // With more than one URI per measurement, each measurement's URIs are followed by a
+          //  blank line, so it is clear which URIs go together.
+          if( !to_archive && (num_uris > 1) )
+            contents += '\n';
+          
+          if( !to_archive )
+          {
+            records[index] = std::move( contents );
+            encoded[index] = 1;
+            return;
+          }
+          
+          // Each record is small, so we will compress it on this thread.
+          if( output_compression != CompressedOutput::Compression::None )
+          {
+            contents = CompressedOutput::compress( contents, output_compression, 1 );
+            if( contents.empty() )
+              throw runtime_error( "failed to compress" );
+          }
+          
+          encoded[index] = 1;
+          writer->submit( index, outnames[to_write[index]], std::move(contents) );
+        }catch( std::exception &e )
+        {
+          errors[index] = e.what();
+        }//try / catch
+      } );
+      
+      for( size_t index = 0; index < to_write.size(); ++index )
+      {
+        if( !encoded[index] )
+        {
+          encoded_all_files = false;
+          const size_t meas_index = to_write[index];
+          cerr << "Failed to encode measurement " << meas_index << " (sample "
+               << meass[meas_index]->sample_number() << ", detector '"
+               << meass[meas_index]->detector_name() << "') of '" << inname
+               << "' as URI: " << errors[index] << endl;
+        }
+      }//for( size_t index = 0; index < to_write.size(); ++index )
+      
+      if( to_archive )
+      {
+        const vector<bool> &written = writer->finish();
+        
+        for( size_t index = 0; index < to_write.size(); ++index )
+        {
+          if( !encoded[index] )
+            continue;
+          
+          const string &outname = outnames[to_write[index]];
+          if( !written[index] )
+          {
+            encoded_all_files = false;
+            cerr << "Possibly failed writing of '" + outname + "'" << endl;
+          }else
+          {
+            cout << "Saved '" << outname << "'" << endl;
+          }
+        }//for( loop over records we tried to write )
+      }else
+      {
+        OutputFile output( saveto, sync_output, output_archive.get() );
+        output.compress( output_compression, num_jobs );
+        
+        if( !output.is_open() )
+        {
+          cerr << "Failed to open output file " << saveto << endl;
+          opened_all_output_files = false;
+          return make_pair(false, file_existed);
+        }
+        
+        // A measurement that failed to encode gets an empty line, so each line (or group of
+        //  lines) still lines up with its measurement.
+        for( size_t index = 0; index < records.size(); ++index )
+        {
+          if( !encoded[index] )
+            output.write( "\n", 1 );
+          else
+            output.write( records[index].data(), static_cast<streamsize>(records[index].size()) );
+        }
+        
+        const bool wrote = (output.good() && output.commit());
+        
+        if( !wrote )
+        {
+          encoded_all_files = false;
+          cerr << "Possibly failed write of '" << saveto << "'" << endl;
+        }else
+        {
+          cout << "Saved '" << saveto << "'" << endl;
+        }
+      }//if( to_archive ) / else
+#endif //SpecUtils_ENABLE_URI_SPECTRA
     }else if( format != SpecUtils::SaveSpectrumAsType::NumTypes )
     {
       // a single spectrum output format
-      if( !force_writing && SpecUtils::is_file(saveto) )
+      if( !force_writing && output_exists(saveto) )
       {
         cerr << "Output file '" << saveto << "' existed, and --force not"
         << " specified, not saving file" << endl;
@@ -1861,11 +2808,8 @@ int run_command_util( const int argc, char *argv[] )
         return make_pair(false, file_existed);
       }//if( !force_writing && SpecUtils::is_file(savename) )
       
-#ifdef _WIN32
-      ofstream output( convert_from_utf8_to_utf16(saveto).c_str(), ios_base::binary | ios_base::out );
-#else
-      ofstream output( saveto.c_str(), ios_base::binary | ios_base::out );
-#endif
+      OutputFile output( saveto, sync_output, output_archive.get() );
+      output.compress( output_compression, num_jobs );
       
       if( !output.is_open() )
       {
@@ -1916,22 +2860,10 @@ int run_command_util( const int argc, char *argv[] )
           {
             output << "[\n\t";
             
-#if( WRITE_JSON_META_INFO )
-            add_file_meta_info_to_json( output, info );
-#endif
-            
             for( size_t i = 0; i < measurements.size(); ++i )
             {
               const auto &meas = *measurements[i];
               
-#if( WRITE_JSON_META_INFO )
-              //output meta-information on the spectrum level (there may be multiple spectra in a single file)
-              //  not implemented at all yet; should probably be done inside D3SpectrumExport::write_spectrum_data_js(...)
-              //meas.has_gps_info() { meas.position_time(), meas.latitude(), meas.longitude()}
-              //meas.contained_neutron()
-              //meas.remarks()
-              //meas.source_type()
-#endif
               if( i != 0 )
                 output << ",\n\t";
               
@@ -1942,6 +2874,11 @@ int run_command_util( const int argc, char *argv[] )
             }//for( loop over measurements )
             
             output << "\n]" << endl;
+          }else if( SpecUtils::iequals_ascii( html_to_include, "json-meta" ) )
+          {
+            JsonWriter json( output );
+            SpectrumJson::write_file( json, info, measurements );
+            wrote = json.flush();
           }else if( SpecUtils::iequals_ascii( html_to_include, "css" ) )
           {
 #if( SpecUtils_D3_SUPPORT_FILE_STATIC )
@@ -2007,7 +2944,8 @@ int run_command_util( const int argc, char *argv[] )
             cerr << "Writing controls HTML is not supported yet - sorry" << endl;
             assert( 0 );
             exit( 12 );
-          }else if( SpecUtils::iequals_ascii( html_to_include, "all" ) )
+          }else if( SpecUtils::iequals_ascii( html_to_include, "all" )
+                    || SpecUtils::iequals_ascii( html_to_include, "lazy" ) )
           {
             using namespace D3SpectrumExport;
             D3SpectrumChartOptions fileopts;
@@ -2037,58 +2975,129 @@ int run_command_util( const int argc, char *argv[] )
             
             const char *endline = "\r\n";
             
-            html_page_header( output, fileopts.m_title );
+            //Write the JavaScript and CSS the first time we write a page to each directory
+            const string assets_dir = SpecUtils::parent_path( saveto );
+            bool first_page_in_dir = false;
+            if( html_shared_assets )
+            {
+              std::lock_guard<std::mutex> lock( *html_asset_dirs_mutex );
+              first_page_in_dir = html_asset_dirs->insert( assets_dir ).second;
+            }
             
-            output << "<body>" << endline;
+            if( first_page_in_dir )
+            {
+              const size_t num_assets = sizeof(ns_html_shared_asset_names) / sizeof(ns_html_shared_asset_names[0]);
+              for( size_t index = 0; index < num_assets; ++index )
+              {
+                const string asset_path = SpecUtils::append_path( assets_dir, ns_html_shared_asset_names[index] );
+                if( !force_writing && output_exists(asset_path) )
+                  continue;
+                
+                OutputFile asset( asset_path, sync_output, output_archive.get() );
+                asset << html_shared_asset( index );
+                if( !asset.commit() )
+                {
+                  encoded_all_files = false;
+                  cerr << "Failed to write '" << asset_path << "'" << endl;
+                }
+              }//for( loop over assets )
+            }//if( first page in this directory )
             
-            for( size_t i = 0; i < measurements.size(); ++i )
+            if( SpecUtils::iequals_ascii( html_to_include, "lazy" ) )
             {
-              std::shared_ptr<const SpecUtils::Measurement> m = measurements[i];
-              const string div_id = "chart" + std::to_string(i);
+              //The records are written, a chunk per file, into a directory next to the page
+              const string data_dir_name = lazy_html_data_dir_name( uncompressed_saveto );
+              const string data_dir = SpecUtils::append_path( assets_dir, data_dir_name );
               
-              fileopts.m_dataTitle = m->title();
-              if( fileopts.m_dataTitle.empty() )
+              if( !output_archive && !SpecUtils::is_directory( data_dir )
+                  && !SpecUtils::create_directory( data_dir ) )
               {
-                if( m->detector_name() != "" )
-                  fileopts.m_dataTitle = "Det " + m->detector_name() + " ";
-                fileopts.m_dataTitle += "Sample " + to_string(m->sample_number());
+                cerr << "Failed to create directory '" << data_dir << "'" << endl;
+                return make_pair(false, file_existed);
               }
               
-              vector< pair<const SpecUtils::Measurement *,D3SpectrumOptions> > htmlinput;
-              htmlinput.push_back( std::pair<const SpecUtils::Measurement *,D3SpectrumOptions>(m.get(),specopts) );
+              const size_t num_chunks = (measurements.size() + ns_lazy_html_chunk_size - 1) / ns_lazy_html_chunk_size;
+              const size_t num_encoders = ParallelOutput::resolve_num_threads( num_jobs );
+              const size_t num_writers = std::min( num_encoders, size_t(4) );
               
-              output << "<div id=\"" << div_id << "\" class=\"chart\" oncontextmenu=\"return false;\";></div>" << endline;  // Adding the main chart div
+              ParallelOutput::AsyncFileWriter writer( num_chunks, num_writers, sync_output,
+                                                      output_archive.get() );
               
+              try
+              {
+                ParallelOutput::parallel_for( num_chunks, num_encoders,
+                                              [&]( const size_t index, const size_t ){
+                  writer.submit( index, SpecUtils::append_path( data_dir, lazy_html_chunk_name(index) ),
+                                 lazy_html_chunk( measurements, index ) );
+                } );
+              }catch( std::exception &e )
+              {
+                cerr << "Error writing records of '" << inname << "': " << e.what() << endl;
+              }
               
-              output << "<script>" << endline;
-              write_js_for_chart( output, div_id, fileopts.m_dataTitle, fileopts.m_xAxisTitle, fileopts.m_yAxisTitle );
-              write_and_set_data_for_chart( output, div_id, htmlinput );
+              const vector<bool> &written = writer.finish();
+              const bool wrote_chunks = std::all_of( begin(written), end(written), []( bool b ){ return b; } );
+              if( !wrote_chunks )
+                cerr << "Failed to write all the data files in '" << data_dir << "'" << endl;
               
-              output <<
-                "const resizeChart_" << div_id << " = function(){\n"
-                "  let height = window.innerHeight;\n"
-                "  let width = window.innerWidth; \n"
-                "  let el = spec_chart_" << div_id << ".chart;\n"
-                "  el.style.width = (width - 40) + \"px\";\n"
-                "  el.style.height = Math.max(250, Math.min(0.4*width,height-175)) + \"px\";\n"
-                "  el.style.marginLeft = \"20px\";\n"
-                "  el.style.marginRight = \"20px\";\n"
-                "  spec_chart_" << div_id << ".handleResize();\n"
-                "};\n"
-                "resizeChart_" << div_id << "();\n"
-                "window.addEventListener('resize', resizeChart_" << div_id << ");\n";
-              //output << "window.addEventListener('resize',function(){spec_chart_" << div_id << ".handleResize();});" << endline;
+              wrote = (write_lazy_html_page( output, fileopts, data_dir_name, measurements.size(),
+                                             html_shared_assets )
+                       && wrote_chunks);
+            }else
+            {
+              html_page_header( output, fileopts.m_title, html_shared_assets );
+            
+              output << "<body>" << endline;
+            
+              for( size_t i = 0; i < measurements.size(); ++i )
+              {
+                std::shared_ptr<const SpecUtils::Measurement> m = measurements[i];
+                const string div_id = "chart" + std::to_string(i);
               
-              write_set_options_for_chart( output, div_id, fileopts );
-              output << "</script>" << endline;
+                fileopts.m_dataTitle = m->title();
+                if( fileopts.m_dataTitle.empty() )
+                {
+                  if( m->detector_name() != "" )
+                    fileopts.m_dataTitle = "Det " + m->detector_name() + " ";
+                  fileopts.m_dataTitle += "Sample " + to_string(m->sample_number());
+                }
               
-              write_html_display_options_for_chart( output, div_id, fileopts );
-            }
+                vector< pair<const SpecUtils::Measurement *,D3SpectrumOptions> > htmlinput;
+                htmlinput.push_back( std::pair<const SpecUtils::Measurement *,D3SpectrumOptions>(m.get(),specopts) );
+              
+                output << "<div id=\"" << div_id << "\" class=\"chart\" oncontextmenu=\"return false;\";></div>" << endline;  // Adding the main chart div
+              
+              
+                output << "<script>" << endline;
+                write_js_for_chart( output, div_id, fileopts.m_dataTitle, fileopts.m_xAxisTitle, fileopts.m_yAxisTitle );
+                write_and_set_data_for_chart( output, div_id, htmlinput );
+              
+                output <<
+                  "const resizeChart_" << div_id << " = function(){\n"
+                  "  let height = window.innerHeight;\n"
+                  "  let width = window.innerWidth; \n"
+                  "  let el = spec_chart_" << div_id << ".chart;\n"
+                  "  el.style.width = (width - 40) + \"px\";\n"
+                  "  el.style.height = Math.max(250, Math.min(0.4*width,height-175)) + \"px\";\n"
+                  "  el.style.marginLeft = \"20px\";\n"
+                  "  el.style.marginRight = \"20px\";\n"
+                  "  spec_chart_" << div_id << ".handleResize();\n"
+                  "};\n"
+                  "resizeChart_" << div_id << "();\n"
+                  "window.addEventListener('resize', resizeChart_" << div_id << ");\n";
+                //output << "window.addEventListener('resize',function(){spec_chart_" << div_id << ".handleResize();});" << endline;
+              
+                write_set_options_for_chart( output, div_id, fileopts );
+                output << "</script>" << endline;
+              
+                write_html_display_options_for_chart( output, div_id, fileopts );
+              }
             
-            output << "</body>" << endline;
-            output << "</html>" << endline;
+              output << "</body>" << endline;
+              output << "</html>" << endline;
             
-            wrote = output.good();
+              wrote = output.good();
+            }//if( lazy loading page ) / else
           }else
           {
             // We should have already caught this above in our initial checks
@@ -2129,7 +3138,7 @@ int run_command_util( const int argc, char *argv[] )
             throw runtime_error( "There are " + std::to_string(num_meas) + " measurements, but"
                                 " you specified to write to " + std::to_string(num_uris)
                                 + " URIs.  Multiple measurements may only be written to a"
-                                " single URI." );
+                                " single URI, unless --uri-per-measurement is specified." );
           
           info.write_uri( output, num_uris, uri_encode_options );
           
@@ -2151,6 +3160,8 @@ int run_command_util( const int argc, char *argv[] )
           break;
       }//switch( format )
       
+      wrote = (wrote && output.commit());
+      
       if( !wrote )
       {
         encoded_all_files = false;
@@ -2159,12 +3170,11 @@ int run_command_util( const int argc, char *argv[] )
       {
         cout << "Saved '" << saveto << "'" << endl;
       }
-    }else //if( we are writing a CALp file )
+    }else if( write_arrow )
     {
-      assert( (outputformatstr == "calp") == (format == SpecUtils::SaveSpectrumAsType::NumTypes) );
-    
-      // a single spectrum output format
-      if( !force_writing && SpecUtils::is_file(saveto) )
+      assert( format == SpecUtils::SaveSpectrumAsType::NumTypes );
+      
+      if( !force_writing && output_exists(saveto) )
       {
         cerr << "Output file '" << saveto << "' existed, and --force not"
         << " specified, not saving file" << endl;
@@ -2172,52 +3182,150 @@ int run_command_util( const int argc, char *argv[] )
         return make_pair(false, file_existed);
       }//if( !force_writing && SpecUtils::is_file(savename) )
       
-      size_t num_written = 0;
-      stringstream calp_contents;
-    
-      set<string> dets_so_far;
+      OutputFile output( saveto, sync_output, output_archive.get() );
+      output.compress( output_compression, num_jobs );
       
-      //Note that disp_detectors has both gamma and neutron detectors, but we only care about gamma
-      const vector<string> &gamma_detectors = info.gamma_detector_names();
-      const vector<string> &all_detectors = info.detector_names();
-      const vector<string> &neut_dets = info.neutron_detector_names();
+      if( !output.is_open() )
+      {
+        cerr << "Failed to open output file " << saveto << endl;
+        opened_all_output_files = false;
+        return make_pair(false, file_existed);
+      }
       
-      for( const int sample : info.sample_numbers() )
+      // Rows are written out in batches as we go, so we dont hold a second copy of the file
+      ArrowWriter arrow( output );
+      for( const shared_ptr<const SpecUtils::Measurement> &meas : info.measurements() )
+        arrow.add( *meas );
+      
+      if( !arrow.finish() || !output.commit() )
+      {
+        encoded_all_files = false;
+        cerr << "Possibly failed write of '" << saveto << "'" << endl;
+      }else
       {
-        for( const string &det : all_detectors )
+        cout << "Saved '" << saveto << "'" << endl;
+      }
+    }else if( write_npy )
+    {
+      assert( format == SpecUtils::SaveSpectrumAsType::NumTypes );
+      
+      // The counts matrix goes in the .npy file, so it can be memory-mapped, and the information
+      //  about each row in a .npz file next to it.
+      const string meta_saveto = npy_meta_filename( uncompressed_saveto, compressed_ext );
+      
+      for( const string &name : { saveto, meta_saveto } )
+      {
+        if( !force_writing && output_exists(name) )
         {
-          if( dets_so_far.count(det) )
-            continue;
-          
-          const shared_ptr<const SpecUtils::Measurement> m = info.measurement( sample, det );
-          shared_ptr<const SpecUtils::EnergyCalibration> cal = m ? m->energy_calibration() : nullptr;
-          
-          if( !cal || !cal->valid() || (cal->num_channels() < 3) )
-          {
-            // We'll assume that a detector that only has neutrons, will always only have neutrons...
-            //  TODO: this may not actually be that good of an assumptions; re-evaluate later.
-            if( std::find(begin(neut_dets), end(neut_dets), det) != end(neut_dets) )
-              dets_so_far.insert( det );
-            
-            continue;
-          }//if( energy cal is not valid )
-          
-          // Dont write the detector name if its unambiguous
-          const string detname = (gamma_detectors.size() == 1) ? string() : det;
-          
-          if( SpecUtils::write_CALp_file(calp_contents, cal, detname) )
-          {
-            num_written += 1;
-            dets_so_far.insert( det );
-          }else
-          {
-            cerr << "Error writing CALp for detector '" << detname << "'" << endl;
-          }
-        }//for( const string det : all_detectors )
+          cerr << "Output file '" << name << "' existed, and --force not"
+          << " specified, not saving file" << endl;
+          file_existed = true;
+          return make_pair(false, file_existed);
+        }//if( !force_writing && SpecUtils::is_file(name) )
+      }//for( loop over the two output files )
+      
+      const vector<shared_ptr<const SpecUtils::Measurement>> measurements
+                                          = NumpyOutput::gamma_measurements( info.measurements() );
+      try
+      {
+        NumpyOutput::common_num_channels( measurements );
+      }catch( std::exception &e )
+      {
+        cerr << "Can not write '" << saveto << "': " << e.what() << endl;
+        encoded_all_files = false;
+        return make_pair(false, file_existed);
+      }//try / catch
+      
+      OutputFile counts_output( saveto, sync_output, output_archive.get() );
+      counts_output.compress( output_compression, num_jobs );
+      
+      OutputFile meta_output( meta_saveto, sync_output, output_archive.get() );
+      meta_output.compress( output_compression, num_jobs );
+      
+      if( !counts_output.is_open() || !meta_output.is_open() )
+      {
+        cerr << "Failed to open output file " << (counts_output.is_open() ? meta_saveto : saveto) << endl;
+        opened_all_output_files = false;
+        return make_pair(false, file_existed);
+      }
+      
+      const bool wrote = NumpyOutput::write_counts( counts_output, measurements )
+                         && NumpyOutput::write_metadata( meta_output, measurements )
+                         && counts_output.commit() && meta_output.commit();
+      
+      if( !wrote )
+      {
+        encoded_all_files = false;
+        cerr << "Possibly failed write of '" << saveto << "'" << endl;
+      }else
+      {
+        cout << "Saved '" << saveto << "' and '" << meta_saveto << "'" << endl;
+      }
+    }else if( write_time_series )
+    {
+      assert( format == SpecUtils::SaveSpectrumAsType::NumTypes );
+      
+      if( !force_writing && output_exists(saveto) )
+      {
+        cerr << "Output file '" << saveto << "' existed, and --force not"
+        << " specified, not saving file" << endl;
+        file_existed = true;
+        return make_pair(false, file_existed);
+      }//if( !force_writing && SpecUtils::is_file(savename) )
+      
+      // Detectors were already selected by the --det-to-include/--det-to-exclude options
+      const TimeSeries::SampleTable table = TimeSeries::tabulate( info, num_jobs );
+      const vector<bool> all_detectors( table.detector_numbers.size(), true );
+      const TimeSeries::Series series = TimeSeries::combine( table, all_detectors );
+      
+      OutputFile output( saveto, sync_output, output_archive.get() );
+      output.compress( output_compression, num_jobs );
+      
+      if( !output.is_open() )
+      {
+        cerr << "Failed to open output file " << saveto << endl;
+        opened_all_output_files = false;
+        return make_pair(false, file_existed);
+      }
+      
+      if( !TimeSeries::write_csv( output, series ) || !output.commit() )
+      {
+        encoded_all_files = false;
+        cerr << "Possibly failed write of '" << saveto << "'" << endl;
+      }else
+      {
+        cout << "Saved '" << saveto << "'" << endl;
+      }
+    }else //if( we are writing a CALp file )
+    {
+      assert( outputformatstr == "calp" );
+      assert( format == SpecUtils::SaveSpectrumAsType::NumTypes );
+    
+      // a single spectrum output format
+      if( !force_writing && output_exists(saveto) )
+      {
+        cerr << "Output file '" << saveto << "' existed, and --force not"
+        << " specified, not saving file" << endl;
+        file_existed = true;
+        return make_pair(false, file_existed);
+      }//if( !force_writing && SpecUtils::is_file(savename) )
+      
+      size_t num_written = 0;
+      stringstream calp_contents;
+      
+      //Note that detector_names() has both gamma and neutron detectors, but we only care about gamma
+      const vector<string> &gamma_detectors = info.gamma_detector_names();
+      
+      for( const DetectorCalibration &det_cal : calibration_per_detector( info ) )
+      {
+        // Dont write the detector name if its unambiguous
+        const string detname = (gamma_detectors.size() == 1) ? string() : det_cal.detector;
         
-        if( all_detectors.size() == dets_so_far.size() )
-          break;
-      }//for( const int sample : m_interspec->displayedSamples(type) )
+        if( SpecUtils::write_CALp_file(calp_contents, det_cal.cal, detname) )
+          num_written += 1;
+        else
+          cerr << "Error writing CALp for detector '" << detname << "'" << endl;
+      }//for( const DetectorCalibration &det_cal : calibration_per_detector( info ) )
       
       
       if( num_written == 0 )
@@ -2227,11 +3335,8 @@ int run_command_util( const int argc, char *argv[] )
         return make_pair(false, file_existed);
       }//if( num_written == 0 )
       
-#ifdef _WIN32
-      ofstream output( convert_from_utf8_to_utf16(saveto).c_str(), ios_base::binary | ios_base::out );
-#else
-      ofstream output( saveto.c_str(), ios_base::binary | ios_base::out );
-#endif
+      OutputFile output( saveto, sync_output, output_archive.get() );
+      output.compress( output_compression, num_jobs );
       
       if( !output.is_open() )
       {
@@ -2241,6 +3346,12 @@ int run_command_util( const int argc, char *argv[] )
       }
       
       output << calp_contents.str() << endl;
+      
+      if( !output.commit() )
+      {
+        encoded_all_files = false;
+        cerr << "Possibly failed write of '" << saveto << "'" << endl;
+      }
     }//if( a single spectrum output format )
     
     const bool full_success = (opened_all_output_files && encoded_all_files);
@@ -2248,16 +3359,457 @@ int run_command_util( const int argc, char *argv[] )
   };//write_output_file lamdba
   
   
-  vector<SpecUtils::SpecFile> files_to_combine; // entries only added if 'combine-input-files' option (see bool `combine_all_files`) is specified.
+  // Returns the output path for the i'th input file (without any compression extension),
+  //  setting `fulloutdir` to the output directory that must be created first, if the directory
+  //  structure of the input directory, or archive, is being mirrored.
+  auto output_path_for = [&]( const size_t i, string &fulloutdir ) -> string {
+    const auto archive_input = archive_inputs.find( inputfiles[i] );
+    const bool from_archive = (archive_input != end(archive_inputs));
+    
+    string savename = outname;
+    
+    if( savename.empty() )
+    {
+      savename = SpecUtils::filename( FileLoader::uncompressed_name(inputfiles[i]) );
+      const string::size_type pos = savename.find_last_of( '.' );
+      if( pos && (pos != string::npos) && (pos < (savename.size()-1)) )
+      {
+        string ext = savename.substr(pos+1);
+        SpecUtils::to_lower_ascii( ext );
+      
+        if( std::count(spec_exts, spec_exts+len_spec_exts, ext) )
+          savename = savename.substr( 0, pos );
+      }//if( pos != string::npos )
+    }//if( savename.empty() )
+  
+    const string::size_type pos = savename.find_last_of( '.' );
+    if( pos && (pos != string::npos) && (pos < (savename.size()-1)) )
+    {
+      const string ext = savename.substr(pos+1);
+      if( !SpecUtils::iequals_ascii( ext, ending )  )
+        savename += "." + ending;
+    }else
+    {
+      savename += "." + ending;
+    }
+  
+    string saveto = SpecUtils::append_path( outdir, savename );
+    fulloutdir.clear();
+  
+    //Mirror the directory structure of the input directory, or archive
+    const bool mirror_archive = (from_archive && outname.empty());
+    if( mirror_archive || (!inputdir.empty() && recursive) )
+    {
+      assert( mirror_archive || (outputname == outdir) );
+      //Need to get relative path difference between inputdir and inputfiles[i]
+      //and then make that hierarchy of directories (once we know the file
+      //parses), if it doesnt already exist.
+      
+      const string reldir = mirror_archive
+            ? SpecUtils::parent_path( archive_input->second.reader->entries()[archive_input->second.index].name )
+            : SpecUtils::fs_relative( inputdir, SpecUtils::parent_path(inputfiles[i]) );
+      
+      fulloutdir = SpecUtils::append_path( outdir, reldir );
+      saveto = SpecUtils::append_path( fulloutdir, savename );
+    }//if( mirror_archive || (!inputdir.empty() && recursive) )
+    
+    return saveto;
+  };//output_path_for(...)
+  
+  
+  // Parses an input file from disk, or from inside an input archive, printing how long it
+  //  took if --print-load-timing was specified; may be called from multiple threads at once.
+  auto load_input = [&archive_inputs, print_load_timing]( const string &inname,
+                                                          SpecUtils::SpecFile &info ) -> bool {
+    const auto archive_input = archive_inputs.find( inname );
+    const bool from_archive = (archive_input != end(archive_inputs));
+    
+    FileLoader::LoadTiming load_timing;
+    bool loaded = false;
+    
+    if( from_archive )
+    {
+      const ArchiveReader &reader = *archive_input->second.reader;
+      const size_t index = archive_input->second.index;
+      const string &entry_name = reader.entries()[index].name;
+      
+      string contents;
+      if( !reader.read( index, contents ) )
+      {
+        cerr << "Failed to read '" << entry_name << "' from archive '"
+             << reader.filename() << "'" << endl;
+        return false;
+      }//if( !reader.read( index, contents ) )
+      
+      // Compressed entries are decompressed as they are parsed.
+      loaded = FileLoader::load_from_memory( info, contents.data(), contents.size(),
+                                     FileLoader::uncompressed_name(entry_name), &load_timing );
+    }else
+    {
+      loaded = FileLoader::load_file( info, inname, inname, &load_timing );
+    }//if( from_archive ) / else
+    
+    if( print_load_timing )
+    {
+      // Put the whole line together first, so lines from different threads dont get mixed up
+      stringstream msg;
+      msg << "Loading '" << inname << "': detected format "
+          << FileLoader::parser_type_name( load_timing.sniffed_type )
+          << (load_timing.used_auto ? " (fell back to trying all formats)" : "")
+          << ", sniff " << 1000.0*load_timing.sniff_seconds << " ms";
+      if( load_timing.compression != FileLoader::Compression::None )
+        msg << ", " << FileLoader::compression_name( load_timing.compression )
+            << " decompress " << 1000.0*load_timing.decompress_seconds << " ms";
+      msg << ", parse " << 1000.0*load_timing.parse_seconds << " ms\n";
+      cout << msg.str() << flush;
+    }//if( print_load_timing )
+    
+    if( !loaded && !load_timing.error.empty() )
+      cerr << ("Error loading '" + inname + "': " + load_timing.error + "\n") << flush;
+    
+    return loaded;
+  };//load_input(...)
+  
+  
+  vector<CompactSpecFile> files_to_combine; // entries only added if 'combine-input-files' option (see bool `combine_all_files`) is specified.
+  
+  //Output directories created (or found to exist) when mirroring the input tree
+  ParallelOutput::DirectoryCache output_directories;
+  
+  //Unless records may be written to separate files (with names depending on
+  //  the file contents), the output file name for each input is known before
+  //  parsing it, letting us skip inputs that have already been converted.
+  const bool output_name_predictable = !combine_all_files
+                            && (summ_meas_for_single_out || !is_single_spectrum_format(format));
+  
+  //Returns if the output file, and any other files written along with it (the .npz
+  //  next to a .npy file, or the data directory of a "lazy" HTML page), all exist.
+  auto all_outputs_exist = [&]( const string &uncompressed_saveto ) -> bool {
+    const string compressed_ext = CompressedOutput::file_extension( output_compression );
+    const string saveto = uncompressed_saveto + compressed_ext;
+    if( !output_exists( saveto ) )
+      return false;
+    
+    if( write_npy && !output_exists( npy_meta_filename( uncompressed_saveto, compressed_ext ) ) )
+      return false;
+    
+    if( (format == SpecUtils::SaveSpectrumAsType::HtmlD3)
+        && SpecUtils::iequals_ascii( html_to_include, "lazy" ) )
+    {
+      const string data_dir = SpecUtils::append_path( SpecUtils::parent_path( saveto ),
+                                                      lazy_html_data_dir_name( uncompressed_saveto ) );
+      if( !output_exists( SpecUtils::append_path( data_dir, lazy_html_chunk_name( 0 ) ) ) )
+        return false;
+    }//if( lazy HTML )
+    
+    return true;
+  };//all_outputs_exist
   
   bool parsed_all = true, input_didnt_exist = false,
        file_existed = false, wrote_all = true;
   
-  for( size_t i = 0; i < inputfiles.size(); ++i )
+  // With --CALp-batch, we parse the inputs in parallel, keeping only their energy calibrations,
+  //  and then write the CALp files; the inputs then dont go through the loop further down.
+  const bool batch_calp = !calp_batch.empty();
+  if( batch_calp )
+  {
+    assert( outputformatstr == "calp" );
+    assert( !combine_all_files );
+    
+    struct CalpInput
+    {
+      bool existed = false;
+      bool loaded = false;
+      bool single_detector = false;
+      string serial;
+      vector<DetectorCalibration> cals;
+    };//struct CalpInput
+    
+    vector<CalpInput> calp_inputs( inputfiles.size() );
+    
+    const size_t num_threads = ParallelOutput::resolve_num_threads( num_jobs );
+    
+    try
+    {
+      ParallelOutput::parallel_for( inputfiles.size(), num_threads,
+                                    [&]( const size_t i, const size_t /*thread_index*/ ){
+        CalpInput &input = calp_inputs[i];
+        const string &inname = inputfiles[i];
+        
+        input.existed = (archive_inputs.count(inname) || SpecUtils::is_file(inname));
+        if( !input.existed )
+          return;
+        
+        SpecUtils::SpecFile info;
+        input.loaded = load_input( inname, info );
+        if( !input.loaded )
+          return;
+        
+        const set<string> cals = info.energy_cal_variants();
+        if( (cals.size() > 1) && !include_all_cal_spec )
+        {
+          const string prefered_variant = preferred_energy_cal_variant( cals );
+          if( !prefered_variant.empty() )
+            info.keep_energy_cal_variants( {prefered_variant} );
+        }//if( more than one calibration present, and we only want one )
+        
+        input.serial = newserialnum.empty() ? info.instrument_id() : newserialnum;
+        input.single_detector = (info.gamma_detector_names().size() == 1);
+        
+        for( DetectorCalibration &det_cal : calibration_per_detector( info ) )
+        {
+          const string &det = det_cal.detector;
+          if( std::count( begin(detectors_to_exclude), end(detectors_to_exclude), det )
+             || (!detectors_to_include.empty()
+                 && !std::count( begin(detectors_to_include), end(detectors_to_include), det )) )
+            continue;
+          
+          const auto rename = det_renames.find( det );
+          if( rename != end(det_renames) )
+            det_cal.detector = rename->second;
+          
+          input.cals.push_back( std::move(det_cal) );
+        }//for( loop over detector calibrations )
+      } );
+    }catch( std::exception &e )
+    {
+      cerr << "Error extracting energy calibrations: " << e.what() << endl;
+      return 49;
+    }//try / catch
+    
+    // Many files will usually share the same calibrations, so we'll de-duplicate them; this lets
+    //  us tell when the calibration of a detector changed between files of an instrument.
+    CalibrationSet unique_cals;
+    size_t num_loaded = 0;
+    for( size_t i = 0; i < calp_inputs.size(); ++i )
+    {
+      CalpInput &input = calp_inputs[i];
+      
+      if( !input.existed )
+      {
+        input_didnt_exist = true;
+        cerr << "Input file '" << inputfiles[i] << "' doesnt exist, or cant be"
+             << " accessed." << endl;
+      }else if( !input.loaded )
+      {
+        parsed_all = false;
+        cerr << "Failed to parse '" << inputfiles[i] << "'" << endl;
+      }else
+      {
+        num_loaded += 1;
+        for( DetectorCalibration &det_cal : input.cals )
+          det_cal.cal = unique_cals.canonical( det_cal.cal );
+      }
+    }//for( loop over inputs )
+    
+    cout << "Found " << unique_cals.size() << " distinct energy calibrations in "
+         << num_loaded << " files." << endl;
+    
+    auto calp_contents = []( const vector<DetectorCalibration> &cals, const bool write_names ) -> string {
+      stringstream contents;
+      for( const DetectorCalibration &det_cal : cals )
+      {
+        const string detname = write_names ? det_cal.detector : string();
+        if( !SpecUtils::write_CALp_file( contents, det_cal.cal, detname ) )
+          cerr << "Error writing CALp for detector '" << detname << "'" << endl;
+      }
+      
+      return contents.str();
+    };//calp_contents(...)
+    
+    const char * const compressed_ext = CompressedOutput::file_extension( output_compression );
+    
+    vector<pair<string,string>> outputs; //{output path, CALp contents}
+    
+    if( calp_batch == "file" )
+    {
+      for( size_t i = 0; i < calp_inputs.size(); ++i )
+      {
+        const CalpInput &input = calp_inputs[i];
+        if( !input.loaded )
+          continue;
+        
+        if( input.cals.empty() )
+        {
+          cerr << "Failed to create CALp file contents for '" << inputfiles[i]
+               << "': no valid energy calibrations." << endl;
+          wrote_all = false;
+          continue;
+        }//if( input.cals.empty() )
+        
+        string fulloutdir;
+        const string saveto = output_path_for( i, fulloutdir );
+        
+        if( saveto == inputfiles[i] )
+        {
+          cerr << "Output file '" << saveto << "' identical to input file name,"
+               << " not saving file" << endl;
+          file_existed = true;
+          continue;
+        }
+        
+        //When writing to an archive, directories are implied by the entry names
+        if( !fulloutdir.empty() && !output_archive
+            && !output_directories.create_directories( fulloutdir ) )
+        {
+          cerr << "Failed to create output directory '" << fulloutdir << "'" << endl;
+          wrote_all = false;
+          continue;
+        }
+        
+        outputs.push_back( make_pair( saveto + compressed_ext,
+                                      calp_contents( input.cals, !input.single_detector ) ) );
+      }//for( loop over inputs )
+    }else
+    {
+      assert( calp_batch == "serial" );
+      
+      // The files of each instrument, in the order the instruments were first seen
+      vector<string> serials;
+      map<string,vector<size_t>> serial_inputs;
+      for( size_t i = 0; i < calp_inputs.size(); ++i )
+      {
+        if( !calp_inputs[i].loaded )
+          continue;
+        
+        const string serial = SpecUtils::trim_copy( calp_inputs[i].serial );
+        if( !serial_inputs.count(serial) )
+          serials.push_back( serial );
+        serial_inputs[serial].push_back( i );
+      }//for( loop over inputs )
+      
+      for( const string &serial : serials )
+      {
+        const vector<size_t> &input_indexes = serial_inputs[serial];
+        
+        // For each detector, the most recent calibration (by the start time of the measurement it
+        //  came from, or if that isn't known, the input order), and the input it came from.
+        vector<string> detectors;
+        map<string,pair<DetectorCalibration,size_t>> newest;
+        map<string,set<const SpecUtils::EnergyCalibration *>> distinct;
+        bool single_detector = true;
+        
+        for( const size_t i : input_indexes )
+        {
+          single_detector = (single_detector && calp_inputs[i].single_detector);
+          
+          for( const DetectorCalibration &det_cal : calp_inputs[i].cals )
+          {
+            distinct[det_cal.detector].insert( det_cal.cal.get() );
+            
+            const auto pos = newest.find( det_cal.detector );
+            if( pos == end(newest) )
+            {
+              detectors.push_back( det_cal.detector );
+              newest.insert( make_pair( det_cal.detector, make_pair(det_cal, i) ) );
+              continue;
+            }
+            
+            const SpecUtils::time_point_t &prev_time = pos->second.first.start_time;
+            if( SpecUtils::is_special(prev_time)
+               || (!SpecUtils::is_special(det_cal.start_time) && (det_cal.start_time >= prev_time)) )
+              pos->second = make_pair( det_cal, i );
+          }//for( loop over calibrations of input )
+        }//for( const size_t i : input_indexes )
+        
+        const string serial_desc = serial.empty() ? string("without a serial number") : ("'" + serial + "'");
+        
+        if( detectors.empty() )
+        {
+          cerr << "Failed to create CALp file contents for instrument " << serial_desc
+               << ": no valid energy calibrations." << endl;
+          wrote_all = false;
+          continue;
+        }//if( detectors.empty() )
+        
+        vector<DetectorCalibration> cals;
+        for( const string &det : detectors )
+        {
+          const pair<DetectorCalibration,size_t> &det_cal = newest[det];
+          cals.push_back( det_cal.first );
+          
+          if( distinct[det].size() > 1 )
+            cout << "Instrument " << serial_desc << ", detector '" << det << "' had "
+                 << distinct[det].size() << " different energy calibrations; using the most"
+                 << " recent one, from '" << inputfiles[det_cal.second] << "'" << endl;
+        }//for( const string &det : detectors )
+        
+        // Make the serial number safe to use as a file name
+        string savename = serial.empty() ? string("unknown-serial") : serial;
+        for( char &c : savename )
+        {
+          if( !isalnum( static_cast<unsigned char>(c) ) && (c != '-') && (c != '_') && (c != '.') )
+            c = '_';
+        }
+        
+        const string saveto = SpecUtils::append_path( outdir, savename + "." + ending );
+        const bool write_names = (!single_detector || (detectors.size() > 1));
+        outputs.push_back( make_pair( saveto + compressed_ext, calp_contents( cals, write_names ) ) );
+      }//for( const string &serial : serials )
+    }//if( calp_batch == "file" ) / else
+    
+    vector<size_t> to_write;
+    for( size_t index = 0; index < outputs.size(); ++index )
+    {
+      if( !force_writing && output_exists( outputs[index].first ) )
+      {
+        cerr << "Output file '" << outputs[index].first << "' existed, and --force not"
+        << " specified, not saving file" << endl;
+        file_existed = true;
+        continue;
+      }//if( !force_writing && file exists )
+      
+      to_write.push_back( index );
+    }//for( size_t index = 0; index < outputs.size(); ++index )
+    
+    {//begin codeblock to write CALp files
+      const size_t num_writers = std::min( num_threads, size_t(4) );
+      ParallelOutput::AsyncFileWriter writer( to_write.size(), num_writers, sync_output,
+                                              output_archive.get() );
+      
+      vector<char> encoded( to_write.size(), 0 );
+      for( size_t index = 0; index < to_write.size(); ++index )
+      {
+        pair<string,string> &output = outputs[to_write[index]];
+        
+        // CALp files are small, so we will compress them one at a time on this thread.
+        string contents = std::move( output.second );
+        if( output_compression != CompressedOutput::Compression::None )
+          contents = CompressedOutput::compress( contents, output_compression, 1 );
+        
+        if( contents.empty() )
+          continue;
+        
+        encoded[index] = 1;
+        writer.submit( index, output.first, std::move(contents) );
+      }//for( loop over files to write )
+      
+      const vector<bool> &written = writer.finish();
+      
+      for( size_t index = 0; index < to_write.size(); ++index )
+      {
+        const string &outname = outputs[to_write[index]].first;
+        
+        if( !encoded[index] || !written[index] )
+        {
+          wrote_all = false;
+          cerr << "Possibly failed writing of '" + outname + "'" << endl;
+        }else
+        {
+          cout << "Saved '" << outname << "'" << endl;
+        }
+      }//for( loop over files we tried to write )
+    }//end codeblock to write CALp files
+  }//if( batch_calp )
+  
+  for( size_t i = 0; !batch_calp && (i < inputfiles.size()); ++i )
   {
     try
     {
-      if( !SpecUtils::is_file(inputfiles[i]) )
+      const auto archive_input = archive_inputs.find( inputfiles[i] );
+      const bool from_archive = (archive_input != end(archive_inputs));
+      
+      if( !from_archive && !SpecUtils::is_file(inputfiles[i]) )
       {
         input_didnt_exist = true;
         cerr << "Input file '" << inputfiles[i] << "' doesnt exist, or cant be"
@@ -2265,10 +3817,34 @@ int run_command_util( const int argc, char *argv[] )
         continue;
       }//if( input file didnt exist )
     
+      string fulloutdir;
+      const string saveto = output_path_for( i, fulloutdir );
+      
+      
+      if( saveto == inputfiles[i] )
+      {
+        cerr << "Output file '" << saveto << "' identical to input file name,"
+             << " not saving file" << endl;
+        file_existed = true;
+        continue;
+      }
+      
+      //If we already know the name of the one output file this input will make,
+      //  and it already exists, skip the input before spending time parsing it.
+      if( !force_writing && output_name_predictable && all_outputs_exist( saveto ) )
+      {
+        cerr << "Output file '" << saveto << CompressedOutput::file_extension(output_compression)
+             << "' existed, and --force not specified, not saving file" << endl;
+        file_existed = true;
+        wrote_all = false;
+        continue;
+      }//if( output file already exists )
+      
       SpecUtils::SpecFile info;
     
       const string inname = inputfiles[i];
-      const bool loaded = info.load_file( inname, SpecUtils::ParserType::Auto, inname );
+      const bool loaded = load_input( inname, info );
+      
       if( !loaded )
       {
         cerr << "Failed to parse '" << inname << "'" << endl;
@@ -2280,58 +3856,7 @@ int run_command_util( const int argc, char *argv[] )
       
       if( cals.size() > 1 && !include_all_cal_spec )
       {
-        //Calibrations I've seen:
-        //"CmpEnCal", and "LinEnCal"
-        //"2.5MeV" vs "9MeV"
-        //{"EnergyCalibration", "LowEnergyCalibration", vs "FullEnergyCalibration"}
-        
-        string prefered_variant;
-        for( const auto str : cals )
-        {
-          if( SpecUtils::icontains( str, "Lin") )
-            prefered_variant = str;
-          //else if( SpecUtils::iequals_ascii( str, "EnergyCalibration") )
-          //  prefered_variant = str;
-        }//for( const auto &str : cals )
-        
-        if( prefered_variant.empty() )
-        {
-          auto getMev = []( string str ) -> double {
-            SpecUtils::to_lower_ascii(str);
-            size_t pos = str.find("mev");
-            if( pos == string::npos )
-              return -999.9;
-            str = str.substr(0,pos);
-            SpecUtils::trim( str );
-            for( size_t index = str.size(); index > 0; --index )
-            {
-              const char c = str[index-1];
-              if( !isdigit(c) && c != '.' && c!=',' )
-              {
-                str = str.substr(index);
-                break;
-              }
-            }
-            
-            double val;
-            if( stringstream(str) >> val )
-              return val;
-            
-            return -999.9;
-          };
-          
-          double maxenergy = -999.9;
-          for( const auto str : cals )
-          {
-            const double energy = getMev(str);
-            if( (energy > 0.0) && (energy > maxenergy) )
-            {
-              maxenergy = energy;
-              prefered_variant = str;
-            }
-          }//for( const auto str : cals )
-          
-        }//if( prefered_variant.empty() )
+        const string prefered_variant = preferred_energy_cal_variant( cals );
         
         if( prefered_variant.size() )
         {
@@ -2490,7 +4015,7 @@ int run_command_util( const int argc, char *argv[] )
       {
         const set<int> sample_num = info.sample_numbers();
         const std::vector<string> det_names = info.detector_names();
-        shared_ptr<SpecUtils::Measurement> summed_meas = info.sum_measurements( sample_num, det_names, nullptr );
+        shared_ptr<SpecUtils::Measurement> summed_meas = sum_measurements( info, sample_num, det_names );
         vector<shared_ptr<const SpecUtils::Measurement>> meass = info.measurements();
         for( shared_ptr<const SpecUtils::Measurement> &m : meass )
           info.remove_measurement( m, false );
@@ -2597,86 +4122,12 @@ int run_command_util( const int argc, char *argv[] )
         }//for( shared_ptr<const SpecUtils::Measurement> m : info.measurements() )
       }//if( linearize )
       
-      string savename = outname;
-      
-      if( savename.empty() )
-      {
-        savename = SpecUtils::filename(inname);
-        const string::size_type pos = savename.find_last_of( '.' );
-        if( pos && (pos != string::npos) && (pos < (savename.size()-1)) )
-        {
-          string ext = savename.substr(pos+1);
-          SpecUtils::to_lower_ascii( ext );
-        
-          if( std::count(spec_exts, spec_exts+len_spec_exts, ext) )
-            savename = savename.substr( 0, pos );
-        }//if( pos != string::npos )
-      }//if( savename.empty() )
-    
-      const string::size_type pos = savename.find_last_of( '.' );
-      if( pos && (pos != string::npos) && (pos < (savename.size()-1)) )
-      {
-        const string ext = savename.substr(pos+1);
-        if( !SpecUtils::iequals_ascii( ext, ending )  )
-          savename += "." + ending;
-      }else
-      {
-        savename += "." + ending;
-      }
-    
-      string saveto = SpecUtils::append_path( outdir, savename );
-    
-      if( !inputdir.empty() && recursive )
-      {
-        assert( outputname == outdir );
-        //Need to get relative path difference between inputdir and inputfiles[i]
-        //and then make that hierarchy of directories, if it doesnt already exist.
-        //SpecUtils::create_directory(const std::string &name)
-        
-        const string reldir = SpecUtils::fs_relative( inputdir, SpecUtils::parent_path(inputfiles[i]) );
-        
-        //ToDo: implement something like SpecUtils:recursive_create_directory(...)
-        //      rather than this huge hack to recursively make directories.
-        
-        string tmpdirstr = reldir;
-        std::deque<string> dirstomake;
-        while( !tmpdirstr.empty() && tmpdirstr!= "." )
-        {
-          string fullpath = SpecUtils::append_path( outdir, tmpdirstr );
-          string parent = SpecUtils::parent_path( fullpath );
-          string leaf = SpecUtils::fs_relative( parent, fullpath );
-          dirstomake.push_front( leaf );
-          tmpdirstr = SpecUtils::fs_relative( outdir, parent );
-        }
-        
-        tmpdirstr = outdir;
-        for( const auto leaf : dirstomake )
-        {
-          tmpdirstr = SpecUtils::append_path( tmpdirstr, leaf );
-          if( !SpecUtils::is_directory(tmpdirstr) )
-          {
-            //cout << "Will make directory '" << tmpdirstr << "'" << endl;
-            SpecUtils::create_directory(tmpdirstr);
-          }else
-          {
-            //cout << "Dont need to make directory '" << tmpdirstr << "'" << endl;
-          }
-        }//for( const auto leaf : dirstomake )
-        
-        const string fulloutdir = SpecUtils::append_path( outdir, reldir );
-        saveto = SpecUtils::append_path( fulloutdir, savename );
-        
-        //cout << "Continuing rather than writing" << endl;
-        //continue; //debug
-      }//if( !inputdir.empty() && recursive )
-      
-      
-      
-      if( saveto == inname )
+      //When writing to an archive, directories are implied by the entry names
+      if( !fulloutdir.empty() && !output_archive
+          && !output_directories.create_directories( fulloutdir ) )
       {
-        cerr << "Output file '" << saveto << "' identical to input file name,"
-             << " not saving file" << endl;
-        file_existed = true;
+        cerr << "Failed to create output directory '" << fulloutdir << "'" << endl;
+        wrote_all = false;
         continue;
       }
     
@@ -2817,8 +4268,8 @@ int run_command_util( const int argc, char *argv[] )
       {
         if( summ_meas_for_single_out && (info.num_measurements() > 1) )
         {
-          shared_ptr<SpecUtils::Measurement> summed_meas = info.sum_measurements( info.sample_numbers(),
-                                                                      info.detector_names(), nullptr );
+          shared_ptr<SpecUtils::Measurement> summed_meas = sum_measurements( info, info.sample_numbers(),
+                                                                             info.detector_names() );
           for( shared_ptr<const SpecUtils::Measurement> &m : info.measurements() )
             info.remove_measurement( m, false );
           info.add_measurement( summed_meas, true );
@@ -2835,7 +4286,7 @@ int run_command_util( const int argc, char *argv[] )
         }//if( summ_meas_for_single_out && (info.num_measurements() > 1) )
         
         
-        files_to_combine.push_back( info );
+        files_to_combine.emplace_back( info, compact_channels );
       }else
       {
         const pair<bool,bool> wrote_out = write_output_file( info, format, saveto, inname );
@@ -2866,16 +4317,37 @@ int run_command_util( const int argc, char *argv[] )
     
     // We will just take model number and all that from the first measurement.
     //  TODO: improve this, or add warnings to the user?
-    SpecUtils::SpecFile info = files_to_combine.front();
+    //  If we are going to sum the spectra from compacted files, we will leave the channel
+    //  counts compacted, and sum from the compacted form below; otherwise we take the
+    //  records back out of the compacted files, which releases their compacted counts.
+    const bool sum_compacted = (sum_all_spectra && compact_channels);
+    SpecUtils::SpecFile info = sum_compacted ? files_to_combine.front().meta()
+                                             : files_to_combine.front().take_expanded();
+    
+    // When summing compacted files, which file, and record within it, each record of `info`
+    //  came from, so its counts can be found after the records are reordered.
+    map<const SpecUtils::Measurement *,pair<size_t,size_t>> compacted_source;
+    if( sum_compacted )
+    {
+      const vector<shared_ptr<const SpecUtils::Measurement>> info_meass = info.measurements();
+      assert( info_meass.size() == files_to_combine.front().measurements().size() );
+      for( size_t j = 0; j < info_meass.size(); ++j )
+        compacted_source[info_meass[j].get()] = make_pair( size_t(0), j );
+    }//if( sum_compacted )
     
     for( size_t i = 1; i < files_to_combine.size(); ++i )
     {
-      const SpecUtils::SpecFile &other = files_to_combine[i];
+      const SpecUtils::SpecFile &other = files_to_combine[i].meta();
+      const vector<shared_ptr<const SpecUtils::Measurement>> &other_meass = files_to_combine[i].measurements();
       
-      for( const shared_ptr<const SpecUtils::Measurement> &m : other.measurements() )
+      for( size_t j = 0; j < other_meass.size(); ++j )
       {
-        auto nm = make_shared<SpecUtils::Measurement>( *m );
+        shared_ptr<SpecUtils::Measurement> nm = sum_compacted
+                            ? make_shared<SpecUtils::Measurement>( *other_meass[j] )
+                            : files_to_combine[i].take( j );
         info.add_measurement( nm, false );
+        if( sum_compacted )
+          compacted_source[nm.get()] = make_pair( i, j );
       }
       
       bool added_remarks = false, added_warning = false;
@@ -2940,8 +4412,52 @@ int run_command_util( const int argc, char *argv[] )
     
     if( sum_all_spectra )
     {
-      shared_ptr<SpecUtils::Measurement> summed_meas = info.sum_measurements( info.sample_numbers(),
-                                                                  info.detector_names(), nullptr );
+      shared_ptr<SpecUtils::Measurement> summed_meas = sum_measurements( info, info.sample_numbers(),
+                                                                         info.detector_names() );
+      
+      if( sum_compacted && summed_meas )
+      {
+        // `summed_meas` has the correct live/real times, neutrons, and energy calibration, but
+        //  the zeroed out gamma counts of the compacted records, so fill in the gamma counts.
+        //  The records are summed in the same order, and with the same pairwise summation, as
+        //  SpectrumSum::deterministic_sum(...) would sum the expanded file, so the result is the
+        //  same whether or not the files were compacted.
+        try
+        {
+          const shared_ptr<const SpecUtils::EnergyCalibration> cal = summed_meas->energy_calibration();
+          if( !cal || !cal->valid() )
+            throw runtime_error( "invalid energy calibration for summed spectrum" );
+          
+          vector<pair<size_t,size_t>> gamma_records;
+          for( const shared_ptr<const SpecUtils::Measurement> &m : info.measurements() )
+          {
+            const shared_ptr<const SpecUtils::EnergyCalibration> &mcal = m->energy_calibration();
+            if( !m->gamma_counts() || m->gamma_counts()->empty() || !mcal || !mcal->valid() )
+              continue;
+            
+            const auto pos = compacted_source.find( m.get() );
+            if( pos == end(compacted_source) )
+              throw runtime_error( "could not find the compacted counts of a record" );
+            gamma_records.push_back( pos->second );
+          }//for( loop over combined records )
+          
+          const vector<double> gamma_sum = SpectrumSum::pairwise_sum( gamma_records.size(),
+                                                                       cal->num_channels(),
+            [&]( const size_t index, vector<double> &leaf ){
+              const pair<size_t,size_t> &source = gamma_records[index];
+              files_to_combine[source.first].add_gamma_counts( source.second, *cal, leaf );
+          }, num_jobs );
+          
+          auto counts = make_shared<vector<float>>( begin(gamma_sum), end(gamma_sum) );
+          summed_meas->set_gamma_counts( counts, summed_meas->live_time(), summed_meas->real_time() );
+        }catch( std::exception &e )
+        {
+          cerr << "Error summing all spectra from summed files: "
+               << e.what() << endl;
+          return 30;
+        }//try / catch
+      }//if( sum_compacted && summed_meas )
+      
       for( shared_ptr<const SpecUtils::Measurement> &m : info.measurements() )
         info.remove_measurement( m, false );
       info.add_measurement( summed_meas, true );
@@ -2971,6 +4487,12 @@ int run_command_util( const int argc, char *argv[] )
   }//if( combine_all_files )
   
   
+  if( output_archive && !output_archive->close() )
+  {
+    cerr << "Failed to write output archive '" << output_archive_name << "'" << endl;
+    wrote_all = false;
+  }
+  
   if( file_existed )
     return 5;
   
@@ -0,0 +1,342 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <map>
+#include <memory>
+#include <vector>
+#include <cassert>
+#include <algorithm>
+#include <stdexcept>
+
+#include "SpecUtils/SpecFile.h"
+#include "SpecUtils/EnergyCalibration.h"
+
+#include "cambio/SpectrumSum.h"
+#include "cambio/CompactSpectra.h"
+
+using namespace std;
+
+namespace
+{
+  //Zero gaps this long or shorter are stored inline, rather than starting a
+  //  new run; a new run costs two uint32_t, or the same as two zero floats.
+  const size_t ns_max_inline_zeros = 2;
+
+}//namespace
+
+
+SparseChannelCounts::SparseChannelCounts()
+  : m_num_channels( 0 ),
+    m_value_start( 1, 0 )
+{
+}
+
+
+SparseChannelCounts::SparseChannelCounts( const std::vector<float> &counts )
+  : m_num_channels( static_cast<uint32_t>(counts.size()) ),
+    m_value_start()
+{
+  const size_t nchannel = counts.size();
+
+  size_t channel = 0;
+  while( channel < nchannel )
+  {
+    //Find the start of the next run
+    while( (channel < nchannel) && (counts[channel] == 0.0f) )
+      ++channel;
+    if( channel >= nchannel )
+      break;
+
+    //Find the end of the run, allowing short gaps of zeros inside of it
+    size_t run_end = channel + 1, last_nonzero = channel;
+    while( run_end < nchannel && (run_end - last_nonzero) <= (ns_max_inline_zeros + 1) )
+    {
+      if( counts[run_end] != 0.0f )
+        last_nonzero = run_end;
+      ++run_end;
+    }
+    run_end = last_nonzero + 1;
+
+    m_run_start.push_back( static_cast<uint32_t>(channel) );
+    m_value_start.push_back( static_cast<uint32_t>(m_values.size()) );
+    m_values.insert( end(m_values), begin(counts) + channel, begin(counts) + run_end );
+
+    channel = run_end;
+  }//while( channel < nchannel )
+
+  m_value_start.push_back( static_cast<uint32_t>(m_values.size()) );
+
+  m_run_start.shrink_to_fit();
+  m_value_start.shrink_to_fit();
+  m_values.shrink_to_fit();
+}//SparseChannelCounts constructor
+
+
+size_t SparseChannelCounts::num_channels() const
+{
+  return m_num_channels;
+}
+
+
+size_t SparseChannelCounts::memory_size() const
+{
+  return sizeof(uint32_t)*(m_run_start.capacity() + m_value_start.capacity())
+         + sizeof(float)*m_values.capacity();
+}//memory_size()
+
+
+void SparseChannelCounts::add_to( std::vector<double> &sum ) const
+{
+  if( sum.size() != m_num_channels )
+    throw runtime_error( "SparseChannelCounts::add_to: channel count mismatch." );
+
+  double * const out = sum.data();
+  const float * const values = m_values.data();
+
+  for( size_t run = 0; run < m_run_start.size(); ++run )
+  {
+    double * const dest = out + m_run_start[run];
+    const float * const src = values + m_value_start[run];
+    const size_t nvalues = m_value_start[run+1] - m_value_start[run];
+    for( size_t i = 0; i < nvalues; ++i )
+      dest[i] += src[i];
+  }//for( loop over runs )
+}//add_to(...)
+
+
+void SparseChannelCounts::rebin_add_to( const std::vector<float> &from_energies,
+                                        const std::vector<float> &to_energies,
+                                        std::vector<double> &sum ) const
+{
+  if( (from_energies.size() < m_num_channels) || (to_energies.size() < sum.size()) || sum.empty() )
+    throw runtime_error( "SparseChannelCounts::rebin_add_to: invalid binning." );
+
+  const float * const values = m_values.data();
+
+  for( size_t run = 0; run < m_run_start.size(); ++run )
+  {
+    const size_t nvalues = m_value_start[run+1] - m_value_start[run];
+    SpectrumSum::rebin_add( values + m_value_start[run], m_run_start[run], nvalues,
+                            from_energies, to_energies, sum );
+  }//for( loop over runs )
+}//rebin_add_to(...)
+
+
+std::shared_ptr<std::vector<float>> SparseChannelCounts::to_dense() const
+{
+  auto answer = make_shared<vector<float>>( m_num_channels, 0.0f );
+
+  for( size_t run = 0; run < m_run_start.size(); ++run )
+    std::copy( begin(m_values) + m_value_start[run], begin(m_values) + m_value_start[run+1],
+               begin(*answer) + m_run_start[run] );
+
+  return answer;
+}//to_dense()
+
+
+CompactSpecFile::CompactSpecFile( SpecUtils::SpecFile &info, const bool compact )
+  : m_compacted( compact )
+{
+  if( compact )
+  {
+    map<size_t,shared_ptr<const vector<float>>> zeros;
+    map<const SpecUtils::Measurement *,SparseChannelCounts> sparse;
+
+    //Encode each record, and swap it into `info` in place of the original, so
+    //  that the dense counts of this file are freed before the next file is
+    //  loaded, and so copying `info` below is cheap.
+    vector<shared_ptr<const SpecUtils::Measurement>> orig_meas = info.measurements();
+    vector<shared_ptr<SpecUtils::Measurement>> new_meas;
+    new_meas.reserve( orig_meas.size() );
+
+    for( const shared_ptr<const SpecUtils::Measurement> &m : orig_meas )
+    {
+      auto nm = make_shared<SpecUtils::Measurement>( *m );
+
+      const shared_ptr<const vector<float>> &counts = m->gamma_counts();
+      if( counts && !counts->empty() )
+      {
+        shared_ptr<const vector<float>> &zero = zeros[counts->size()];
+        if( !zero )
+          zero = make_shared<vector<float>>( counts->size(), 0.0f );
+
+        sparse[nm.get()] = SparseChannelCounts( *counts );
+        nm->set_gamma_counts( zero, m->live_time(), m->real_time() );
+      }//if( counts && !counts->empty() )
+
+      new_meas.push_back( nm );
+    }//for( loop over original measurements )
+
+    info.remove_measurements( orig_meas );
+    orig_meas.clear();
+
+    for( const shared_ptr<SpecUtils::Measurement> &m : new_meas )
+      info.add_measurement( m, false );
+    new_meas.clear();
+
+    info.cleanup_after_load( SpecUtils::SpecFile::CleanupAfterLoadFlags::DontChangeOrReorderSamples );
+
+    //Copying the SpecFile only copies the shared all-zero count arrays.
+    m_meta = info;
+    m_measurements = m_meta.measurements();
+    m_counts.resize( m_measurements.size() );
+
+    const vector<shared_ptr<const SpecUtils::Measurement>> &info_meas = info.measurements();
+    for( size_t i = 0; (i < m_measurements.size()) && (i < info_meas.size()); ++i )
+    {
+      const auto pos = sparse.find( info_meas[i].get() );
+      if( pos != end(sparse) )
+        m_counts[i] = std::move( pos->second );
+    }//for( loop over measurements )
+  }else
+  {
+    m_meta = info;
+    m_measurements = m_meta.measurements();
+  }//if( compact ) / else
+}//CompactSpecFile constructor
+
+
+bool CompactSpecFile::compacted() const
+{
+  return m_compacted;
+}
+
+
+const SpecUtils::SpecFile &CompactSpecFile::meta() const
+{
+  return m_meta;
+}
+
+
+const std::vector<std::shared_ptr<const SpecUtils::Measurement>> &CompactSpecFile::measurements() const
+{
+  return m_measurements;
+}
+
+
+std::shared_ptr<SpecUtils::Measurement> CompactSpecFile::expand( const size_t index ) const
+{
+  if( index >= m_measurements.size() || !m_measurements[index] )
+    throw runtime_error( "CompactSpecFile::expand: invalid index." );
+
+  const shared_ptr<const SpecUtils::Measurement> &m = m_measurements[index];
+
+  auto answer = make_shared<SpecUtils::Measurement>( *m );
+
+  if( m_compacted && m_counts[index].num_channels() )
+    answer->set_gamma_counts( m_counts[index].to_dense(), m->live_time(), m->real_time() );
+
+  return answer;
+}//expand(...)
+
+
+SpecUtils::SpecFile CompactSpecFile::expanded() const
+{
+  SpecUtils::SpecFile answer = m_meta;
+  if( !m_compacted )
+    return answer;
+
+  for( const shared_ptr<const SpecUtils::Measurement> &m : m_measurements )
+    answer.remove_measurement( m, false );
+
+  for( size_t i = 0; i < m_measurements.size(); ++i )
+    answer.add_measurement( expand(i), false );
+
+  answer.cleanup_after_load( SpecUtils::SpecFile::CleanupAfterLoadFlags::DontChangeOrReorderSamples );
+
+  return answer;
+}//expanded()
+
+
+std::shared_ptr<SpecUtils::Measurement> CompactSpecFile::take( const size_t index )
+{
+  shared_ptr<SpecUtils::Measurement> answer = expand( index );
+  if( m_compacted )
+    m_counts[index] = SparseChannelCounts();
+  return answer;
+}//take(...)
+
+
+SpecUtils::SpecFile CompactSpecFile::take_expanded()
+{
+  SpecUtils::SpecFile answer = m_meta;
+  if( !m_compacted )
+    return answer;
+
+  for( const shared_ptr<const SpecUtils::Measurement> &m : m_measurements )
+    answer.remove_measurement( m, false );
+
+  for( size_t i = 0; i < m_measurements.size(); ++i )
+    answer.add_measurement( take(i), false );
+
+  answer.cleanup_after_load( SpecUtils::SpecFile::CleanupAfterLoadFlags::DontChangeOrReorderSamples );
+
+  return answer;
+}//take_expanded()
+
+
+void CompactSpecFile::add_gamma_counts( const size_t index,
+                                        const SpecUtils::EnergyCalibration &cal,
+                                        std::vector<double> &sum ) const
+{
+  const shared_ptr<const vector<float>> &to_energies = cal.channel_energies();
+  if( !to_energies || sum.size() != cal.num_channels() )
+    throw runtime_error( "CompactSpecFile::add_gamma_counts: invalid energy calibration." );
+
+  if( index >= m_measurements.size() || !m_measurements[index] )
+    throw runtime_error( "CompactSpecFile::add_gamma_counts: invalid index." );
+
+  const SpecUtils::Measurement &m = *m_measurements[index];
+  const shared_ptr<const SpecUtils::EnergyCalibration> &mcal = m.energy_calibration();
+  const shared_ptr<const vector<float>> &from_energies = mcal ? mcal->channel_energies() : nullptr;
+
+  if( !mcal || !mcal->valid() || !from_energies )
+    return;
+
+  //The same test, and rebinning, SpectrumSum::deterministic_sum(...) uses.
+  const bool same_binning = ((mcal.get() == &cal)
+                             || (from_energies == to_energies)
+                             || ((*from_energies) == (*to_energies)));
+
+  if( m_compacted )
+  {
+    const SparseChannelCounts &counts = m_counts[index];
+    if( !counts.num_channels() )
+      return;
+
+    if( same_binning && (counts.num_channels() == sum.size()) )
+      counts.add_to( sum );
+    else
+      counts.rebin_add_to( *from_energies, *to_energies, sum );
+    return;
+  }//if( m_compacted )
+
+  const vector<float> * const counts = m.gamma_counts().get();
+  if( !counts || counts->empty() )
+    return;
+
+  if( same_binning && (counts->size() == sum.size()) )
+  {
+    for( size_t channel = 0; channel < sum.size(); ++channel )
+      sum[channel] += (*counts)[channel];
+  }else
+  {
+    SpectrumSum::rebin_add( counts->data(), 0, counts->size(), *from_energies, *to_energies, sum );
+  }
+}//add_gamma_counts(...)
@@ -0,0 +1,417 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "Cambio_config.h"
+
+#include <string>
+#include <thread>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#if( CAMBIO_ENABLE_ZSTD )
+#include <zstd.h>
+#endif
+
+#include "SpecUtils/StringAlgo.h"
+
+#include "cambio/ParallelOutput.h"
+#include "cambio/CompressedOutput.h"
+
+using namespace std;
+
+namespace
+{
+  const int ns_gzip_level = 6;  //zlib default
+  const int ns_zstd_level = 3;  //zstd default
+
+  /** Compresses `input` into a raw deflate stream (no gzip header), ending
+   with a sync-flush (so the next block can be appended), or, for the last
+   block, the final deflate block.
+   */
+  bool deflate_block( const string &input, const bool last, string &output )
+  {
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+
+    //Negative window bits gives a raw deflate stream
+    if( deflateInit2( &strm, ns_gzip_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+      return false;
+
+    //The sync-flush marker, and final empty block, add a few bytes to the bound.
+    output.resize( deflateBound( &strm, static_cast<uLong>(input.size()) ) + 16 );
+
+    strm.next_in = reinterpret_cast<Bytef *>( const_cast<char *>(input.data()) );
+    strm.avail_in = static_cast<uInt>( input.size() );
+
+    const int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    size_t nwritten = 0;
+    int rc = Z_OK;
+
+    do
+    {
+      if( nwritten == output.size() )
+        output.resize( 2*output.size() );
+
+      strm.next_out = reinterpret_cast<Bytef *>( &output[nwritten] );
+      strm.avail_out = static_cast<uInt>( output.size() - nwritten );
+      rc = deflate( &strm, flush );
+      nwritten = output.size() - strm.avail_out;
+    }while( (rc == Z_OK) && (last || (strm.avail_out == 0)) );
+
+    deflateEnd( &strm );
+
+    output.resize( nwritten );
+
+    return last ? (rc == Z_STREAM_END) : ((rc == Z_OK) || (rc == Z_BUF_ERROR));
+  }//deflate_block(...)
+
+
+  void append_uint32_le( string &data, const uint32_t value )
+  {
+    for( int i = 0; i < 4; ++i )
+      data.push_back( static_cast<char>( (value >> (8*i)) & 0xFF ) );
+  }//append_uint32_le(...)
+}//namespace
+
+
+namespace CompressedOutput
+{
+
+Compression compression_from_string( const std::string &name )
+{
+  string lname = name;
+  SpecUtils::trim( lname );
+  SpecUtils::to_lower_ascii( lname );
+
+  Compression type;
+  if( lname.empty() || (lname == "none") )
+    type = Compression::None;
+  else if( (lname == "gzip") || (lname == "gz") )
+    type = Compression::Gzip;
+  else if( (lname == "zstd") || (lname == "zst") )
+    type = Compression::Zstd;
+  else
+    throw runtime_error( "Unknown compression type '" + name + "' (valid types: gzip, zstd)" );
+
+  if( !is_available(type) )
+    throw runtime_error( "This build of Cambio does not support '" + name + "' compression" );
+
+  return type;
+}//compression_from_string(...)
+
+
+bool is_available( const Compression type )
+{
+  switch( type )
+  {
+    case Compression::None:
+    case Compression::Gzip:
+      return true;
+
+    case Compression::Zstd:
+      return CAMBIO_ENABLE_ZSTD;
+  }//switch( type )
+
+  return false;
+}//is_available(...)
+
+
+const char *file_extension( const Compression type )
+{
+  switch( type )
+  {
+    case Compression::None: return "";
+    case Compression::Gzip: return ".gz";
+    case Compression::Zstd: return ".zst";
+  }//switch( type )
+
+  return "";
+}//file_extension(...)
+
+
+std::string compress( const std::string &data, const Compression type, const size_t num_threads )
+{
+  if( type == Compression::None )
+    return data;
+
+  std::stringbuf result( ios_base::out | ios_base::binary );
+
+  {
+    CompressingStreamBuf compressor( &result, type, num_threads );
+    const streamsize nput = compressor.sputn( data.data(), static_cast<streamsize>(data.size()) );
+    if( (nput != static_cast<streamsize>(data.size())) || !compressor.finish() )
+      return string();
+  }
+
+  return result.str();
+}//compress(...)
+
+
+CompressingStreamBuf::CompressingStreamBuf( std::streambuf *dest, const Compression type,
+                                            const size_t num_threads, const size_t block_size )
+  : std::streambuf(),
+    m_dest( dest ),
+    m_type( type ),
+    m_num_threads( ParallelOutput::resolve_num_threads( num_threads ) ),
+    m_block_size( std::max( block_size, size_t(1024) ) ),
+    m_block( m_block_size ),
+    m_wrote_header( false ),
+    m_finished( false ),
+    m_failed( false ),
+    m_crc( static_cast<uint32_t>( crc32( 0L, Z_NULL, 0 ) ) ),
+    m_total_in( 0 ),
+    m_stopping( false )
+{
+  if( !m_dest || !is_available(m_type) || (m_type == Compression::None) )
+    throw runtime_error( "CompressingStreamBuf: invalid destination or compression type." );
+
+  setp( m_block.data(), m_block.data() + m_block.size() );
+}//CompressingStreamBuf constructor
+
+
+CompressingStreamBuf::~CompressingStreamBuf()
+{
+  {//begin lock on m_mutex
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_stopping = true;
+    m_jobs.clear();
+  }//end lock on m_mutex
+
+  m_job_available.notify_all();
+
+  for( std::thread &worker : m_workers )
+  {
+    if( worker.joinable() )
+      worker.join();
+  }
+}//~CompressingStreamBuf()
+
+
+CompressingStreamBuf::int_type CompressingStreamBuf::overflow( int_type ch )
+{
+  if( m_finished )
+    return traits_type::eof();
+
+  if( pptr() != pbase() )
+    submit_block( false );
+
+  if( m_failed )
+    return traits_type::eof();
+
+  if( !traits_type::eq_int_type( ch, traits_type::eof() ) )
+  {
+    *pptr() = traits_type::to_char_type( ch );
+    pbump( 1 );
+  }
+
+  return traits_type::not_eof( ch );
+}//overflow(...)
+
+
+void CompressingStreamBuf::compress_block( Block &block ) const
+{
+  block.crc = 0;
+  block.ok = false;
+
+  switch( m_type )
+  {
+    case Compression::None:
+      break;
+
+    case Compression::Gzip:
+    {
+      block.crc = static_cast<uint32_t>( crc32( crc32( 0L, Z_NULL, 0 ),
+                                   reinterpret_cast<const Bytef *>( block.input.data() ),
+                                   static_cast<uInt>( block.input.size() ) ) );
+      block.ok = deflate_block( block.input, block.last, block.output );
+      break;
+    }//case Compression::Gzip:
+
+    case Compression::Zstd:
+    {
+#if( CAMBIO_ENABLE_ZSTD )
+      block.output.resize( ZSTD_compressBound( block.input.size() ) );
+      const size_t nbytes = ZSTD_compress( &block.output[0], block.output.size(),
+                                           block.input.data(), block.input.size(),
+                                           ns_zstd_level );
+      block.ok = !ZSTD_isError( nbytes );
+      block.output.resize( block.ok ? nbytes : size_t(0) );
+#endif
+      break;
+    }//case Compression::Zstd:
+  }//switch( m_type )
+}//compress_block(...)
+
+
+void CompressingStreamBuf::submit_block( const bool last )
+{
+  auto block = make_shared<Block>();
+  block->input.assign( pbase(), pptr() );
+  block->last = last;
+  block->done = false;
+  block->ok = false;
+  block->crc = 0;
+
+  m_total_in += block->input.size();
+  setp( m_block.data(), m_block.data() + m_block.size() );
+
+  if( !m_wrote_header && (m_type == Compression::Gzip) )
+  {
+    //Magic number, deflate, no flags, no modification time, no extra flags, unknown OS
+    const char header[10] = { '\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, '\xff' };
+    write_to_dest( string( header, header + sizeof(header) ) );
+  }
+  m_wrote_header = true;
+
+  if( m_workers.empty() && ((m_num_threads <= 1) || last) )
+  {
+    //Nothing is in flight, so we can compress and write this block right away.
+    compress_block( *block );
+    block->done = true;
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_pending.push_back( block );
+  }else
+  {
+    if( m_workers.empty() )
+      start_workers();
+
+    std::unique_lock<std::mutex> lock( m_mutex );
+    m_pending.push_back( block );
+    m_jobs.push_back( block );
+    lock.unlock();
+    m_job_available.notify_one();
+  }//if( compress on this thread ) / else
+
+  write_completed_blocks();
+
+  //Limit how many uncompressed and compressed blocks are held in memory.
+  const size_t max_pending = 2*m_num_threads;
+
+  std::unique_lock<std::mutex> lock( m_mutex );
+  while( !m_pending.empty() && (last || (m_pending.size() >= max_pending)) )
+  {
+    m_block_done.wait( lock, [this](){ return m_pending.front()->done; } );
+    lock.unlock();
+    write_completed_blocks();
+    lock.lock();
+  }//while( need to wait on blocks to finish )
+}//submit_block(...)
+
+
+void CompressingStreamBuf::write_completed_blocks()
+{
+  while( true )
+  {
+    shared_ptr<Block> block;
+
+    {//begin lock on m_mutex
+      std::lock_guard<std::mutex> lock( m_mutex );
+      if( m_pending.empty() || !m_pending.front()->done )
+        return;
+      block = m_pending.front();
+      m_pending.pop_front();
+    }//end lock on m_mutex
+
+    if( !block->ok )
+      m_failed = true;
+
+    if( m_type == Compression::Gzip )
+      m_crc = static_cast<uint32_t>( crc32_combine( m_crc, block->crc,
+                                          static_cast<z_off_t>(block->input.size()) ) );
+
+    write_to_dest( block->output );
+  }//while( true )
+}//write_completed_blocks()
+
+
+void CompressingStreamBuf::write_to_dest( const std::string &data )
+{
+  if( m_failed || data.empty() )
+    return;
+
+  const streamsize nput = m_dest->sputn( data.data(), static_cast<streamsize>(data.size()) );
+  if( nput != static_cast<streamsize>(data.size()) )
+    m_failed = true;
+}//write_to_dest(...)
+
+
+void CompressingStreamBuf::start_workers()
+{
+  for( size_t i = 0; i < m_num_threads; ++i )
+    m_workers.emplace_back( &CompressingStreamBuf::worker_loop, this );
+}//start_workers()
+
+
+void CompressingStreamBuf::worker_loop()
+{
+  while( true )
+  {
+    shared_ptr<Block> block;
+
+    {//begin lock on m_mutex
+      std::unique_lock<std::mutex> lock( m_mutex );
+      m_job_available.wait( lock, [this](){ return m_stopping || !m_jobs.empty(); } );
+
+      if( m_stopping )
+        return;
+
+      block = m_jobs.front();
+      m_jobs.pop_front();
+    }//end lock on m_mutex
+
+    compress_block( *block );
+
+    {//begin lock on m_mutex
+      std::lock_guard<std::mutex> lock( m_mutex );
+      block->done = true;
+    }//end lock on m_mutex
+
+    m_block_done.notify_all();
+  }//while( true )
+}//worker_loop()
+
+
+bool CompressingStreamBuf::finish()
+{
+  if( m_finished )
+    return !m_failed;
+
+  submit_block( true );
+  m_finished = true;
+
+  if( m_type == Compression::Gzip )
+  {
+    string trailer;
+    append_uint32_le( trailer, m_crc );
+    append_uint32_le( trailer, static_cast<uint32_t>( m_total_in & 0xFFFFFFFF ) );
+    write_to_dest( trailer );
+  }//if( m_type == Compression::Gzip )
+
+  setp( nullptr, nullptr );
+
+  return !m_failed;
+}//finish()
+
+}//namespace CompressedOutput
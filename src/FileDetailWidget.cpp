@@ -593,7 +593,10 @@ void FileDetailWidget::realtimeChanged()
     snprintf( buff, sizeof(buff), "%.3f", val );
     m_realtime->setText( buff );
   }else
+  {
     m_measurment->set_real_time( val, m_meas );
+    emit fileDataModified();
+  }
 }//void realtimeChanged()
 
 
@@ -611,7 +614,10 @@ void FileDetailWidget::livetimeChanged()
     snprintf( buff, sizeof(buff), "%.3f", val );
     m_realtime->setText( buff );
   }else
+  {
     m_measurment->set_live_time( val, m_meas );
+    emit fileDataModified();
+  }
 }//void livetimeChanged()
 
 
@@ -0,0 +1,1648 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "Cambio_config.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <fstream>
+#include <istream>
+#include <algorithm>
+#include <stdexcept>
+#include <streambuf>
+
+#if( defined(_WIN32) )
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN 1
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <zlib.h>
+
+#if( CAMBIO_ENABLE_ZSTD )
+#include <zstd.h>
+#endif
+
+#if( CAMBIO_ENABLE_XZ )
+#include <lzma.h>
+#endif
+
+#include "SpecUtils/SpecFile.h"
+#include "SpecUtils/StringAlgo.h"
+
+#include "cambio/FileLoader.h"
+#include "cambio/ParallelOutput.h"
+
+using namespace std;
+
+namespace
+{
+  //The number of bytes at the start of a file looked at to guess its format.
+  const size_t ns_sniff_size = 4096;
+
+  //Multi-member gzip files smaller than this are just decompressed on one thread.
+  const size_t ns_min_parallel_gunzip_size = 4*1024*1024;
+
+  //The approximate size of the pieces preview_n42_2012(...) parses at a time.
+  const size_t ns_preview_piece_size = 4*1024*1024;
+
+  //preview_n42_2012(...) reads the file this many bytes at a time, and gives up
+  //  if it hasnt found the first <RadMeasurement> within ns_max_preview_header.
+  const size_t ns_preview_read_size = 1024*1024;
+  const size_t ns_max_preview_header = 16*1024*1024;
+
+
+  /** Returns if the data starts with a '<', after an optional UTF-8 byte order
+   mark and whitespace.
+   */
+  bool looks_like_xml( const char *data, const size_t size )
+  {
+    size_t pos = 0;
+    if( (size >= 3) && !memcmp( data, "\xEF\xBB\xBF", 3 ) )
+      pos = 3;
+
+    const size_t max_pos = (size < 1024) ? size : 1024;
+    while( (pos < max_pos) && ((data[pos] == ' ') || (data[pos] == '\t')
+                               || (data[pos] == '\r') || (data[pos] == '\n')) )
+      ++pos;
+
+    return (pos < size) && (data[pos] == '<');
+  }//looks_like_xml(...)
+
+
+  bool contains( const char *data, const size_t size, const char *substr )
+  {
+    const size_t len = strlen( substr );
+    if( len > size )
+      return false;
+
+    for( size_t i = 0; i <= (size - len); ++i )
+    {
+      if( (data[i] == substr[0]) && !memcmp( data + i, substr, len ) )
+        return true;
+    }
+
+    return false;
+  }//contains(...)
+
+
+  /** Returns the position of `substr` in `data`, from `pos` up to `end`, or
+   std::string::npos if not found.
+   */
+  size_t find( const char *data, size_t pos, const size_t end, const std::string &substr )
+  {
+    if( substr.empty() || (end < substr.size()) )
+      return std::string::npos;
+
+    const size_t len = substr.size();
+    while( (pos + len) <= end )
+    {
+      const void *found = memchr( data + pos, substr[0], end - len + 1 - pos );
+      if( !found )
+        break;
+      pos = static_cast<size_t>( static_cast<const char *>(found) - data );
+      if( !memcmp( data + pos, substr.data(), len ) )
+        return pos;
+      ++pos;
+    }//while( (pos + len) <= end )
+
+    return std::string::npos;
+  }//find(...)
+
+
+  /** Returns the position of the '<' of the first start tag of element `name`,
+   with any namespace prefix (which is put into `prefix`, e.g., "n42:"), from
+   `pos` up to `end`, or std::string::npos if there isn't one.
+   */
+  size_t find_start_tag( const char *data, size_t pos, const size_t end,
+                         const std::string &name, std::string &prefix )
+  {
+    while( (pos = find( data, pos, end, name )) != std::string::npos )
+    {
+      const size_t after = pos + name.size();
+      const char next = (after < end) ? data[after] : '\0';
+      const bool name_ends = ((next == '>') || (next == '/') || (next == ' ')
+                              || (next == '\t') || (next == '\r') || (next == '\n'));
+
+      size_t lt = pos;
+      while( (lt > 0) && (isalnum( static_cast<unsigned char>(data[lt-1]) )
+                          || (data[lt-1] == '_') || (data[lt-1] == '-')
+                          || (data[lt-1] == '.') || (data[lt-1] == ':')) )
+        --lt;
+
+      //Whatever is between the '<' and the name must be a "prefix:"
+      if( name_ends && (lt > 0) && (data[lt-1] == '<')
+          && ((lt == pos) || (data[pos-1] == ':')) )
+      {
+        prefix.assign( data + lt, data + pos );
+        return lt - 1;
+      }
+
+      pos = after;
+    }//while( we find the name )
+
+    return std::string::npos;
+  }//find_start_tag(...)
+
+
+  uint16_t read_uint16( const char *data )
+  {
+    const unsigned char *p = reinterpret_cast<const unsigned char *>( data );
+    return static_cast<uint16_t>( p[0] | (p[1] << 8) );
+  }
+
+
+  uint32_t read_uint32( const char *data )
+  {
+    const unsigned char *p = reinterpret_cast<const unsigned char *>( data );
+    return static_cast<uint32_t>( p[0] ) | (static_cast<uint32_t>( p[1] ) << 8)
+           | (static_cast<uint32_t>( p[2] ) << 16) | (static_cast<uint32_t>( p[3] ) << 24);
+  }
+
+
+  double seconds_since( const std::chrono::steady_clock::time_point &start )
+  {
+    const auto now = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>( now - start ).count();
+  }
+
+
+  /** A read-only stream buffer over a block of memory, so parsers that take a
+   std::istream can read decompressed data without another copy.
+   */
+  class MemoryStreamBuf : public std::streambuf
+  {
+  public:
+    MemoryStreamBuf( const char *data, const size_t nbytes )
+    {
+      //The get area is never written through.
+      char * const begin = const_cast<char *>( data );
+      setg( begin, begin, begin + nbytes );
+    }
+
+  protected:
+    virtual pos_type seekoff( off_type off, std::ios_base::seekdir dir,
+                              std::ios_base::openmode which ) override
+    {
+      if( !(which & std::ios_base::in) )
+        return pos_type( off_type(-1) );
+
+      off_type pos = off;
+      if( dir == std::ios_base::cur )
+        pos += (gptr() - eback());
+      else if( dir == std::ios_base::end )
+        pos += (egptr() - eback());
+
+      if( (pos < 0) || (pos > (egptr() - eback())) )
+        return pos_type( off_type(-1) );
+
+      setg( eback(), eback() + pos, egptr() );
+      return pos_type( pos );
+    }//seekoff(...)
+
+    virtual pos_type seekpos( pos_type pos, std::ios_base::openmode which ) override
+    {
+      return seekoff( off_type(pos), std::ios_base::beg, which );
+    }
+  };//class MemoryStreamBuf
+
+
+  /** A read-only, seekable, stream buffer that decompresses gzip, zstd, or xz
+   data from another stream as it is read, so neither the compressed nor the
+   decompressed data is ever held in memory all at once.
+
+   Seeking forward decompresses (and discards) up to the new position, seeking
+   backward starts decompressing again from the beginning, and seeking from the
+   end decompresses everything once to find the size; parsers that only peek
+   at the size, or rewind to try a second format, cost an extra pass through
+   the decoder, not any memory.
+   */
+  class DecompressStreamBuf : public std::streambuf
+  {
+  public:
+    DecompressStreamBuf( std::istream &compressed, const FileLoader::Compression type )
+      : m_compressed( compressed ),
+        m_compressed_start( compressed.tellg() ),
+        m_type( type ),
+        m_in( 256*1024 ),
+        m_out( 256*1024 ),
+        m_in_eof( false ),
+        m_ended( false ),
+        m_failed( false ),
+        m_member_done( false ),
+        m_out_offset( 0 ),
+        m_total_size( -1 ),
+        m_seconds( 0.0 ),
+        m_zlib_init( false )
+#if( CAMBIO_ENABLE_ZSTD )
+        , m_zstd( nullptr )
+#endif
+#if( CAMBIO_ENABLE_XZ )
+        , m_lzma_init( false )
+#endif
+    {
+      memset( &m_zlib, 0, sizeof(m_zlib) );
+#if( CAMBIO_ENABLE_ZSTD )
+      m_zin.src = nullptr;
+      m_zin.size = m_zin.pos = 0;
+#endif
+#if( CAMBIO_ENABLE_XZ )
+      m_lzma = LZMA_STREAM_INIT;
+#endif
+
+      init_decoder();
+      setg( m_out.data(), m_out.data(), m_out.data() );
+    }//DecompressStreamBuf constructor
+
+    virtual ~DecompressStreamBuf()
+    {
+      end_decoder();
+    }
+
+    /** If the data was corrupt, truncated, or the format isn't supported by
+     this build.
+     */
+    bool failed() const
+    {
+      return m_failed;
+    }
+
+    /** The total time spent in the decoder. */
+    double seconds() const
+    {
+      return m_seconds;
+    }
+
+  protected:
+    virtual int_type underflow() override
+    {
+      if( gptr() < egptr() )
+        return traits_type::to_int_type( *gptr() );
+
+      m_out_offset += static_cast<uint64_t>( egptr() - eback() );
+
+      const auto start = std::chrono::steady_clock::now();
+      const size_t nproduced = decode( m_out.data(), m_out.size() );
+      m_seconds += seconds_since( start );
+
+      setg( m_out.data(), m_out.data(), m_out.data() + nproduced );
+
+      if( !nproduced )
+      {
+        if( !m_failed )
+          m_total_size = static_cast<int64_t>( m_out_offset );
+        return traits_type::eof();
+      }
+
+      return traits_type::to_int_type( m_out[0] );
+    }//underflow()
+
+    virtual pos_type seekoff( off_type off, std::ios_base::seekdir dir,
+                              std::ios_base::openmode which ) override
+    {
+      if( !(which & std::ios_base::in) )
+        return pos_type( off_type(-1) );
+
+      int64_t target = off;
+      if( dir == std::ios_base::cur )
+      {
+        target += static_cast<int64_t>( m_out_offset + (gptr() - eback()) );
+      }else if( dir == std::ios_base::end )
+      {
+        while( (m_total_size < 0) && !m_failed )
+        {
+          setg( eback(), egptr(), egptr() );
+          underflow();
+        }
+
+        if( m_failed )
+          return pos_type( off_type(-1) );
+        target += m_total_size;
+      }//if( dir == std::ios_base::cur ) / else
+
+      if( target < 0 )
+        return pos_type( off_type(-1) );
+
+      return seek_to( static_cast<uint64_t>(target) );
+    }//seekoff(...)
+
+    virtual pos_type seekpos( pos_type pos, std::ios_base::openmode which ) override
+    {
+      return seekoff( off_type(pos), std::ios_base::beg, which );
+    }
+
+  private:
+    pos_type seek_to( const uint64_t target )
+    {
+      if( target < m_out_offset )
+        restart();
+
+      while( true )
+      {
+        const uint64_t buffer_end = m_out_offset + static_cast<uint64_t>( egptr() - eback() );
+        if( target < buffer_end )
+        {
+          setg( eback(), eback() + (target - m_out_offset), egptr() );
+          return pos_type( static_cast<off_type>(target) );
+        }
+
+        setg( eback(), egptr(), egptr() );
+        if( traits_type::eq_int_type( underflow(), traits_type::eof() ) )
+        {
+          //Positioning exactly at the end is fine, past it is not.
+          if( m_failed || (target != m_out_offset) )
+            return pos_type( off_type(-1) );
+          return pos_type( static_cast<off_type>(target) );
+        }
+      }//while( true )
+    }//seek_to(...)
+
+
+    /** Reads the next chunk of compressed data into m_in, returning its size. */
+    size_t read_input()
+    {
+      if( m_in_eof )
+        return 0;
+
+      m_compressed.read( m_in.data(), static_cast<streamsize>( m_in.size() ) );
+      const size_t nread = static_cast<size_t>( m_compressed.gcount() );
+      if( !nread )
+        m_in_eof = true;
+      return nread;
+    }//read_input()
+
+
+    void init_decoder()
+    {
+      switch( m_type )
+      {
+        case FileLoader::Compression::Gzip:
+          //15 window bits, plus 16 to only accept a gzip wrapper
+          m_zlib_init = (inflateInit2( &m_zlib, 15 + 16 ) == Z_OK);
+          m_failed = !m_zlib_init;
+          break;
+
+        case FileLoader::Compression::Zstd:
+#if( CAMBIO_ENABLE_ZSTD )
+          m_zstd = ZSTD_createDStream();
+          m_failed = !m_zstd || ZSTD_isError( ZSTD_initDStream( m_zstd ) );
+#else
+          m_failed = true;
+#endif
+          break;
+
+        case FileLoader::Compression::Xz:
+#if( CAMBIO_ENABLE_XZ )
+          m_lzma_init = (lzma_stream_decoder( &m_lzma, UINT64_MAX, LZMA_CONCATENATED ) == LZMA_OK);
+          m_failed = !m_lzma_init;
+#else
+          m_failed = true;
+#endif
+          break;
+
+        case FileLoader::Compression::None:
+          m_failed = true;
+          break;
+      }//switch( m_type )
+
+      m_ended = m_failed;
+    }//init_decoder()
+
+
+    void end_decoder()
+    {
+      if( m_zlib_init )
+        inflateEnd( &m_zlib );
+      m_zlib_init = false;
+      memset( &m_zlib, 0, sizeof(m_zlib) );
+
+#if( CAMBIO_ENABLE_ZSTD )
+      if( m_zstd )
+        ZSTD_freeDStream( m_zstd );
+      m_zstd = nullptr;
+      m_zin.src = nullptr;
+      m_zin.size = m_zin.pos = 0;
+#endif
+
+#if( CAMBIO_ENABLE_XZ )
+      if( m_lzma_init )
+        lzma_end( &m_lzma );
+      m_lzma_init = false;
+      m_lzma = LZMA_STREAM_INIT;
+#endif
+    }//end_decoder()
+
+
+    /** Starts decompressing again from the start of the compressed data. */
+    void restart()
+    {
+      end_decoder();
+
+      m_compressed.clear();
+      m_compressed.seekg( m_compressed_start );
+      m_in_eof = false;
+      m_failed = false;
+      m_member_done = false;
+      m_out_offset = 0;
+      setg( m_out.data(), m_out.data(), m_out.data() );
+
+      init_decoder();
+    }//restart()
+
+
+    /** Decompresses up to `nbytes` into `out`, returning how many bytes were
+     produced; returns zero once all the data has been decompressed, or on
+     error (with m_failed set).
+     */
+    size_t decode( char *out, const size_t nbytes )
+    {
+      size_t produced = 0;
+
+      while( !produced && !m_ended )
+      {
+        switch( m_type )
+        {
+          case FileLoader::Compression::Gzip:
+          {
+            if( !m_zlib.avail_in )
+            {
+              const size_t nread = read_input();
+              if( !nread )
+              {
+                //The input must end at the end of a member.
+                m_failed = !m_member_done;
+                m_ended = true;
+                break;
+              }
+
+              m_zlib.next_in = reinterpret_cast<Bytef *>( m_in.data() );
+              m_zlib.avail_in = static_cast<uInt>( nread );
+            }//if( !m_zlib.avail_in )
+
+            if( m_member_done )
+            {
+              //Another member must start with the gzip magic number; anything
+              //  else is trailing garbage, which gunzip ignores too.
+              if( m_zlib.next_in[0] != 0x1f )
+              {
+                m_ended = true;
+                break;
+              }
+
+              inflateReset( &m_zlib );
+              m_member_done = false;
+            }//if( m_member_done )
+
+            m_zlib.next_out = reinterpret_cast<Bytef *>( out );
+            m_zlib.avail_out = static_cast<uInt>( nbytes );
+
+            const int rc = inflate( &m_zlib, Z_NO_FLUSH );
+            produced = nbytes - m_zlib.avail_out;
+
+            if( rc == Z_STREAM_END )
+            {
+              m_member_done = true;
+            }else if( (rc != Z_OK) && (rc != Z_BUF_ERROR) )
+            {
+              m_failed = m_ended = true;
+            }
+            break;
+          }//case FileLoader::Compression::Gzip:
+
+          case FileLoader::Compression::Zstd:
+          {
+#if( CAMBIO_ENABLE_ZSTD )
+            if( m_zin.pos == m_zin.size )
+            {
+              m_zin.src = m_in.data();
+              m_zin.size = read_input();
+              m_zin.pos = 0;
+            }
+
+            ZSTD_outBuffer zout = { out, nbytes, 0 };
+            const size_t rc = ZSTD_decompressStream( m_zstd, &zout, &m_zin );
+            produced = zout.pos;
+
+            if( ZSTD_isError( rc ) )
+            {
+              m_failed = m_ended = true;
+            }else if( !produced && m_in_eof && (m_zin.pos == m_zin.size) )
+            {
+              //A non-zero return means the last frame wasnt finished.
+              m_failed = (rc != 0);
+              m_ended = true;
+            }
+#endif
+            break;
+          }//case FileLoader::Compression::Zstd:
+
+          case FileLoader::Compression::Xz:
+          {
+#if( CAMBIO_ENABLE_XZ )
+            if( !m_lzma.avail_in && !m_in_eof )
+            {
+              m_lzma.next_in = reinterpret_cast<const uint8_t *>( m_in.data() );
+              m_lzma.avail_in = read_input();
+            }
+
+            m_lzma.next_out = reinterpret_cast<uint8_t *>( out );
+            m_lzma.avail_out = nbytes;
+
+            const lzma_ret rc = lzma_code( &m_lzma, (m_in_eof && !m_lzma.avail_in) ? LZMA_FINISH : LZMA_RUN );
+            produced = nbytes - m_lzma.avail_out;
+
+            if( rc == LZMA_STREAM_END )
+              m_ended = true;
+            else if( rc != LZMA_OK )
+              m_failed = m_ended = true;
+#endif
+            break;
+          }//case FileLoader::Compression::Xz:
+
+          case FileLoader::Compression::None:
+            m_failed = m_ended = true;
+            break;
+        }//switch( m_type )
+      }//while( !produced && !m_ended )
+
+      return produced;
+    }//decode(...)
+
+
+    std::istream &m_compressed;
+    const std::streampos m_compressed_start;
+    const FileLoader::Compression m_type;
+
+    vector<char> m_in, m_out;
+    bool m_in_eof;
+
+    /** If the decoder has finished, either at the end of the data, or on error. */
+    bool m_ended;
+    bool m_failed;
+
+    /** If a gzip member has just ended, so another may start. */
+    bool m_member_done;
+
+    /** The decompressed position of the start of the get area. */
+    uint64_t m_out_offset;
+
+    /** The decompressed size, once known, or -1. */
+    int64_t m_total_size;
+
+    double m_seconds;
+
+    z_stream m_zlib;
+    bool m_zlib_init;
+
+#if( CAMBIO_ENABLE_ZSTD )
+    ZSTD_DStream *m_zstd;
+    ZSTD_inBuffer m_zin;
+#endif
+
+#if( CAMBIO_ENABLE_XZ )
+    lzma_stream m_lzma;
+    bool m_lzma_init;
+#endif
+  };//class DecompressStreamBuf
+
+
+  /** Returns if the parser for `type` reads from a std::istream without
+   modifying what it reads (everything we sniff, except N42).
+   */
+  bool parses_from_stream( const SpecUtils::ParserType type )
+  {
+    switch( type )
+    {
+      case SpecUtils::ParserType::Pcf:
+      case SpecUtils::ParserType::Spc:
+      case SpecUtils::ParserType::Chn:
+      case SpecUtils::ParserType::SpeIaea:
+      case SpecUtils::ParserType::Cnf:
+        return true;
+
+      default:
+        break;
+    }//switch( type )
+
+    return false;
+  }//parses_from_stream(...)
+
+
+  /** Parses `input`, from its start, using the parser for `type`; returns
+   false (with `info` reset) if it fails, or there is no std::istream parser
+   for the type.
+
+   `input` is only read from, so other parsers can be tried if this one fails.
+   */
+  bool parse_stream( SpecUtils::SpecFile &info, const SpecUtils::ParserType type,
+                     std::istream &input )
+  {
+    input.clear();
+    input.seekg( 0, ios::beg );
+
+    bool loaded = false;
+    try
+    {
+      switch( type )
+      {
+        case SpecUtils::ParserType::N42_2006:
+        case SpecUtils::ParserType::N42_2012:
+          //The N42 parser works in-situ, so let it copy the data into its
+          //  own buffer.
+          loaded = info.load_from_N42( input );
+          break;
+
+        case SpecUtils::ParserType::Pcf:
+          loaded = info.load_from_pcf( input );
+          break;
+
+        case SpecUtils::ParserType::Spc:
+          loaded = info.load_from_binary_spc( input );
+          if( !loaded )
+          {
+            input.clear();
+            input.seekg( 0, ios::beg );
+            loaded = info.load_from_iaea_spc( input );
+          }
+          break;
+
+        case SpecUtils::ParserType::Chn:
+          loaded = info.load_from_chn( input );
+          break;
+
+        case SpecUtils::ParserType::SpeIaea:
+          loaded = info.load_from_iaea( input );
+          break;
+
+        case SpecUtils::ParserType::Cnf:
+          loaded = info.load_from_cnf( input );
+          break;
+
+        case SpecUtils::ParserType::Tka:
+          loaded = info.load_from_tka( input );
+          break;
+
+        case SpecUtils::ParserType::Exploranium:
+          loaded = info.load_from_binary_exploranium( input );
+          break;
+
+        case SpecUtils::ParserType::SPMDailyFile:
+          loaded = info.load_from_spectroscopic_daily_file( input );
+          break;
+
+        case SpecUtils::ParserType::TxtOrCsv:
+          loaded = info.load_from_txt_or_csv( input );
+          break;
+
+        default:
+          break;
+      }//switch( type )
+    }catch( std::exception & )
+    {
+      loaded = false;
+    }//try / catch
+
+    if( !loaded )
+      info.reset();
+
+    return loaded;
+  }//parse_stream(...)
+
+
+  /** The same as parse_stream(...), but for data already in memory. */
+  bool parse_memory( SpecUtils::SpecFile &info, const SpecUtils::ParserType type,
+                     const char *data, const size_t nbytes )
+  {
+    MemoryStreamBuf buffer( data, nbytes );
+    std::istream input( &buffer );
+    return parse_stream( info, type, input );
+  }//parse_memory(...)
+
+
+  /** The formats parse_stream(...) can parse, in the order they are tried when
+   the format isn't recognized by FileLoader::sniff_parser_type(...).
+   */
+  const SpecUtils::ParserType ns_stream_parse_order[] = {
+    SpecUtils::ParserType::N42_2012, SpecUtils::ParserType::Pcf,
+    SpecUtils::ParserType::Spc, SpecUtils::ParserType::Chn,
+    SpecUtils::ParserType::SpeIaea, SpecUtils::ParserType::Cnf,
+    SpecUtils::ParserType::Tka, SpecUtils::ParserType::Exploranium,
+    SpecUtils::ParserType::SPMDailyFile, SpecUtils::ParserType::TxtOrCsv
+  };
+
+
+  /** Sniffs the format of `input`, and parses it with the matching parser,
+   trying each parser of ns_stream_parse_order if that fails.  `size` is the
+   size of the data, or zero if not known (it is then only found if needed to
+   sniff the format).  Everything is read from `input`, nothing touches disk.
+   */
+  bool load_from_stream( SpecUtils::SpecFile &info, std::istream &input, size_t size,
+                         FileLoader::LoadTiming *timing )
+  {
+    auto start = std::chrono::steady_clock::now();
+
+    char header[ns_sniff_size];
+    input.read( header, sizeof(header) );
+    const size_t nread = static_cast<size_t>( input.gcount() );
+
+    //Binary formats are partly identified by the file size, but for XML we
+    //  dont need it, which saves decompressing a large N42 file an extra time.
+    if( !size && (nread < sizeof(header)) )
+      size = nread;
+
+    if( !size && !looks_like_xml( header, nread ) )
+    {
+      input.clear();
+      input.seekg( 0, ios::end );
+      const streamoff end_pos = input.tellg();
+      size = (end_pos > 0) ? static_cast<size_t>(end_pos) : nread;
+    }//if( we need the size )
+
+    const SpecUtils::ParserType type = FileLoader::sniff_parser_type( header, nread, size );
+
+    if( timing )
+    {
+      timing->sniffed_type = type;
+      timing->used_auto = false;
+      timing->sniff_seconds += seconds_since( start );
+    }
+
+    start = std::chrono::steady_clock::now();
+
+    bool loaded = (type != SpecUtils::ParserType::Auto) && parse_stream( info, type, input );
+
+    if( !loaded && timing )
+      timing->used_auto = true;
+
+    //N42-2006 and N42-2012 use the same parser
+    const bool sniffed_n42 = (type == SpecUtils::ParserType::N42_2006)
+                             || (type == SpecUtils::ParserType::N42_2012);
+    for( size_t i = 0; !loaded && (i < sizeof(ns_stream_parse_order)/sizeof(ns_stream_parse_order[0])); ++i )
+    {
+      const SpecUtils::ParserType other = ns_stream_parse_order[i];
+      if( (other == type) || (sniffed_n42 && (other == SpecUtils::ParserType::N42_2012)) )
+        continue;
+      loaded = parse_stream( info, other, input );
+    }//for( loop over parsers to try )
+
+    if( timing )
+      timing->parse_seconds += seconds_since( start );
+
+    return loaded;
+  }//load_from_stream(...)
+
+
+  /** Inflates gzip data, which may be multiple concatenated members, appending
+   to `output`.  If `exact`, the data must end exactly at the end of a member
+   (used to validate guessed member boundaries); otherwise trailing non-gzip
+   bytes are ignored, like gunzip does.
+   */
+  bool gunzip( const char *data, const size_t nbytes, const bool exact, string &output )
+  {
+    z_stream strm;
+    memset( &strm, 0, sizeof(strm) );
+
+    //15 window bits, plus 16 to only accept a gzip wrapper
+    if( inflateInit2( &strm, 15 + 16 ) != Z_OK )
+      return false;
+
+    const size_t max_chunk = 1024*1024*1024;
+    const unsigned char *in = reinterpret_cast<const unsigned char *>( data );
+    size_t in_remaining = nbytes;
+    size_t out_pos = output.size();
+    bool success = false;
+
+    while( true )
+    {
+      if( !strm.avail_in && in_remaining )
+      {
+        const size_t nchunk = std::min( in_remaining, max_chunk );
+        strm.next_in = const_cast<Bytef *>( in );
+        strm.avail_in = static_cast<uInt>( nchunk );
+        in += nchunk;
+        in_remaining -= nchunk;
+      }//if( need more input )
+
+      if( out_pos == output.size() )
+        output.resize( std::max( 2*output.size(), out_pos + 64*1024 ) );
+
+      const size_t out_avail = std::min( output.size() - out_pos, max_chunk );
+      strm.next_out = reinterpret_cast<Bytef *>( &output[out_pos] );
+      strm.avail_out = static_cast<uInt>( out_avail );
+
+      const int rc = inflate( &strm, Z_NO_FLUSH );
+      out_pos += (out_avail - strm.avail_out);
+
+      if( rc == Z_STREAM_END )
+      {
+        const size_t left = strm.avail_in + in_remaining;
+        if( !left )
+        {
+          success = true;
+          break;
+        }
+
+        //Another member must start with the gzip magic number.
+        //The input is contiguous, so we can look past `avail_in`.
+        const unsigned char *next = strm.next_in;
+        if( (left >= 2) && (next[0] == 0x1f) && (next[1] == 0x8b) )
+        {
+          inflateReset( &strm );
+          continue;
+        }
+
+        success = !exact;
+        break;
+      }//if( rc == Z_STREAM_END )
+
+      if( (rc != Z_OK) && (rc != Z_BUF_ERROR) )
+        break;
+
+      //No progress possible: truncated input
+      if( (rc == Z_BUF_ERROR) && !strm.avail_in && !in_remaining )
+        break;
+    }//while( true )
+
+    inflateEnd( &strm );
+    output.resize( out_pos );
+
+    return success;
+  }//gunzip(...)
+
+
+  /** Tries to decompress a multi-member gzip file in parallel, by guessing
+   member boundaries from the gzip magic number, and decompressing each range
+   of members on its own thread.  Every range must decompress exactly (zlib
+   checks each member's CRC and length), or false is returned, and the caller
+   should fall back to decompressing sequentially.
+   */
+  bool parallel_gunzip( const char *data, const size_t nbytes, const size_t num_threads,
+                        string &output )
+  {
+    const size_t nthreads = ParallelOutput::resolve_num_threads( num_threads );
+    if( (nthreads < 2) || (nbytes < ns_min_parallel_gunzip_size) )
+      return false;
+
+    //Possible member starts: the magic number, deflate method, and no reserved flags.
+    vector<size_t> candidates;
+    for( size_t pos = 1; (pos + 10) < nbytes; ++pos )
+    {
+      const void *found = memchr( data + pos, 0x1f, nbytes - 10 - pos );
+      if( !found )
+        break;
+      pos = static_cast<size_t>( static_cast<const char *>(found) - data );
+      if( (static_cast<unsigned char>(data[pos+1]) == 0x8b) && (data[pos+2] == 8)
+          && !(static_cast<unsigned char>(data[pos+3]) & 0xE0) )
+        candidates.push_back( pos );
+    }//for( loop over data looking for gzip headers )
+
+    if( candidates.empty() )
+      return false;
+
+    //Group members into a few ranges per thread, of about equal compressed size.
+    const size_t nranges = std::min( 4*nthreads, candidates.size() + 1 );
+    vector<size_t> starts( 1, 0 );
+    for( size_t i = 1; i < nranges; ++i )
+    {
+      const size_t target = (i * nbytes) / nranges;
+      const auto pos = std::lower_bound( begin(candidates), end(candidates), target );
+      if( (pos != end(candidates)) && (*pos > starts.back()) )
+        starts.push_back( *pos );
+    }//for( size_t i = 1; i < nranges; ++i )
+
+    if( starts.size() < 2 )
+      return false;
+    starts.push_back( nbytes );
+
+    vector<string> results( starts.size() - 1 );
+    vector<char> ok( results.size(), 0 );
+
+    ParallelOutput::parallel_for( results.size(), nthreads,
+                                  [&]( const size_t index, const size_t ){
+      const size_t len = starts[index+1] - starts[index];
+      results[index].reserve( 4*len );
+      ok[index] = gunzip( data + starts[index], len, true, results[index] );
+    } );
+
+    if( std::count( begin(ok), end(ok), char(0) ) )
+      return false;
+
+    size_t total = 0;
+    for( const string &result : results )
+      total += result.size();
+
+    output.reserve( output.size() + total );
+    for( string &result : results )
+    {
+      output += result;
+      string().swap( result );
+    }
+
+    return true;
+  }//parallel_gunzip(...)
+}//namespace
+
+
+namespace FileLoader
+{
+
+MappedFile::MappedFile( const std::string &filename )
+  : m_data( nullptr ),
+    m_size( 0 )
+#if( defined(_WIN32) )
+    , m_file( INVALID_HANDLE_VALUE ),
+    m_mapping( nullptr )
+#endif
+{
+#if( defined(_WIN32) )
+  const std::wstring wfilename = SpecUtils::convert_from_utf8_to_utf16( filename );
+  HANDLE file = CreateFileW( wfilename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                             OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr );
+  if( file == INVALID_HANDLE_VALUE )
+    throw runtime_error( "Unable to open '" + filename + "'" );
+  m_file = file;
+
+  LARGE_INTEGER filesize;
+  if( !GetFileSizeEx( file, &filesize ) || (filesize.QuadPart <= 0) )
+  {
+    CloseHandle( file );
+    throw runtime_error( "Unable to get size of '" + filename + "'" );
+  }
+  m_size = static_cast<size_t>( filesize.QuadPart );
+
+  HANDLE mapping = CreateFileMappingW( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+  if( !mapping )
+  {
+    CloseHandle( file );
+    throw runtime_error( "Unable to map '" + filename + "'" );
+  }
+  m_mapping = mapping;
+
+  m_data = static_cast<const char *>( MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 ) );
+  if( !m_data )
+  {
+    CloseHandle( mapping );
+    CloseHandle( file );
+    throw runtime_error( "Unable to map view of '" + filename + "'" );
+  }
+#else
+  const int fd = open( filename.c_str(), O_RDONLY );
+  if( fd < 0 )
+    throw runtime_error( "Unable to open '" + filename + "'" );
+
+  struct stat statbuf;
+  if( (fstat( fd, &statbuf ) != 0) || (statbuf.st_size <= 0) )
+  {
+    close( fd );
+    throw runtime_error( "Unable to get size of '" + filename + "'" );
+  }
+  m_size = static_cast<size_t>( statbuf.st_size );
+
+  void *data = mmap( nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+
+  if( data == MAP_FAILED )
+    throw runtime_error( "Unable to map '" + filename + "'" );
+
+  m_data = static_cast<const char *>( data );
+
+#if( defined(MADV_SEQUENTIAL) )
+  madvise( data, m_size, MADV_SEQUENTIAL );
+#endif
+#endif
+}//MappedFile constructor
+
+
+MappedFile::~MappedFile()
+{
+#if( defined(_WIN32) )
+  if( m_data )
+    UnmapViewOfFile( const_cast<char *>(m_data) );
+  if( m_mapping )
+    CloseHandle( static_cast<HANDLE>(m_mapping) );
+  if( m_file != INVALID_HANDLE_VALUE )
+    CloseHandle( static_cast<HANDLE>(m_file) );
+#else
+  if( m_data )
+    munmap( const_cast<char *>(m_data), m_size );
+#endif
+}//~MappedFile()
+
+
+const char *MappedFile::data() const
+{
+  return m_data;
+}
+
+
+size_t MappedFile::size() const
+{
+  return m_size;
+}
+
+
+SpecUtils::ParserType sniff_parser_type( const char *data, const size_t nbytes,
+                                         const size_t file_size )
+{
+  if( !data || (nbytes < 4) )
+    return SpecUtils::ParserType::Auto;
+
+  //N42: the root element should be within the first few kilobytes.
+  if( looks_like_xml( data, nbytes ) )
+  {
+    if( contains( data, nbytes, "RadInstrumentData" ) )
+      return SpecUtils::ParserType::N42_2012;
+
+    if( contains( data, nbytes, "N42InstrumentData" ) )
+      return SpecUtils::ParserType::N42_2006;
+
+    return SpecUtils::ParserType::Auto;
+  }//if( looks_like_xml( data, nbytes ) )
+
+  //IAEA SPE files start with a "$SPEC_ID:", "$SPEC_REM:", etc. line
+  if( (nbytes >= 10) && (data[0] == '$')
+      && (!strncmp( data, "$SPEC_ID:", 9 ) || !strncmp( data, "$SPEC_REM:", 10 )
+          || !strncmp( data, "$DATE_MEA:", 10 ) || !strncmp( data, "$MEAS_TIM:", 10 )) )
+    return SpecUtils::ParserType::SpeIaea;
+
+  //PCF: int16 number of 256 byte records per spectrum, then a "DHS" version.
+  if( (nbytes >= 256) && !memcmp( data + 2, "DHS", 3 ) )
+    return SpecUtils::ParserType::Pcf;
+
+  //CHN: the first int16 is always -1, followed by the MCA number and segment.
+  if( (file_size >= 32) && (read_uint16( data ) == 0xFFFF) )
+    return SpecUtils::ParserType::Chn;
+
+  //ORTEC binary SPC: made of 128 byte records; INFTYP is 1, and FILTYP is
+  //  1 for integer or 5 for floating point data.
+  if( (nbytes >= 128) && ((file_size % 128) == 0)
+      && (read_uint16( data ) == 1)
+      && ((read_uint16( data + 2 ) == 1) || (read_uint16( data + 2 ) == 5)) )
+    return SpecUtils::ParserType::Spc;
+
+  //Canberra CNF: a list of 0x30 byte block descriptors starts at 0x70, with
+  //  the block ID as the first uint32; we'll look for the acquisition
+  //  parameters (0x12000) and spectrum data (0x12005) blocks.
+  if( nbytes >= 0x200 )
+  {
+    bool has_acq = false, has_data = false;
+    for( size_t pos = 0x70; (pos + 4) <= nbytes && (pos < 0x800); pos += 0x30 )
+    {
+      const uint32_t block_id = read_uint32( data + pos );
+      if( !block_id )
+        break;
+      has_acq |= (block_id == 0x00012000);
+      has_data |= (block_id == 0x00012005);
+    }
+
+    if( has_acq && has_data )
+      return SpecUtils::ParserType::Cnf;
+  }//if( nbytes >= 0x200 )
+
+  return SpecUtils::ParserType::Auto;
+}//sniff_parser_type(...)
+
+
+const char *parser_type_name( const SpecUtils::ParserType type )
+{
+  switch( type )
+  {
+    case SpecUtils::ParserType::N42_2006: return "N42-2006";
+    case SpecUtils::ParserType::N42_2012: return "N42-2012";
+    case SpecUtils::ParserType::Spc:      return "SPC";
+    case SpecUtils::ParserType::Pcf:      return "PCF";
+    case SpecUtils::ParserType::Chn:      return "CHN";
+    case SpecUtils::ParserType::SpeIaea:  return "SPE";
+    case SpecUtils::ParserType::Cnf:      return "CNF";
+    case SpecUtils::ParserType::Auto:     return "Auto";
+    default:                              break;
+  }//switch( type )
+
+  return "Other";
+}//parser_type_name(...)
+
+
+Compression sniff_compression( const char *data, const size_t nbytes )
+{
+  const unsigned char *p = reinterpret_cast<const unsigned char *>( data );
+
+  if( !p || (nbytes < 4) )
+    return Compression::None;
+
+  if( (p[0] == 0x1f) && (p[1] == 0x8b) && (p[2] == 8) )
+    return Compression::Gzip;
+
+  if( (p[0] == 0x28) && (p[1] == 0xb5) && (p[2] == 0x2f) && (p[3] == 0xfd) )
+    return Compression::Zstd;
+
+  if( (nbytes >= 6) && !memcmp( p, "\xFD" "7zXZ\x00", 6 ) )
+    return Compression::Xz;
+
+  return Compression::None;
+}//sniff_compression(...)
+
+
+const char *compression_name( const Compression type )
+{
+  switch( type )
+  {
+    case Compression::None: return "none";
+    case Compression::Gzip: return "gzip";
+    case Compression::Zstd: return "zstd";
+    case Compression::Xz:   return "xz";
+  }//switch( type )
+
+  return "";
+}//compression_name(...)
+
+
+bool decompress( const char *data, const size_t nbytes, const Compression type,
+                 std::string &output, const size_t num_threads )
+{
+  switch( type )
+  {
+    case Compression::None:
+      output.append( data, nbytes );
+      return true;
+
+    case Compression::Gzip:
+    {
+      if( parallel_gunzip( data, nbytes, num_threads, output ) )
+        return true;
+
+      //The last four bytes are the uncompressed size (mod 4 GB) of the last member,
+      //  which for the usual single-member file, is the whole thing.
+      const size_t orig_size = output.size();
+      size_t expected = 4*nbytes;
+      if( nbytes >= 18 )
+        expected = std::max( size_t(read_uint32( data + nbytes - 4 )), nbytes );
+      output.reserve( orig_size + expected );
+
+      if( gunzip( data, nbytes, false, output ) )
+        return true;
+      output.resize( orig_size );
+      return false;
+    }//case Compression::Gzip:
+
+    case Compression::Zstd:
+    {
+#if( CAMBIO_ENABLE_ZSTD )
+      ZSTD_DStream * const stream = ZSTD_createDStream();
+      if( !stream )
+        return false;
+      ZSTD_initDStream( stream );
+
+      const size_t orig_size = output.size();
+      const unsigned long long content_size = ZSTD_getFrameContentSize( data, nbytes );
+      if( (content_size != ZSTD_CONTENTSIZE_UNKNOWN) && (content_size != ZSTD_CONTENTSIZE_ERROR) )
+        output.reserve( orig_size + static_cast<size_t>(content_size) );
+
+      ZSTD_inBuffer in = { data, nbytes, 0 };
+      size_t out_pos = orig_size;
+      size_t rc = 0;
+      bool ok = true;
+      while( in.pos < in.size )
+      {
+        if( out_pos == output.size() )
+          output.resize( std::max( 2*output.size(), out_pos + ZSTD_DStreamOutSize() ) );
+
+        ZSTD_outBuffer out = { &output[0], output.size(), out_pos };
+        rc = ZSTD_decompressStream( stream, &out, &in );
+        out_pos = out.pos;
+        if( ZSTD_isError( rc ) )
+        {
+          ok = false;
+          break;
+        }
+      }//while( in.pos < in.size )
+
+      //Flush out anything left in the decoder.
+      while( ok && (rc != 0) )
+      {
+        if( out_pos == output.size() )
+          output.resize( std::max( 2*output.size(), out_pos + ZSTD_DStreamOutSize() ) );
+
+        const size_t prev_pos = out_pos;
+        ZSTD_outBuffer out = { &output[0], output.size(), out_pos };
+        rc = ZSTD_decompressStream( stream, &out, &in );
+        out_pos = out.pos;
+        ok = !ZSTD_isError( rc ) && ((out_pos != prev_pos) || (rc == 0));
+      }//while( frame not finished )
+
+      ZSTD_freeDStream( stream );
+      output.resize( ok ? out_pos : orig_size );
+      return ok;
+#else
+      return false;
+#endif
+    }//case Compression::Zstd:
+
+    case Compression::Xz:
+    {
+#if( CAMBIO_ENABLE_XZ )
+      lzma_stream strm = LZMA_STREAM_INIT;
+      if( lzma_stream_decoder( &strm, UINT64_MAX, LZMA_CONCATENATED ) != LZMA_OK )
+        return false;
+
+      const size_t orig_size = output.size();
+      size_t out_pos = orig_size;
+      strm.next_in = reinterpret_cast<const uint8_t *>( data );
+      strm.avail_in = nbytes;
+
+      lzma_ret rc = LZMA_OK;
+      while( rc == LZMA_OK )
+      {
+        if( out_pos == output.size() )
+          output.resize( std::max( 2*output.size(), out_pos + 64*1024 ) );
+
+        strm.next_out = reinterpret_cast<uint8_t *>( &output[out_pos] );
+        strm.avail_out = output.size() - out_pos;
+        rc = lzma_code( &strm, strm.avail_in ? LZMA_RUN : LZMA_FINISH );
+        out_pos = output.size() - strm.avail_out;
+      }//while( rc == LZMA_OK )
+
+      lzma_end( &strm );
+      const bool ok = (rc == LZMA_STREAM_END);
+      output.resize( ok ? out_pos : orig_size );
+      return ok;
+#else
+      return false;
+#endif
+    }//case Compression::Xz:
+  }//switch( type )
+
+  return false;
+}//decompress(...)
+
+
+std::string uncompressed_name( const std::string &filename )
+{
+  const char * const exts[] = { ".gz", ".gzip", ".zst", ".zstd", ".xz" };
+
+  for( const char *ext : exts )
+  {
+    const size_t len = strlen( ext );
+    if( (filename.size() > len)
+        && SpecUtils::iequals_ascii( filename.substr( filename.size() - len ), ext ) )
+      return filename.substr( 0, filename.size() - len );
+  }//for( const char *ext : exts )
+
+  return filename;
+}//uncompressed_name(...)
+
+
+LoadTiming::LoadTiming()
+  : sniffed_type( SpecUtils::ParserType::Auto ),
+    used_auto( false ),
+    compression( Compression::None ),
+    sniff_seconds( 0.0 ),
+    decompress_seconds( 0.0 ),
+    parse_seconds( 0.0 )
+{
+}
+
+
+bool load_from_memory( SpecUtils::SpecFile &info, const char *data, const size_t nbytes,
+                       const std::string &filename, LoadTiming *timing )
+{
+  const Compression compression = sniff_compression( data, std::min( nbytes, ns_sniff_size ) );
+
+  if( timing )
+  {
+    timing->compression = compression;
+    timing->sniff_seconds = timing->decompress_seconds = timing->parse_seconds = 0.0;
+    timing->error.clear();
+  }
+
+  MemoryStreamBuf buffer( data, nbytes );
+  std::istream input( &buffer );
+
+  bool loaded = false;
+  if( compression == Compression::None )
+  {
+    loaded = load_from_stream( info, input, nbytes, timing );
+    if( !loaded && timing )
+      timing->error = "unrecognized format";
+  }else
+  {
+    DecompressStreamBuf decompressed( input, compression );
+    std::istream decompressed_input( &decompressed );
+    loaded = load_from_stream( info, decompressed_input, 0, timing );
+
+    if( !loaded && timing )
+      timing->error = decompressed.failed()
+                      ? (string("unable to decompress ") + compression_name(compression) + " data")
+                      : string("unrecognized format inside compressed file");
+
+    if( timing )
+    {
+      timing->decompress_seconds = decompressed.seconds();
+      timing->parse_seconds = std::max( 0.0, timing->parse_seconds - timing->decompress_seconds );
+    }
+  }//if( compression == Compression::None ) / else
+
+  if( loaded )
+    info.set_filename( filename );
+
+  return loaded;
+}//load_from_memory(...)
+
+
+bool load_file( SpecUtils::SpecFile &info, const std::string &filename,
+                const std::string &hint, LoadTiming *timing )
+{
+  auto start = std::chrono::steady_clock::now();
+
+  SpecUtils::ParserType type = SpecUtils::ParserType::Auto;
+  Compression compression = Compression::None;
+
+#ifdef _WIN32
+  ifstream input( SpecUtils::convert_from_utf8_to_utf16(filename).c_str(), ios::in | ios::binary );
+#else
+  ifstream input( filename.c_str(), ios::in | ios::binary );
+#endif
+
+  char header[ns_sniff_size];
+  input.read( header, sizeof(header) );
+  const size_t nread = static_cast<size_t>( input.gcount() );
+  input.clear();
+  input.seekg( 0, ios::end );
+  const streamoff file_size = input.tellg();
+
+  compression = sniff_compression( header, nread );
+  if( nread && (file_size > 0) && (compression == Compression::None) )
+    type = sniff_parser_type( header, nread, static_cast<size_t>(file_size) );
+
+  if( timing )
+  {
+    timing->sniffed_type = type;
+    timing->used_auto = false;
+    timing->compression = compression;
+    timing->sniff_seconds = seconds_since( start );
+    timing->decompress_seconds = timing->parse_seconds = 0.0;
+    timing->error.clear();
+  }
+
+  if( compression != Compression::None )
+  {
+    //Decompress the file as it is parsed, so neither the compressed, nor the
+    //  whole decompressed, file is ever held in memory.
+    input.clear();
+    input.seekg( 0, ios::beg );
+
+    DecompressStreamBuf decompressed( input, compression );
+    std::istream decompressed_input( &decompressed );
+    const bool loaded = load_from_stream( info, decompressed_input, 0, timing );
+
+    if( timing )
+    {
+      timing->decompress_seconds = decompressed.seconds();
+      timing->parse_seconds = std::max( 0.0, timing->parse_seconds - timing->decompress_seconds );
+      if( !loaded )
+        timing->error = decompressed.failed()
+                        ? (string("unable to decompress ") + compression_name(compression) + " data")
+                        : string("unrecognized format inside compressed file");
+    }//if( timing )
+
+    if( loaded )
+      info.set_filename( uncompressed_name( filename ) );
+
+    return loaded;
+  }//if( compression != Compression::None )
+
+  input.close();
+
+  start = std::chrono::steady_clock::now();
+
+  bool loaded = false;
+  if( parses_from_stream( type ) )
+  {
+    //These parsers only read their input, so they can read the file straight
+    //  from a read-only mapping, with no copy on the heap.
+    unique_ptr<MappedFile> mapped;
+    try
+    {
+      mapped.reset( new MappedFile( filename ) );
+    }catch( std::exception & )
+    {
+    }
+
+    if( mapped )
+      loaded = parse_memory( info, type, mapped->data(), mapped->size() );
+    if( loaded )
+      info.set_filename( filename );
+  }else if( type != SpecUtils::ParserType::Auto )
+  {
+    //The N42 parser modifies its input in-place, so let SpecFile::load_file(...)
+    //  read the file into its own buffer.
+    loaded = info.load_file( filename, type, hint );
+  }//if( parses_from_stream( type ) ) / else
+
+  if( !loaded )
+  {
+    if( timing )
+      timing->used_auto = true;
+    loaded = info.load_file( filename, SpecUtils::ParserType::Auto, hint );
+  }
+
+  if( timing )
+  {
+    timing->parse_seconds = seconds_since( start );
+    if( !loaded )
+      timing->error = "unrecognized format";
+  }
+
+  return loaded;
+}//load_file(...)
+
+
+bool preview_n42_2012( const std::string &filename,
+            const std::function<bool(const SpecUtils::SpecFile &piece,double fraction)> &callback )
+{
+  //The file is read with ordinary bounded reads, rather than mapped, since this
+  //  may run for as long as the real parse, and the file could be modified or
+  //  truncated under us.
+#ifdef _WIN32
+  ifstream input( SpecUtils::convert_from_utf8_to_utf16(filename).c_str(), ios::in | ios::binary );
+#else
+  ifstream input( filename.c_str(), ios::in | ios::binary );
+#endif
+  if( !input.is_open() )
+    return false;
+
+  input.seekg( 0, ios::end );
+  const streamoff file_size = input.tellg();
+  input.seekg( 0, ios::beg );
+  if( file_size <= 0 )
+    return false;
+  const size_t size = static_cast<size_t>( file_size );
+
+  //`buffer` holds the file from `buffer_offset` on; what has been used is
+  //  removed from the front after each piece.
+  string buffer;
+  size_t buffer_offset = 0;
+  bool at_eof = false;
+
+  const auto read_more = [&]() -> bool {
+    if( at_eof )
+      return false;
+
+    const size_t old_size = buffer.size();
+    buffer.resize( old_size + ns_preview_read_size );
+    input.read( &buffer[old_size], ns_preview_read_size );
+    const size_t nread = static_cast<size_t>( std::max( input.gcount(), streamsize(0) ) );
+    buffer.resize( old_size + nread );
+    at_eof = !input;
+
+    return (nread > 0);
+  };//read_more lambda
+
+  read_more();
+
+  const size_t nsniff = std::min( buffer.size(), ns_sniff_size );
+  if( (sniff_compression( buffer.data(), nsniff ) != Compression::None)
+      || (sniff_parser_type( buffer.data(), nsniff, size ) != SpecUtils::ParserType::N42_2012) )
+    return false;
+
+  const string element_name = "RadMeasurement";
+  string prefix;
+  size_t first = string::npos, search = 0;
+  while( (first = find_start_tag( buffer.data(), search, buffer.size(), element_name, prefix )) == string::npos )
+  {
+    //The tag may be cut off at the end of what has been read so far
+    search = buffer.size() - std::min( buffer.size(), element_name.size() );
+    if( (buffer.size() > ns_max_preview_header) || !read_more() )
+      return false;
+  }
+
+  //Everything before the first measurement is included with each piece, and
+  //  each piece closed with the end tag of the root element.
+  const string header = buffer.substr( 0, first );
+  const string footer = "</" + prefix + "RadInstrumentData>";
+  const string start_tag = "<" + prefix + "RadMeasurement";
+  const string end_tag = "</" + prefix + "RadMeasurement>";
+
+  buffer.erase( 0, first );
+  buffer_offset = first;
+
+  bool any_parsed = false;
+  bool done = false;
+  size_t pos = 0;  //Where in `buffer` to look for the next element
+  while( !done )
+  {
+    string piece = header;
+    size_t num_elements = 0;
+
+    while( (piece.size() - header.size()) < ns_preview_piece_size )
+    {
+      //Find the next complete element, reading more of the file as needed;
+      //  each search picks up where the last left off.
+      size_t start = string::npos, end = string::npos;
+      search = pos;
+      for( ; ; )
+      {
+        if( start == string::npos )
+        {
+          start = find( buffer.data(), search, buffer.size(), start_tag );
+
+          //Make sure we didnt find a "RadMeasurementGroup", or similar
+          while( (start != string::npos) && ((start + start_tag.size()) < buffer.size())
+                 && !strchr( " \t\r\n>/", buffer[start + start_tag.size()] ) )
+            start = find( buffer.data(), start + 1, buffer.size(), start_tag );
+
+          if( (start != string::npos) && ((start + start_tag.size()) >= buffer.size()) )
+          {
+            search = start;  //Need the next character to know it's the tag
+            start = string::npos;
+          }else if( start == string::npos )
+          {
+            search = std::max( search, buffer.size() - std::min( buffer.size(), start_tag.size() ) );
+          }else
+          {
+            search = start + start_tag.size();
+          }
+        }//if( start == string::npos )
+
+        if( start != string::npos )
+        {
+          end = find( buffer.data(), search, buffer.size(), end_tag );
+          if( end != string::npos )
+            break;
+          search = std::max( search, buffer.size() - std::min( buffer.size(), end_tag.size() ) );
+        }//if( start != string::npos )
+
+        if( !read_more() )
+          break;
+      }//for( ; ; )
+
+      if( end == string::npos )
+      {
+        done = true;
+        break;
+      }
+
+      pos = end + end_tag.size();
+      piece.append( buffer, start, pos - start );
+      ++num_elements;
+    }//while( the piece isnt big enough yet )
+
+    if( !num_elements )
+      break;
+
+    buffer.erase( 0, pos );
+    buffer_offset += pos;
+    pos = 0;
+
+    piece += footer;
+
+    SpecUtils::SpecFile info;
+    bool loaded = false;
+    try
+    {
+      loaded = info.load_N42_from_data( &piece[0], &piece[0] + piece.size() );
+    }catch( std::exception & )
+    {
+      loaded = false;
+    }
+
+    if( !loaded )
+      continue;
+
+    any_parsed = true;
+    info.set_filename( filename );
+
+    const double fraction = std::min( 1.0, static_cast<double>(buffer_offset) / size );
+    if( !callback( info, fraction ) )
+      break;
+  }//while( !done )
+
+  return any_parsed;
+}//preview_n42_2012(...)
+
+}//namespace FileLoader
@@ -0,0 +1,829 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <locale>
+#include <ostream>
+#include <sstream>
+#include <algorithm>
+
+#include "SpecUtils/SpecFile.h"
+#include "SpecUtils/DateTime.h"
+#include "SpecUtils/EnergyCalibration.h"
+
+#include "cambio/JsonWriter.h"
+
+using namespace std;
+
+namespace
+{
+  /** Writes `value` in decimal, returning the number of characters written. */
+  size_t format_integer( const int64_t value, char *buffer )
+  {
+    char digits[24];
+    size_t ndigits = 0;
+
+    //Work with a negative number, so INT64_MIN doesn't overflow
+    int64_t remaining = (value < 0) ? value : -value;
+    do
+    {
+      digits[ndigits++] = static_cast<char>( '0' - (remaining % 10) );
+      remaining /= 10;
+    }while( remaining );
+
+    size_t pos = 0;
+    if( value < 0 )
+      buffer[pos++] = '-';
+    while( ndigits )
+      buffer[pos++] = digits[--ndigits];
+
+    return pos;
+  }//format_integer(...)
+
+
+  /** Returns if `value` is an integer small enough to be exactly held by an
+   int64_t, setting `as_int` if so.
+   */
+  template<class T>
+  bool is_integer_value( const T value, int64_t &as_int )
+  {
+    if( !(value > T(-1.0E15) && value < T(1.0E15)) )  //Also false for NaN
+      return false;
+
+    as_int = static_cast<int64_t>( value );
+    return (static_cast<T>( as_int ) == value);
+  }//is_integer_value(...)
+
+
+  /** Writes the decimal number `digits` x 10^`exponent`, in plain notation for
+   moderate exponents, and scientific notation otherwise.
+   */
+  size_t format_decimal( const bool negative, uint64_t digits, int exponent, char *buffer )
+  {
+    char digit_chars[24];
+    size_t ndigits = 0;
+    while( digits && !(digits % 10) )  //Trailing zeros
+    {
+      digits /= 10;
+      ++exponent;
+    }
+    do
+    {
+      digit_chars[ndigits++] = static_cast<char>( '0' + (digits % 10) );
+      digits /= 10;
+    }while( digits );
+    std::reverse( digit_chars, digit_chars + ndigits );
+
+    size_t pos = 0;
+    if( negative )
+      buffer[pos++] = '-';
+
+    //The exponent if written as d.ddd x 10^sci_exponent
+    const int sci_exponent = exponent + static_cast<int>(ndigits) - 1;
+
+    if( (sci_exponent >= -6) && (sci_exponent < 21) )
+    {
+      if( exponent >= 0 )
+      {
+        memcpy( buffer + pos, digit_chars, ndigits );
+        pos += ndigits;
+        memset( buffer + pos, '0', exponent );
+        pos += exponent;
+      }else if( sci_exponent >= 0 )
+      {
+        const size_t nint = static_cast<size_t>( sci_exponent + 1 );
+        memcpy( buffer + pos, digit_chars, nint );
+        pos += nint;
+        buffer[pos++] = '.';
+        memcpy( buffer + pos, digit_chars + nint, ndigits - nint );
+        pos += ndigits - nint;
+      }else
+      {
+        buffer[pos++] = '0';
+        buffer[pos++] = '.';
+        memset( buffer + pos, '0', -sci_exponent - 1 );
+        pos += -sci_exponent - 1;
+        memcpy( buffer + pos, digit_chars, ndigits );
+        pos += ndigits;
+      }
+    }else
+    {
+      buffer[pos++] = digit_chars[0];
+      if( ndigits > 1 )
+      {
+        buffer[pos++] = '.';
+        memcpy( buffer + pos, digit_chars + 1, ndigits - 1 );
+        pos += ndigits - 1;
+      }
+      pos += snprintf( buffer + pos, 8, "e%+d", sci_exponent );
+    }//if( plain notation ) / else
+
+    return pos;
+  }//format_decimal(...)
+
+
+  /** Finds the shortest decimal that reads back as `value`, using double
+   precision arithmetic, which is much faster than printing and parsing with
+   snprintf/strtof.
+
+   A candidate d x 10^e (d having at most 9 digits, so exactly representable)
+   round-trips if it lies strictly between the midpoints to the neighboring
+   floats (which are exact in double).  The product d x 10^e is computed with
+   a single rounding, so if it lands within a rounding error of a midpoint we
+   can't be sure, and return 0 so the caller uses the slow, exact, method;
+   this also happens for very large or small values, where 10^e isn't exact.
+   */
+  size_t format_float_fast( const float value, char *buffer )
+  {
+    static const double powers_of_ten[] = {
+      1E0, 1E1, 1E2, 1E3, 1E4, 1E5, 1E6, 1E7, 1E8, 1E9, 1E10, 1E11,
+      1E12, 1E13, 1E14, 1E15, 1E16, 1E17, 1E18, 1E19, 1E20, 1E21, 1E22
+    };
+
+    const bool negative = (value < 0.0f);
+    const float magnitude = std::fabs( value );
+    if( !(magnitude > 0.0f) || std::isinf(magnitude) )
+      return 0;
+
+    const double exact = magnitude;
+    const double lower = 0.5*(exact + std::nextafter( magnitude, 0.0f ));
+    const double upper = 0.5*(exact + std::nextafter( magnitude, HUGE_VALF ));
+
+    const int decimal_exponent = static_cast<int>( std::floor( std::log10( exact ) ) );
+
+    for( int precision = 1; precision <= 9; ++precision )
+    {
+      //We want digits = round( magnitude x 10^scale ), with precision digits.
+      const int scale = precision - 1 - decimal_exponent;
+      if( (scale > 22) || (scale < -22) )
+        return 0;
+
+      const double scaled = (scale >= 0) ? (exact * powers_of_ten[scale])
+                                         : (exact / powers_of_ten[-scale]);
+      const double digits = std::floor( scaled + 0.5 );
+      if( digits < 1.0 )
+        continue;
+
+      const double candidate = (scale >= 0) ? (digits / powers_of_ten[scale])
+                                            : (digits * powers_of_ten[-scale]);
+      const double tolerance = 4.0 * candidate * std::numeric_limits<double>::epsilon();
+
+      if( (candidate > (lower + tolerance)) && (candidate < (upper - tolerance)) )
+        return format_decimal( negative, static_cast<uint64_t>(digits), -scale, buffer );
+
+      if( (std::fabs( candidate - lower ) <= tolerance) || (std::fabs( candidate - upper ) <= tolerance) )
+        return 0;
+    }//for( int precision = 1; precision <= 9; ++precision )
+
+    return 0;
+  }//format_float_fast(...)
+
+
+  /** Writes `value` with the fewest significant digits, from `min_precision`
+   to `max_precision`, that read back as `value`, in the same form as
+   "%.*g", and returns the number of characters written.
+
+   snprintf and strtod use the global C locale, which the GUI (through Qt)
+   sets from the environment, so could write a comma as the decimal point;
+   streams imbued with the classic locale are used instead.  If reading back
+   fails (e.g., some standard libraries fail on denormals), more digits are
+   tried, and the `max_precision` result is used, which always round-trips.
+   */
+  template<class T>
+  size_t format_round_trip( const T value, const int min_precision,
+                            const int max_precision, char *buffer )
+  {
+    std::ostringstream output;
+    output.imbue( std::locale::classic() );
+
+    string result;
+    for( int precision = min_precision; precision <= max_precision; ++precision )
+    {
+      output.str( "" );
+      output.precision( precision );
+      output << value;
+      result = output.str();
+
+      std::istringstream input( result );
+      input.imbue( std::locale::classic() );
+      T readback = 0;
+      if( (input >> readback) && (readback == value) )
+        break;
+    }//for( loop over precisions )
+
+    const size_t nchars = std::min( result.size(), size_t(31) );
+    memcpy( buffer, result.data(), nchars );
+    return nchars;
+  }//format_round_trip(...)
+
+
+  const char *source_type_str( const SpecUtils::SourceType type )
+  {
+    switch( type )
+    {
+      case SpecUtils::SourceType::IntrinsicActivity: return "IntrinsicActivity";
+      case SpecUtils::SourceType::Calibration:       return "Calibration";
+      case SpecUtils::SourceType::Background:        return "Background";
+      case SpecUtils::SourceType::Foreground:        return "Foreground";
+      case SpecUtils::SourceType::Unknown:           return "Unknown";
+    }//switch( type )
+
+    return "Unknown";
+  }//source_type_str(...)
+
+
+  const char *occupancy_str( const SpecUtils::OccupancyStatus status )
+  {
+    switch( status )
+    {
+      case SpecUtils::OccupancyStatus::NotOccupied: return "NotOccupied";
+      case SpecUtils::OccupancyStatus::Occupied:    return "Occupied";
+      case SpecUtils::OccupancyStatus::Unknown:     return "Unknown";
+    }//switch( status )
+
+    return "Unknown";
+  }//occupancy_str(...)
+
+
+  const char *energy_cal_type_str( const SpecUtils::EnergyCalType type )
+  {
+    switch( type )
+    {
+      case SpecUtils::EnergyCalType::Polynomial:        return "Polynomial";
+      case SpecUtils::EnergyCalType::FullRangeFraction: return "FullRangeFraction";
+      case SpecUtils::EnergyCalType::LowerChannelEdge:  return "LowerChannelEdge";
+      case SpecUtils::EnergyCalType::UnspecifiedUsingDefaultPolynomial:
+        return "UnspecifiedUsingDefaultPolynomial";
+      case SpecUtils::EnergyCalType::InvalidEquationType: return "Invalid";
+    }//switch( type )
+
+    return "Invalid";
+  }//energy_cal_type_str(...)
+
+
+  void write_string_array( JsonWriter &json, const vector<string> &values )
+  {
+    json.begin_array();
+    for( const string &value : values )
+      json.string_value( value );
+    json.end_array();
+  }//write_string_array(...)
+
+
+  /** Writes the key and value, if the value isn't empty. */
+  void write_nonempty( JsonWriter &json, const char *key, const string &value )
+  {
+    if( value.empty() )
+      return;
+
+    json.key( key );
+    json.string_value( value );
+  }//write_nonempty(...)
+}//namespace
+
+
+JsonWriter::JsonWriter( std::ostream &output, const size_t buffer_size )
+  : m_output( output ),
+    m_buffer_size( std::max( buffer_size, size_t(1024) ) ),
+    m_buffer(),
+    m_has_value(),
+    m_after_key( false )
+{
+  m_buffer.reserve( m_buffer_size + 1024 );
+}//JsonWriter constructor
+
+
+JsonWriter::~JsonWriter()
+{
+  flush();
+}
+
+
+bool JsonWriter::flush()
+{
+  if( !m_buffer.empty() )
+  {
+    m_output.write( m_buffer.data(), static_cast<streamsize>( m_buffer.size() ) );
+    m_buffer.clear();
+  }
+
+  return m_output.good();
+}//flush()
+
+
+void JsonWriter::before_value()
+{
+  if( m_buffer.size() >= m_buffer_size )
+    flush();
+
+  if( m_after_key )
+  {
+    m_after_key = false;
+    return;
+  }
+
+  if( !m_has_value.empty() )
+  {
+    if( m_has_value.back() )
+      m_buffer += ',';
+    m_has_value.back() = true;
+  }
+}//before_value()
+
+
+void JsonWriter::begin_object()
+{
+  before_value();
+  m_buffer += '{';
+  m_has_value.push_back( false );
+}
+
+
+void JsonWriter::end_object()
+{
+  m_buffer += '}';
+  if( !m_has_value.empty() )
+    m_has_value.pop_back();
+}
+
+
+void JsonWriter::begin_array()
+{
+  before_value();
+  m_buffer += '[';
+  m_has_value.push_back( false );
+}
+
+
+void JsonWriter::end_array()
+{
+  m_buffer += ']';
+  if( !m_has_value.empty() )
+    m_has_value.pop_back();
+}
+
+
+void JsonWriter::key( const char *name )
+{
+  before_value();
+  m_buffer += '"';
+  escape( name, strlen(name), m_buffer );
+  m_buffer += "\":";
+  m_after_key = true;
+}
+
+
+void JsonWriter::key( const std::string &name )
+{
+  before_value();
+  m_buffer += '"';
+  escape( name.data(), name.size(), m_buffer );
+  m_buffer += "\":";
+  m_after_key = true;
+}
+
+
+void JsonWriter::string_value( const char *value )
+{
+  before_value();
+  m_buffer += '"';
+  escape( value, strlen(value), m_buffer );
+  m_buffer += '"';
+}
+
+
+void JsonWriter::string_value( const std::string &value )
+{
+  before_value();
+  m_buffer += '"';
+  escape( value.data(), value.size(), m_buffer );
+  m_buffer += '"';
+}
+
+
+void JsonWriter::number( const float value )
+{
+  before_value();
+  char buffer[32];
+  m_buffer.append( buffer, format_number( value, buffer ) );
+}
+
+
+void JsonWriter::number( const double value )
+{
+  before_value();
+  char buffer[32];
+  m_buffer.append( buffer, format_number( value, buffer ) );
+}
+
+
+void JsonWriter::integer( const int64_t value )
+{
+  before_value();
+  char buffer[32];
+  m_buffer.append( buffer, format_integer( value, buffer ) );
+}
+
+
+void JsonWriter::boolean( const bool value )
+{
+  before_value();
+  m_buffer += (value ? "true" : "false");
+}
+
+
+void JsonWriter::null()
+{
+  before_value();
+  m_buffer += "null";
+}
+
+
+void JsonWriter::number_array( const float *values, const size_t num_values )
+{
+  begin_array();
+
+  char buffer[32];
+  for( size_t i = 0; i < num_values; ++i )
+  {
+    if( m_buffer.size() >= m_buffer_size )
+      flush();
+
+    if( i )
+      m_buffer += ',';
+    m_buffer.append( buffer, format_number( values[i], buffer ) );
+  }//for( size_t i = 0; i < num_values; ++i )
+
+  end_array();
+}//number_array(...)
+
+
+void JsonWriter::number_array( const std::vector<float> &values )
+{
+  number_array( values.data(), values.size() );
+}
+
+
+void JsonWriter::escape( const char *input, const size_t length, std::string &output )
+{
+  static const char * const hex = "0123456789abcdef";
+
+  //Copy runs of characters that don't need escaping all at once
+  size_t run_start = 0;
+  for( size_t i = 0; i < length; ++i )
+  {
+    const unsigned char c = static_cast<unsigned char>( input[i] );
+    if( (c >= 0x20) && (c != '"') && (c != '\\') && (c != '<') )
+      continue;
+
+    output.append( input + run_start, i - run_start );
+    run_start = i + 1;
+
+    switch( c )
+    {
+      case '"':  output += "\\\""; break;
+      case '\\': output += "\\\\"; break;
+      case '\n': output += "\\n";  break;
+      case '\r': output += "\\r";  break;
+      case '\t': output += "\\t";  break;
+      case '\b': output += "\\b";  break;
+      case '\f': output += "\\f";  break;
+      default:
+        //Other control characters, and '<', so "</script>" can't appear
+        output += "\\u00";
+        output += hex[c >> 4];
+        output += hex[c & 0xF];
+    }//switch( c )
+  }//for( size_t i = 0; i < length; ++i )
+
+  output.append( input + run_start, length - run_start );
+}//escape(...)
+
+
+size_t JsonWriter::format_number( const float value, char *buffer )
+{
+  int64_t as_int;
+  if( is_integer_value( value, as_int ) )
+    return format_integer( as_int, buffer );
+
+  if( std::isnan(value) || std::isinf(value) )
+  {
+    memcpy( buffer, "null", 4 );
+    return 4;
+  }
+
+  size_t nchars = format_float_fast( value, buffer );
+  if( nchars )
+    return nchars;
+
+  //Add digits until the value round-trips; only reached for values very near
+  //  a rounding boundary, and very large or small (including denormal) values.
+  return format_round_trip( value, 1, 9, buffer );
+}//format_number( float )
+
+
+size_t JsonWriter::format_number( const double value, char *buffer )
+{
+  int64_t as_int;
+  if( is_integer_value( value, as_int ) )
+    return format_integer( as_int, buffer );
+
+  if( std::isnan(value) || std::isinf(value) )
+  {
+    memcpy( buffer, "null", 4 );
+    return 4;
+  }
+
+  //Every decimal with DBL_DIG (15) or fewer significant digits survives a trip
+  //  through double, so "%.15g" gives the shortest representation whenever one
+  //  that short exists (denormals aside); otherwise we add digits until the
+  //  value round-trips.
+  return format_round_trip( value, 15, 17, buffer );
+}//format_number( double )
+
+
+namespace SpectrumJson
+{
+
+void write_file( JsonWriter &json, const SpecUtils::SpecFile &info,
+                 const std::vector<std::shared_ptr<const SpecUtils::Measurement>> &measurements )
+{
+  json.begin_object();
+
+  json.key( "File" );
+  write_file_meta_info( json, info );
+
+  json.key( "Measurements" );
+  json.begin_array();
+  for( const shared_ptr<const SpecUtils::Measurement> &meas : measurements )
+  {
+    if( meas )
+      write_measurement( json, *meas );
+  }
+  json.end_array();
+
+  json.end_object();
+}//write_file(...)
+
+
+void write_file_meta_info( JsonWriter &json, const SpecUtils::SpecFile &info )
+{
+  json.begin_object();
+
+  write_nonempty( json, "Filename", info.filename() );
+  write_nonempty( json, "Uuid", info.uuid() );
+  write_nonempty( json, "Manufacturer", info.manufacturer() );
+  write_nonempty( json, "Model", info.instrument_model() );
+  write_nonempty( json, "InstrumentType", info.instrument_type() );
+  write_nonempty( json, "SerialNumber", info.instrument_id() );
+  json.key( "DetectorType" );
+  json.string_value( SpecUtils::detectorTypeToString( info.detector_type() ) );
+  write_nonempty( json, "Operator", info.measurement_operator() );
+  write_nonempty( json, "Inspection", info.inspection() );
+  write_nonempty( json, "LocationName", info.measurement_location_name() );
+  if( info.lane_number() >= 0 )
+  {
+    json.key( "LaneNumber" );
+    json.integer( info.lane_number() );
+  }
+
+  json.key( "Passthrough" );
+  json.boolean( info.passthrough() );
+
+  if( !info.remarks().empty() )
+  {
+    json.key( "Remarks" );
+    write_string_array( json, info.remarks() );
+  }
+
+  if( !info.parse_warnings().empty() )
+  {
+    json.key( "ParseWarnings" );
+    write_string_array( json, info.parse_warnings() );
+  }
+
+  json.key( "NumberMeasurements" );
+  json.integer( static_cast<int64_t>( info.num_measurements() ) );
+
+  json.key( "DetectorNames" );
+  write_string_array( json, info.detector_names() );
+
+  if( info.has_gps_info() )
+  {
+    json.key( "MeanLatitude" );
+    json.number( info.mean_latitude() );
+    json.key( "MeanLongitude" );
+    json.number( info.mean_longitude() );
+  }
+
+  json.key( "TotalLiveTime" );
+  json.number( info.gamma_live_time() );
+  json.key( "TotalRealTime" );
+  json.number( info.gamma_real_time() );
+  json.key( "TotalGammaCounts" );
+  json.number( info.gamma_count_sum() );
+  json.key( "TotalNeutronCounts" );
+  json.number( info.neutron_counts_sum() );
+
+  const shared_ptr<const SpecUtils::DetectorAnalysis> ana = info.detectors_analysis();
+  if( ana )
+  {
+    json.key( "Analysis" );
+    json.begin_object();
+
+    write_nonempty( json, "AlgorithmName", ana->algorithm_name_ );
+    write_nonempty( json, "AlgorithmCreator", ana->algorithm_creator_ );
+    write_nonempty( json, "AlgorithmDescription", ana->algorithm_description_ );
+    write_nonempty( json, "AlgorithmResultDescription", ana->algorithm_result_description_ );
+
+    if( !ana->algorithm_component_versions_.empty() )
+    {
+      json.key( "ComponentVersions" );
+      json.begin_array();
+      for( const pair<string,string> &version : ana->algorithm_component_versions_ )
+      {
+        json.begin_object();
+        json.key( "Component" );
+        json.string_value( version.first );
+        json.key( "Version" );
+        json.string_value( version.second );
+        json.end_object();
+      }
+      json.end_array();
+    }//if( !ana->algorithm_component_versions_.empty() )
+
+    if( !ana->remarks_.empty() )
+    {
+      json.key( "Remarks" );
+      write_string_array( json, ana->remarks_ );
+    }
+
+    json.key( "Results" );
+    json.begin_array();
+    for( const SpecUtils::DetectorAnalysisResult &result : ana->results_ )
+    {
+      json.begin_object();
+      write_nonempty( json, "Nuclide", result.nuclide_ );
+      write_nonempty( json, "NuclideType", result.nuclide_type_ );
+      write_nonempty( json, "Confidence", result.id_confidence_ );
+      write_nonempty( json, "Remark", result.remark_ );
+      write_nonempty( json, "Detector", result.detector_ );
+      if( result.activity_ > 0.0f )
+      {
+        json.key( "Activity" );  //Becquerel
+        json.number( result.activity_ );
+      }
+      if( result.dose_rate_ > 0.0f )
+      {
+        json.key( "DoseRate" );  //Micro-sievert per hour
+        json.number( result.dose_rate_ );
+      }
+      if( result.distance_ > 0.0f )
+      {
+        json.key( "Distance" );  //mm
+        json.number( result.distance_ );
+      }
+      if( result.real_time_ > 0.0f )
+      {
+        json.key( "RealTime" );  //Seconds
+        json.number( result.real_time_ );
+      }
+      json.end_object();
+    }//for( loop over results )
+    json.end_array();
+
+    json.end_object();
+  }//if( ana )
+
+  json.end_object();
+}//write_file_meta_info(...)
+
+
+void write_measurement( JsonWriter &json, const SpecUtils::Measurement &meas )
+{
+  json.begin_object();
+
+  json.key( "title" );
+  json.string_value( meas.title() );
+  json.key( "SampleNumber" );
+  json.integer( meas.sample_number() );
+  json.key( "DetectorName" );
+  json.string_value( meas.detector_name() );
+  json.key( "DetectorNumber" );
+  json.integer( meas.detector_number() );
+
+  if( !SpecUtils::is_special( meas.start_time() ) )
+  {
+    json.key( "StartTime" );
+    json.string_value( SpecUtils::to_extended_iso_string( meas.start_time() ) );
+  }
+
+  json.key( "liveTime" );
+  json.number( meas.live_time() );
+  json.key( "realTime" );
+  json.number( meas.real_time() );
+  json.key( "SourceType" );
+  json.string_value( source_type_str( meas.source_type() ) );
+  json.key( "Occupied" );
+  json.string_value( occupancy_str( meas.occupied() ) );
+
+  json.key( "GammaCountSum" );
+  json.number( meas.gamma_count_sum() );
+  json.key( "ContainedNeutron" );
+  json.boolean( meas.contained_neutron() );
+  if( meas.contained_neutron() )
+  {
+    json.key( "neutrons" );
+    json.number( meas.neutron_counts_sum() );
+    if( meas.neutron_live_time() > 0.0f )
+    {
+      json.key( "NeutronLiveTime" );
+      json.number( meas.neutron_live_time() );
+    }
+  }//if( meas.contained_neutron() )
+
+  if( meas.has_gps_info() )
+  {
+    json.key( "Latitude" );
+    json.number( meas.latitude() );
+    json.key( "Longitude" );
+    json.number( meas.longitude() );
+    if( !SpecUtils::is_special( meas.position_time() ) )
+    {
+      json.key( "PositionTime" );
+      json.string_value( SpecUtils::to_extended_iso_string( meas.position_time() ) );
+    }
+  }//if( meas.has_gps_info() )
+
+  if( !meas.remarks().empty() )
+  {
+    json.key( "Remarks" );
+    write_string_array( json, meas.remarks() );
+  }
+
+  const shared_ptr<const SpecUtils::EnergyCalibration> &cal = meas.energy_calibration();
+  if( cal && cal->valid() )
+  {
+    json.key( "EnergyCalibration" );
+    json.begin_object();
+    json.key( "Type" );
+    json.string_value( energy_cal_type_str( cal->type() ) );
+    if( cal->type() != SpecUtils::EnergyCalType::LowerChannelEdge )
+    {
+      json.key( "Coefficients" );
+      json.number_array( cal->coefficients() );
+    }
+    if( !cal->deviation_pairs().empty() )
+    {
+      json.key( "DeviationPairs" );
+      json.begin_array();
+      for( const pair<float,float> &dev : cal->deviation_pairs() )
+      {
+        const float values[2] = { dev.first, dev.second };
+        json.number_array( values, 2 );
+      }
+      json.end_array();
+    }//if( !cal->deviation_pairs().empty() )
+    json.end_object();
+
+    const shared_ptr<const vector<float>> &energies = cal->channel_energies();
+    if( energies )
+    {
+      json.key( "x" );
+      json.number_array( *energies );
+    }
+  }//if( cal && cal->valid() )
+
+  const shared_ptr<const vector<float>> &counts = meas.gamma_counts();
+  json.key( "y" );
+  if( counts )
+    json.number_array( *counts );
+  else
+    json.number_array( nullptr, 0 );
+
+  json.end_object();
+}//write_measurement(...)
+
+}//namespace SpectrumJson
@@ -19,6 +19,9 @@
 
 
 #include <string>
+#include <chrono>
+#include <atomic>
+#include <thread>
 #include <sstream>
 #include <fstream>
 #include <iostream>
@@ -34,6 +37,7 @@
 #include <QCheckBox>
 #include <QMimeData>
 #include <QTabWidget>
+#include <QDir>
 #include <QDropEvent>
 #include <QStatusBar>
 #include <QGridLayout>
@@ -41,6 +45,7 @@
 #include <QGridLayout>
 #include <QMessageBox>
 #include <QPushButton>
+#include <QProgressDialog>
 #include <QToolButton>
 #include <QFileDialog>
 #include <QThreadPool>
@@ -50,14 +55,18 @@
 #include <QDesktopWidget>
 #include <QDragLeaveEvent>
 #include <QDragEnterEvent>
+#include <QStandardPaths>
 #include <QCoreApplication>
 
 #include "cambio/TimeView.h"
+#include "cambio/TimeSeries.h"
+#include "cambio/FileLoader.h"
 #include "cambio/SaveWidget.h"
 #include "cambio/MainWindow.h"
 #include "cambio/SpectrumView.h"
 #include "cambio/BusyIndicator.h"
 #include "cambio/SpectrumChart.h"
+#include "cambio/SpecFileCache.h"
 #include "cambio/FileDetailWidget.h"
 
 #include "cambio/left_arrow.hpp"
@@ -109,6 +118,210 @@ QTCOMMERCIALCHART_USE_NAMESPACE
 QT_CHARTS_USE_NAMESPACE
 #endif
 
+
+namespace
+{
+  //Files at least this large (that aren't loaded from the cache) have a
+  //  preview shown while they are being parsed.
+  const qint64 ns_min_preview_size = 32*1024*1024;
+  
+  //The minimum time between updates of the preview, in milliseconds.
+  const int ns_preview_update_ms = 250;
+  
+  
+  //LoadPreview accumulates the gross-count time series, and summed spectrum,
+  //  of the pieces of a file FileLoader::preview_n42_2012(...) reads, using
+  //  all detectors.
+  class LoadPreview
+  {
+  public:
+    void add( const SpecUtils::SpecFile &piece )
+    {
+      const TimeSeries::SampleTable table = TimeSeries::tabulate( piece, 1 );
+      const vector<bool> all_detectors( table.detector_numbers.size(), true );
+      m_series.append( TimeSeries::combine( table, all_detectors ) );
+      
+      std::shared_ptr<SpecUtils::Measurement> sum
+          = piece.sum_measurements( piece.sample_numbers(), piece.detector_names(), nullptr );
+      if( !sum || !sum->gamma_counts() )
+        return;
+      
+      if( !m_sum )
+      {
+        m_sum = sum;
+      }else if( m_sum->num_gamma_channels() == sum->num_gamma_channels() )
+      {
+        //Pieces are added channel by channel, ignoring any small differences
+        //  in energy calibration, which is fine for a preview.
+        auto counts = make_shared<vector<float>>( *m_sum->gamma_counts() );
+        const vector<float> &to_add = *sum->gamma_counts();
+        for( size_t i = 0; i < counts->size(); ++i )
+          (*counts)[i] += to_add[i];
+        
+        m_sum->set_gamma_counts( counts, m_sum->live_time() + sum->live_time(),
+                                 m_sum->real_time() + sum->real_time() );
+      }//if( !m_sum ) / else
+    }//void add( const SpecUtils::SpecFile &piece )
+    
+    //Returns the time series histogram of what has been added so far.
+    std::shared_ptr<SpecUtils::Measurement> gross_counts() const
+    {
+      return TimeSeries::to_histogram( m_series );
+    }
+    
+    //Returns a copy of the summed spectrum, or nullptr if nothing added yet.
+    std::shared_ptr<SpecUtils::Measurement> summed() const
+    {
+      return m_sum ? make_shared<SpecUtils::Measurement>( *m_sum ) : nullptr;
+    }
+    
+    bool empty() const
+    {
+      return m_series.sample_numbers.empty();
+    }
+    
+  private:
+    TimeSeries::Series m_series;
+    std::shared_ptr<SpecUtils::Measurement> m_sum;
+  };//class LoadPreview
+}//namespace
+
+
+FileLoadRunnable::FileLoadRunnable( const QString &filename, const std::string &cache_filename,
+                                    const bool remove_file, const int load_id,
+                                    std::shared_ptr<std::atomic<bool>> cancelled )
+  : QObject(), QRunnable(),
+    m_filename( filename ),
+    m_cache_filename( cache_filename ),
+    m_remove_file( remove_file ),
+    m_load_id( load_id ),
+    m_cancelled( cancelled )
+{
+}
+
+
+FileLoadRunnable::~FileLoadRunnable()
+{
+}
+
+
+void FileLoadRunnable::run()
+{
+  const string utf8_filename = m_filename.toUtf8().data();
+  const QString displayname = QFileInfo( m_filename ).fileName();
+  std::shared_ptr<SpecUtils::SpecFile> info = std::make_shared<SpecUtils::SpecFile>();
+  
+  bool open = false;
+  if( !m_cache_filename.empty() )
+  {
+    emit progress( "Checking for a cached copy of " + displayname + "..." );
+    
+    const auto start = std::chrono::steady_clock::now();
+    open = SpecFileCache::load_cache( *info, utf8_filename, m_cache_filename );
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    
+    if( open )
+      qDebug() << "Loaded" << m_filename << "from cache in" << 1000.0*elapsed.count() << "ms";
+  }//if( !m_cache_filename.empty() )
+  
+  std::shared_ptr<const SpecFileCache::CacheContents> to_cache;
+  
+  if( !open && !m_cancelled->load() )
+  {
+    emit progress( "Parsing " + displayname + "..." );
+    
+    FileLoader::LoadTiming timing;
+    
+    if( QFileInfo(m_filename).size() >= ns_min_preview_size )
+    {
+      //Parse the file on another thread, while on this thread we read through
+      //  it a piece at a time, and send out what we have every so often.  Only
+      //  uncompressed N42-2012 files can be read a piece at a time; other
+      //  formats just show the progress message until they are parsed.
+      std::atomic<bool> parsed( false );
+      std::thread parser( [&](){
+        open = FileLoader::load_file( *info, utf8_filename, "", &timing );
+        parsed.store( true );
+      } );
+      
+      try
+      {
+        //Reading continues from where the last piece ended, until the parse
+        //  finishes, so no part of the file is read twice by the preview.
+        LoadPreview preview;
+        bool pending = false;
+        double last_fraction = 0.0;
+        auto last_update = std::chrono::steady_clock::now();
+        
+        FileLoader::preview_n42_2012( utf8_filename,
+                              [&]( const SpecUtils::SpecFile &piece, double fraction ) -> bool {
+          if( parsed.load() || m_cancelled->load() )
+            return false;
+          
+          preview.add( piece );
+          pending = true;
+          last_fraction = fraction;
+          
+          const auto now = std::chrono::steady_clock::now();
+          if( (now - last_update) >= std::chrono::milliseconds(ns_preview_update_ms) )
+          {
+            emit previewUpdated( preview.gross_counts(), preview.summed(), fraction, m_load_id );
+            last_update = now;
+            pending = false;
+          }
+          
+          return true;
+        } );
+        
+        //The preview has the whole file, but the full parse is still going
+        if( pending && !preview.empty() && !parsed.load() && !m_cancelled->load() )
+          emit previewUpdated( preview.gross_counts(), preview.summed(), last_fraction, m_load_id );
+      }catch( std::exception &e )
+      {
+        qDebug() << "Failed making preview of" << m_filename << ":" << e.what();
+      }//try / catch
+      
+      parser.join();
+    }else
+    {
+      open = FileLoader::load_file( *info, utf8_filename, "", &timing );
+    }//if( a large file ) / else
+    
+    qDebug() << "Loaded" << m_filename << "detected as"
+             << FileLoader::parser_type_name( timing.sniffed_type )
+             << (timing.used_auto ? "(fell back to Auto)" : "")
+             << "sniff:" << 1000.0*timing.sniff_seconds << "ms,"
+             << FileLoader::compression_name( timing.compression )
+             << "decompress:" << 1000.0*timing.decompress_seconds << "ms,"
+             << "parse:" << 1000.0*timing.parse_seconds << "ms";
+    
+    //The GUI may modify `info` once we hand it off, so take what the cache needs
+    //  now (the metadata, and references to the unchanging channel counts).
+    if( open && !m_cache_filename.empty() && !m_cancelled->load()
+        && (timing.sniffed_type == SpecUtils::ParserType::N42_2012) && !timing.used_auto
+        && (timing.compression == FileLoader::Compression::None) )
+      to_cache = SpecFileCache::prepare_cache( *info );
+  }//if( !open && !m_cancelled->load() )
+  
+  if( m_remove_file )
+    SpecUtils::remove_file( utf8_filename );
+  
+  if( open )
+    info->set_filename( SpecUtils::filename( info->filename() ) );
+  
+  if( !m_cancelled->load() )
+    emit loaded( info, open, m_load_id );
+  
+  if( to_cache && !m_cancelled->load() )
+  {
+    if( SpecFileCache::write_cache( *to_cache, utf8_filename, m_cache_filename ) )
+      SpecFileCache::prune_cache_dir( SpecUtils::parent_path( m_cache_filename ) );
+    else
+      qDebug() << "Failed to write cache for" << m_filename;
+  }//if( we should write the cache )
+}//void FileLoadRunnable::run()
+
+
 MainWindow::MainWindow( QWidget *parent, Qt::WindowFlags flags )
   : QMainWindow( parent, flags ),
     m_tabs( new QTabWidget ),
@@ -132,7 +345,10 @@ MainWindow::MainWindow( QWidget *parent, Qt::WindowFlags flags )
     m_mouseEnergy( new QLabel ),
     m_mouseHeight( new QLabel ),
     m_mouseChannelCounts( new QLabel ),
-    m_statusFiller( new QWidget() )
+    m_statusFiller( new QWidget() ),
+    m_loadId( 0 ),
+    m_loadProgress( nullptr ),
+    m_loadPreviewShown( false )
 {
   setAcceptDrops( true );
   QCoreApplication::setOrganizationDomain( "gov" );
@@ -283,6 +499,7 @@ MainWindow::MainWindow( QWidget *parent, Qt::WindowFlags flags )
   
   //
   qRegisterMetaType< std::shared_ptr<SpecUtils::SpecFile> >("std::shared_ptr<SpecUtils::SpecFile>");
+  qRegisterMetaType< std::shared_ptr<SpecUtils::Measurement> >("std::shared_ptr<SpecUtils::Measurement>");
   
   QObject::connect( m_spectrum, SIGNAL(fileDropped(QDropEvent*)),
                    this, SLOT(recievedDropEvent(QDropEvent*)));
@@ -376,6 +593,9 @@ MainWindow::MainWindow( QWidget *parent, Qt::WindowFlags flags )
 
 MainWindow::~MainWindow()
 {
+  //Let a load that is still running know not to bother caching its result
+  if( m_loadCancelled )
+    m_loadCancelled->store( true );
 }
 
 
@@ -872,131 +1092,18 @@ void MainWindow::setTimeText( std::shared_ptr<const SpecUtils::Measurement> meas
 
 
 void MainWindow::calculateTimeSeriesData(
-                      std::shared_ptr<SpecUtils::Measurement> &grosscounts ) const
+                      std::shared_ptr<SpecUtils::Measurement> &grosscounts )
 {
-  //for 'rslbig.n42' this function takes about 165 ms, so perhaps mutlithreading
-  //  might be helpful?
-  
   if( !m_measurment || !m_measurment->passthrough() )
     return;
   
-  const vector<int> det_nums = m_measurment->detector_numbers();
-  const vector<bool> &det_to_use = m_detectorsDisplayed;
-
-  if( det_nums.size() != det_to_use.size() )
-    throw runtime_error( "Inconsistent number of detectors." );
-
-  set<int> dets;
-  for( size_t i = 0; i < det_nums.size(); ++i )
-    if( det_to_use[i] )
-      dets.insert( det_nums[i] );
-  
-  const std::set<int> &sample_numbers = m_measurment->sample_numbers();
-  
-  double time = 0.0;
-  vector<int> sample_num_vec;
-  vector<pair<float,int> > binning;
-  binning.push_back( pair<float,int>(0.0f,-1) );
-  
-  foreach( const int sample, sample_numbers )
-  {
-    const vector< std::shared_ptr<const SpecUtils::Measurement> > meas
-                                  = m_measurment->sample_measurements( sample );
-    
-    if( meas.empty() )
-      continue;
-    
-    foreach( const std::shared_ptr<const SpecUtils::Measurement> &m, meas )
-    {
-      if( !dets.count( m->detector_number() ) )
-        continue;
-      
-      if( m->source_type() == SpecUtils::SourceType::Background )
-        continue;
-      
-      time += (m->real_time()/meas.size());
-    }
-    
-    sample_num_vec.push_back( sample );
-    binning.push_back( make_pair(static_cast<float>(time),sample) );
-  }//foreach( const int sample, sample_nums )
-  
-  sort( binning.begin(), binning.end() );
-  
-  vector<float> bin_edges( binning.size() );
-  for( size_t i = 0; i < binning.size(); ++i )
-    bin_edges[i] = binning[i].first;
-  const int num_time_bins = static_cast<int>( bin_edges.size() );
-  if( num_time_bins > 2 )
-    bin_edges.push_back( 2.0f*bin_edges.back() - bin_edges[num_time_bins-2]);
-  else if( num_time_bins )
-    bin_edges.push_back( bin_edges.back() + 1.0f );
+  if( !m_timeSeriesTable )
+    m_timeSeriesTable = std::make_shared<const TimeSeries::SampleTable>(
+                                        TimeSeries::tabulate( *m_measurment, 0 ) );
   
-  grosscounts = make_shared<SpecUtils::Measurement>();
-//  std::shared_ptr<Measurement> grosscounts( new Measurement() );
+  const TimeSeries::Series series = TimeSeries::combine( *m_timeSeriesTable, m_detectorsDisplayed );
   
-  auto times = make_shared<vector<float>>(bin_edges);
-  const size_t ntimes = times->size();
-  
-  std::shared_ptr<vector<float>> gamma_counts, nuetron_counts;
-  if( ntimes )
-  {
-    assert( ntimes >= sample_numbers.size() );
-    gamma_counts = std::make_shared<vector<float>>( ntimes - 1, 0.0f );
-    nuetron_counts = std::make_shared<vector<float>>( ntimes - 1, 0.0f );
-  }else
-  {
-    gamma_counts = std::make_shared<vector<float>>();
-    nuetron_counts = std::make_shared<vector<float>>();
-  }
-  
-  foreach( const int sample_number, sample_numbers )
-  {
-    vector<int>::const_iterator begin = sample_num_vec.begin();
-    vector<int>::const_iterator end = sample_num_vec.end();
-    vector<int>::const_iterator pos = std::find( begin, end, sample_number );
-    
-    if( pos == end )
-      continue;
-    
-    const size_t channel = static_cast<int>(pos - begin);
-    
-    const vector< std::shared_ptr<const SpecUtils::Measurement> > meas
-                         = m_measurment->sample_measurements( sample_number );
-    
-    float num_gamma = 0.0f, num_nuteron = 0.0f, live_time = 0.0f;
-    for( size_t i = 0; i < meas.size(); ++i )
-    {
-      if( !meas[i] )
-        continue;  //shouldnt ever happen
-      
-      if( !dets.count( meas[i]->detector_number() ) )
-        continue;
-      
-      live_time += meas[i]->live_time();
-      num_gamma += meas[i]->gamma_count_sum();
-      num_nuteron += meas[i]->neutron_counts_sum();
-    }//for( size_t i = 0; i < meas.size(); ++i )
-    
-    if( live_time > 0.0f )
-      num_gamma /= (live_time / meas.size());
-    
-    if( channel < gamma_counts->size() )
-    {
-      gamma_counts->operator[](channel) += num_gamma;
-      nuetron_counts->operator[](channel) += num_nuteron;
-    }
-  }//foreach( const int sample_number, sample_numbers )
-  
-  grosscounts->set_gamma_counts( gamma_counts, 0.0f, 0.0f );
-  grosscounts->set_neutron_counts( *nuetron_counts );
-  
-  if( ntimes )
-  {
-    auto cal = make_shared<SpecUtils::EnergyCalibration>();
-    cal->set_lower_channel_energy( ntimes - 1, *times );
-    grosscounts->set_energy_calibration( cal );
-  }
+  grosscounts = TimeSeries::to_histogram( series );
 }//void MainWindow::calculateTimeSeriesData()
 
 
@@ -1082,6 +1189,7 @@ void MainWindow::displayMeasurment()
       const int nbin = dialog.exec();
 
       m_measurment->keep_n_bin_spectra_only( static_cast<size_t>(nbin) );
+      m_timeSeriesTable.reset();
       meas = m_measurment->sum_measurements( m_displayedSampleNumbers, detnames, nullptr );
       
       //Still not quite right - needs a cleanup probably
@@ -1184,6 +1292,8 @@ void MainWindow::displayMeasurment()
 
 void MainWindow::refreshDisplays()
 {
+  //The file may have been modified
+  m_timeSeriesTable.reset();
   displayMeasurment();
 }//void refreshDisplays()
 
@@ -1202,6 +1312,7 @@ void MainWindow::detectorsToDisplayChanged()
 void MainWindow::setMeasurment( std::shared_ptr<SpecUtils::SpecFile> measurment )
 {
   m_measurment = measurment;
+  m_timeSeriesTable.reset();
 
   if( !!m_measurment
       && (m_measurment->measurements().empty()
@@ -1238,7 +1349,7 @@ void MainWindow::setMeasurment( std::shared_ptr<SpecUtils::SpecFile> measurment
 
 
 
-void MainWindow::handleSingleFileDrop( const QUrl &url )
+void MainWindow::handleSingleFileDrop( const QUrl &url, const bool remove_file_when_done )
 {
   const QString filename = url.toLocalFile();
   QFileInfo fileinfo( filename );
@@ -1248,34 +1359,97 @@ void MainWindow::handleSingleFileDrop( const QUrl &url )
     m_save->initBatchConvertion( filename );
     return;
   }//if( fileinfo.isDir() )
- 
   
-  BusyIndicator *indicator = 0;
-  if( fileinfo.size() > 30*1024 )
+  //Only one file is loaded at a time; opening a new one abandons the previous load
+  cancelFileLoad();
+  
+  //Large N42-2012 files are cached after parsing, so they open almost instantly next time.
+  string cache_filename;
+  if( static_cast<uint64_t>(fileinfo.size()) >= SpecFileCache::ns_min_source_size )
   {
-    indicator = new BusyIndicator( BusyIndicator::OpeningFile, this );
-    indicator->show();
-    repaint();
-    indicator->repaint();
-    update();
-    indicator->update();
-    qApp->processEvents();
-    QCoreApplication::flush();
+    const QString cache_dir = QStandardPaths::writableLocation( QStandardPaths::CacheLocation )
+                              + "/spectrum_files";
+    if( QDir().mkpath( cache_dir ) )
+      cache_filename = SpecFileCache::cache_filename( cache_dir.toUtf8().data(),
+                                       fileinfo.absoluteFilePath().toUtf8().data() );
+  }//if( a large file )
+  
+  m_loadId += 1;
+  m_loadFilename = filename;
+  m_loadPreviewShown = false;
+  m_loadCancelled = std::make_shared<std::atomic<bool>>( false );
+  
+  FileLoadRunnable *loader = new FileLoadRunnable( filename, cache_filename, remove_file_when_done,
+                                                   m_loadId, m_loadCancelled );
+  loader->setAutoDelete( true );
+  
+  //Small files load quickly enough that the dialog will never be shown
+  m_loadProgress = new QProgressDialog( "Opening " + fileinfo.fileName() + "...", "Cancel",
+                                        0, 0, this );
+  m_loadProgress->setWindowModality( Qt::WindowModal );
+  m_loadProgress->setMinimumDuration( 500 );
+  m_loadProgress->setAutoClose( false );
+  m_loadProgress->setAutoReset( false );
+  m_loadProgress->setValue( 0 );
+  
+  QObject::connect( m_loadProgress, SIGNAL(canceled()), this, SLOT(cancelFileLoad()) );
+  QObject::connect( loader, SIGNAL(progress(QString)),
+                    m_loadProgress, SLOT(setLabelText(QString)), Qt::QueuedConnection );
+  QObject::connect( loader, SIGNAL(loaded(std::shared_ptr<SpecUtils::SpecFile>,bool,int)),
+                    this, SLOT(fileLoadFinished(std::shared_ptr<SpecUtils::SpecFile>,bool,int)),
+                    Qt::QueuedConnection );
+  QObject::connect( loader, SIGNAL(previewUpdated(std::shared_ptr<SpecUtils::Measurement>,std::shared_ptr<SpecUtils::Measurement>,double,int)),
+                    this, SLOT(fileLoadPreview(std::shared_ptr<SpecUtils::Measurement>,std::shared_ptr<SpecUtils::Measurement>,double,int)),
+                    Qt::QueuedConnection );
+  
+  QThreadPool::globalInstance()->start( loader );
+}//void handleSingleFileDrop( QUrl url )
+
+
+void MainWindow::cancelFileLoad()
+{
+  if( m_loadCancelled )
+    m_loadCancelled->store( true );
+  m_loadCancelled.reset();
+  
+  //Anything still to be delivered from the abandoned load will now be ignored
+  m_loadId += 1;
+  m_loadFilename.clear();
+  
+  //Dont leave a partial preview of the file up
+  if( m_loadPreviewShown )
+  {
+    m_loadPreviewShown = false;
+    setMeasurment( nullptr );
   }
   
-  std::shared_ptr<SpecUtils::SpecFile> info = std::make_shared<SpecUtils::SpecFile>();
-  const bool open = info->load_file( filename.toUtf8().data(), SpecUtils::ParserType::Auto );
+  if( m_loadProgress )
+  {
+    //We may have been called by the dialog, so it cant be deleted right now
+    m_loadProgress->disconnect( this );
+    m_loadProgress->hide();
+    m_loadProgress->deleteLater();
+  }
+  m_loadProgress = nullptr;
+}//void cancelFileLoad()
+
+
+void MainWindow::fileLoadFinished( std::shared_ptr<SpecUtils::SpecFile> info,
+                                   bool success, int load_id )
+{
+  if( load_id != m_loadId )
+    return;
   
-  if( indicator )
-    delete indicator;
-  indicator = 0;
-  qApp->processEvents();
-  QCoreApplication::flush();
-    
-  if( open )
+  const QString filename = m_loadFilename;
+  
+  //Clean up the dialog; the load is done, so there is nothing left to cancel.
+  //  If it worked, any preview will be replaced by the actual file.
+  if( success && info )
+    m_loadPreviewShown = false;
+  cancelFileLoad();
+  
+  if( success && info )
   {
-    info->set_filename( SpecUtils::filename( info->filename() ) );
-    
     setMeasurment( info );
   }else
   {
@@ -1283,11 +1457,62 @@ void MainWindow::handleSingleFileDrop( const QUrl &url )
                   " spectrum file, please email it to wcjohns@sandia.gov"
                   " to fix this.";
     
+    qDebug() << "Failed to open" << filename;
+    
     QMessageBox msgBox;
     msgBox.setText( msg );
     msgBox.exec();
   }
-}//void handleSingleFileDrop( QUrl url )
+}//void fileLoadFinished(...)
+
+
+void MainWindow::fileLoadPreview( std::shared_ptr<SpecUtils::Measurement> grosscounts,
+                                  std::shared_ptr<SpecUtils::Measurement> summed,
+                                  double fraction, int load_id )
+{
+  if( load_id != m_loadId )
+    return;
+  
+  const bool first_preview = !m_loadPreviewShown;
+  m_loadPreviewShown = true;
+  
+  if( first_preview )
+  {
+    //The charts will now show the file being loaded, so the previously
+    //  displayed file can no longer be interacted with.
+    m_measurment.reset();
+    m_timeSeriesTable.reset();
+    m_displayedSampleNumbers.clear();
+    m_detectorsDisplayed.clear();
+    
+    for( size_t i = 0; i < m_detCheckBox.size(); ++i )
+      delete m_detCheckBox[i];
+    m_detCheckBox.clear();
+    
+    m_detectors->hide();
+    m_sampleChanger->hide();
+    m_time->show();
+    m_chartlayout->setRowStretch( 1, 2 );
+    
+    //Let the user watch the charts fill in, but still be able to cancel
+    if( m_loadProgress )
+    {
+      m_loadProgress->hide();
+      m_loadProgress->setWindowModality( Qt::NonModal );
+      m_loadProgress->setRange( 0, 100 );
+      m_loadProgress->show();
+    }
+  }//if( first_preview )
+  
+  if( m_loadProgress )
+    m_loadProgress->setValue( static_cast<int>( 100.0*fraction ) );
+  
+  const QString title = QFileInfo( m_loadFilename ).fileName() + " (loading)";
+  
+  setTimeText( summed );
+  m_spectrum->setSpectrum( summed, first_preview, title.toUtf8().data() );
+  m_time->setGrossCounts( grosscounts );
+}//void fileLoadPreview(...)
 
 
 void MainWindow::handleMultipleFileDrop( const QList<QUrl> &urlist )
@@ -1412,7 +1637,9 @@ void MainWindow::dropEvent( QDropEvent *event )
           throw std::runtime_error( "Failed to write: " + tmpfilename );
       }
 	  
-      handleSingleFileDrop( QUrl::fromLocalFile( tmpfilename.c_str() ) );
+      //The file is loaded in the background, which will remove it when done
+      handleSingleFileDrop( QUrl::fromLocalFile( tmpfilename.c_str() ), true );
+      tmpfilename.clear();
       event->acceptProposedAction();
     }catch( std::exception &e )
     {
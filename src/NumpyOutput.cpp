@@ -0,0 +1,339 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <chrono>
+#include <limits>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <ostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "SpecUtils/SpecFile.h"
+#include "SpecUtils/DateTime.h"
+#include "SpecUtils/EnergyCalibration.h"
+
+#include "cambio/NumpyOutput.h"
+#include "cambio/ArchiveWriter.h"
+
+using namespace std;
+
+namespace
+{
+  typedef vector<shared_ptr<const SpecUtils::Measurement>> MeasVec;
+
+  //NumPy "NaT" (not a time) value for datetime64
+  const int64_t ns_not_a_time = std::numeric_limits<int64_t>::min();
+
+
+  /** Returns '<' or '>', for the byte order of this machine; we write arrays
+   in native order, and let NumPy swap them if needed.
+   */
+  char byte_order()
+  {
+    const uint16_t value = 1;
+    uint8_t first_byte;
+    memcpy( &first_byte, &value, 1 );
+    return (first_byte == 1) ? '<' : '>';
+  }
+
+
+  const char *source_type_str( const SpecUtils::SourceType type )
+  {
+    switch( type )
+    {
+      case SpecUtils::SourceType::IntrinsicActivity: return "IntrinsicActivity";
+      case SpecUtils::SourceType::Calibration:       return "Calibration";
+      case SpecUtils::SourceType::Background:        return "Background";
+      case SpecUtils::SourceType::Foreground:        return "Foreground";
+      case SpecUtils::SourceType::Unknown:           return "Unknown";
+    }//switch( type )
+
+    return "Unknown";
+  }//source_type_str(...)
+
+
+  /** Decodes UTF-8 to code points; invalid bytes are decoded as U+FFFD. */
+  vector<uint32_t> utf8_to_utf32( const string &input )
+  {
+    vector<uint32_t> output;
+    output.reserve( input.size() );
+
+    const size_t len = input.size();
+    for( size_t i = 0; i < len; )
+    {
+      const unsigned char c = static_cast<unsigned char>( input[i] );
+      size_t extra = 0;
+      uint32_t code = 0xFFFD;
+      if( c < 0x80 )
+      {
+        code = c;
+      }else if( (c & 0xE0) == 0xC0 )
+      {
+        extra = 1;
+        code = c & 0x1F;
+      }else if( (c & 0xF0) == 0xE0 )
+      {
+        extra = 2;
+        code = c & 0x0F;
+      }else if( (c & 0xF8) == 0xF0 )
+      {
+        extra = 3;
+        code = c & 0x07;
+      }
+
+      bool valid = ((i + extra) < len) || !extra;
+      for( size_t j = 1; valid && (j <= extra); ++j )
+      {
+        const unsigned char cont = static_cast<unsigned char>( input[i+j] );
+        valid = ((cont & 0xC0) == 0x80);
+        code = (code << 6) | (cont & 0x3F);
+      }
+
+      if( !valid )
+      {
+        output.push_back( 0xFFFD );
+        i += 1;
+      }else
+      {
+        output.push_back( (extra || (c < 0x80)) ? code : 0xFFFD );
+        i += extra + 1;
+      }
+    }//for( loop over input bytes )
+
+    return output;
+  }//utf8_to_utf32(...)
+
+
+  template<class T>
+  void append_value( string &data, const T value )
+  {
+    data.append( reinterpret_cast<const char *>(&value), sizeof(T) );
+  }
+
+
+  /** Returns a 1D .npy array of the values, with the given type (without byte order). */
+  template<class T>
+  string npy_array( const char *type, const vector<T> &values )
+  {
+    string npy = NumpyOutput::npy_header( string(1, byte_order()) + type,
+                                          vector<size_t>(1, values.size()) );
+    if( !values.empty() )
+      npy.append( reinterpret_cast<const char *>(values.data()), sizeof(T)*values.size() );
+    return npy;
+  }//npy_array(...)
+
+
+  /** Returns a 1D .npy array of fixed width unicode strings. */
+  string npy_string_array( const vector<string> &values )
+  {
+    vector<vector<uint32_t>> code_points;
+    size_t width = 1;
+    for( const string &value : values )
+    {
+      code_points.push_back( utf8_to_utf32( value ) );
+      width = std::max( width, code_points.back().size() );
+    }
+
+    string npy = NumpyOutput::npy_header( byte_order() + string("U") + std::to_string(width),
+                                          vector<size_t>(1, values.size()) );
+    for( const vector<uint32_t> &value : code_points )
+    {
+      for( const uint32_t code : value )
+        append_value( npy, code );
+      npy.append( 4*(width - value.size()), '\0' );
+    }
+
+    return npy;
+  }//npy_string_array(...)
+}//namespace
+
+
+namespace NumpyOutput
+{
+std::vector<std::shared_ptr<const SpecUtils::Measurement>> gamma_measurements(
+                  const std::vector<std::shared_ptr<const SpecUtils::Measurement>> &measurements )
+{
+  MeasVec answer;
+  for( const shared_ptr<const SpecUtils::Measurement> &meas : measurements )
+  {
+    if( meas && meas->gamma_counts() && !meas->gamma_counts()->empty() )
+      answer.push_back( meas );
+  }
+
+  return answer;
+}//gamma_measurements(...)
+
+
+size_t common_num_channels( const std::vector<std::shared_ptr<const SpecUtils::Measurement>> &measurements )
+{
+  size_t num_channels = 0;
+  for( const shared_ptr<const SpecUtils::Measurement> &meas : measurements )
+  {
+    const size_t nchannel = meas->gamma_counts() ? meas->gamma_counts()->size() : size_t(0);
+    if( !num_channels )
+      num_channels = nchannel;
+
+    if( nchannel != num_channels )
+      throw runtime_error( "Measurements have differing numbers of channels ("
+                           + std::to_string(num_channels) + " and " + std::to_string(nchannel)
+                           + "); use the 'linearize-lower-energy' and 'linearize-upper-energy'"
+                           " options to put them on a common binning." );
+  }//for( loop over measurements )
+
+  return num_channels;
+}//common_num_channels(...)
+
+
+std::string npy_header( const std::string &dtype, const std::vector<size_t> &shape )
+{
+  string dict = "{'descr': '" + dtype + "', 'fortran_order': False, 'shape': (";
+  for( size_t i = 0; i < shape.size(); ++i )
+    dict += std::to_string( shape[i] ) + ((shape.size() == 1) ? "," : ((i + 1) < shape.size() ? ", " : ""));
+  dict += "), }";
+
+  //Magic string, version, header length, then the dictionary padded with
+  //  spaces and ended with a newline, so the data is 64 byte aligned.
+  const size_t prefix_len = 10;
+  const size_t total_len = ((prefix_len + dict.size() + 1 + 63) / 64) * 64;
+  dict.append( total_len - prefix_len - dict.size() - 1, ' ' );
+  dict += '\n';
+
+  string header( "\x93NUMPY\x01\x00", 8 );
+  if( dict.size() > 0xFFFF )  //Only possible with absurdly many dimensions
+    throw runtime_error( "npy header too long" );
+  header += static_cast<char>( dict.size() & 0xFF );
+  header += static_cast<char>( (dict.size() >> 8) & 0xFF );
+  header += dict;
+
+  return header;
+}//npy_header(...)
+
+
+bool write_counts( std::ostream &output,
+                   const std::vector<std::shared_ptr<const SpecUtils::Measurement>> &measurements )
+{
+  const size_t num_channels = common_num_channels( measurements );
+
+  vector<size_t> shape;
+  shape.push_back( measurements.size() );
+  shape.push_back( num_channels );
+  const string header = npy_header( byte_order() + string("f4"), shape );
+  output.write( header.data(), header.size() );
+
+  //Rows are written straight from each measurement, so no copy of the matrix is made
+  for( const shared_ptr<const SpecUtils::Measurement> &meas : measurements )
+  {
+    const vector<float> &counts = *meas->gamma_counts();
+    output.write( reinterpret_cast<const char *>(counts.data()), sizeof(float)*counts.size() );
+  }
+
+  return output.good();
+}//write_counts(...)
+
+
+bool write_metadata( std::ostream &output,
+                     const std::vector<std::shared_ptr<const SpecUtils::Measurement>> &measurements )
+{
+  const size_t num_meas = measurements.size();
+  const size_t num_channels = common_num_channels( measurements );
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+
+  vector<float> live_times, real_times;
+  vector<int32_t> sample_numbers, detector_numbers;
+  vector<string> detector_names, titles, source_types;
+  vector<int64_t> start_times;
+  vector<double> gamma_sums, neutron_sums, latitudes, longitudes;
+
+  for( const shared_ptr<const SpecUtils::Measurement> &meas : measurements )
+  {
+    live_times.push_back( meas->live_time() );
+    real_times.push_back( meas->real_time() );
+    sample_numbers.push_back( meas->sample_number() );
+    detector_numbers.push_back( meas->detector_number() );
+    detector_names.push_back( meas->detector_name() );
+    titles.push_back( meas->title() );
+    source_types.push_back( source_type_str( meas->source_type() ) );
+
+    const SpecUtils::time_point_t &start = meas->start_time();
+    if( SpecUtils::is_special( start ) )
+      start_times.push_back( ns_not_a_time );
+    else
+      start_times.push_back( chrono::duration_cast<chrono::microseconds>( start.time_since_epoch() ).count() );
+
+    gamma_sums.push_back( meas->gamma_count_sum() );
+    neutron_sums.push_back( meas->contained_neutron() ? meas->neutron_counts_sum() : nan );
+    latitudes.push_back( meas->has_gps_info() ? meas->latitude() : nan );
+    longitudes.push_back( meas->has_gps_info() ? meas->longitude() : nan );
+  }//for( loop over measurements )
+
+  //Lower channel energies; stored once if all measurements use the same energies.
+  const shared_ptr<const vector<float>> no_energies;
+  auto lower_energies = [&no_energies]( const SpecUtils::Measurement &meas ) -> const shared_ptr<const vector<float>> & {
+    const shared_ptr<const SpecUtils::EnergyCalibration> &cal = meas.energy_calibration();
+    return (cal && cal->valid()) ? cal->channel_energies() : no_energies;
+  };
+
+  bool common_energies = true;
+  for( size_t i = 1; common_energies && (i < num_meas); ++i )
+  {
+    const shared_ptr<const vector<float>> &first = lower_energies( *measurements[0] );
+    const shared_ptr<const vector<float>> &current = lower_energies( *measurements[i] );
+    common_energies = (first == current) || (first && current && (*first == *current));
+  }
+
+  const size_t num_energy_rows = (common_energies ? std::min( num_meas, size_t(1) ) : num_meas);
+  string energies;
+  energies.reserve( sizeof(float) * num_energy_rows * num_channels );
+  for( size_t i = 0; i < num_energy_rows; ++i )
+  {
+    const shared_ptr<const vector<float>> &row = lower_energies( *measurements[i] );
+    for( size_t channel = 0; channel < num_channels; ++channel )
+    {
+      const bool have = (row && (channel < row->size()));
+      append_value( energies, have ? (*row)[channel] : std::numeric_limits<float>::quiet_NaN() );
+    }
+  }//for( loop over energy rows )
+
+  vector<size_t> energy_shape;
+  if( !common_energies )
+    energy_shape.push_back( num_meas );
+  energy_shape.push_back( num_energy_rows ? num_channels : size_t(0) );
+
+  ArchiveWriter npz( output, ArchiveWriter::Format::Zip );
+  npz.add_file( "live_time.npy", npy_array( "f4", live_times ) );
+  npz.add_file( "real_time.npy", npy_array( "f4", real_times ) );
+  npz.add_file( "sample_number.npy", npy_array( "i4", sample_numbers ) );
+  npz.add_file( "detector_number.npy", npy_array( "i4", detector_numbers ) );
+  npz.add_file( "detector_name.npy", npy_string_array( detector_names ) );
+  npz.add_file( "title.npy", npy_string_array( titles ) );
+  npz.add_file( "source_type.npy", npy_string_array( source_types ) );
+  npz.add_file( "start_time.npy", npy_array( "M8[us]", start_times ) );
+  npz.add_file( "gamma_count_sum.npy", npy_array( "f8", gamma_sums ) );
+  npz.add_file( "neutron_count_sum.npy", npy_array( "f8", neutron_sums ) );
+  npz.add_file( "latitude.npy", npy_array( "f8", latitudes ) );
+  npz.add_file( "longitude.npy", npy_array( "f8", longitudes ) );
+  npz.add_file( "channel_energies.npy",
+                npy_header( byte_order() + string("f4"), energy_shape ) + energies );
+
+  return npz.close();
+}//write_metadata(...)
+}//namespace NumpyOutput
@@ -0,0 +1,259 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdio>
+#include <fstream>
+
+#if( defined(_WIN32) )
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN 1
+#include <Windows.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "SpecUtils/StringAlgo.h"
+#include "SpecUtils/Filesystem.h"
+
+#include "cambio/OutputFile.h"
+#include "cambio/ArchiveWriter.h"
+
+using namespace std;
+
+namespace
+{
+  //Large enough that writing to a network share is a small number of large
+  //  writes, rather than many small ones.
+  const size_t ns_buffer_size = 1024*1024;
+
+
+  /** Returns a name, in the same directory as `filename`, that won't collide
+   with other threads or processes writing the same output.
+   */
+  string temporary_name( const string &filename )
+  {
+    static std::atomic<unsigned int> s_counter( 0 );
+
+#if( defined(_WIN32) )
+    const unsigned long pid = static_cast<unsigned long>( _getpid() );
+#else
+    const unsigned long pid = static_cast<unsigned long>( getpid() );
+#endif
+    const unsigned long ticks = static_cast<unsigned long>(
+                       std::chrono::steady_clock::now().time_since_epoch().count() & 0xFFFFFF );
+
+    char suffix[64];
+    snprintf( suffix, sizeof(suffix), ".%lx-%x-%lx.tmp", pid, s_counter++, ticks );
+
+    const string dir = SpecUtils::parent_path( filename );
+    const string name = "." + SpecUtils::filename( filename ) + suffix;
+
+    return dir.empty() ? name : SpecUtils::append_path( dir, name );
+  }//temporary_name(...)
+
+
+  /** Makes sure the contents of the (closed) file are on disk. */
+  bool sync_file_to_disk( const string &filename )
+  {
+#if( defined(_WIN32) )
+    const std::wstring wfilename = SpecUtils::convert_from_utf8_to_utf16( filename );
+    HANDLE file = CreateFileW( wfilename.c_str(), GENERIC_WRITE, 0, nullptr,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+    if( file == INVALID_HANDLE_VALUE )
+      return false;
+    const bool synced = FlushFileBuffers( file );
+    CloseHandle( file );
+    return synced;
+#else
+    const int fd = open( filename.c_str(), O_WRONLY );
+    if( fd < 0 )
+      return false;
+    const bool synced = (fsync( fd ) == 0);
+    close( fd );
+    return synced;
+#endif
+  }//sync_file_to_disk(...)
+
+
+  /** Renames `from` to `to`, replacing `to` if it exists. */
+  bool replace_file( const string &from, const string &to )
+  {
+#if( defined(_WIN32) )
+    const std::wstring wfrom = SpecUtils::convert_from_utf8_to_utf16( from );
+    const std::wstring wto = SpecUtils::convert_from_utf8_to_utf16( to );
+    return MoveFileExW( wfrom.c_str(), wto.c_str(),
+                        MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH );
+#else
+    return (rename( from.c_str(), to.c_str() ) == 0);
+#endif
+  }//replace_file(...)
+
+
+  /** Syncs the directory entry of a renamed file, so the rename itself is
+   durable; not needed (or possible) on Windows.
+   */
+  void sync_parent_directory( const string &filename )
+  {
+#if( !defined(_WIN32) )
+    string dir = SpecUtils::parent_path( filename );
+    if( dir.empty() )
+      dir = ".";
+
+    const int fd = open( dir.c_str(), O_RDONLY );
+    if( fd >= 0 )
+    {
+      fsync( fd );
+      close( fd );
+    }
+#endif
+  }//sync_parent_directory(...)
+}//namespace
+
+
+OutputFile::OutputFile( const std::string &filename, const bool sync_to_disk,
+                        ArchiveWriter *archive )
+  : std::ostream( nullptr ),
+    m_filename( filename ),
+    m_temp_filename(),
+    m_buffer(),
+    m_filebuf(),
+    m_archive( archive ),
+    m_archive_buf( ios_base::out | ios_base::binary ),
+    m_compressor(),
+    m_sync_to_disk( sync_to_disk ),
+    m_committed( false ),
+    m_commit_success( false )
+{
+  if( m_archive )
+  {
+    rdbuf( &m_archive_buf );
+    return;
+  }
+
+  m_temp_filename = temporary_name( filename );
+  m_buffer.resize( ns_buffer_size );
+
+  //The buffer must be set before opening the file for it to take effect.
+  m_filebuf.pubsetbuf( m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()) );
+
+#ifdef _WIN32
+  const std::wstring wname = SpecUtils::convert_from_utf8_to_utf16( m_temp_filename );
+  m_filebuf.open( wname.c_str(), ios_base::binary | ios_base::out | ios_base::trunc );
+#else
+  m_filebuf.open( m_temp_filename.c_str(), ios_base::binary | ios_base::out | ios_base::trunc );
+#endif
+
+  rdbuf( &m_filebuf );
+
+  if( !m_filebuf.is_open() )
+    setstate( ios_base::failbit );
+}//OutputFile constructor
+
+
+OutputFile::~OutputFile()
+{
+  if( !m_committed )
+    discard();
+}//~OutputFile()
+
+
+bool OutputFile::is_open() const
+{
+  return m_archive || m_filebuf.is_open();
+}
+
+
+void OutputFile::compress( const CompressedOutput::Compression type, const size_t num_threads )
+{
+  if( (type == CompressedOutput::Compression::None) || m_compressor || !is_open() )
+    return;
+
+  std::streambuf * const dest = m_archive ? static_cast<std::streambuf *>(&m_archive_buf)
+                                          : static_cast<std::streambuf *>(&m_filebuf);
+  m_compressor.reset( new CompressedOutput::CompressingStreamBuf( dest, type, num_threads ) );
+  rdbuf( m_compressor.get() );
+}//compress(...)
+
+
+const std::string &OutputFile::filename() const
+{
+  return m_filename;
+}
+
+
+void OutputFile::discard()
+{
+  if( m_filebuf.is_open() )
+  {
+    m_filebuf.close();
+    SpecUtils::remove_file( m_temp_filename );
+  }
+}//discard()
+
+
+bool OutputFile::commit()
+{
+  if( m_committed )
+    return m_commit_success;
+
+  m_committed = true;
+  m_commit_success = false;
+
+  if( m_compressor )
+  {
+    flush();
+    if( !m_compressor->finish() )
+      setstate( ios_base::badbit );
+  }//if( m_compressor )
+
+  if( m_archive )
+  {
+    m_commit_success = good() && m_archive->add_file( m_filename, m_archive_buf.str() );
+    m_archive_buf.str( "" );
+    return m_commit_success;
+  }//if( m_archive )
+
+  if( !m_filebuf.is_open() )
+    return false;
+
+  flush();
+  const bool wrote_all = good();
+  const bool closed = (m_filebuf.close() != nullptr);
+
+  if( !wrote_all || !closed
+     || (m_sync_to_disk && !sync_file_to_disk( m_temp_filename ))
+     || !replace_file( m_temp_filename, m_filename ) )
+  {
+    SpecUtils::remove_file( m_temp_filename );
+    setstate( ios_base::badbit );
+    return false;
+  }
+
+  if( m_sync_to_disk )
+    sync_parent_directory( m_filename );
+
+  m_commit_success = true;
+
+  return true;
+}//commit()
@@ -0,0 +1,276 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <functional>
+
+#include "SpecUtils/StringAlgo.h"
+#include "SpecUtils/Filesystem.h"
+
+#include "cambio/OutputFile.h"
+#include "cambio/ArchiveWriter.h"
+#include "cambio/ParallelOutput.h"
+
+using namespace std;
+
+namespace
+{
+  string normalized_name( const string &filename )
+  {
+    string name = SpecUtils::filename( filename );
+#if( defined(_WIN32) || defined(__APPLE__) )
+    SpecUtils::to_lower_ascii( name );
+#endif
+    return name;
+  }//normalized_name(...)
+}//namespace
+
+
+namespace ParallelOutput
+{
+
+size_t resolve_num_threads( const size_t num_threads )
+{
+  if( num_threads )
+    return num_threads;
+
+  return std::max( 1u, std::thread::hardware_concurrency() );
+}//resolve_num_threads(...)
+
+
+void parallel_for( const size_t num_items, const size_t num_threads,
+                   const std::function<void(size_t,size_t)> &fcn )
+{
+  const size_t nthreads = std::min( resolve_num_threads(num_threads), std::max(num_items, size_t(1)) );
+
+  std::atomic<size_t> next_index( 0 );
+  std::atomic<bool> had_error( false );
+  string error_msg;
+
+  auto worker = [&]( const size_t thread_index ){
+    try
+    {
+      for( size_t index = next_index++; (index < num_items) && !had_error; index = next_index++ )
+        fcn( index, thread_index );
+    }catch( std::exception &e )
+    {
+      if( !had_error.exchange(true) )
+        error_msg = e.what();
+    }//try / catch
+  };//worker lambda
+
+  vector<std::thread> threads;
+  for( size_t i = 1; i < nthreads; ++i )
+    threads.emplace_back( worker, i );
+  worker( 0 );
+  for( std::thread &thread : threads )
+    thread.join();
+
+  if( had_error )
+    throw runtime_error( error_msg );
+}//parallel_for(...)
+
+
+AsyncFileWriter::AsyncFileWriter( const size_t num_items, const size_t num_writers,
+                                  const bool sync_to_disk, ArchiveWriter *archive,
+                                  const size_t max_queued_bytes )
+  : m_sync_to_disk( sync_to_disk ),
+    m_archive( archive ),
+    m_max_queued_bytes( max_queued_bytes ),
+    m_queued_bytes( 0 ),
+    m_finishing( false ),
+    m_results( num_items, false )
+{
+  for( size_t i = 0; i < std::max( num_writers, size_t(1) ); ++i )
+    m_writers.emplace_back( &AsyncFileWriter::writer_loop, this );
+}//AsyncFileWriter constructor
+
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+  finish();
+}
+
+
+void AsyncFileWriter::submit( const size_t index, const std::string &filename,
+                              std::string &&contents )
+{
+  if( index >= m_results.size() )
+    throw runtime_error( "AsyncFileWriter::submit: invalid index." );
+
+  std::unique_lock<std::mutex> lock( m_mutex );
+
+  //Always allow at least one job in the queue, so a single file larger than
+  //  the limit can't block forever.
+  m_space_available.wait( lock, [this](){
+    return m_queue.empty() || (m_queued_bytes < m_max_queued_bytes);
+  } );
+
+  m_queued_bytes += contents.size();
+  m_queue.push_back( Job{ index, filename, std::move(contents) } );
+
+  lock.unlock();
+  m_job_available.notify_one();
+}//submit(...)
+
+
+void AsyncFileWriter::writer_loop()
+{
+  while( true )
+  {
+    Job job;
+
+    {//begin lock on m_mutex
+      std::unique_lock<std::mutex> lock( m_mutex );
+      m_job_available.wait( lock, [this](){ return m_finishing || !m_queue.empty(); } );
+
+      if( m_queue.empty() )
+        return;
+
+      job = std::move( m_queue.front() );
+      m_queue.pop_front();
+    }//end lock on m_mutex
+
+    bool wrote = false;
+    if( m_archive )
+    {
+      wrote = m_archive->add_file( job.filename, job.contents );
+    }else
+    {
+      OutputFile output( job.filename, m_sync_to_disk );
+      if( output.is_open() )
+      {
+        output.write( job.contents.data(), static_cast<std::streamsize>(job.contents.size()) );
+        wrote = output.commit();
+      }
+    }//if( m_archive ) / else
+
+    {//begin lock on m_mutex
+      std::lock_guard<std::mutex> lock( m_mutex );
+      m_queued_bytes -= job.contents.size();
+      m_results[job.index] = wrote;
+    }//end lock on m_mutex
+
+    m_space_available.notify_all();
+  }//while( true )
+}//writer_loop()
+
+
+const std::vector<bool> &AsyncFileWriter::finish()
+{
+  {//begin lock on m_mutex
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_finishing = true;
+  }//end lock on m_mutex
+
+  m_job_available.notify_all();
+
+  for( std::thread &writer : m_writers )
+  {
+    if( writer.joinable() )
+      writer.join();
+  }
+  m_writers.clear();
+
+  return m_results;
+}//finish()
+
+
+DirectoryListing::DirectoryListing( const std::string &directory )
+{
+  const string dir = directory.empty() ? string(".") : directory;
+
+  if( !SpecUtils::is_directory( dir ) )
+    return;
+
+  for( const string &path : SpecUtils::ls_files_in_directory( dir ) )
+    m_names.insert( normalized_name( path ) );
+}//DirectoryListing constructor
+
+
+bool DirectoryListing::contains( const std::string &filename ) const
+{
+  return m_names.count( normalized_name( filename ) ) > 0;
+}//contains(...)
+
+
+DirectoryCache::DirectoryCache()
+  : m_mutex(),
+    m_existing()
+{
+}
+
+
+bool DirectoryCache::create_directories( const std::string &directory )
+{
+  string dir = directory;
+  while( (dir.size() > 1) && ((dir.back() == '/') || (dir.back() == '\\')) )
+    dir.erase( dir.size() - 1 );
+
+  if( dir.empty() || (dir == ".") )
+    return true;
+
+  std::lock_guard<std::mutex> lock( m_mutex );
+
+  if( m_existing.count( dir ) )
+    return true;
+
+  //Walk up until we find a directory that exists, then create the missing
+  //  ones from the top down.
+  vector<string> to_create;
+  for( string path = dir; !path.empty() && (path != "."); )
+  {
+    if( m_existing.count( path ) )
+      break;
+
+    if( SpecUtils::is_directory( path ) )
+    {
+      m_existing.insert( path );
+      break;
+    }
+
+    to_create.push_back( path );
+
+    const string parent = SpecUtils::parent_path( path );
+    if( parent == path )
+      break;
+    path = parent;
+  }//for( walk up the directory tree )
+
+  for( auto iter = to_create.rbegin(); iter != to_create.rend(); ++iter )
+  {
+    //create_directory(...) returns 0 on failure; another thread or process
+    //  may have created the directory since we checked.
+    if( !SpecUtils::create_directory( *iter ) && !SpecUtils::is_directory( *iter ) )
+      return false;
+
+    m_existing.insert( *iter );
+  }//for( loop over directories to create, top down )
+
+  return true;
+}//create_directories(...)
+
+}//namespace ParallelOutput
@@ -33,6 +33,7 @@
 #include <QFileInfo>
 #include <QGroupBox>
 #include <QLineEdit>
+#include <QCheckBox>
 #include <QScrollArea>
 #include <QMessageBox>
 #include <QFileDialog>
@@ -48,6 +49,7 @@
 
 #include "cambio/CambioApp.h"
 #include "cambio/SaveWidget.h"
+#include "cambio/OutputFile.h"
 #include "cambio/MainWindow.h"
 #include "SpecUtils/SpecFile.h"
 #include "cambio/BusyIndicator.h"
@@ -93,7 +95,7 @@ const char *description( const SaveSpectrumAsType type )
 }//const char *descriptionText( const SaveSpectrumAsType type )
 
 #if( SpecUtils_ENABLE_D3_CHART )
-bool writeIndividualHtmlSpectraToOutputFile( std::ofstream &output,
+bool writeIndividualHtmlSpectraToOutputFile( std::ostream &output,
                                               const SpecUtils::SpecFile &meas,
                                               const std::set<int> samplenums,
                                               std::vector<bool> detectors )
@@ -253,7 +255,8 @@ bool writeSumOfSpectraToOutputFile( const SaveSpectrumAsType format,
                                    std::shared_ptr<SpecUtils::SpecFile> meas,
                                    const std::set<int> samplenums,
                                    std::vector<bool> detectors,
-                                   const QString nameAppend )
+                                   const QString nameAppend,
+                                   const CompressedOutput::Compression compression )
 {
   bool ok = true;
   
@@ -273,6 +276,7 @@ bool writeSumOfSpectraToOutputFile( const SaveSpectrumAsType format,
     filename = filename + "_" + nameAppend + extention;
   }//if( nameAppend.size() )
   
+  filename += CompressedOutput::file_extension( compression );
   
   QFileInfo outputfile( initialDir, filename );
   
@@ -315,8 +319,7 @@ bool writeSumOfSpectraToOutputFile( const SaveSpectrumAsType format,
     return false;
   }//if( detnums.empty() )
   
-  std::ofstream output( outputfile.filePath().toUtf8().data(),
-                       std::ios::binary | std::ios::out );
+  OutputFile output( outputfile.filePath().toUtf8().data() );
   if( !output.is_open() )
   {
     QMessageBox msg;
@@ -326,6 +329,8 @@ bool writeSumOfSpectraToOutputFile( const SaveSpectrumAsType format,
     return false;
   }//if( !output.is_open() )
   
+  output.compress( compression );
+  
   switch( format )
   {
     case SaveSpectrumAsType::Txt:
@@ -442,7 +447,7 @@ bool writeSumOfSpectraToOutputFile( const SaveSpectrumAsType format,
       break;
   }//switch( format )
   
-  return ok;
+  return ok && output.commit();
 }//writeSumOfSpectraToOutputFile(...)
 
   
@@ -453,14 +458,15 @@ bool writeIndividualSpectraToOutputFile( const SaveSpectrumAsType format,
                                                     const QString filename,
                                                     std::shared_ptr<SpecUtils::SpecFile> meas,
                                                     const std::set<int> samplenums,
-                                                    std::vector<bool> detectors )
+                                                    std::vector<bool> detectors,
+                                                    const CompressedOutput::Compression compression )
 {
   bool ok = false;
   
   if( !meas )
     return false;
   
-  QFileInfo outputfile( initialDir, filename );
+  QFileInfo outputfile( initialDir, filename + CompressedOutput::file_extension(compression) );
   
   if( outputfile.exists() )
   {
@@ -527,12 +533,7 @@ bool writeIndividualSpectraToOutputFile( const SaveSpectrumAsType format,
   
   const string utf8_outname = outputfile.filePath().toUtf8().data();
   
-#ifdef _WIN32
-  const std::wstring win_outname = SpecUtils::convert_from_utf8_to_utf16(utf8_outname);
-  std::ofstream output( win_outname.c_str(), std::ios::binary | std::ios::out );
-#else
-  std::ofstream output( utf8_outname, std::ios::binary | std::ios::out );
-#endif
+  OutputFile output( utf8_outname );
   
   if( !output.is_open() )
   {
@@ -543,6 +544,8 @@ bool writeIndividualSpectraToOutputFile( const SaveSpectrumAsType format,
     return false;
   }//if( !output.is_open() )
   
+  output.compress( compression );
+  
   
   switch( format )
   {
@@ -567,12 +570,7 @@ bool writeIndividualSpectraToOutputFile( const SaveSpectrumAsType format,
         msg.setStandardButtons( QMessageBox::Yes | QMessageBox::No );
         const int code = msg.exec();
         if( code == QMessageBox::No )
-        {
-          output.close();
-          QFile file( outputfile.filePath() );
-          file.remove();
-          return false;
-        }
+          return false;  //The temporary file is removed when `output` goes out of scope
       }//if( samplenums.size() > 20 )
       
       ok = writeIndividualHtmlSpectraToOutputFile( output, info, samplenums, detectors );
@@ -624,9 +622,7 @@ bool writeIndividualSpectraToOutputFile( const SaveSpectrumAsType format,
   }//switch( type )
   
   
-  output.close();
-  
-  return ok;
+  return ok && output.commit();
 }//bool writeIndividualSpectraToOutputFile(...)
 
 }//namespace
@@ -637,6 +633,7 @@ SaveWidget::SaveWidget( QWidget *parent , Qt::WindowFlags f )
     m_layout( 0 ),
     m_saveDirectory( 0 ),
     m_saveName( 0 ),
+    m_compressOutput( 0 ),
     m_saveAsType( 0 ),
     m_formatDescription( 0 ),
     m_noOptionsText( 0 ),
@@ -809,14 +806,19 @@ SaveWidget::SaveWidget( QWidget *parent , Qt::WindowFlags f )
   m_saveName = new QLineEdit();
   namelayout->addWidget( m_saveName, 4, 0 );
   
+  m_compressOutput = new QCheckBox( "Compress (gzip)" );
+  m_compressOutput->setToolTip( "Compresses the output file as it is written, and adds"
+                                " '.gz' to the file name." );
+  namelayout->addWidget( m_compressOutput, 5, 0, Qt::AlignLeft );
+  
   m_saveButton = new QPushButton( "Save" );
   m_saveButton->setEnabled( false );
-  namelayout->addWidget( m_saveButton, 5, 0, Qt::AlignCenter );
+  namelayout->addWidget( m_saveButton, 6, 0, Qt::AlignCenter );
   
-  namelayout->addWidget( new QWidget, 6, 0 );
+  namelayout->addWidget( new QWidget, 7, 0 );
   
   namelayout->setColumnStretch( 0, 10 );
-  namelayout->setRowStretch( 6, 10 );
+  namelayout->setRowStretch( 7, 10 );
   
   m_layout->addWidget( nameframe, 0, 2 );
   
@@ -955,6 +957,9 @@ void SaveWidget::save()
   
   bool ok = false;
   const SaveSpectrumAsType type = SaveSpectrumAsType(row);
+  const CompressedOutput::Compression compression = m_compressOutput->isChecked()
+                                                    ? CompressedOutput::Compression::Gzip
+                                                    : CompressedOutput::Compression::None;
   
   
   if( type == SaveSpectrumAsType::Chn
@@ -987,7 +992,7 @@ void SaveWidget::save()
       {
         ok = writeSumOfSpectraToOutputFile( type, initialDir,
                                             filename, m_measurment,
-                                            m_samplenums, m_detectors, "" );
+                                            m_samplenums, m_detectors, "", compression );
         break;
       }//case kCurrentlyDisplayedOnly or kShowingSpectraSummedToSingle
         
@@ -997,7 +1002,7 @@ void SaveWidget::save()
         const vector<bool> dets( m_measurment->detector_names().size(), true );
         ok = writeSumOfSpectraToOutputFile( type, initialDir,
                                             filename, m_measurment,
-                                            samples, dets, "" );
+                                            samples, dets, "", compression );
         break;
       }//case kAllSpectraSummedToSingle:
         
@@ -1027,7 +1032,7 @@ void SaveWidget::save()
             const bool wrote = writeSumOfSpectraToOutputFile(
                                                   type, initialDir,
                                                   filename, m_measurment,
-                                                  samples, dets, nameappend );
+                                                  samples, dets, nameappend, compression );
             nwroteone += wrote;
             ok &= wrote;
           }else
@@ -1068,14 +1073,14 @@ void SaveWidget::save()
         const set<int> allsamples = m_measurment->sample_numbers();
         
         ok = writeIndividualSpectraToOutputFile( type, initialDir, filename,
-                                            m_measurment, allsamples, alldets );
+                                            m_measurment, allsamples, alldets, compression );
         break;
       }//case kAllSpecSeperatelyToSingleFile:
         
       case kCurrentSingleSpecOnly:
       {
         ok = writeIndividualSpectraToOutputFile( type, initialDir, filename,
-                                      m_measurment, m_samplenums, m_detectors );
+                                      m_measurment, m_samplenums, m_detectors, compression );
         break;
       }//case kCurrentSingleSpecOnly:
         
@@ -1087,11 +1092,11 @@ void SaveWidget::save()
           ok = writeIndividualSpectraToOutputFile( type, initialDir, filename,
                                                 m_measurment,
                                                 m_measurment->sample_numbers(),
-                                                vector<bool>(1,true) );
+                                                vector<bool>(1,true), compression );
         }else
         {
           ok = writeSumOfSpectraToOutputFile( type, initialDir, filename,
-                                  m_measurment, m_samplenums, m_detectors, "" );
+                                  m_measurment, m_samplenums, m_detectors, "", compression );
         }
         break;
       }//case kShowingSpectraAsSingle:
@@ -1102,7 +1107,7 @@ void SaveWidget::save()
         const vector<bool> alldets( ndets, true );
         const set<int> allsamples = m_measurment->sample_numbers();
         ok = writeSumOfSpectraToOutputFile( type, initialDir, filename,
-                                       m_measurment, allsamples, alldets, "" );
+                                       m_measurment, allsamples, alldets, "", compression );
         break;
       }//case kAllSpecSummedToSingle:
         
@@ -1144,7 +1149,7 @@ void SaveWidget::save()
             const bool wrote = writeSumOfSpectraToOutputFile(
                                                              type, initialDir,
                                                              filename, m_measurment,
-                                                             samples, dets, nameappend );
+                                                             samples, dets, nameappend, compression );
             nwroteone += wrote;
             ok &= wrote;
           }else
@@ -1187,7 +1192,7 @@ void SaveWidget::save()
           const vector<bool> dets( info->detector_numbers().size(), true );
           ok = writeIndividualSpectraToOutputFile( type, initialDir, filename,
                                                    info, info->sample_numbers(),
-                                                   dets );
+                                                   dets, compression );
         }//if( info->measurements().size() )
         
         break;
@@ -0,0 +1,609 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+#if( defined(_WIN32) )
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN 1
+#include <Windows.h>
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#include "SpecUtils/SpecFile.h"
+#include "SpecUtils/StringAlgo.h"
+#include "SpecUtils/Filesystem.h"
+
+#include "cambio/FileLoader.h"
+#include "cambio/OutputFile.h"
+#include "cambio/SpecFileCache.h"
+
+using namespace std;
+
+namespace
+{
+  /** Cache file layout (all numbers in native byte order):
+
+     CacheHeader
+     N42 XML of the file, with all channel counts zero     (at meta_offset)
+     detector names, each followed by a '\0'               (at names_offset)
+     CacheRecord for each record with gamma counts        (at index_offset)
+     float channel counts of each record, 64 byte aligned  (at CacheRecord::counts_offset)
+
+   Increment ns_cache_version whenever this changes.
+   */
+  const char ns_cache_magic[8] = { 'C', 'a', 'm', 'b', 'i', 'o', 'S', 'C' };
+  const uint32_t ns_cache_version = 2;
+  const uint32_t ns_byte_order_mark = 0x01020304;
+
+  //The source file is hashed from this many bytes at its start, and its end.
+  const size_t ns_hash_bytes = 1024*1024;
+
+  struct CacheHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order_mark;
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint64_t source_file_id;
+    uint64_t source_hash;
+    uint64_t cache_size;
+    uint64_t meta_offset;
+    uint64_t meta_size;
+    uint64_t names_offset;
+    uint64_t names_size;
+    uint64_t index_offset;
+    uint64_t num_records;
+  };//struct CacheHeader
+
+  struct CacheRecord
+  {
+    uint64_t counts_offset;
+    uint32_t num_channels;
+    int32_t sample_number;
+    uint32_t detector_index;
+    uint32_t reserved;
+  };//struct CacheRecord
+
+  static_assert( sizeof(CacheHeader) == 104, "Unexpected CacheHeader padding" );
+  static_assert( sizeof(CacheRecord) == 24, "Unexpected CacheRecord padding" );
+
+
+  struct SourceStamp
+  {
+    uint64_t size;
+
+    /** Modification time, in nanoseconds (or as fine as the platform gives). */
+    int64_t mtime;
+
+    /** The inode (and device) on POSIX, or file index (and volume) on Windows,
+     so a file replaced by another of the same size and time is noticed.
+     */
+    uint64_t file_id;
+
+    uint64_t hash;
+
+    /** If the file is an uncompressed N42-2012 file, from its first megabyte. */
+    bool is_n42_2012;
+  };//struct SourceStamp
+
+
+  uint64_t fnv1a_hash( const char *data, const size_t nbytes, uint64_t hash = 14695981039346656037ULL )
+  {
+    for( size_t i = 0; i < nbytes; ++i )
+    {
+      hash ^= static_cast<unsigned char>( data[i] );
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }//fnv1a_hash(...)
+
+
+  uint64_t aligned( const uint64_t offset, const uint64_t alignment )
+  {
+    return ((offset + alignment - 1) / alignment) * alignment;
+  }
+
+
+  /** Gets the size, modification time, and file ID of the source file, and
+   hashes its first and last megabyte (hashing all of a large file would take
+   about as long as parsing it).
+   */
+  bool source_stamp( const string &filename, SourceStamp &stamp )
+  {
+#ifdef _WIN32
+    const std::wstring wfilename = SpecUtils::convert_from_utf8_to_utf16( filename );
+    HANDLE file = CreateFileW( wfilename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                               nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+    if( file == INVALID_HANDLE_VALUE )
+      return false;
+
+    BY_HANDLE_FILE_INFORMATION fileinfo;
+    const bool got_info = GetFileInformationByHandle( file, &fileinfo );
+    CloseHandle( file );
+    if( !got_info )
+      return false;
+
+    stamp.size = (static_cast<uint64_t>(fileinfo.nFileSizeHigh) << 32) | fileinfo.nFileSizeLow;
+    //In 100 ns intervals
+    stamp.mtime = static_cast<int64_t>( (static_cast<uint64_t>(fileinfo.ftLastWriteTime.dwHighDateTime) << 32)
+                                        | fileinfo.ftLastWriteTime.dwLowDateTime );
+    stamp.file_id = (static_cast<uint64_t>(fileinfo.nFileIndexHigh) << 32) | fileinfo.nFileIndexLow;
+    stamp.file_id ^= static_cast<uint64_t>( fileinfo.dwVolumeSerialNumber ) * 1099511628211ULL;
+
+    ifstream input( wfilename.c_str(), ios::in | ios::binary );
+#else
+    struct stat statbuf;
+    if( stat( filename.c_str(), &statbuf ) != 0 )
+      return false;
+
+    stamp.size = static_cast<uint64_t>( statbuf.st_size );
+#if( defined(__APPLE__) )
+    stamp.mtime = static_cast<int64_t>( statbuf.st_mtimespec.tv_sec ) * 1000000000LL
+                  + statbuf.st_mtimespec.tv_nsec;
+#else
+    stamp.mtime = static_cast<int64_t>( statbuf.st_mtim.tv_sec ) * 1000000000LL
+                  + statbuf.st_mtim.tv_nsec;
+#endif
+    stamp.file_id = static_cast<uint64_t>( statbuf.st_ino )
+                    ^ (static_cast<uint64_t>( statbuf.st_dev ) * 1099511628211ULL);
+
+    ifstream input( filename.c_str(), ios::in | ios::binary );
+#endif
+
+    if( !input.is_open() )
+      return false;
+
+    const size_t head_size = static_cast<size_t>( std::min( stamp.size, uint64_t(ns_hash_bytes) ) );
+    string buffer( head_size, '\0' );
+    if( !input.read( &buffer[0], head_size ) )
+      return false;
+    stamp.hash = fnv1a_hash( buffer.data(), buffer.size() );
+
+    stamp.is_n42_2012
+          = (FileLoader::sniff_compression( buffer.data(), buffer.size() ) == FileLoader::Compression::None)
+            && (FileLoader::sniff_parser_type( buffer.data(), buffer.size(), static_cast<size_t>(stamp.size) )
+                == SpecUtils::ParserType::N42_2012);
+
+    if( stamp.size > ns_hash_bytes )
+    {
+      const uint64_t tail_start = std::max( stamp.size - ns_hash_bytes, uint64_t(ns_hash_bytes) );
+      buffer.resize( static_cast<size_t>(stamp.size - tail_start) );
+      input.seekg( static_cast<streamoff>(tail_start), ios::beg );
+      if( !input.read( &buffer[0], buffer.size() ) )
+        return false;
+      stamp.hash = fnv1a_hash( buffer.data(), buffer.size(), stamp.hash );
+    }//if( file is larger than the head we hashed )
+
+    stamp.hash = fnv1a_hash( reinterpret_cast<const char *>(&stamp.size), sizeof(stamp.size), stamp.hash );
+
+    return true;
+  }//source_stamp(...)
+
+
+  typedef pair<int,string> RecordKey;
+
+  RecordKey record_key( const SpecUtils::Measurement &meas )
+  {
+    return RecordKey( meas.sample_number(), meas.detector_name() );
+  }
+
+
+  /** Returns the records with gamma counts, keyed by sample number and
+   detector name; returns false if two records have the same key.
+   */
+  bool records_by_key( const vector<shared_ptr<const SpecUtils::Measurement>> &measurements,
+                       map<RecordKey,shared_ptr<const SpecUtils::Measurement>> &records )
+  {
+    records.clear();
+    for( const shared_ptr<const SpecUtils::Measurement> &meas : measurements )
+    {
+      const shared_ptr<const vector<float>> &counts = meas->gamma_counts();
+      if( !counts || counts->empty() )
+        continue;
+
+      if( !records.insert( make_pair( record_key(*meas), meas ) ).second )
+        return false;
+    }//for( loop over measurements )
+
+    return true;
+  }//records_by_key(...)
+}//namespace
+
+
+namespace SpecFileCache
+{
+std::string cache_filename( const std::string &cache_dir, const std::string &source_filename )
+{
+  const uint64_t hash = fnv1a_hash( source_filename.data(), source_filename.size() );
+
+  char name[64];
+  snprintf( name, sizeof(name), "%016llx.cambiocache", static_cast<unsigned long long>(hash) );
+
+  return SpecUtils::append_path( cache_dir, name );
+}//cache_filename(...)
+
+
+struct CacheContents
+{
+  /** The file, with all gamma counts replaced by zeros (which the N42 writer
+   compresses to almost nothing), the same as CompactSpecFile does.
+   */
+  SpecUtils::SpecFile meta;
+
+  /** The channel counts of records with gamma counts, by sample number and
+   detector name; shared with the original file.
+   */
+  map<RecordKey,shared_ptr<const vector<float>>> counts;
+};//struct CacheContents
+
+
+std::shared_ptr<const CacheContents> prepare_cache( const SpecUtils::SpecFile &info )
+{
+  //Records are matched up by sample number and detector name when loading.
+  map<RecordKey,shared_ptr<const SpecUtils::Measurement>> records;
+  if( !records_by_key( info.measurements(), records ) )
+    return nullptr;
+
+  auto contents = make_shared<CacheContents>();
+  for( const auto &record : records )
+    contents->counts[record.first] = record.second->gamma_counts();
+
+  SpecUtils::SpecFile &meta = contents->meta;
+  meta = info;
+
+  map<size_t,shared_ptr<const vector<float>>> zeros;
+  vector<shared_ptr<SpecUtils::Measurement>> zeroed;
+
+  for( const shared_ptr<const SpecUtils::Measurement> &m : meta.measurements() )
+  {
+    auto nm = make_shared<SpecUtils::Measurement>( *m );
+
+    const shared_ptr<const vector<float>> &counts = m->gamma_counts();
+    if( counts && !counts->empty() )
+    {
+      shared_ptr<const vector<float>> &zero = zeros[counts->size()];
+      if( !zero )
+        zero = make_shared<vector<float>>( counts->size(), 0.0f );
+      nm->set_gamma_counts( zero, m->live_time(), m->real_time() );
+    }//if( counts && !counts->empty() )
+
+    zeroed.push_back( nm );
+  }//for( loop over measurements )
+
+  meta.remove_measurements( meta.measurements() );
+  for( const shared_ptr<SpecUtils::Measurement> &m : zeroed )
+    meta.add_measurement( m, false );
+  meta.cleanup_after_load( SpecUtils::SpecFile::CleanupAfterLoadFlags::DontChangeOrReorderSamples );
+
+  return contents;
+}//prepare_cache(...)
+
+
+bool write_cache( const CacheContents &contents, const std::string &source_filename,
+                  const std::string &cache_filename )
+{
+  SourceStamp stamp;
+  if( !source_stamp( source_filename, stamp ) || !stamp.is_n42_2012 )
+    return false;
+
+  stringstream xml;
+  if( !contents.meta.write_2012_N42( xml ) )
+    return false;
+  string meta_xml = xml.str();
+
+  //Make sure the records survive the trip through N42, and are still unique.
+  const map<RecordKey,shared_ptr<const vector<float>>> &records = contents.counts;
+
+  {
+    string xml_copy = meta_xml;  //The N42 parser modifies its input
+    SpecUtils::SpecFile reread;
+    map<RecordKey,shared_ptr<const SpecUtils::Measurement>> reread_records;
+    if( xml_copy.empty()
+        || !reread.load_N42_from_data( &xml_copy[0], &xml_copy[0] + xml_copy.size() )
+        || !records_by_key( reread.measurements(), reread_records )
+        || (reread_records.size() != records.size()) )
+      return false;
+
+    for( const auto &record : records )
+    {
+      const auto pos = reread_records.find( record.first );
+      if( (pos == end(reread_records))
+          || (pos->second->num_gamma_channels() != record.second->size()) )
+        return false;
+    }
+  }
+
+  //Detector names, and the index of records.
+  map<string,uint32_t> detector_indexes;
+  string names;
+  for( const auto &record : records )
+  {
+    if( detector_indexes.count( record.first.second ) )
+      continue;
+    const uint32_t index = static_cast<uint32_t>( detector_indexes.size() );
+    detector_indexes[record.first.second] = index;
+    names += record.first.second;
+    names += '\0';
+  }//for( loop over records )
+
+  CacheHeader header;
+  memset( &header, 0, sizeof(header) );
+  memcpy( header.magic, ns_cache_magic, sizeof(header.magic) );
+  header.version = ns_cache_version;
+  header.byte_order_mark = ns_byte_order_mark;
+  header.source_size = stamp.size;
+  header.source_mtime = stamp.mtime;
+  header.source_file_id = stamp.file_id;
+  header.source_hash = stamp.hash;
+  header.meta_offset = sizeof(CacheHeader);
+  header.meta_size = meta_xml.size();
+  header.names_offset = aligned( header.meta_offset + header.meta_size, 8 );
+  header.names_size = names.size();
+  header.index_offset = aligned( header.names_offset + header.names_size, 64 );
+  header.num_records = records.size();
+
+  vector<CacheRecord> index;
+  uint64_t offset = aligned( header.index_offset + records.size()*sizeof(CacheRecord), 64 );
+  for( const auto &record : records )
+  {
+    CacheRecord entry;
+    memset( &entry, 0, sizeof(entry) );
+    entry.counts_offset = offset;
+    entry.num_channels = static_cast<uint32_t>( record.second->size() );
+    entry.sample_number = record.first.first;
+    entry.detector_index = detector_indexes[record.first.second];
+    index.push_back( entry );
+
+    offset = aligned( offset + sizeof(float)*entry.num_channels, 64 );
+  }//for( loop over records )
+  header.cache_size = offset;
+
+  OutputFile output( cache_filename );
+  if( !output.is_open() )
+    return false;
+
+  uint64_t position = 0;
+  auto write_at = [&output,&position]( const uint64_t at, const char *data, const size_t nbytes ){
+    static const char zeros[64] = { 0 };
+    while( position < at )
+    {
+      const size_t npad = static_cast<size_t>( std::min( at - position, uint64_t(sizeof(zeros)) ) );
+      output.write( zeros, npad );
+      position += npad;
+    }
+    output.write( data, nbytes );
+    position += nbytes;
+  };
+
+  write_at( 0, reinterpret_cast<const char *>(&header), sizeof(header) );
+  write_at( header.meta_offset, meta_xml.data(), meta_xml.size() );
+  string().swap( meta_xml );
+  write_at( header.names_offset, names.data(), names.size() );
+  write_at( header.index_offset, reinterpret_cast<const char *>(index.data()),
+            index.size()*sizeof(CacheRecord) );
+
+  size_t record_index = 0;
+  for( const auto &record : records )
+  {
+    const vector<float> &counts = *record.second;
+    write_at( index[record_index++].counts_offset, reinterpret_cast<const char *>(counts.data()),
+              sizeof(float)*counts.size() );
+  }
+  write_at( header.cache_size, nullptr, 0 );
+
+  return output.commit();
+}//write_cache(...)
+
+
+bool load_cache( SpecUtils::SpecFile &info, const std::string &source_filename,
+                 const std::string &cache_filename )
+{
+  info.reset();
+
+  if( !SpecUtils::is_file( cache_filename ) )
+    return false;
+
+  SourceStamp stamp;
+  if( !source_stamp( source_filename, stamp ) )
+    return false;
+
+  unique_ptr<FileLoader::MappedFile> mapped;
+  try
+  {
+    mapped.reset( new FileLoader::MappedFile( cache_filename ) );
+  }catch( std::exception & )
+  {
+    return false;
+  }
+
+  const char * const data = mapped->data();
+  const uint64_t size = mapped->size();
+  if( size < sizeof(CacheHeader) )
+    return false;
+
+  CacheHeader header;
+  memcpy( &header, data, sizeof(header) );
+
+  if( memcmp( header.magic, ns_cache_magic, sizeof(header.magic) )
+      || (header.version != ns_cache_version)
+      || (header.byte_order_mark != ns_byte_order_mark)
+      || (header.cache_size != size)
+      || (header.source_size != stamp.size)
+      || (header.source_mtime != stamp.mtime)
+      || (header.source_file_id != stamp.file_id)
+      || (header.source_hash != stamp.hash) )
+    return false;
+
+  if( (header.meta_offset > size) || (header.meta_size > (size - header.meta_offset))
+      || (header.names_offset > size) || (header.names_size > (size - header.names_offset))
+      || (header.index_offset > size)
+      || (header.num_records > ((size - header.index_offset) / sizeof(CacheRecord))) )
+    return false;
+
+  vector<string> detector_names;
+  const char *names = data + header.names_offset;
+  for( size_t pos = 0; pos < header.names_size; )
+  {
+    const void *end = memchr( names + pos, '\0', static_cast<size_t>(header.names_size - pos) );
+    if( !end )
+      return false;
+    const size_t len = static_cast<size_t>( static_cast<const char *>(end) - (names + pos) );
+    detector_names.push_back( string( names + pos, len ) );
+    pos += len + 1;
+  }//for( loop over detector names )
+
+  map<RecordKey,CacheRecord> index;
+  for( uint64_t i = 0; i < header.num_records; ++i )
+  {
+    CacheRecord entry;
+    memcpy( &entry, data + header.index_offset + i*sizeof(CacheRecord), sizeof(entry) );
+
+    if( (entry.detector_index >= detector_names.size())
+        || (entry.counts_offset > size)
+        || (entry.num_channels > ((size - entry.counts_offset) / sizeof(float))) )
+      return false;
+
+    const RecordKey key( entry.sample_number, detector_names[entry.detector_index] );
+    if( !index.insert( make_pair( key, entry ) ).second )
+      return false;
+  }//for( loop over records )
+
+  //The N42 parser modifies its input, so the (small) metadata is copied out
+  //  of the read-only mapping first.
+  vector<char> meta( data + header.meta_offset, data + header.meta_offset + header.meta_size );
+  if( meta.empty() || !info.load_N42_from_data( meta.data(), meta.data() + meta.size() ) )
+  {
+    info.reset();
+    return false;
+  }
+
+  //Copy the counts from the mapping into each record.
+  vector<shared_ptr<SpecUtils::Measurement>> filled;
+  size_t num_filled = 0;
+  for( const shared_ptr<const SpecUtils::Measurement> &m : info.measurements() )
+  {
+    auto nm = make_shared<SpecUtils::Measurement>( *m );
+
+    if( m->num_gamma_channels() )
+    {
+      const auto pos = index.find( record_key( *m ) );
+      if( (pos == end(index)) || (pos->second.num_channels != m->num_gamma_channels()) )
+      {
+        info.reset();
+        return false;
+      }
+
+      const float *begin = reinterpret_cast<const float *>( data + pos->second.counts_offset );
+      auto counts = make_shared<vector<float>>( begin, begin + pos->second.num_channels );
+      nm->set_gamma_counts( counts, m->live_time(), m->real_time() );
+      ++num_filled;
+    }//if( m->num_gamma_channels() )
+
+    filled.push_back( nm );
+  }//for( loop over measurements )
+
+  if( num_filled != index.size() )
+  {
+    info.reset();
+    return false;
+  }
+
+  info.remove_measurements( info.measurements() );
+  for( const shared_ptr<SpecUtils::Measurement> &m : filled )
+    info.add_measurement( m, false );
+  info.cleanup_after_load( SpecUtils::SpecFile::CleanupAfterLoadFlags::DontChangeOrReorderSamples );
+  info.set_filename( source_filename );
+
+  //Mark the cache as recently used, for prune_cache_dir(...).
+  mapped.reset();
+#ifdef _WIN32
+  _wutime( SpecUtils::convert_from_utf8_to_utf16(cache_filename).c_str(), nullptr );
+#else
+  utime( cache_filename.c_str(), nullptr );
+#endif
+
+  return true;
+}//load_cache(...)
+
+
+void prune_cache_dir( const std::string &cache_dir, const uint64_t max_total_size )
+{
+  struct CacheFile
+  {
+    string path;
+    uint64_t size;
+    int64_t last_used;
+  };
+
+  vector<CacheFile> files;
+  uint64_t total_size = 0;
+
+  for( const string &path : SpecUtils::ls_files_in_directory( cache_dir, ".cambiocache" ) )
+  {
+    CacheFile file;
+    file.path = path;
+#ifdef _WIN32
+    struct _stat64 statbuf;
+    if( _wstat64( SpecUtils::convert_from_utf8_to_utf16(path).c_str(), &statbuf ) != 0 )
+      continue;
+#else
+    struct stat statbuf;
+    if( stat( path.c_str(), &statbuf ) != 0 )
+      continue;
+#endif
+    file.size = static_cast<uint64_t>( statbuf.st_size );
+    file.last_used = static_cast<int64_t>( statbuf.st_mtime );
+    total_size += file.size;
+    files.push_back( file );
+  }//for( loop over cache files )
+
+  if( total_size <= max_total_size )
+    return;
+
+  std::sort( begin(files), end(files), []( const CacheFile &lhs, const CacheFile &rhs ){
+    return lhs.last_used < rhs.last_used;
+  } );
+
+  for( const CacheFile &file : files )
+  {
+    if( total_size <= max_total_size )
+      break;
+
+    if( SpecUtils::remove_file( file.path ) )
+      total_size -= file.size;
+  }//for( loop over cache files, least recently used first )
+}//prune_cache_dir(...)
+}//namespace SpecFileCache
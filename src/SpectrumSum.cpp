@@ -0,0 +1,370 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <set>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cassert>
+#include <algorithm>
+#include <utility>
+#include <stdexcept>
+
+#include "SpecUtils/SpecFile.h"
+#include "SpecUtils/DateTime.h"
+#include "SpecUtils/EnergyCalibration.h"
+
+#include "cambio/SpectrumSum.h"
+
+using namespace std;
+
+namespace
+{
+  //The number of records summed into each partial sum.  This must not depend
+  //  on the number of threads, or else results would change with thread count.
+  const size_t ns_records_per_block = 256;
+
+
+  void add_to( vector<double> &lhs, const vector<double> &rhs )
+  {
+    assert( lhs.size() == rhs.size() );
+
+    double * const a = lhs.data();
+    const double * const b = rhs.data();
+    const size_t n = lhs.size();
+    for( size_t i = 0; i < n; ++i )
+      a[i] += b[i];
+  }//add_to(...)
+
+
+  /** A pairwise (cascade) summation of channel arrays.
+   Equal height sub-trees are merged as soon as they both exist, and the
+   remainders are merged newest-to-oldest at the end, so the shape of the tree
+   only depends on the number of arrays added.
+   */
+  class PairwiseAccumulator
+  {
+  public:
+    explicit PairwiseAccumulator( const size_t nchannel )
+      : m_nchannel( nchannel )
+    {
+    }
+
+    void add( vector<double> &&leaf )
+    {
+      assert( leaf.size() == m_nchannel );
+
+      size_t height = 0;
+      while( !m_stack.empty() && (m_stack.back().first == height) )
+      {
+        add_to( m_stack.back().second, leaf );
+        leaf.swap( m_stack.back().second );
+        m_stack.pop_back();
+        ++height;
+      }
+
+      m_stack.emplace_back( height, std::move(leaf) );
+    }//add(...)
+
+    vector<double> result()
+    {
+      if( m_stack.empty() )
+        return vector<double>( m_nchannel, 0.0 );
+
+      vector<double> sum = std::move( m_stack.back().second );
+      m_stack.pop_back();
+
+      while( !m_stack.empty() )
+      {
+        add_to( m_stack.back().second, sum );
+        sum.swap( m_stack.back().second );
+        m_stack.pop_back();
+      }
+
+      return sum;
+    }//result()
+
+  protected:
+    const size_t m_nchannel;
+    vector<pair<size_t,vector<double>>> m_stack;
+  };//class PairwiseAccumulator
+
+
+  /** Adds the gamma counts of `m`, in the binning of `cal`, to `leaf`. */
+  void add_in_binning( const SpecUtils::Measurement &m,
+                       const SpecUtils::EnergyCalibration &cal,
+                       vector<double> &leaf )
+  {
+    const size_t nchannel = cal.num_channels();
+    const shared_ptr<const vector<float>> &counts = m.gamma_counts();
+    const shared_ptr<const SpecUtils::EnergyCalibration> &mcal = m.energy_calibration();
+    assert( counts && mcal && mcal->valid() && (leaf.size() == nchannel) );
+
+    const shared_ptr<const vector<float>> &from_energies = mcal->channel_energies();
+    const shared_ptr<const vector<float>> &to_energies = cal.channel_energies();
+
+    const bool same_binning = (counts->size() == nchannel)
+                              && ((mcal.get() == &cal)
+                                  || (from_energies && to_energies
+                                      && ((from_energies == to_energies)
+                                          || ((*from_energies) == (*to_energies)))));
+
+    if( same_binning )
+    {
+      const float * const src = counts->data();
+      double * const dest = leaf.data();
+      for( size_t i = 0; i < nchannel; ++i )
+        dest[i] += src[i];
+    }else
+    {
+      if( !from_energies || !to_energies )
+        throw runtime_error( "Energy calibration missing channel energies." );
+
+      SpectrumSum::rebin_add( counts->data(), 0, counts->size(), *from_energies, *to_energies, leaf );
+    }//if( same_binning ) / else
+  }//add_in_binning(...)
+
+
+  /** The upper energy of channel `index`; the last channel is taken to be as
+   wide as the one before it, if `energies` doesnt include its upper edge.
+   */
+  double upper_energy( const vector<float> &energies, const size_t index )
+  {
+    if( (index + 1) < energies.size() )
+      return energies[index + 1];
+    if( index > 0 )
+      return 2.0*energies[index] - energies[index - 1];
+    return energies[index] + 1.0;
+  }//upper_energy(...)
+}//namespace
+
+
+namespace SpectrumSum
+{
+
+std::shared_ptr<SpecUtils::Measurement>
+  deterministic_sum( const SpecUtils::SpecFile &info,
+                     const std::set<int> &sample_numbers,
+                     const std::vector<std::string> &detector_names,
+                     std::shared_ptr<const SpecUtils::EnergyCalibration> energy_cal,
+                     size_t num_threads )
+{
+  const set<string> dets( begin(detector_names), end(detector_names) );
+
+  vector<shared_ptr<const SpecUtils::Measurement>> records, gamma_records;
+  for( const shared_ptr<const SpecUtils::Measurement> &m : info.measurements() )
+  {
+    if( !m || !sample_numbers.count(m->sample_number()) || !dets.count(m->detector_name()) )
+      continue;
+
+    records.push_back( m );
+
+    const shared_ptr<const SpecUtils::EnergyCalibration> &cal = m->energy_calibration();
+    if( m->gamma_counts() && !m->gamma_counts()->empty() && cal && cal->valid() )
+      gamma_records.push_back( m );
+  }//for( loop over measurements )
+
+  if( records.empty() )
+    return nullptr;
+
+  if( !energy_cal )
+    energy_cal = info.suggested_sum_energy_calibration( sample_numbers, detector_names );
+
+  if( gamma_records.empty() || !energy_cal || !energy_cal->valid() )
+    throw runtime_error( "No gamma spectra with a valid energy calibration to sum." );
+
+  const size_t nchannel = energy_cal->num_channels();
+  const vector<double> gamma_sum = pairwise_sum( gamma_records.size(), nchannel,
+    [&gamma_records,&energy_cal]( const size_t index, vector<double> &leaf ){
+      add_in_binning( *gamma_records[index], *energy_cal, leaf );
+  }, num_threads );
+
+  auto summed_counts = make_shared<vector<float>>( nchannel );
+  for( size_t i = 0; i < nchannel; ++i )
+    (*summed_counts)[i] = static_cast<float>( gamma_sum[i] );
+
+  //The rest of the quantities are cheap, so we'll just sum them in record order
+  double live_time = 0.0, real_time = 0.0;
+  for( const shared_ptr<const SpecUtils::Measurement> &m : gamma_records )
+  {
+    live_time += m->live_time();
+    real_time += m->real_time();
+  }
+
+  bool contained_neutrons = false;
+  double neutron_live_time = 0.0;
+  vector<double> neutron_sum;
+  SpecUtils::time_point_t earliest_start;
+  bool have_start = false, same_source_type = true;
+  for( const shared_ptr<const SpecUtils::Measurement> &m : records )
+  {
+    if( m->contained_neutron() )
+    {
+      contained_neutrons = true;
+      neutron_live_time += m->neutron_live_time();
+      const vector<float> &neutrons = m->neutron_counts();
+      if( neutron_sum.size() < neutrons.size() )
+        neutron_sum.resize( neutrons.size(), 0.0 );
+      for( size_t i = 0; i < neutrons.size(); ++i )
+        neutron_sum[i] += neutrons[i];
+    }//if( m->contained_neutron() )
+
+    if( !SpecUtils::is_special(m->start_time())
+        && (!have_start || (m->start_time() < earliest_start)) )
+    {
+      have_start = true;
+      earliest_start = m->start_time();
+    }
+
+    same_source_type = same_source_type
+                       && (m->source_type() == records.front()->source_type());
+  }//for( loop over records )
+
+  //Like SpecFile::sum_measurements(...), the result starts out blank (no title,
+  //  remarks, position, etc), rather than taking these from any one record.
+  auto answer = make_shared<SpecUtils::Measurement>();
+  answer->set_gamma_counts( summed_counts, static_cast<float>(live_time),
+                            static_cast<float>(real_time) );
+  answer->set_energy_calibration( energy_cal );
+
+  if( contained_neutrons )
+    answer->set_neutron_counts( vector<float>( begin(neutron_sum), end(neutron_sum) ),
+                                static_cast<float>(neutron_live_time) );
+
+  if( have_start )
+    answer->set_start_time( earliest_start );
+
+  if( sample_numbers.size() == 1 )
+    answer->set_sample_number( *begin(sample_numbers) );
+
+  if( dets.size() == 1 )
+    answer->set_detector_name( *begin(dets) );
+
+  if( same_source_type )
+    answer->set_source_type( records.front()->source_type() );
+
+  return answer;
+}//deterministic_sum(...)
+
+
+std::vector<double> pairwise_sum( const size_t num_records, const size_t num_channels,
+                     const std::function<void(size_t,std::vector<double> &)> &add_record,
+                     size_t num_threads )
+{
+  const size_t nblocks = (num_records + ns_records_per_block - 1) / ns_records_per_block;
+
+  if( num_threads == 0 )
+    num_threads = std::max( 1u, std::thread::hardware_concurrency() );
+  num_threads = std::min( num_threads, nblocks );
+
+  vector<vector<double>> block_sums( nblocks );
+  std::atomic<size_t> next_block( 0 );
+  std::atomic<bool> had_error( false );
+  string error_msg;
+
+  auto sum_blocks = [&](){
+    try
+    {
+      for( size_t block = next_block++; block < nblocks && !had_error; block = next_block++ )
+      {
+        const size_t first = block * ns_records_per_block;
+        const size_t last = std::min( first + ns_records_per_block, num_records );
+
+        PairwiseAccumulator accum( num_channels );
+        for( size_t i = first; i < last; ++i )
+        {
+          vector<double> leaf( num_channels, 0.0 );
+          add_record( i, leaf );
+          accum.add( std::move(leaf) );
+        }
+
+        block_sums[block] = accum.result();
+      }//for( loop over blocks )
+    }catch( std::exception &e )
+    {
+      if( !had_error.exchange(true) )
+        error_msg = e.what();
+    }//try / catch
+  };//sum_blocks lambda
+
+  vector<std::thread> workers;
+  for( size_t i = 1; i < num_threads; ++i )
+    workers.emplace_back( sum_blocks );
+  sum_blocks();
+  for( std::thread &worker : workers )
+    worker.join();
+
+  if( had_error )
+    throw runtime_error( "Error summing spectra: " + error_msg );
+
+  PairwiseAccumulator total( num_channels );
+  for( vector<double> &block_sum : block_sums )
+    total.add( std::move(block_sum) );
+
+  return total.result();
+}//pairwise_sum(...)
+
+
+void rebin_add( const float *counts, const size_t first_channel, const size_t num_values,
+                const std::vector<float> &from_energies,
+                const std::vector<float> &to_energies,
+                std::vector<double> &sum )
+{
+  const size_t nbins = std::min( sum.size(), to_energies.size() );
+  if( !num_values || !nbins )
+    return;
+
+  if( (first_channel + num_values) > from_energies.size() )
+    throw runtime_error( "Energy calibration has fewer channels than the spectrum." );
+
+  //Start at the bin containing the lower edge of the first channel; bins only
+  //  ever move forward from there, since both sets of energies increase.
+  const auto to_begin = begin(to_energies), to_end = to_begin + nbins;
+  size_t bin = std::upper_bound( to_begin, to_end, from_energies[first_channel] ) - to_begin;
+  bin = bin ? (bin - 1) : 0;
+
+  for( size_t i = 0; i < num_values; ++i )
+  {
+    const float value = counts[i];
+    if( value == 0.0f )
+      continue;
+
+    const size_t channel = first_channel + i;
+    const double lower = from_energies[channel];
+    const double upper = upper_energy( from_energies, channel );
+    const double width = upper - lower;
+    if( !(width > 0.0) )
+      continue;
+
+    while( (bin < nbins) && (upper_energy( to_energies, bin ) <= lower) )
+      ++bin;
+
+    for( size_t j = bin; (j < nbins) && (to_energies[j] < upper); ++j )
+    {
+      const double overlap = std::min( upper, upper_energy( to_energies, j ) )
+                             - std::max( lower, static_cast<double>(to_energies[j]) );
+      if( overlap > 0.0 )
+        sum[j] += value * (overlap / width);
+    }
+  }//for( loop over channels )
+}//rebin_add(...)
+
+}//namespace SpectrumSum
@@ -0,0 +1,265 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <set>
+#include <memory>
+#include <string>
+#include <vector>
+#include <numeric>
+#include <ostream>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "SpecUtils/SpecFile.h"
+#include "SpecUtils/EnergyCalibration.h"
+
+#include "cambio/TimeSeries.h"
+#include "cambio/ParallelOutput.h"
+
+using namespace std;
+
+namespace
+{
+  //The number of samples each thread sums at a time.
+  const size_t ns_samples_per_block = 1024;
+}//namespace
+
+
+namespace TimeSeries
+{
+
+double Series::gamma_rate( const size_t index ) const
+{
+  const double live_time = live_times.at( index );
+  return (live_time > 0.0) ? (gamma_counts[index] / live_time) : gamma_counts[index];
+}//gamma_rate(...)
+
+
+void Series::append( const Series &other )
+{
+  const double offset = start_times.empty() ? 0.0 : start_times.back();
+  if( !start_times.empty() && !other.start_times.empty() )
+    start_times.pop_back();
+
+  for( const double time : other.start_times )
+    start_times.push_back( offset + time );
+
+  sample_numbers.insert( end(sample_numbers), begin(other.sample_numbers), end(other.sample_numbers) );
+  live_times.insert( end(live_times), begin(other.live_times), end(other.live_times) );
+  gamma_counts.insert( end(gamma_counts), begin(other.gamma_counts), end(other.gamma_counts) );
+  neutron_counts.insert( end(neutron_counts), begin(other.neutron_counts), end(other.neutron_counts) );
+}//append(...)
+
+
+SampleTable tabulate( const SpecUtils::SpecFile &info, const size_t num_threads )
+{
+  SampleTable table;
+
+  const set<int> &samples = info.sample_numbers();
+  table.sample_numbers.assign( begin(samples), end(samples) );
+  table.detector_numbers = info.detector_numbers();
+
+  const size_t nsample = table.sample_numbers.size();
+  const size_t ndet = table.detector_numbers.size();
+
+  unordered_map<int,size_t> sample_index, det_index;
+  sample_index.reserve( nsample );
+  for( size_t i = 0; i < nsample; ++i )
+    sample_index[table.sample_numbers[i]] = i;
+  for( size_t i = 0; i < ndet; ++i )
+    det_index[table.detector_numbers[i]] = i;
+
+  //Group the records by sample (keeping their order), so each sample can be
+  //  summed on its own, without looking through all the records for it.
+  const vector<shared_ptr<const SpecUtils::Measurement>> &meas = info.measurements();
+
+  vector<size_t> record_sample( meas.size(), nsample );
+  vector<size_t> sample_start( nsample + 1, 0 );
+  for( size_t i = 0; i < meas.size(); ++i )
+  {
+    if( !meas[i] )
+      continue;
+
+    const auto pos = sample_index.find( meas[i]->sample_number() );
+    if( pos == end(sample_index) )
+      continue;
+
+    record_sample[i] = pos->second;
+    sample_start[pos->second + 1] += 1;
+  }//for( loop over records )
+
+  std::partial_sum( begin(sample_start), end(sample_start), begin(sample_start) );
+
+  vector<size_t> sample_records( sample_start.back() );
+  vector<size_t> next( begin(sample_start), end(sample_start) - 1 );
+  for( size_t i = 0; i < meas.size(); ++i )
+  {
+    if( record_sample[i] < nsample )
+      sample_records[next[record_sample[i]]++] = i;
+  }
+
+  table.num_records.resize( nsample );
+  for( size_t i = 0; i < nsample; ++i )
+    table.num_records[i] = sample_start[i+1] - sample_start[i];
+
+  table.gamma_counts.resize( nsample*ndet, 0.0 );
+  table.neutron_counts.resize( nsample*ndet, 0.0 );
+  table.live_times.resize( nsample*ndet, 0.0 );
+  table.real_times.resize( nsample*ndet, 0.0 );
+
+  //Each block of samples only writes to its own elements of the table.
+  const size_t nblocks = (nsample + ns_samples_per_block - 1) / ns_samples_per_block;
+  ParallelOutput::parallel_for( nblocks, num_threads, [&]( const size_t block, const size_t ){
+    const size_t first = block * ns_samples_per_block;
+    const size_t last = std::min( first + ns_samples_per_block, nsample );
+
+    for( size_t sample = first; sample < last; ++sample )
+    {
+      for( size_t i = sample_start[sample]; i < sample_start[sample+1]; ++i )
+      {
+        const SpecUtils::Measurement &m = *meas[sample_records[i]];
+
+        const auto det = det_index.find( m.detector_number() );
+        if( det == end(det_index) )
+          continue;
+
+        const size_t index = sample*ndet + det->second;
+        table.gamma_counts[index] += m.gamma_count_sum();
+        table.neutron_counts[index] += m.neutron_counts_sum();
+        table.live_times[index] += m.live_time();
+
+        if( m.source_type() != SpecUtils::SourceType::Background )
+          table.real_times[index] += m.real_time();
+      }//for( loop over records of the sample )
+    }//for( loop over samples of the block )
+  } );
+
+  return table;
+}//tabulate(...)
+
+
+Series combine( const SampleTable &table, const std::vector<bool> &use_detector )
+{
+  const size_t nsample = table.sample_numbers.size();
+  const size_t ndet = table.detector_numbers.size();
+
+  if( use_detector.size() != ndet )
+    throw runtime_error( "Inconsistent number of detectors." );
+
+  Series series;
+  series.sample_numbers = table.sample_numbers;
+  series.start_times.resize( nsample + 1, 0.0 );
+  series.live_times.resize( nsample, 0.0 );
+  series.gamma_counts.resize( nsample, 0.0 );
+  series.neutron_counts.resize( nsample, 0.0 );
+
+  double time = 0.0;
+  for( size_t sample = 0; sample < nsample; ++sample )
+  {
+    double real_time = 0.0, live_time = 0.0;
+    for( size_t det = 0; det < ndet; ++det )
+    {
+      if( !use_detector[det] )
+        continue;
+
+      const size_t index = sample*ndet + det;
+      real_time += table.real_times[index];
+      live_time += table.live_times[index];
+      series.gamma_counts[sample] += table.gamma_counts[index];
+      series.neutron_counts[sample] += table.neutron_counts[index];
+    }//for( loop over detectors )
+
+    const size_t nrecords = table.num_records[sample];
+    if( nrecords )
+    {
+      time += real_time / nrecords;
+      series.live_times[sample] = live_time / nrecords;
+    }
+
+    series.start_times[sample+1] = time;
+  }//for( loop over samples )
+
+  return series;
+}//combine(...)
+
+
+std::shared_ptr<SpecUtils::Measurement> to_histogram( const Series &series )
+{
+  const size_t nsample = series.gamma_counts.size();
+
+  vector<float> bin_edges( 1, 0.0f );
+  for( size_t i = 1; i < series.start_times.size(); ++i )
+    bin_edges.push_back( static_cast<float>( series.start_times[i] ) );
+
+  //There is one more bin than samples; the extra bin is empty, and has the
+  //  same width as the last sample.
+  const size_t nedges = bin_edges.size();
+  if( nedges > 2 )
+    bin_edges.push_back( 2.0f*bin_edges.back() - bin_edges[nedges-2] );
+  else
+    bin_edges.push_back( bin_edges.back() + 1.0f );
+
+  const size_t nchannel = bin_edges.size() - 1;
+  auto gamma_counts = make_shared<vector<float>>( nchannel, 0.0f );
+  vector<float> neutron_counts( nchannel, 0.0f );
+
+  for( size_t i = 0; (i < nsample) && (i < nchannel); ++i )
+  {
+    (*gamma_counts)[i] = static_cast<float>( series.gamma_rate( i ) );
+    neutron_counts[i] = static_cast<float>( series.neutron_counts[i] );
+  }
+
+  auto grosscounts = make_shared<SpecUtils::Measurement>();
+  grosscounts->set_gamma_counts( gamma_counts, 0.0f, 0.0f );
+  grosscounts->set_neutron_counts( neutron_counts );
+
+  auto cal = make_shared<SpecUtils::EnergyCalibration>();
+  cal->set_lower_channel_energy( nchannel, bin_edges );
+  grosscounts->set_energy_calibration( cal );
+
+  return grosscounts;
+}//to_histogram(...)
+
+
+bool write_csv( std::ostream &output, const Series &series )
+{
+  output << "SampleNumber,StartTime (s),RealTime (s),LiveTime (s),"
+            "GammaCounts,GammaRate,NeutronCounts\r\n";
+
+  const auto old_precision = output.precision( 9 );
+
+  for( size_t i = 0; i < series.gamma_counts.size(); ++i )
+  {
+    output << series.sample_numbers[i]
+           << "," << series.start_times[i]
+           << "," << (series.start_times[i+1] - series.start_times[i])
+           << "," << series.live_times[i]
+           << "," << series.gamma_counts[i]
+           << "," << series.gamma_rate( i )
+           << "," << series.neutron_counts[i]
+           << "\r\n";
+  }//for( loop over samples )
+
+  output.precision( old_precision );
+
+  return output.good();
+}//write_csv(...)
+
+}//namespace TimeSeries
@@ -1,18 +1,28 @@
+#include <map>
 #include <string>
 #include <vector>
+#include <chrono>
+#include <limits>
+#include <cstdlib>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
 #include <iostream>
 #include <algorithm>
+#include <functional>
 
 #include <boost/filesystem.hpp>
-#include <boost/process.hpp>
 
 #include "rapidxml/rapidxml.hpp"
 #include "rapidxml/rapidxml_utils.hpp"
 
+#include "SpecUtils/SpecFile.h"
+
+#include "cambio/FileLoader.h"
+#include "cambio/CommandLineUtil.h"
+
 using namespace std;
 using boost::filesystem::path;
-namespace bp = boost::process;
 
 int compareFiles(const std::string& p1, const std::string& p2) {
 	std::ifstream f1(p1);
@@ -48,27 +58,126 @@ int compareFiles(const std::string& p1, const std::string& p2) {
 	return -1;
 }
 
-int generateOutput(path inputFile, path inputTemplate, path outputFile) {
+// How long it takes to render each template, not including parsing the input file, or writing
+//  the output to disk; filled out by generateOutput().
+struct RenderTiming {
+	string name;          // the output file name, which is unique to each test
+	double renderMs;      // the fastest of the timed renders, in milliseconds
+	size_t outputBytes;   // the size of the rendered output
+};
+
+vector<RenderTiming> renderTimings;
+
+// Each template is rendered at least minRenderIterations times, and then until
+//  minRenderSeconds have elapsed, or maxRenderIterations renders have been done.
+const int minRenderIterations = 3;
+const int maxRenderIterations = 100;
+const double minRenderSeconds = 0.25;
+
+// Renders into memory repeatedly, keeping the fastest time; returns false if any render fails.
+bool timeRender(const std::function<bool(std::ostream&)>& render, double& fastestMs, size_t& outputBytes) {
+	double fastest = std::numeric_limits<double>::max(), total = 0.0;
+
+	for (int i = 0; (i < minRenderIterations) || ((total < minRenderSeconds) && (i < maxRenderIterations)); ++i) {
+		std::ostringstream output;
+
+		const auto start = std::chrono::steady_clock::now();
+		const bool rendered = render(output);
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if (!rendered) {
+			return false;
+		}
+
+		total += seconds;
+		fastest = std::min(fastest, seconds);
+		outputBytes = static_cast<size_t>(output.tellp());
+	}
+
+	fastestMs = 1000.0 * fastest;
+
+	return true;
+}
+
+double msPerMb(double ms, size_t bytes) {
+	return ms / std::max(bytes / (1024.0 * 1024.0), 1.0E-6);
+}
+
+// Render times are stored relative to how long it takes this machine to write the test spectrum
+//  file as N42-2012 with the native (non-template) writer, so the baseline is comparable between
+//  machines, and a slowdown common to all templates is still caught.  Returns the ms/MB of the
+//  native writer, or a negative value on error.
+double calibrationMsPerMb(path template_directory) {
+	SpecUtils::SpecFile info;
+	if (!FileLoader::load_file(info, (template_directory / path("Test") / path("pu239_1C_Detective_X_50cm.pcf")).string())) {
+		return -1.0;
+	}
+
+	double ms = 0.0;
+	size_t bytes = 0;
+	if (!timeRender([&info](std::ostream& output) { return info.write_2012_N42(output); }, ms, bytes)) {
+		return -1.0;
+	}
+
+	return msPerMb(ms, bytes);
+}
+
+// Reads the timing baseline; each line holds an output file name, a tab, and the template's
+//  render time per byte as a multiple of calibrationMsPerMb().  Lines starting with '#' are comments.
+bool readBaseline(const string& filename, map<string, double>& baseline) {
+	ifstream input(filename);
+	if (!input) {
+		return false;
+	}
+
+	string line;
+	while (getline(input, line)) {
+		const size_t tab = line.find('\t');
+		if (line.empty() || (line[0] == '#') || (tab == string::npos)) {
+			continue;
+		}
+
+		baseline[line.substr(0, tab)] = atof(line.c_str() + tab + 1);
+	}
+
+	return true;
+}
+
+bool writeBaseline(const string& filename, const map<string, double>& baseline) {
+	ofstream output(filename);
+	if (!output) {
+		return false;
+	}
+
+	output << "# Template render time per byte, relative to writing N42-2012 natively on the same machine.\n";
+	output << "# Written by template_test --update-baseline; each line is the output name, a tab, and the ratio.\n";
+	for (const auto& entry : baseline) {
+		output << entry.first << '\t' << std::setprecision(4) << entry.second << '\n';
+	}
 
-	// This is built by the cambio project
-	//path cl("../Debug/cambio.exe");
-	path cl("./Release/cambio.exe");
+	return output.good();
+}
 
-	string commandString;
-	commandString.append(cl.string());
-	commandString.append(" --input=");
-	commandString.append("\"" + inputFile.string() + "\"");
-	commandString.append(" --output=");
-	commandString.append("\"" + outputFile.string() + "\"");
-	commandString.append(" --template-file=");
-	commandString.append("\"" + inputTemplate.string() + "\"");
+int generateOutput(path inputFile, path inputTemplate, path outputFile) {
 
-	cout << commandString << endl;
+	// Run the conversion in-process, the same as if cambio was ran from the command line
+	vector<string> args = {
+		"cambio",
+		"--input=" + inputFile.string(),
+		"--output=" + outputFile.string(),
+		"--template-file=" + inputTemplate.string()
+	};
 
-	int result = bp::system(commandString);
+	vector<char*> argv;
+	for (string& arg : args) {
+		argv.push_back(&arg[0]);
+	}
+	argv.push_back(nullptr);
+
+	const int result = CommandLineUtil::run_command_util(static_cast<int>(args.size()), argv.data());
 
 	if (result != 0) {
-		cout << "FAILED, error running process" << endl;
+		cout << "FAILED, conversion returned " << result << endl;
 		return EXIT_FAILURE;
 	}
 
@@ -77,6 +186,25 @@ int generateOutput(path inputFile, path inputTemplate, path outputFile) {
 		return EXIT_FAILURE;
 	}
 
+	// Now time just rendering the template
+	SpecUtils::SpecFile info;
+	if (!FileLoader::load_file(info, inputFile.string())) {
+		cout << "FAILED, could not parse input file for timing" << endl;
+		return EXIT_FAILURE;
+	}
+
+	const string templateFile = inputTemplate.string();
+	double renderMs = 0.0;
+	size_t outputBytes = 0;
+
+	if (!timeRender([&info, &templateFile](std::ostream& output) { return info.write_template(output, templateFile, false); },
+		renderMs, outputBytes)) {
+		cout << "FAILED, error rendering template for timing" << endl;
+		return EXIT_FAILURE;
+	}
+
+	renderTimings.push_back(RenderTiming{ outputFile.filename().string(), renderMs, outputBytes });
+
 	return EXIT_SUCCESS;
 }
 
@@ -230,139 +358,52 @@ int test_Aspect_MKC(path template_directory, path output_directory) {
 	return EXIT_SUCCESS;
 }
 
-int test_AtomTex_6101C(path template_directory, path output_directory) {
-	cout << "TEST: AtomTex 6101C SPE template ... ";
-
-	path expectedOutput = output_directory / path("AtomTex_6101C_spec_20170131_151620.spe");
-	path inputFile = template_directory / path("Test") / path("AtomTex_6101C") / path("spec_20170131_151620.spe");
-
-	if (generateOutput(
-		inputFile,
-		template_directory / path("AtomTex_6101C") / path("TEMPLATE_spec_20170131_151620.spe"),
-		expectedOutput) != 0)
-	{
-		return EXIT_FAILURE;
-	}
-
-	//TESTCODE
-	generateOutput(
-		inputFile,
-		template_directory / path("Test") / path("TEMPLATE_ALL.txt"),
-		output_directory / path("AtomTex_6101C_spec_20170131_151620_all.txt")
-	);
-
-	string absOutputPath = boost::filesystem::absolute(expectedOutput).string();
-	string absInputPath = boost::filesystem::absolute(inputFile).string();
-
-	int lineDiff = compareFiles(absInputPath, absOutputPath);
-	if (lineDiff >= 0) {
-
-		cout << "FAILED, files differ on line " << lineDiff << endl;
-		return EXIT_FAILURE;
-	}
-
-	cout << "SUCCESS" << endl;
-
-	return EXIT_SUCCESS;
-}
-
-int test_FLIRR400_2006(path template_directory, path output_directory) {
-	cout << "TEST: FLIR R400 2006 template ... ";
+// Finds the round-trip templates: each TEMPLATE_<name> file under the templates directory, whose
+//  input is Test/<same sub-directory>/<name>.  Rendering the template from its input should
+//  reproduce the input exactly.  Templates without an input file are listed and skipped.
+vector<path> findRoundTripTemplates(path template_directory) {
+	vector<path> templates;
 
-	path expectedOutput = output_directory / path("FLIR R400 Identification 3916.ANSI N42.42 2006.n42");
-	path inputFile = template_directory / path("Test") / path("FLIR_R400") / path("Identification 3916.ANSI N42.42 2006.n42");
-
-	if (generateOutput(
-		inputFile,
-		template_directory / path("FLIR_R400") / path("TEMPLATE_Identification 3916.ANSI N42.42 2006.n42"),
-		expectedOutput) != 0)
-	{
-		return EXIT_FAILURE;
-	}
+	const path test_directory = template_directory / path("Test");
+	boost::filesystem::recursive_directory_iterator iter(template_directory), end_iter;
+	for (; iter != end_iter; ++iter) {
+		const path& template_file = iter->path();
 
-	string absOutputPath = boost::filesystem::absolute(expectedOutput).string();
-	string absInputPath = boost::filesystem::absolute(inputFile).string();
-
-	int lineDiff = compareFiles(absInputPath, absOutputPath);
-	if (lineDiff >= 0) {
-
-		cout << "FAILED, files differ on line " << lineDiff << endl;
-		return EXIT_FAILURE;
-	}
-
-	cout << "SUCCESS" << endl;
-
-	return EXIT_SUCCESS;
-}
-
-int test_FLIRR400_2012(path template_directory, path output_directory) {
-	cout << "TEST: FLIR R400 2012 template ... ";
-
-	path expectedOutput = output_directory / path("FLIR R400 Identification 3916.ANSI N42.42 2012.n42");
-	path inputFile = template_directory / path("Test") / path("FLIR_R400") / path("Identification 3916.ANSI N42.42 2012.n42");
-
-	if (generateOutput(
-		inputFile,
-		template_directory / path("FLIR_R400") / path("TEMPLATE_Identification 3916.ANSI N42.42 2012.n42"),
-		expectedOutput) != 0)
-	{
-		return EXIT_FAILURE;
-	}
+		if (template_file == test_directory) {
+			iter.no_push();
+			continue;
+		}
 
-	string absOutputPath = boost::filesystem::absolute(expectedOutput).string();
-	string absInputPath = boost::filesystem::absolute(inputFile).string();
+		const string name = template_file.filename().string();
+		if (!boost::filesystem::is_regular_file(template_file) || (name.rfind("TEMPLATE_", 0) != 0)) {
+			continue;
+		}
 
-	int lineDiff = compareFiles(absInputPath, absOutputPath);
-	if (lineDiff >= 0) {
+		const path sub_directory = boost::filesystem::relative(template_file.parent_path(), template_directory);
+		if (!boost::filesystem::exists(test_directory / sub_directory / path(name.substr(9)))) {
+			cout << "SKIPPING " << (sub_directory / path(name)).generic_string() << ", no input file" << endl;
+			continue;
+		}
 
-		cout << "FAILED, files differ on line " << lineDiff << endl;
-		return EXIT_FAILURE;
-	}
+		templates.push_back(template_file);
+	}//for (; iter != end_iter; ++iter)
 
-	cout << "SUCCESS" << endl;
+	std::sort(begin(templates), end(templates));
 
-	return EXIT_SUCCESS;
+	return templates;
 }
 
-int test_FLIRR425(path template_directory, path output_directory) {
-	cout << "TEST: FLIR R425 template ... ";
+int testRoundTripTemplate(path template_directory, path template_file, path output_directory) {
+	const path sub_directory = boost::filesystem::relative(template_file.parent_path(), template_directory);
+	const path inputFile = template_directory / path("Test") / sub_directory / path(template_file.filename().string().substr(9));
 
-	path expectedOutput = output_directory / path("FLIR R425 Spectra_599.n42");
-	path inputFile = template_directory / path("Test") / path("FLIR_R425") / path("Spectra_599.n42");
+	cout << "TEST: " << sub_directory.generic_string() << " template ... ";
 
-	if (generateOutput(
-		inputFile,
-		template_directory / path("FLIR_R425") / path("TEMPLATE_Spectra_599.n42"),
-		expectedOutput) != 0)
-	{
-		return EXIT_FAILURE;
-	}
-
-	string absOutputPath = boost::filesystem::absolute(expectedOutput).string();
-	string absInputPath = boost::filesystem::absolute(inputFile).string();
-
-	int lineDiff = compareFiles(absInputPath, absOutputPath);
-	if (lineDiff >= 0) {
-
-		cout << "FAILED, files differ on line " << lineDiff << endl;
-		return EXIT_FAILURE;
-	}
-
-	cout << "SUCCESS" << endl;
-
-	return EXIT_SUCCESS;
-}
-
-int test_Ortec_Detective_X(path template_directory, path output_directory) {
-	cout << "TEST: Ortec Detective X template ... ";
-
-	path expectedOutput = output_directory / path("Ortec Detective X 0001220_2018_03_08_23_24_200.n42");
-	path inputFile = template_directory / path("Test") / path("Ortec_Detective_X") / path("0001220_2018_03_08_23_24_200.n42");
+	string outputName = (sub_directory / inputFile.filename()).generic_string();
+	std::replace(begin(outputName), end(outputName), '/', ' ');
+	path expectedOutput = output_directory / path(outputName);
 
-	if (generateOutput(
-		inputFile,
-		template_directory / path("Ortec_Detective_X") / path("TEMPLATE_0001220_2018_03_08_23_24_200.n42"),
-		expectedOutput) != 0)
+	if (generateOutput(inputFile, template_file, expectedOutput) != 0)
 	{
 		return EXIT_FAILURE;
 	}
@@ -382,225 +423,147 @@ int test_Ortec_Detective_X(path template_directory, path output_directory) {
 	return EXIT_SUCCESS;
 }
 
-int test_Ortec_RadEagleT_With_Intrinsic_Source(path template_directory, path output_directory) {
-	cout << "TEST: Ortec RadEagle T (w/ intrinsic source) template ... ";
-
-	path expectedOutput = output_directory / path("Ortec RadEagleT wSource 2019-11-25T12-50-11_161.n42");
-	path inputFile = template_directory / path("Test") / path("Ortec_RadEagleT") / path("with_intrinsic_source") / path("2019-11-25T12-50-11_161.n42");
-
-	if (generateOutput(
-		inputFile,
-		template_directory / path("Ortec_RadEagleT") / path("with_intrinsic_source") / path("TEMPLATE_2019-11-25T12-50-11_161.n42"),
-		expectedOutput) != 0)
-	{
-		return EXIT_FAILURE;
-	}
-
-	string absOutputPath = boost::filesystem::absolute(expectedOutput).string();
-	string absInputPath = boost::filesystem::absolute(inputFile).string();
-
-	int lineDiff = compareFiles(absInputPath, absOutputPath);
-	if (lineDiff >= 0) {
-
-		cout << "FAILED, files differ on line " << lineDiff << endl;
-		return EXIT_FAILURE;
-	}
-
-	cout << "SUCCESS" << endl;
-
-	return EXIT_SUCCESS;
-}
-
-int test_Ortec_RadEagleT_No_Intrinsic_Source(path template_directory, path output_directory) {
-	cout << "TEST: Ortec RadEagle T (NO intrinsic source) template ... ";
-
-	path expectedOutput = output_directory / path("Ortec RadEagleT No Source 2019-11-25T12-15-44_223.n42");
-	path inputFile = template_directory / path("Test") / path("Ortec_RadEagleT") / path("No_intrinsic_source") / path("2019-11-25T12-15-44_223.n42");
-
-	if (generateOutput(
-		inputFile,
-		template_directory / path("Ortec_RadEagleT") / path("No_intrinsic_source") / path("TEMPLATE_2019-11-25T12-15-44_223.n42"),
-		expectedOutput) != 0)
-	{
-		return EXIT_FAILURE;
-	}
-
-	string absOutputPath = boost::filesystem::absolute(expectedOutput).string();
-	string absInputPath = boost::filesystem::absolute(inputFile).string();
-
-	int lineDiff = compareFiles(absInputPath, absOutputPath);
-	if (lineDiff >= 0) {
-
-		cout << "FAILED, files differ on line " << lineDiff << endl;
-		return EXIT_FAILURE;
-	}
-
-	cout << "SUCCESS" << endl;
-
-	return EXIT_SUCCESS;
-}
-
-int test_Polimaster_1410(path template_directory, path output_directory) {
-	cout << "TEST: Polimaster 1410 template ... ";
-
-	path expectedOutput = output_directory / path("Polimaster 1410 201803080064.spe");
-	path inputFile = template_directory / path("Test") / path("Polimaster_1410") / path("201803080064.spe");
-
-	if (generateOutput(
-		inputFile,
-		template_directory / path("Polimaster_1410") / path("TEMPLATE_201803080064.spe"),
-		expectedOutput) != 0)
-	{
-		return EXIT_FAILURE;
-	}
+int main(int argc, char** argv)
+{
+	cout << "Cambio Template Test Utility" << endl;
 
-	string absOutputPath = boost::filesystem::absolute(expectedOutput).string();
-	string absInputPath = boost::filesystem::absolute(inputFile).string();
+	// This is obviously only valid if the build directory is at the cambio repository root
+	//path template_directory("../../../Templates/");
+	path template_directory("n42templates/Templates");
+	
+	path output_directory("./template_test_output/");
 
-	int lineDiff = compareFiles(absInputPath, absOutputPath);
-	if (lineDiff >= 0) {
+	// Tests fail if a template's render time per byte, relative to the native N42-2012 writer (see
+	//  calibrationMsPerMb()), is more than `tolerance` fractionally higher than in the baseline file.
+#ifdef TEMPLATE_TEST_BASELINE
+	string baseline_file = TEMPLATE_TEST_BASELINE;
+#else
+	string baseline_file = "render_baseline.txt";
+#endif
+	bool update_baseline = false;
+	double tolerance = 0.5;
+
+	for (int i = 1; i < argc; ++i) {
+		const string arg = argv[i];
+
+		if (arg.rfind("--templates=", 0) == 0) {
+			template_directory = arg.substr(12);
+		}
+		else if (arg.rfind("--output=", 0) == 0) {
+			output_directory = arg.substr(9);
+		}
+		else if (arg.rfind("--baseline=", 0) == 0) {
+			baseline_file = arg.substr(11);
+		}
+		else if (arg == "--update-baseline") {
+			update_baseline = true;
+		}
+		else if (arg.rfind("--tolerance=", 0) == 0) {
+			tolerance = atof(arg.c_str() + 12);
+		}
+		else {
+			cout << "Usage: " << argv[0] << " [--templates=DIR] [--output=DIR] [--baseline=FILE]"
+				" [--update-baseline] [--tolerance=FRACTION]" << endl;
+			return EXIT_FAILURE;
+		}
+	}//for (int i = 1; i < argc; ++i)
 
-		cout << "FAILED, files differ on line " << lineDiff << endl;
+	if (!boost::filesystem::is_directory(template_directory)) {
+		cout << "Template directory '" << template_directory.string() << "' not found" << endl;
 		return EXIT_FAILURE;
 	}
 
-	cout << "SUCCESS" << endl;
-
-	return EXIT_SUCCESS;
-}
-
-int test_RadSeeker(path template_directory, path output_directory) {
-	cout << "TEST: RadSeeker template ... ";
-
-	path expectedOutput = output_directory / path("RadSeeker_CS_76886_D20180308_T145826_E1227_U.n42");
-	path inputFile = template_directory / path("Test") / path("RadSeeker") / path("RadSeeker_CS_76886_D20180308_T145826_E1227_U.n42");
-
-	if (generateOutput(
-		inputFile,
-		template_directory / path("RadSeeker") / path("TEMPLATE_RadSeeker_CS_76886_D20180308_T145826_E1227_U.n42"),
-		expectedOutput) != 0)
-	{
+	map<string, double> baseline;
+	if (!update_baseline && !readBaseline(baseline_file, baseline)) {
+		cout << "Could not read timing baseline '" << baseline_file << "'" << endl;
 		return EXIT_FAILURE;
 	}
 
-	string absOutputPath = boost::filesystem::absolute(expectedOutput).string();
-	string absInputPath = boost::filesystem::absolute(inputFile).string();
-
-	int lineDiff = compareFiles(absInputPath, absOutputPath);
-	if (lineDiff >= 0) {
+	// Clean output directory and recreate
+	cout << "Cleaning and recreating output directory..." << endl;
 
-		cout << "FAILED, files differ on line " << lineDiff << endl;
-		return EXIT_FAILURE;
+	try {
+		boost::filesystem::remove_all(output_directory);
+		boost::filesystem::create_directory(output_directory);
 	}
+	catch (exception&) {}
 
-	cout << "SUCCESS" << endl;
-
-	return EXIT_SUCCESS;
-}
-
-int test_Symetrica_Verifinder(path template_directory, path output_directory) {
-	cout << "TEST: Symetrica Verifinder template ... ";
+	int testCount = 0;
+	int failureCount = 0;
 
-	path expectedOutput = output_directory / path("Symetrica Verifinder Event_SN23N-190007_D20191125_T200611Z_E0586.n42");
-	path inputFile = template_directory / path("Test") / path("Symetrica_Verifinder") / path("Event_SN23N-190007_D20191125_T200611Z_E0586.n42");
+	failureCount += testChannelDataTemplate(template_directory, output_directory); testCount++;
+	failureCount += testChannelDataCompressionTemplate(template_directory, output_directory); testCount++;
+	failureCount += testTimesTemplate(template_directory, output_directory); testCount++;
+	//failureCount += test_Aspect_MKC(template_directory, output_directory); testCount++; // This one is a binary file that fails anyway
 
-	if (generateOutput(
-		inputFile,
-		template_directory / path("Symetrica_Verifinder") / path("TEMPLATE_Event_SN23N-190007_D20191125_T200611Z_E0586.n42"),
-		expectedOutput) != 0)
-	{
-		return EXIT_FAILURE;
+	for (const path& template_file : findRoundTripTemplates(template_directory)) {
+		failureCount += testRoundTripTemplate(template_directory, template_file, output_directory); testCount++;
 	}
 
-	string absOutputPath = boost::filesystem::absolute(expectedOutput).string();
-	string absInputPath = boost::filesystem::absolute(inputFile).string();
-
-	int lineDiff = compareFiles(absInputPath, absOutputPath);
-	if (lineDiff >= 0) {
+	cout << endl;
 
-		cout << "FAILED, files differ on line " << lineDiff << endl;
+	const double calibration = calibrationMsPerMb(template_directory);
+	if (calibration <= 0.0) {
+		cout << "FAILED, could not time the native N42-2012 writer for calibration" << endl;
 		return EXIT_FAILURE;
 	}
 
-	cout << "SUCCESS" << endl;
+	cout << "Render Timing (relative to the native N42-2012 writer, " << std::fixed << std::setprecision(2)
+		<< (1000.0 / calibration) << " MB/s on this machine)" << endl;
 
-	return EXIT_SUCCESS;
-}
+	map<string, double> measured;
+	int regressionCount = 0, unbaselinedCount = 0;
+	for (const RenderTiming& timing : renderTimings) {
+		const double relative = msPerMb(timing.renderMs, timing.outputBytes) / calibration;
+		measured[timing.name] = relative;
 
-int test_Thermo_RIIDEye(path template_directory, path output_directory) {
-	cout << "TEST: Thermo RIIDEye template ... ";
+		cout << "  " << timing.name << ": " << timing.renderMs << " ms, "
+			<< (timing.outputBytes / (1024.0 * 1024.0)) / (timing.renderMs / 1000.0) << " MB/s, "
+			<< relative << "x native";
 
-	path expectedOutput = output_directory / path("Thermo SPEC0654.N42");
-	path inputFile = template_directory / path("Test") / path("Thermo_RIIDEyeX") / path("SPEC0654.N42");
+		if (!update_baseline) {
+			const auto pos = baseline.find(timing.name);
+			if (pos == end(baseline)) {
+				cout << " (not in baseline)";
+				unbaselinedCount++;
+			}
+			else {
+				cout << " (baseline " << pos->second << "x)";
+				if (relative > (pos->second * (1.0 + tolerance))) {
+					cout << " TOO SLOW";
+					regressionCount++;
+				}
+			}
+		}//if (!update_baseline)
 
-	if (generateOutput(
-		inputFile,
-		template_directory / path("Thermo_RIIDEyeX") / path("TEMPLATE_SPEC0654.N42"),
-		expectedOutput) != 0)
-	{
-		return EXIT_FAILURE;
-	}
+		cout << endl;
+	}//for (const RenderTiming& timing : renderTimings)
 
-	string absOutputPath = boost::filesystem::absolute(expectedOutput).string();
-	string absInputPath = boost::filesystem::absolute(inputFile).string();
+	cout.unsetf(std::ios::floatfield);
 
-	int lineDiff = compareFiles(absInputPath, absOutputPath);
-	if (lineDiff >= 0) {
-
-		cout << "FAILED, files differ on line " << lineDiff << endl;
-		return EXIT_FAILURE;
+	if (update_baseline && (failureCount > 0)) {
+		cout << "Not updating the timing baseline, since some tests failed" << endl;
 	}
+	else if (update_baseline) {
+		if (!writeBaseline(baseline_file, measured)) {
+			cout << "Failed to write timing baseline '" << baseline_file << "'" << endl;
+			return EXIT_FAILURE;
+		}
 
-	cout << "SUCCESS" << endl;
-
-	return EXIT_SUCCESS;
-}
-
-int main(int argc, char** argv)
-{
-	cout << "Cambio Template Test Utility" << endl;
-
-	// This is obviously only valid if the build directory is at the cambio repository root
-	//path template_directory("../../../Templates/");
-	path template_directory("n42templates/Templates");
-	
-	path output_directory("./template_test_output/");
-
-	// Clean output directory and recreate
-	cout << "Cleaning and recreating output directory..." << endl;
-
-	try {
-		boost::filesystem::remove_all(output_directory);
-		boost::filesystem::create_directory(output_directory);
+		cout << "Wrote timing baseline '" << baseline_file << "'" << endl;
 	}
-	catch (exception&) {}
-
-	int testCount = 0;
-	int failureCount = 0;
-
-	failureCount += testChannelDataTemplate(template_directory, output_directory); testCount++;
-	failureCount += testChannelDataCompressionTemplate(template_directory, output_directory); testCount++;
-	failureCount += testTimesTemplate(template_directory, output_directory); testCount++;
-	//failureCount += test_Aspect_MKC(template_directory, output_directory); testCount++; // This one is a binary file that fails anyway
-	failureCount += test_AtomTex_6101C(template_directory, output_directory); testCount++;
-	failureCount += test_FLIRR400_2006(template_directory, output_directory); testCount++;
-	failureCount += test_FLIRR400_2012(template_directory, output_directory); testCount++;
-	failureCount += test_FLIRR425(template_directory, output_directory); testCount++;
-	failureCount += test_Ortec_Detective_X(template_directory, output_directory); testCount++;
-	failureCount += test_Ortec_RadEagleT_With_Intrinsic_Source(template_directory, output_directory); testCount++;
-	failureCount += test_Ortec_RadEagleT_No_Intrinsic_Source(template_directory, output_directory); testCount++;
-	failureCount += test_Polimaster_1410(template_directory, output_directory); testCount++;
-	failureCount += test_RadSeeker(template_directory, output_directory); testCount++;
-	failureCount += test_Symetrica_Verifinder(template_directory, output_directory); testCount++; // Note this one has like a billion spectra in it, only did the first few...
-	failureCount += test_Thermo_RIIDEye(template_directory, output_directory); testCount++;
 
 	cout << endl;
 	cout << "Test Summary" << endl;
 	cout << (testCount - failureCount) << " tests passed of " << testCount << endl;
+	if (!update_baseline) {
+		cout << regressionCount << " templates rendered more than " << (100.0 * tolerance)
+			<< "% slower than the baseline" << endl;
+		if (unbaselinedCount > 0) {
+			cout << unbaselinedCount << " templates have no baseline; run with --update-baseline to add them" << endl;
+		}
+	}
 
-	return (failureCount == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+	return ((failureCount == 0) && (regressionCount == 0)) ? EXIT_SUCCESS : EXIT_FAILURE;
 
 }//int main( int argc, char **argv )
-
-
-
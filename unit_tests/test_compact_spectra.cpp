@@ -0,0 +1,181 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <set>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+#include "SpecUtils/SpecFile.h"
+#include "SpecUtils/EnergyCalibration.h"
+
+#include "cambio/SpectrumSum.h"
+#include "cambio/CompactSpectra.h"
+
+using namespace std;
+
+namespace
+{
+  int ns_num_failed = 0;
+
+  void check( const bool passed, const string &description )
+  {
+    if( !passed )
+    {
+      cerr << "FAILED: " << description << endl;
+      ++ns_num_failed;
+    }
+  }//check(...)
+
+
+  shared_ptr<const SpecUtils::EnergyCalibration> make_cal( const size_t nchannel,
+                                                           const float gain )
+  {
+    auto cal = make_shared<SpecUtils::EnergyCalibration>();
+    cal->set_polynomial( nchannel, { 0.0f, gain }, {} );
+    return cal;
+  }
+
+
+  /** Makes a file with a few samples from two detectors, with mostly-zero
+   spectra (like short passthrough samples), and with the last record having a
+   different energy calibration, so it has to be rebinned to be summed.  There
+   are enough records that the pairwise sum uses more than one block.
+   */
+  SpecUtils::SpecFile make_file()
+  {
+    const size_t nchannel = 1024;
+    const auto cal = make_cal( nchannel, 3.0f );
+    const auto other_cal = make_cal( nchannel, 2.9f );
+
+    SpecUtils::SpecFile info;
+
+    const size_t nsample = 300;
+    for( size_t sample = 1; sample <= nsample; ++sample )
+    {
+      for( size_t det = 0; det < 2; ++det )
+      {
+        auto counts = make_shared<vector<float>>( nchannel, 0.0f );
+        for( size_t i = 0; i < nchannel; ++i )
+        {
+          //A few isolated counts, a run of non-zero channels, and zeros.
+          if( ((i * 7 + sample * 13 + det) % 41) == 0 )
+            (*counts)[i] = 1.0f + (i % 3);
+          if( (i >= 100 + 2*sample) && (i < 120 + 2*sample) )
+            (*counts)[i] = 0.5f * (i % 5) + det;
+        }
+
+        auto meas = make_shared<SpecUtils::Measurement>();
+        meas->set_sample_number( static_cast<int>(sample) );
+        meas->set_detector_name( det ? "Ba2" : "Aa1" );
+        meas->set_gamma_counts( counts, 1.0f, 1.0f );
+        meas->set_energy_calibration( ((sample == nsample) && det) ? other_cal : cal );
+        info.add_measurement( meas, false );
+      }//for( loop over detectors )
+    }//for( loop over samples )
+
+    info.cleanup_after_load();
+
+    return info;
+  }//make_file()
+}//namespace
+
+
+int main()
+{
+  const SpecUtils::SpecFile dense = make_file();
+
+  //Sum the dense file the normal way.
+  const vector<string> &det_names = dense.detector_names();
+  const set<int> &samples = dense.sample_numbers();
+  const auto cal = dense.measurements().front()->energy_calibration();
+  const shared_ptr<SpecUtils::Measurement> dense_sum = dense.sum_measurements( samples, det_names, cal );
+  check( dense_sum && dense_sum->gamma_counts(), "Summed the dense file" );
+  if( !dense_sum || !dense_sum->gamma_counts() )
+    return EXIT_FAILURE;
+
+  const vector<float> &expected = *dense_sum->gamma_counts();
+
+  //What the '--deterministic' option sums the dense file to, which the
+  //  compacted file must match bit-for-bit.
+  const shared_ptr<SpecUtils::Measurement> deterministic
+                  = SpectrumSum::deterministic_sum( dense, samples, det_names, cal, 4 );
+  check( deterministic && deterministic->gamma_counts(), "Deterministically summed the dense file" );
+  if( !deterministic || !deterministic->gamma_counts() )
+    return EXIT_FAILURE;
+
+  for( const bool compact : { true, false } )
+  {
+    const string desc = compact ? "compacted" : "not compacted";
+
+    SpecUtils::SpecFile copy = dense;
+    CompactSpecFile compacted( copy, compact );
+
+    check( compacted.compacted() == compact, desc + ": compacted()" );
+    check( compacted.measurements().size() == dense.measurements().size(),
+           desc + ": number of records" );
+
+    //Sum the same way the command line sums compacted files.
+    const vector<double> sum = SpectrumSum::pairwise_sum( compacted.measurements().size(),
+                                                          cal->num_channels(),
+      [&compacted,&cal]( const size_t index, vector<double> &leaf ){
+        compacted.add_gamma_counts( index, *cal, leaf );
+    }, 3 );
+
+    check( sum.size() == expected.size(), desc + ": number of channels summed" );
+    for( size_t i = 0; (i < sum.size()) && (i < expected.size()); ++i )
+    {
+      const double diff = fabs( sum[i] - expected[i] );
+      if( diff > 1.0E-4 * std::max( 1.0, fabs( static_cast<double>(expected[i]) ) ) )
+      {
+        check( false, desc + ": channel " + to_string(i) + " summed to " + to_string(sum[i])
+                      + ", but expected " + to_string(expected[i]) );
+        break;
+      }
+    }//for( loop over channels )
+
+    const vector<float> sum_floats( begin(sum), end(sum) );
+    check( sum_floats == *deterministic->gamma_counts(),
+           desc + ": sum is bit-for-bit the same as SpectrumSum::deterministic_sum" );
+
+    //Taking the records back out gives exactly the original counts.
+    const SpecUtils::SpecFile restored = compacted.take_expanded();
+    const auto &orig_meas = dense.measurements();
+    const auto &restored_meas = restored.measurements();
+    check( orig_meas.size() == restored_meas.size(), desc + ": number of restored records" );
+    for( size_t i = 0; (i < orig_meas.size()) && (i < restored_meas.size()); ++i )
+    {
+      check( restored_meas[i]->sample_number() == orig_meas[i]->sample_number()
+             && restored_meas[i]->detector_name() == orig_meas[i]->detector_name()
+             && (*restored_meas[i]->gamma_counts()) == (*orig_meas[i]->gamma_counts()),
+             desc + ": restored record " + to_string(i) );
+    }
+  }//for( compacted and not )
+
+  if( ns_num_failed )
+    cerr << ns_num_failed << " checks failed." << endl;
+  else
+    cout << "All checks passed." << endl;
+
+  return ns_num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}//main(...)
@@ -0,0 +1,291 @@
+/**
+ Cambio: a simple program to convert or manipulate gamma spectrum data files.
+ Copyright (C) 2015 William Johnson
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <cmath>
+#include <clocale>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <iostream>
+
+#include "cambio/JsonWriter.h"
+
+using namespace std;
+
+namespace
+{
+  int ns_num_failed = 0;
+
+  void check( const bool passed, const string &description )
+  {
+    if( !passed )
+    {
+      cerr << "FAILED: " << description << endl;
+      ++ns_num_failed;
+    }
+  }//check(...)
+
+
+  string format( const float value )
+  {
+    char buffer[32];
+    return string( buffer, JsonWriter::format_number( value, buffer ) );
+  }
+
+
+  string format( const double value )
+  {
+    char buffer[32];
+    return string( buffer, JsonWriter::format_number( value, buffer ) );
+  }
+
+
+  string escape( const string &input )
+  {
+    string output;
+    JsonWriter::escape( input.data(), input.size(), output );
+    return output;
+  }
+
+
+  /** Returns the number of significant digits of the shortest "%.*g" that
+   reads back as `value`; must be called with the "C" locale.
+   */
+  int shortest_digits( const float value )
+  {
+    char buffer[32];
+    for( int precision = 1; precision < 9; ++precision )
+    {
+      snprintf( buffer, sizeof(buffer), "%.*g", precision, static_cast<double>(value) );
+      if( strtof( buffer, nullptr ) == value )
+        return precision;
+    }
+    return 9;
+  }//shortest_digits(...)
+
+
+  /** Returns the number of significant digits in a formatted number. */
+  int num_digits( const string &formatted )
+  {
+    string mantissa = formatted.substr( 0, formatted.find_first_of( "eE" ) );
+    string digits;
+    for( const char c : mantissa )
+    {
+      if( (c >= '0') && (c <= '9') )
+        digits += c;
+    }
+
+    const size_t first = digits.find_first_not_of( '0' );
+    if( first == string::npos )
+      return 1;
+    digits = digits.substr( first );
+    const size_t last = digits.find_last_not_of( '0' );
+    return static_cast<int>( last + 1 );
+  }//num_digits(...)
+
+
+  /** Checks `value` is written so it reads back exactly, with no more digits
+   than needed; integer values (below 1E15) are written in full, so are
+   exempt from the digit check.
+   */
+  void check_round_trip( const float value )
+  {
+    if( !std::isfinite( value ) )
+      return;
+
+    const string formatted = format( value );
+    const float readback = strtof( formatted.c_str(), nullptr );
+    check( readback == value, "float " + formatted + " reads back as itself" );
+
+    const bool is_integer = (std::fabs( value ) < 1.0E15f) && (std::floor( value ) == value);
+    if( !is_integer )
+      check( num_digits( formatted ) <= shortest_digits( value ),
+             "float " + formatted + " uses the fewest digits" );
+  }//check_round_trip(...)
+
+
+  void check_round_trip( const double value )
+  {
+    const string formatted = format( value );
+    check( strtod( formatted.c_str(), nullptr ) == value,
+           "double " + formatted + " reads back as itself" );
+  }//check_round_trip(...)
+
+
+  void test_format_number()
+  {
+    //Integers are written without a decimal point.
+    check( format( 0.0f ) == "0", "0.0f" );
+    check( format( -0.0f ) == "0", "-0.0f" );
+    check( format( 12345.0f ) == "12345", "12345.0f" );
+    check( format( -7.0 ) == "-7", "-7.0" );
+
+    check( format( 0.5f ) == "0.5", "0.5f" );
+    check( format( 0.1f ) == "0.1", "0.1f" );
+    check( format( -2.25f ) == "-2.25", "-2.25f" );
+    check( format( 0.1 ) == "0.1", "0.1" );
+
+    //Infinity and NaN have no JSON representation.
+    check( format( numeric_limits<float>::infinity() ) == "null", "inf" );
+    check( format( -numeric_limits<float>::infinity() ) == "null", "-inf" );
+    check( format( numeric_limits<float>::quiet_NaN() ) == "null", "nan" );
+    check( format( numeric_limits<double>::infinity() ) == "null", "double inf" );
+    check( format( numeric_limits<double>::quiet_NaN() ) == "null", "double nan" );
+
+    //Extremes, and denormals, which go through the slow path.
+    const float special_floats[] = {
+      numeric_limits<float>::min(), numeric_limits<float>::max(),
+      numeric_limits<float>::lowest(), numeric_limits<float>::denorm_min(),
+      -numeric_limits<float>::denorm_min(), 3.0f * numeric_limits<float>::denorm_min(),
+      numeric_limits<float>::min() / 3.0f, numeric_limits<float>::epsilon(),
+      1.0E-7f, 1.0E20f, 1.5E21f, 123456.789f, 16777217.0f
+    };
+    for( const float value : special_floats )
+      check_round_trip( value );
+
+    const double special_doubles[] = {
+      numeric_limits<double>::min(), numeric_limits<double>::max(),
+      numeric_limits<double>::denorm_min(), numeric_limits<double>::epsilon(),
+      1.0/3.0, 2.0/3.0, 1.0E300, 1.0E-300, 1.0E15 + 0.5
+    };
+    for( const double value : special_doubles )
+      check_round_trip( value );
+
+    //Random values over a wide range of magnitudes, and random bit patterns.
+    std::mt19937 rng( 42 );
+    std::uniform_real_distribution<float> mantissa( 1.0f, 10.0f );
+    std::uniform_int_distribution<int> exponent( -40, 38 );
+    std::uniform_int_distribution<uint32_t> bits;
+    for( int i = 0; i < 200000; ++i )
+    {
+      check_round_trip( mantissa(rng) * std::pow( 10.0f, static_cast<float>(exponent(rng)) ) );
+
+      const uint32_t pattern = bits( rng );
+      float value;
+      memcpy( &value, &pattern, sizeof(value) );
+      check_round_trip( value );
+
+      check_round_trip( static_cast<double>( mantissa(rng) ) / 7.0 );
+
+      if( ns_num_failed > 20 )
+        return;
+    }//for( loop over random values )
+  }//test_format_number()
+
+
+  /** Numbers must always be written with a '.', whatever the locale is. */
+  void test_format_number_locale()
+  {
+    const char * const comma_locales[] = { "de_DE.UTF-8", "de_DE.utf8", "de_DE", "fr_FR.UTF-8", "German" };
+
+    bool set_locale = false;
+    for( const char *name : comma_locales )
+    {
+      if( setlocale( LC_ALL, name ) )
+      {
+        set_locale = true;
+        break;
+      }
+    }
+
+    if( !set_locale )
+    {
+      cout << "No locale with a comma decimal point available; skipping locale test." << endl;
+      return;
+    }
+
+    //Values that go through both the fast and slow paths.
+    check( format( 0.5f ) == "0.5", "0.5f in a comma locale" );
+    check( format( 0.1 ) == "0.1", "0.1 in a comma locale" );
+    check( format( 1.0/3.0 ).find( ',' ) == string::npos, "1/3 in a comma locale" );
+    const string denorm = format( numeric_limits<float>::denorm_min() );
+    check( denorm.find( ',' ) == string::npos, "denormal in a comma locale: " + denorm );
+
+    setlocale( LC_ALL, "C" );
+    check( strtof( denorm.c_str(), nullptr ) == numeric_limits<float>::denorm_min(),
+           "denormal written in a comma locale reads back" );
+  }//test_format_number_locale()
+
+
+  void test_escape()
+  {
+    check( escape( "" ).empty(), "empty string" );
+    check( escape( "plain text" ) == "plain text", "plain text" );
+    check( escape( "a\"b" ) == "a\\\"b", "quote" );
+    check( escape( "a\\b" ) == "a\\\\b", "backslash" );
+    check( escape( "\n\r\t\b\f" ) == "\\n\\r\\t\\b\\f", "short escapes" );
+    check( escape( string( "a\0b", 3 ) ) == "a\\u0000b", "embedded null" );
+    check( escape( "\x01\x1f" ) == "\\u0001\\u001f", "control characters" );
+    check( escape( "</script>" ) == "\\u003c/script>", "script end tag" );
+    check( escape( "\x7f" ) == "\x7f", "DEL is not escaped" );
+
+    //UTF-8 is passed through unchanged.
+    check( escape( "\xC2\xB5Sv/h \xE2\x80\x94 \xF0\x9F\x98\x80" )
+           == "\xC2\xB5Sv/h \xE2\x80\x94 \xF0\x9F\x98\x80", "UTF-8" );
+  }//test_escape()
+
+
+  void test_writer()
+  {
+    stringstream output;
+    {
+      JsonWriter json( output, 16 );
+      json.begin_object();
+      json.key( "Name" );
+      json.string_value( "x\"y" );
+      json.key( "Values" );
+      const vector<float> values{ 1.0f, 0.5f, numeric_limits<float>::quiet_NaN() };
+      json.number_array( values );
+      json.key( "Empty" );
+      json.begin_array();
+      json.end_array();
+      json.key( "Flag" );
+      json.boolean( true );
+      json.key( "Nothing" );
+      json.null();
+      json.end_object();
+      check( json.flush(), "flush" );
+    }
+
+    check( output.str() == "{\"Name\":\"x\\\"y\",\"Values\":[1,0.5,null],\"Empty\":[],"
+                           "\"Flag\":true,\"Nothing\":null}",
+           "writer output: " + output.str() );
+  }//test_writer()
+}//namespace
+
+
+int main()
+{
+  test_format_number();
+  test_escape();
+  test_writer();
+  test_format_number_locale();
+
+  if( ns_num_failed )
+    cerr << ns_num_failed << " checks failed." << endl;
+  else
+    cout << "All checks passed." << endl;
+
+  return ns_num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}//main(...)